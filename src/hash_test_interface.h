@@ -374,6 +374,8 @@ class BaseHashtableInterface {
   virtual bool supports_readwrite() const = 0;
   virtual bool supports_num_table_copies() const = 0;
   virtual bool supports_serialization() const = 0;
+  // Whether serialize() writes what a table with the default Policy would.
+  virtual bool supports_default_layout() const = 0;
 
  protected:
   HT ht_;
@@ -432,6 +434,7 @@ class HashtableInterface_SparseHashMap
   bool supports_readwrite() const { return true; }
   bool supports_num_table_copies() const { return false; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const { return true; }
 
   void set_empty_key(const typename p::key_type&) { }
   void clear_empty_key() { }
@@ -539,6 +542,7 @@ class HashtableInterface_SparseHashSet
   bool supports_readwrite() const { return true; }
   bool supports_num_table_copies() const { return false; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const { return true; }
 
   void set_empty_key(const typename p::key_type&) { }
   void clear_empty_key() { }
@@ -655,6 +659,7 @@ class HashtableInterface_SparseHashtable
   bool supports_readwrite() const { return true; }
   bool supports_num_table_copies() const { return true; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const { return true; }
 
   void set_empty_key(const typename p::key_type&) { }
   void clear_empty_key() { }
@@ -707,12 +712,14 @@ void swap(HashtableInterface_SparseHashtable<V,K,HF,EK,SK,Eq,A>& a,
 template <class Key, class T, const Key& EMPTY_KEY,
           class HashFcn = SPARSEHASH_HASH<Key>,
           class EqualKey = std::equal_to<Key>,
-          class Alloc = libc_allocator_with_realloc<std::pair<const Key, T> > >
+          class Alloc = libc_allocator_with_realloc<std::pair<const Key, T> >,
+          class Policy = dense_hashtable_policy>
 class HashtableInterface_DenseHashMap
     : public BaseHashtableInterface< dense_hash_map<Key, T, HashFcn,
-                                                    EqualKey, Alloc> > {
+                                                    EqualKey, Alloc,
+                                                    Policy> > {
  private:
-  typedef dense_hash_map<Key, T, HashFcn, EqualKey, Alloc> ht;
+  typedef dense_hash_map<Key, T, HashFcn, EqualKey, Alloc, Policy> ht;
   typedef BaseHashtableInterface<ht> p;  // parent
 
  public:
@@ -755,6 +762,9 @@ class HashtableInterface_DenseHashMap
   bool supports_readwrite() const { return false; }
   bool supports_num_table_copies() const { return false; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const {
+    return is_same<Policy, dense_hashtable_policy>::value;
+  }
 
   typedef typename ht::NopointerSerializer NopointerSerializer;
   template <typename OUTPUT> bool write_metadata(OUTPUT *) { return false; }
@@ -768,9 +778,11 @@ class HashtableInterface_DenseHashMap
   int num_table_copies() const { return 0; }
 
  protected:
-  template <class K2, class T2, const K2& Empty2, class H2, class E2, class A2>
-  friend void swap(HashtableInterface_DenseHashMap<K2,T2,Empty2,H2,E2,A2>& a,
-                   HashtableInterface_DenseHashMap<K2,T2,Empty2,H2,E2,A2>& b);
+  template <class K2, class T2, const K2& Empty2, class H2, class E2, class A2,
+            class P2>
+  friend void swap(
+      HashtableInterface_DenseHashMap<K2,T2,Empty2,H2,E2,A2,P2>& a,
+      HashtableInterface_DenseHashMap<K2,T2,Empty2,H2,E2,A2,P2>& b);
 
   typename p::key_type it_to_key(const typename p::iterator& it) const {
     return it->first;
@@ -787,9 +799,10 @@ class HashtableInterface_DenseHashMap
   }
 };
 
-template <class K, class T, const K& Empty, class H, class E, class A>
-void swap(HashtableInterface_DenseHashMap<K,T,Empty,H,E,A>& a,
-          HashtableInterface_DenseHashMap<K,T,Empty,H,E,A>& b) {
+template <class K, class T, const K& Empty, class H, class E, class A,
+          class P>
+void swap(HashtableInterface_DenseHashMap<K,T,Empty,H,E,A,P>& a,
+          HashtableInterface_DenseHashMap<K,T,Empty,H,E,A,P>& b) {
   swap(a.ht_, b.ht_);
 }
 
@@ -801,12 +814,14 @@ void swap(HashtableInterface_DenseHashMap<K,T,Empty,H,E,A>& a,
 template <class Value, const Value& EMPTY_KEY,
           class HashFcn = SPARSEHASH_HASH<Value>,
           class EqualKey = std::equal_to<Value>,
-          class Alloc = libc_allocator_with_realloc<Value> >
+          class Alloc = libc_allocator_with_realloc<Value>,
+          class Policy = dense_hashtable_policy>
 class HashtableInterface_DenseHashSet
     : public BaseHashtableInterface< dense_hash_set<Value, HashFcn,
-                                                     EqualKey, Alloc> > {
+                                                     EqualKey, Alloc,
+                                                     Policy> > {
  private:
-  typedef dense_hash_set<Value, HashFcn, EqualKey, Alloc> ht;
+  typedef dense_hash_set<Value, HashFcn, EqualKey, Alloc, Policy> ht;
   typedef BaseHashtableInterface<ht> p;  // parent
 
  public:
@@ -859,6 +874,9 @@ class HashtableInterface_DenseHashSet
   bool supports_readwrite() const { return false; }
   bool supports_num_table_copies() const { return false; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const {
+    return is_same<Policy, dense_hashtable_policy>::value;
+  }
 
   typedef typename ht::NopointerSerializer NopointerSerializer;
   template <typename OUTPUT> bool write_metadata(OUTPUT *) { return false; }
@@ -872,9 +890,10 @@ class HashtableInterface_DenseHashSet
   int num_table_copies() const { return 0; }
 
  protected:
-  template <class K2, const K2& Empty2, class H2, class E2, class A2>
-  friend void swap(HashtableInterface_DenseHashSet<K2,Empty2,H2,E2,A2>& a,
-                   HashtableInterface_DenseHashSet<K2,Empty2,H2,E2,A2>& b);
+  template <class K2, const K2& Empty2, class H2, class E2, class A2,
+            class P2>
+  friend void swap(HashtableInterface_DenseHashSet<K2,Empty2,H2,E2,A2,P2>& a,
+                   HashtableInterface_DenseHashSet<K2,Empty2,H2,E2,A2,P2>& b);
 
   typename p::key_type it_to_key(const typename p::iterator& it) const {
     return *it;
@@ -891,9 +910,9 @@ class HashtableInterface_DenseHashSet
   }
 };
 
-template <class K, const K& Empty, class H, class E, class A>
-void swap(HashtableInterface_DenseHashSet<K,Empty,H,E,A>& a,
-          HashtableInterface_DenseHashSet<K,Empty,H,E,A>& b) {
+template <class K, const K& Empty, class H, class E, class A, class P>
+void swap(HashtableInterface_DenseHashSet<K,Empty,H,E,A,P>& a,
+          HashtableInterface_DenseHashSet<K,Empty,H,E,A,P>& b) {
   swap(a.ht_, b.ht_);
 }
 
@@ -986,6 +1005,7 @@ class HashtableInterface_DenseHashtable
   bool supports_readwrite() const { return false; }
   bool supports_num_table_copies() const { return true; }
   bool supports_serialization() const { return true; }
+  bool supports_default_layout() const { return true; }
 
   typedef typename ht::NopointerSerializer NopointerSerializer;
   template <typename OUTPUT> bool write_metadata(OUTPUT *) { return false; }
@@ -44,6 +44,11 @@
 // to call every public method on the class: not just to make sure
 // they work, but to make sure they even compile.
 
+// So the ParallelResize test below has threads to resize on.
+#if __cplusplus >= 201103L
+# define SPARSEHASH_PARALLEL_RESIZE 1
+#endif
+
 #include <sparsehash/internal/sparseconfig.h>
 #include <config.h>
 #include <math.h>
@@ -53,33 +58,69 @@
 #ifdef HAVE_STDINT_H
 # include <stdint.h>
 #endif   // for uintptr_t
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <set>
 #include <sstream>
 #include <typeinfo>   // for class typeinfo (returned by typeid)
 #include <vector>
 #include <sparsehash/type_traits.h>
 #include <sparsehash/sparsetable>
+#include <sparsehash/hashtable_statistics>
+#include <sparsehash/dense_hash_map_view>
+#include <sparsehash/internal/aligned_allocator_with_realloc.h>
+#include <sparsehash/internal/huge_page_allocator_with_realloc.h>
 #include "hash_test_interface.h"
 #include "testutil.h"
+#ifdef SPARSEHASH_CXX11   // from hashtable-common.h, via hash_test_interface.h
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <sparsehash/concurrent_dense_hash_map>
+#include <sparsehash/concurrent_dense_hash_set>
+#include <sparsehash/sharded_dense_hash_map>
+#include <sparsehash/sharded_sparse_hash_map>
+#endif
 namespace testing = GOOGLE_NAMESPACE::testing;
 
 using std::cout;
+using std::map;
 using std::pair;
 using std::set;
 using std::string;
 using std::vector;
 using GOOGLE_NAMESPACE::dense_hash_map;
+using GOOGLE_NAMESPACE::dense_hash_map_view;
 using GOOGLE_NAMESPACE::dense_hash_set;
 using GOOGLE_NAMESPACE::sparse_hash_map;
 using GOOGLE_NAMESPACE::sparse_hash_set;
 using GOOGLE_NAMESPACE::sparsetable;
+using GOOGLE_NAMESPACE::DEFAULT_SPARSEGROUP_SIZE;
+using GOOGLE_NAMESPACE::aligned_allocator_with_realloc;
+using GOOGLE_NAMESPACE::default_hash_mixing;
+using GOOGLE_NAMESPACE::dense_hashtable_policy;
+using GOOGLE_NAMESPACE::fibonacci_hash_mixing;
+using GOOGLE_NAMESPACE::hashtable_statistics;
+using GOOGLE_NAMESPACE::hashtable_stats;
+using GOOGLE_NAMESPACE::huge_page_allocator_with_realloc;
+using GOOGLE_NAMESPACE::libc_allocator_with_realloc;
+using GOOGLE_NAMESPACE::linear_probing;
+using GOOGLE_NAMESPACE::memory_breakdown;
+using GOOGLE_NAMESPACE::no_hash_mixing;
+using GOOGLE_NAMESPACE::sparse_hashtable_policy;
 using GOOGLE_NAMESPACE::HashtableInterface_SparseHashMap;
 using GOOGLE_NAMESPACE::HashtableInterface_SparseHashSet;
 using GOOGLE_NAMESPACE::HashtableInterface_SparseHashtable;
 using GOOGLE_NAMESPACE::HashtableInterface_DenseHashMap;
 using GOOGLE_NAMESPACE::HashtableInterface_DenseHashSet;
 using GOOGLE_NAMESPACE::HashtableInterface_DenseHashtable;
+#ifdef SPARSEHASH_CXX11
+using GOOGLE_NAMESPACE::concurrent_dense_hash_map;
+using GOOGLE_NAMESPACE::concurrent_dense_hash_set;
+using GOOGLE_NAMESPACE::sharded_dense_hash_map;
+using GOOGLE_NAMESPACE::sharded_sparse_hash_map;
+#endif
 namespace sparsehash_internal = GOOGLE_NAMESPACE::sparsehash_internal;
 
 typedef unsigned char uint8;
@@ -496,6 +537,46 @@ namespace {
                                     SetKey<const char*, Identity>,      \
                                     Hasher, Alloc<ValueType> >
 
+// The same tests again, on dense tables with the main Policy knobs
+// turned on (see dense_hashtable_policy in densehashtable.h).
+struct TypedCtrlCacheHashPolicy : public dense_hashtable_policy {
+  enum { use_control_bytes = true };
+  enum { cache_hash = true };
+};
+struct TypedLinearBucketGroupPolicy : public dense_hashtable_policy {
+  enum { bucket_group_bytes = 64 };
+  typedef linear_probing probing;
+};
+struct TypedRobinHoodPolicy : public dense_hashtable_policy {
+  enum { use_robin_hood = true };
+};
+struct TypedIncrementalPolicy : public dense_hashtable_policy {
+  enum { incremental_resize_buckets = 4 };
+};
+struct TypedInlineBucketsPolicy : public dense_hashtable_policy {
+  enum { inline_buckets = 4 };
+};
+struct TypedSplitValuesPolicy : public dense_hashtable_policy {
+  enum { split_values = true };
+};
+
+#define POLICY_HASHTABLES                                               \
+  HashtableInterface_DenseHashMap<int, int, kEmptyInt, Hasher, Hasher,  \
+                                  Alloc<int>, TypedCtrlCacheHashPolicy>, \
+  HashtableInterface_DenseHashSet<string, kEmptyString, Hasher, Hasher, \
+                                  Alloc<string>,                        \
+                                  TypedLinearBucketGroupPolicy>,        \
+  HashtableInterface_DenseHashMap<string, string, kEmptyString,         \
+                                  Hasher, Hasher, Alloc<string>,        \
+                                  TypedRobinHoodPolicy>,                \
+  HashtableInterface_DenseHashSet<int, kEmptyInt, Hasher, Hasher,       \
+                                  Alloc<int>, TypedIncrementalPolicy>,  \
+  HashtableInterface_DenseHashMap<const char*, ValueType, kEmptyCharStar, \
+                                  Hasher, Hasher, Alloc<const char*>,   \
+                                  TypedInlineBucketsPolicy>,            \
+  HashtableInterface_DenseHashMap<int, int, kEmptyInt, Hasher, Hasher,  \
+                                  Alloc<int>, TypedSplitValuesPolicy>
+
 // This is the list of types we run each test against.
 // We need to define the same class 4 times due to limitations in the
 // testing framework.  Basically, we associate each class below with
@@ -512,13 +593,14 @@ template <typename HashtableType> class HashtableAllTest
 typedef testing::TypeList6<INT_HASHTABLES> IntHashtables;
 typedef testing::TypeList6<STRING_HASHTABLES> StringHashtables;
 typedef testing::TypeList6<CHARSTAR_HASHTABLES> CharStarHashtables;
-typedef testing::TypeList18<INT_HASHTABLES, STRING_HASHTABLES,
-                            CHARSTAR_HASHTABLES> AllHashtables;
+typedef testing::TypeList24<INT_HASHTABLES, STRING_HASHTABLES,
+                            CHARSTAR_HASHTABLES,
+                            POLICY_HASHTABLES> AllHashtables;
 
 TYPED_TEST_CASE_6(HashtableIntTest, IntHashtables);
 TYPED_TEST_CASE_6(HashtableStringTest, StringHashtables);
 TYPED_TEST_CASE_6(HashtableCharStarTest, CharStarHashtables);
-TYPED_TEST_CASE_18(HashtableAllTest, AllHashtables);
+TYPED_TEST_CASE_24(HashtableAllTest, AllHashtables);
 
 // ------------------------------------------------------------------------
 // First, some testing of the underlying infrastructure.
@@ -526,12 +608,13 @@ TYPED_TEST_CASE_18(HashtableAllTest, AllHashtables);
 TEST(HashtableCommonTest, HashMunging) {
   const Hasher hasher;
 
-  // We don't munge the hash value on non-pointer template types.
+  // We don't munge the hash value on non-pointer template types
+  // (though we do mix it, by default, for integers; see below).
   {
     const sparsehash_internal::sh_hashtable_settings<int, Hasher, size_t, 1>
         settings(hasher, 0.0, 0.0);
     const int v = 1000;
-    EXPECT_EQ(hasher(v), settings.hash(v));
+    EXPECT_EQ(hasher(v), settings.unmixed_hash(v));
   }
 
   {
@@ -1584,6 +1667,65 @@ TYPED_TEST(HashtableIntTest, NopointerSerialization) {
   EXPECT_FALSE(ht_in.count(this->UniqueKey(56)));
 }
 
+// Does just what NopointerSerializer does, but as another type, so
+// the tables use their general serialization code rather than their
+// bulk path for NopointerSerializer.
+template <class Value>
+struct PodSerializerOneByOne {
+  template <typename OUTPUT>
+  bool operator()(OUTPUT* fp, const Value& value) const {
+    return fwrite(&value, sizeof(value), 1, fp) == 1;
+  }
+  template <typename INPUT>
+  bool operator()(INPUT* fp, Value* value) const {
+    return fread(value, sizeof(*value), 1, fp) == 1;
+  }
+};
+
+TYPED_TEST(HashtableIntTest, NopointerSerializationMatchesGeneral) {
+  if (!this->ht_.supports_serialization()) return;
+  TypeParam ht_out;
+  ht_out.set_deleted_key(this->UniqueKey(20000));
+  // Enough to fill the write buffer several times over.
+  for (int i = 1; i < 15000; i++) {
+    ht_out.insert(this->UniqueObject(i));
+  }
+  ht_out.erase(this->UniqueKey(56));
+
+  string bulk_file(TmpFile("nopointer_bulk"));
+  FILE* fp = fopen(bulk_file.c_str(), "wb");
+  EXPECT_TRUE(ht_out.serialize(typename TypeParam::NopointerSerializer(), fp));
+  fputc('!', fp);               // the reader mustn't read ahead into this
+  fclose(fp);
+  string slow_file(TmpFile("nopointer_one_by_one"));
+  fp = fopen(slow_file.c_str(), "wb");
+  EXPECT_TRUE(ht_out.serialize(
+      PodSerializerOneByOne<typename TypeParam::value_type>(), fp));
+  fputc('!', fp);
+  fclose(fp);
+
+  std::ifstream bulk_in(bulk_file.c_str(), std::ios::binary);
+  std::ifstream slow_in(slow_file.c_str(), std::ios::binary);
+  std::stringstream bulk_contents, slow_contents;
+  bulk_contents << bulk_in.rdbuf();
+  slow_contents << slow_in.rdbuf();
+  EXPECT_TRUE(bulk_contents.str() == slow_contents.str());
+
+  TypeParam ht_in;
+  fp = fopen(bulk_file.c_str(), "rb");
+  EXPECT_TRUE(ht_in.unserialize(typename TypeParam::NopointerSerializer(), fp));
+  EXPECT_EQ('!', fgetc(fp));
+  fclose(fp);
+  EXPECT_EQ(ht_out.size(), ht_in.size());
+  for (int i = 1; i < 15000; i++) {
+    if (i == 56) {
+      EXPECT_FALSE(ht_in.count(this->UniqueKey(i)));
+    } else {
+      EXPECT_EQ(this->UniqueObject(i), *ht_in.find(this->UniqueKey(i)));
+    }
+  }
+}
+
 // We don't support serializing to a string by default, but you can do
 // it by writing your own custom input/output class.
 class StringIO {
@@ -1669,6 +1811,16 @@ TYPED_TEST(HashtableAllTest, MetadataSerializationAndEndianness) {
   string kExpectedDense("\x13W\x86""B\0\0\0\0\0\0\0 \0\0\0\0\0\0\0\0\0\0\0\0",
                         24);
   string kExpectedSparse("$hu1\0\0\0 \0\0\0\0\0\0\0\0\0\0\0\0", 20);
+  // Integer and pointer keys' hashes are mixed, which the magic number
+  // records.
+  if (default_hash_mixing::mixes<typename TypeParam::key_type>()) {
+    kExpectedDense[3] = 'E';
+    kExpectedSparse[3] = '2';
+  }
+
+  // Tables with other policies write files of their own.
+  if (!ht_out.supports_default_layout())
+    return;
 
   if (ht_out.supports_readwrite()) {
     string file(TmpFile("metadata_serialization"));
@@ -1938,6 +2090,2481 @@ TEST(HashtableTest, ResizeWithoutShrink) {
   }
 }
 
+struct ControlBytePolicy : public dense_hashtable_policy {
+  enum { use_control_bytes = true };
+};
+
+TEST(HashtableTest, ControlBytes) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         ControlBytePolicy> CtrlMap;
+  CtrlMap ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  map<int, int> expected;
+
+  // Mix inserts and erases, so we see plenty of tombstones and resizes.
+  srand(17);
+  for (int i = 0; i < 20000; ++i) {
+    const int key = rand() % 3000;
+    if (rand() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), ht.erase(key));
+    } else {
+      ht[key] = i;
+      expected[key] = i;
+    }
+  }
+  EXPECT_EQ(expected.size(), ht.size());
+  for (map<int, int>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    CtrlMap::const_iterator pos = ht.find(it->first);
+    EXPECT_TRUE(pos != ht.end());
+    EXPECT_EQ(it->second, pos->second);
+  }
+  size_t num_seen = 0;
+  for (CtrlMap::const_iterator it = ht.begin(); it != ht.end(); ++it) {
+    EXPECT_EQ(1, expected.count(it->first));
+    ++num_seen;
+  }
+  EXPECT_EQ(expected.size(), num_seen);
+
+  // A miss should be decided by the tags, with hardly any key compares.
+  const int compares_before = ht.key_eq().num_compares();
+  for (int i = 3000; i < 4000; ++i) {
+    EXPECT_EQ(0, ht.count(i));
+  }
+  EXPECT_LT(ht.key_eq().num_compares() - compares_before, 100);
+
+  CtrlMap ht_copy(ht);
+  EXPECT_TRUE(ht == ht_copy);
+  ht_copy.resize(0);                 // squashes the deleted buckets
+  EXPECT_TRUE(ht == ht_copy);
+
+  std::stringstream string_buffer;
+  EXPECT_TRUE(ht.serialize(CtrlMap::NopointerSerializer(), &string_buffer));
+  CtrlMap ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(CtrlMap::NopointerSerializer(),
+                                &string_buffer));
+  EXPECT_TRUE(ht == ht_in);
+
+  // A table without control bytes probes differently: it must refuse a
+  // file written with them, but not the other way around.
+  dense_hash_map<int, int, Hasher, Hasher> plain;
+  plain.set_empty_key(-1);
+  string_buffer.clear();
+  string_buffer.seekg(0);
+  EXPECT_FALSE(plain.unserialize(CtrlMap::NopointerSerializer(),
+                                 &string_buffer));
+  for (int i = 0; i < 500; ++i)
+    plain[i * 37] = i;
+  std::stringstream plain_buffer;
+  EXPECT_TRUE(plain.serialize(CtrlMap::NopointerSerializer(), &plain_buffer));
+  EXPECT_TRUE(ht_in.unserialize(CtrlMap::NopointerSerializer(),
+                                &plain_buffer));
+  EXPECT_EQ(plain.size(), ht_in.size());
+  for (int i = 0; i < 500; ++i)
+    EXPECT_EQ(i, ht_in[i * 37]);
+
+  ht_in.swap(ht_copy);
+  EXPECT_TRUE(ht == ht_in);
+  ht_in.clear_no_resize();
+  EXPECT_TRUE(ht_in.empty());
+  EXPECT_TRUE(ht_in.begin() == ht_in.end());
+  EXPECT_EQ(0, ht_in.count(expected.begin()->first));
+  ht_in.clear();
+  ht_in[5] = 6;
+  EXPECT_EQ(6, ht_in[5]);
+}
+
+TEST(HashtableTest, ControlBytesStrings) {
+  dense_hash_set<string, Hasher, Hasher, libc_allocator_with_realloc<string>,
+                 ControlBytePolicy> ht;
+  ht.set_empty_key("");
+  ht.set_deleted_key("-");
+  set<string> expected;
+  for (int i = 0; i < 5000; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%d", rand() % 2000);
+    if (i % 4 == 0) {
+      EXPECT_EQ(expected.erase(buf), ht.erase(buf));
+    } else {
+      EXPECT_EQ(expected.insert(buf).second, ht.insert(buf).second);
+    }
+  }
+  EXPECT_EQ(expected.size(), ht.size());
+  for (set<string>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    EXPECT_EQ(1, ht.count(*it));
+  }
+}
+
+struct BucketGroupPolicy : public dense_hashtable_policy {
+  enum { bucket_group_bytes = 64 };
+};
+
+// Checks ht against a std::map through a long run of inserts and
+// erases.  Table and key need only support the dense_hash_map API.
+template <class Table>
+void ExpectSameAsMap(Table* ht, int num_ops, int max_key) {
+  map<int, int> expected;
+  for (int i = 0; i < num_ops; ++i) {
+    const int key = rand() % max_key;
+    if (rand() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), ht->erase(key));
+    } else {
+      (*ht)[key] = i;
+      expected[key] = i;
+    }
+  }
+  EXPECT_EQ(expected.size(), ht->size());
+  for (map<int, int>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    typename Table::const_iterator pos = ht->find(it->first);
+    EXPECT_TRUE(pos != ht->end());
+    EXPECT_EQ(it->second, pos->second);
+  }
+  for (int key = max_key; key < max_key + 1000; ++key) {
+    EXPECT_TRUE(ht->find(key) == ht->end());
+  }
+  size_t num_seen = 0;
+  for (typename Table::const_iterator it = ht->begin(); it != ht->end(); ++it) {
+    EXPECT_EQ(1, expected.count(it->first));
+    ++num_seen;
+  }
+  EXPECT_EQ(expected.size(), num_seen);
+}
+
+TEST(HashtableTest, BucketGroups) {
+  // pair<const int, int> is trivially copyable, so this grows in place.
+  dense_hash_map<int, int, Hasher, Hasher,
+                 aligned_allocator_with_realloc<pair<const int, int> >,
+                 BucketGroupPolicy> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  srand(18);
+  ExpectSameAsMap(&ht, 50000, 20000);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(&*ht.begin()) %
+               sizeof(pair<const int, int>));
+
+  // The hasher is the identity, so these all start in the same group
+  // and have to spill over into others.
+  ht.clear();
+  for (int i = 0; i < 1000; ++i) {
+    ht[i * 4096] = i;
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(i, ht[i * 4096]);
+  }
+
+  // A value type we can't move with memcpy, which takes the copying path.
+  dense_hash_map<int, string, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, string> >,
+                 BucketGroupPolicy> ht2;
+  ht2.set_empty_key(-1);
+  ht2.set_deleted_key(-2);
+  for (int i = 0; i < 5000; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    ht2[i] = buf;
+  }
+  for (int i = 0; i < 5000; i += 2) {
+    ht2.erase(i);
+  }
+  EXPECT_EQ(2500, ht2.size());
+  EXPECT_EQ("4999", ht2[4999]);
+  EXPECT_EQ(0, ht2.count(4998));
+}
+
+TEST(HashtableTest, InPlaceRehash) {
+  // The default allocator can realloc and pair<const int, int> is
+  // trivially copyable, so these resize without a second table.
+  dense_hash_map<int, int, Hasher, Hasher> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  ht.set_resizing_parameters(0.2f, 0.9f);   // lots of collisions
+  srand(20);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  // Shrinking.
+  ht.clear();
+  for (int i = 0; i < 10000; ++i) {
+    ht[i * 7] = i;
+  }
+  const size_t big = ht.bucket_count();
+  for (int i = 0; i < 10000; i += 100) {
+    ht.erase(i * 7);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    if (i % 100 != 0)
+      ht.erase(i * 7);
+  }
+  ht[1] = 1;                         // shrinks
+  EXPECT_LT(ht.bucket_count(), big);
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(0, ht.count(i * 7));
+  }
+  EXPECT_EQ(1, ht[1]);
+
+  // Purging deleted buckets without changing size, as serialize() does.
+  for (int i = 0; i < 1000; ++i) {
+    ht[i * 4096] = i;
+  }
+  for (int i = 0; i < 1000; i += 3) {
+    ht.erase(i * 4096);
+  }
+  std::stringstream string_buffer;
+  EXPECT_TRUE(ht.serialize(dense_hash_map<int, int>::NopointerSerializer(),
+                           &string_buffer));
+  dense_hash_map<int, int, Hasher, Hasher> ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(
+      dense_hash_map<int, int>::NopointerSerializer(), &string_buffer));
+  EXPECT_TRUE(ht == ht_in);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(static_cast<size_t>(i % 3 != 0), ht.count(i * 4096));
+  }
+}
+
+TEST(HashtableTest, HugePageAllocator) {
+  // A low threshold, so that even these small tables get mapped, and
+  // growing and shrinking go through mremap() and madvise().
+  typedef huge_page_allocator_with_realloc<pair<const int, int>, 4096> Alloc;
+  dense_hash_map<int, int, Hasher, Hasher, Alloc> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  srand(21);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  ht.clear();
+  for (int i = 0; i < 200000; ++i) {   // big enough for several huge pages
+    ht[i] = i + 1;
+  }
+  for (int i = 0; i < 200000; ++i) {
+    if (i % 1000 != 0)
+      ht.erase(i);
+  }
+  ht[-3] = 0;                          // shrinks
+  EXPECT_EQ(201, ht.size());
+  for (int i = 0; i < 200000; i += 1000) {
+    EXPECT_EQ(i + 1, ht[i]);
+  }
+
+  // Values that can't be moved with memcpy still work; they just
+  // don't use reallocate().
+  dense_hash_map<int, string, Hasher, Hasher,
+                 huge_page_allocator_with_realloc<pair<const int, string>,
+                                                  4096> > ht2;
+  ht2.set_empty_key(-1);
+  for (int i = 0; i < 5000; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    ht2[i] = buf;
+  }
+  EXPECT_EQ("4999", ht2[4999]);
+}
+
+struct LinearProbingPolicy : public dense_hashtable_policy {
+  typedef linear_probing probing;
+};
+struct LinearBucketGroupPolicy : public BucketGroupPolicy {
+  typedef linear_probing probing;
+};
+struct LinearControlBytePolicy : public ControlBytePolicy {
+  typedef linear_probing probing;
+};
+struct SparseLinearProbingPolicy : public sparse_hashtable_policy {
+  typedef linear_probing probing;
+};
+
+TEST(HashtableTest, LinearProbing) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         LinearProbingPolicy> LinearMap;
+  LinearMap ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  srand(23);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  // Neighbouring keys, which the default hash_mixing scatters.
+  ht.clear();
+  for (int i = 0; i < 1000; ++i)
+    ht[i] = i;
+  EXPECT_EQ(999, ht[999]);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 aligned_allocator_with_realloc<pair<const int, int> >,
+                 LinearBucketGroupPolicy> grouped;
+  grouped.set_empty_key(-1);
+  grouped.set_deleted_key(-2);
+  ExpectSameAsMap(&grouped, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 LinearControlBytePolicy> ctrl;
+  ctrl.set_empty_key(-1);
+  ctrl.set_deleted_key(-2);
+  ExpectSameAsMap(&ctrl, 50000, 20000);
+
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseLinearProbingPolicy> sparse;
+  sparse.set_deleted_key(-2);
+  ExpectSameAsMap(&sparse, 50000, 20000);
+
+  // A linear table reads what a quadratic one wrote, and rehashes it;
+  // a quadratic one refuses what a linear one wrote.
+  dense_hash_map<int, int, Hasher, Hasher> plain;
+  plain.set_empty_key(-1);
+  for (int i = 0; i < 1000; ++i)
+    plain[i * 8] = i;
+  std::stringstream plain_buffer;
+  EXPECT_TRUE(plain.serialize(LinearMap::NopointerSerializer(),
+                              &plain_buffer));
+  LinearMap ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(LinearMap::NopointerSerializer(),
+                                &plain_buffer));
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(i, ht_in[i * 8]);
+  std::stringstream linear_buffer;
+  EXPECT_TRUE(ht_in.serialize(LinearMap::NopointerSerializer(),
+                              &linear_buffer));
+  EXPECT_FALSE(plain.unserialize(LinearMap::NopointerSerializer(),
+                                 &linear_buffer));
+
+  std::stringstream sparse_buffer;
+  sparse_hash_map<int, int, Hasher, Hasher> sparse_plain;
+  for (int i = 0; i < 1000; ++i)
+    sparse_plain[i * 8] = i;
+  EXPECT_TRUE(sparse_plain.serialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_buffer));
+  EXPECT_TRUE(sparse.unserialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_buffer));
+  EXPECT_EQ(1000u, sparse.size());
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(i, sparse[i * 8]);
+}
+
+struct NoHashMixingPolicy : public dense_hashtable_policy {
+  typedef no_hash_mixing hash_mixing;
+};
+struct LinearNoHashMixingPolicy : public LinearProbingPolicy {
+  typedef no_hash_mixing hash_mixing;
+};
+struct SparseNoHashMixingPolicy : public sparse_hashtable_policy {
+  typedef no_hash_mixing hash_mixing;
+};
+
+TEST(HashtableTest, HashMixing) {
+  EXPECT_TRUE(default_hash_mixing::mixes<int>());
+  EXPECT_TRUE(default_hash_mixing::mixes<unsigned long>());
+  EXPECT_FALSE(default_hash_mixing::mixes<string>());
+  EXPECT_TRUE(default_hash_mixing::mixes<const int*>());
+  EXPECT_TRUE(fibonacci_hash_mixing::mixes<string>());
+  EXPECT_FALSE(no_hash_mixing::mixes<int>());
+
+  // Under the identity hash, keys 4096 apart all have the same low 12
+  // bits, so they'd all want the same bucket of a 1024-bucket table.
+  // Mixed, they spread out about as much as random hashes would.
+  const Hasher hasher;
+  const sparsehash_internal::sh_hashtable_settings<int, Hasher, size_t, 1>
+      mixed(hasher, 0.0, 0.0);
+  const sparsehash_internal::sh_hashtable_settings<int, Hasher, size_t, 1,
+                                                   no_hash_mixing>
+      unmixed(hasher, 0.0, 0.0);
+  set<size_t> mixed_buckets, unmixed_buckets;
+  for (int i = 0; i < 1024; ++i) {
+    mixed_buckets.insert(mixed.hash(i * 4096) & 1023);
+    unmixed_buckets.insert(unmixed.hash(i * 4096) & 1023);
+    EXPECT_EQ(unmixed.hash(i * 4096), mixed.unmixed_hash(i * 4096));
+  }
+  EXPECT_EQ(1u, unmixed_buckets.size());
+  EXPECT_GT(mixed_buckets.size(), 600u);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 NoHashMixingPolicy> unmixed_ht;
+  unmixed_ht.set_empty_key(-1);
+  unmixed_ht.set_deleted_key(-2);
+  ExpectSameAsMap(&unmixed_ht, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 LinearNoHashMixingPolicy> linear;
+  linear.set_empty_key(-1);
+  linear.set_deleted_key(-2);
+  ExpectSameAsMap(&linear, 50000, 20000);
+  // The hasher is the identity, so these are all in one run, which
+  // linear probing walks bucket by bucket.
+  linear.clear();
+  for (int i = 0; i < 1000; ++i)
+    linear[i] = i;
+  EXPECT_EQ(999, linear[999]);
+
+  // The default mixing reads what an unmixed table wrote, and rehashes
+  // it; an unmixed table refuses what a mixed one wrote.
+  unmixed_ht.clear();
+  for (int i = 0; i < 1000; ++i)
+    unmixed_ht[i * 4096] = i;
+  std::stringstream unmixed_buffer;
+  EXPECT_TRUE(unmixed_ht.serialize(
+      dense_hash_map<int, int>::NopointerSerializer(), &unmixed_buffer));
+  dense_hash_map<int, int, Hasher, Hasher> ht;
+  ht.set_empty_key(-1);
+  EXPECT_TRUE(ht.unserialize(dense_hash_map<int, int>::NopointerSerializer(),
+                             &unmixed_buffer));
+  EXPECT_EQ(1000u, ht.size());
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(i, ht[i * 4096]);
+  std::stringstream mixed_buffer;
+  EXPECT_TRUE(ht.serialize(dense_hash_map<int, int>::NopointerSerializer(),
+                           &mixed_buffer));
+  EXPECT_FALSE(unmixed_ht.unserialize(
+      dense_hash_map<int, int>::NopointerSerializer(), &mixed_buffer));
+  mixed_buffer.clear();
+  mixed_buffer.seekg(0);
+  dense_hash_map<int, int, Hasher, Hasher> ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(
+      dense_hash_map<int, int>::NopointerSerializer(), &mixed_buffer));
+  EXPECT_TRUE(ht == ht_in);
+
+  // Sparse files say so too, in the sparsetable's magic number.
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseNoHashMixingPolicy> sparse_unmixed;
+  sparse_unmixed.set_deleted_key(-2);
+  ExpectSameAsMap(&sparse_unmixed, 50000, 20000);
+  sparse_unmixed.clear();
+  for (int i = 0; i < 1000; ++i)
+    sparse_unmixed[i * 4096] = i;
+  std::stringstream sparse_buffer;
+  EXPECT_TRUE(sparse_unmixed.serialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_buffer));
+  sparse_hash_map<int, int, Hasher, Hasher> sparse;
+  EXPECT_TRUE(sparse.unserialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_buffer));
+  EXPECT_EQ(1000u, sparse.size());
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(i, sparse[i * 4096]);
+  string file(TmpFile("hash_mixing"));
+  FILE* fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(sparse_unmixed.write_metadata(fp));
+  EXPECT_TRUE(sparse_unmixed.write_nopointer_data(fp));
+  fclose(fp);
+  sparse_hash_map<int, int, Hasher, Hasher> sparse_in;
+  fp = fopen(file.c_str(), "rb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(sparse_in.read_metadata(fp));
+  EXPECT_TRUE(sparse_in.read_nopointer_data(fp));
+  fclose(fp);
+  EXPECT_TRUE(sparse == sparse_in);
+  // A mixing table reads its own files without rehashing them, and an
+  // unmixed one refuses them.
+  std::stringstream sparse_mixed_buffer;
+  EXPECT_TRUE(sparse.serialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_mixed_buffer));
+  EXPECT_FALSE(sparse_unmixed.unserialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_mixed_buffer));
+  sparse_mixed_buffer.clear();
+  sparse_mixed_buffer.seekg(0);
+  sparse_hash_map<int, int, Hasher, Hasher> sparse_mixed_in;
+  const int hashes_before = sparse_mixed_in.hash_funct().num_hashes();
+  EXPECT_TRUE(sparse_mixed_in.unserialize(
+      sparse_hash_map<int, int>::NopointerSerializer(), &sparse_mixed_buffer));
+  EXPECT_EQ(hashes_before, sparse_mixed_in.hash_funct().num_hashes());
+  EXPECT_TRUE(sparse == sparse_mixed_in);
+}
+
+struct RobinHoodPolicy : public dense_hashtable_policy {
+  enum { use_robin_hood = true };
+};
+
+TEST(HashtableTest, RobinHood) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         RobinHoodPolicy> RobinHoodMap;
+  // Erasing shifts entries back, so there's no deleted key to set.
+  RobinHoodMap ht;
+  ht.set_empty_key(-1);
+  srand(19);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  // The hasher is the identity, so these all collide in one long run.
+  ht.clear();
+  for (int i = 0; i < 1000; ++i) {
+    ht[i * 4096] = i;
+  }
+  for (int i = 0; i < 1000; i += 2) {
+    EXPECT_EQ(1, ht.erase(i * 4096));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(static_cast<size_t>(i % 2), ht.count(i * 4096));
+  }
+  EXPECT_EQ(500, ht.size());
+
+  RobinHoodMap ht_copy(ht);
+  EXPECT_TRUE(ht == ht_copy);
+  ht_copy.erase(ht_copy.begin(), ht_copy.end());
+  EXPECT_TRUE(ht_copy.empty());
+
+  // A table using the default probe sequence must refuse the file.
+  std::stringstream string_buffer;
+  EXPECT_TRUE(ht.serialize(RobinHoodMap::NopointerSerializer(),
+                           &string_buffer));
+  dense_hash_map<int, int, Hasher, Hasher> plain;
+  plain.set_empty_key(-1);
+  EXPECT_FALSE(plain.unserialize(RobinHoodMap::NopointerSerializer(),
+                                 &string_buffer));
+  string_buffer.clear();
+  string_buffer.seekg(0);
+  RobinHoodMap ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(RobinHoodMap::NopointerSerializer(),
+                                &string_buffer));
+  EXPECT_TRUE(ht == ht_in);
+  ht_in.clear_no_resize();
+  EXPECT_TRUE(ht_in.empty());
+  EXPECT_EQ(0, ht_in.count(4096));
+
+  dense_hash_set<string, Hasher, Hasher, libc_allocator_with_realloc<string>,
+                 RobinHoodPolicy> hs;
+  hs.set_empty_key("");
+  for (int i = 0; i < 5000; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    hs.insert(buf);
+  }
+  for (int i = 0; i < 5000; i += 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    hs.erase(buf);
+  }
+  EXPECT_EQ(2500, hs.size());
+  EXPECT_EQ(1, hs.count("4999"));
+  EXPECT_EQ(0, hs.count("4998"));
+}
+
+struct DenseCacheHashPolicy : public dense_hashtable_policy {
+  enum { cache_hash = true };
+};
+struct RobinHoodCacheHashPolicy : public RobinHoodPolicy {
+  enum { cache_hash = true };
+};
+struct CtrlCacheHashPolicy : public ControlBytePolicy {
+  enum { cache_hash = true };
+};
+struct SparseCacheHashPolicy : public sparse_hashtable_policy {
+  enum { cache_hash = true };
+};
+
+// Checks that a table with cached hashes never compares keys whose
+// hashes differ, and never hashes a key again once it's in the table.
+// (A dense table without control bytes would also compare keys with
+// the empty key.)  ht_in must be empty, and ready to unserialize into.
+template <class Table>
+void ExpectHashesCached(Table* ht, Table* ht_in) {
+  char buf[32];
+  for (int i = 0; i < 2000; ++i) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    (*ht)[buf] = i;
+  }
+  for (int i = 0; i < 2000; i += 2) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    ht->erase(buf);
+  }
+  int hashes_before = ht->hash_funct().num_hashes();
+  ht->resize(100000);
+  Table copy(*ht);
+  EXPECT_EQ(hashes_before, ht->hash_funct().num_hashes());
+  EXPECT_EQ(hashes_before, copy.hash_funct().num_hashes());
+
+  const int compares_before = ht->key_eq().num_compares();
+  for (int i = 0; i < 2000; ++i) {
+    snprintf(buf, sizeof(buf), "key%d", i);
+    EXPECT_EQ(static_cast<size_t>(i % 2), ht->count(buf));
+    snprintf(buf, sizeof(buf), "missing%d", i);
+    EXPECT_EQ(0, ht->count(buf));
+  }
+  // Only the keys we found need comparing.
+  EXPECT_EQ(1000, ht->key_eq().num_compares() - compares_before);
+
+  string file(TmpFile("cache_hash"));
+  FILE* fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(ht->serialize(ValueSerializer(), fp));
+  fclose(fp);
+  fp = fopen(file.c_str(), "rb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(ht_in->unserialize(ValueSerializer(), fp));
+  fclose(fp);
+  EXPECT_TRUE(*ht == *ht_in);
+  hashes_before = ht_in->hash_funct().num_hashes();
+  ht_in->resize(200000);
+  EXPECT_EQ(hashes_before, ht_in->hash_funct().num_hashes());
+  EXPECT_EQ(1000, ht_in->size());
+}
+
+TEST(HashtableTest, CacheHash) {
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 DenseCacheHashPolicy> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  srand(21);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 RobinHoodCacheHashPolicy> ht2;
+  ht2.set_empty_key(-1);
+  ExpectSameAsMap(&ht2, 50000, 20000);
+
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseCacheHashPolicy> ht3;
+  ht3.set_deleted_key(-2);
+  ExpectSameAsMap(&ht3, 50000, 20000);
+
+  typedef dense_hash_map<string, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const string, int> >,
+                         CtrlCacheHashPolicy> DenseMap;
+  DenseMap ht4, ht4_in;
+  ht4.set_empty_key("");
+  ht4.set_deleted_key("-");
+  ht4_in.set_empty_key("");
+  ExpectHashesCached(&ht4, &ht4_in);
+
+  typedef sparse_hash_map<string, int, Hasher, Hasher,
+                          libc_allocator_with_realloc<pair<const string, int> >,
+                          SparseCacheHashPolicy> SparseMap;
+  SparseMap ht5, ht5_in;
+  ht5.set_deleted_key("-");
+  ExpectHashesCached(&ht5, &ht5_in);
+}
+
+#ifdef SPARSEHASH_CXX11
+// Counts how often a non-zero value is copied.  (New buckets are
+// filled with copies of the empty value, whose CopyCounted is zero.)
+struct CopyCounted {
+  static int num_copies;
+  int value;
+  CopyCounted() : value(0) { }
+  explicit CopyCounted(int v) : value(v) { }
+  CopyCounted(const CopyCounted& that) : value(that.value) { count(); }
+  CopyCounted(CopyCounted&& that) : value(that.value) { that.value = 0; }
+  CopyCounted& operator=(const CopyCounted& that) {
+    value = that.value;
+    count();
+    return *this;
+  }
+  CopyCounted& operator=(CopyCounted&& that) {
+    value = that.value;
+    that.value = 0;
+    return *this;
+  }
+  void count() const { if (value != 0) ++num_copies; }
+};
+int CopyCounted::num_copies = 0;
+
+// Inserts every which way, erases, and resizes, without copying a value.
+template <class Map>
+void ExpectValuesMoved(Map* ht) {
+  CopyCounted::num_copies = 0;
+  for (int i = 1; i <= 1000; ++i)
+    ht->try_emplace(i, i);
+  for (int i = 1001; i <= 2000; ++i)
+    ht->insert(std::make_pair(i, CopyCounted(i)));
+  for (int i = 2001; i <= 3000; ++i)
+    (*ht)[i] = CopyCounted(i);
+  for (int i = 3001; i <= 4000; ++i)
+    ht->emplace(i, CopyCounted(i));
+  for (int i = 1; i <= 4000; i += 2)
+    ht->erase(i);
+  ht->resize(20000);
+  ht->resize(0);
+  EXPECT_EQ(0, CopyCounted::num_copies);
+  EXPECT_EQ(2000u, ht->size());
+  for (int i = 1; i <= 4000; ++i) {
+    typename Map::const_iterator it = ht->find(i);
+    if (i % 2) {
+      EXPECT_TRUE(it == ht->end());
+    } else {
+      EXPECT_TRUE(it != ht->end());
+      EXPECT_EQ(i, it->second.value);
+    }
+  }
+}
+
+TEST(HashtableTest, MoveSemantics) {
+  dense_hash_map<int, CopyCounted> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  ExpectValuesMoved(&ht);
+
+  dense_hash_map<int, CopyCounted, SPARSEHASH_HASH<int>, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, CopyCounted> >,
+                 ControlBytePolicy> ht2;
+  ht2.set_empty_key(-1);
+  ht2.set_deleted_key(-2);
+  ExpectValuesMoved(&ht2);
+
+  dense_hash_map<int, CopyCounted, SPARSEHASH_HASH<int>, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, CopyCounted> >,
+                 RobinHoodPolicy> ht3;
+  ht3.set_empty_key(-1);
+  ExpectValuesMoved(&ht3);
+
+  // Moving a table hands over its buckets, and leaves it empty, with
+  // no buckets and nothing allocated, but still usable.
+  dense_hash_map<string, vector<int> > a;
+  a.set_empty_key("");
+  a.set_deleted_key("-");
+  a["x"].push_back(1);
+  const int* data = &a["x"][0];
+  dense_hash_map<string, vector<int> > b(std::move(a));
+  EXPECT_EQ(data, &b["x"][0]);
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ(0u, a.bucket_count());
+  EXPECT_TRUE(a.begin() == a.end());
+  EXPECT_TRUE(a.find("x") == a.end());
+  EXPECT_EQ(0u, a.count("x"));
+  EXPECT_EQ(0u, a.erase("x"));
+  EXPECT_EQ("", a.empty_key());
+  EXPECT_EQ("-", a.deleted_key());
+  a["y"].push_back(2);
+  EXPECT_EQ(1u, a.size());
+  a = std::move(b);
+  EXPECT_EQ(data, &a["x"][0]);
+  EXPECT_EQ(1u, a.size());
+  EXPECT_TRUE(b.empty());
+  int num_seen = 0;
+  for (dense_hash_map<string, vector<int> >::iterator it = b.begin();
+       it != b.end(); ++it)
+    ++num_seen;
+  EXPECT_EQ(0, num_seen);
+  b.clear();
+  b["z"];
+  EXPECT_EQ(1u, b.size());
+  EXPECT_EQ(1u, b.count("z"));
+  b.clear_no_resize();
+  dense_hash_map<string, vector<int> > c(std::move(b));
+  b.clear_no_resize();
+  b.insert(std::make_pair(string("w"), vector<int>()));
+  EXPECT_EQ(1u, b.size());
+  // Neither move allocates.  They copy the empty value, so they can't
+  // throw if copying a value_type can't.
+  EXPECT_TRUE((std::is_nothrow_move_constructible<
+               dense_hash_map<int, int> >::value));
+  EXPECT_TRUE((std::is_nothrow_move_assignable<
+               dense_hash_map<int, int> >::value));
+  EXPECT_FALSE((std::is_nothrow_move_constructible<
+                dense_hash_map<string, vector<int> > >::value));
+  dense_hash_set<int> moved_set;
+  moved_set.set_empty_key(-1);
+  moved_set.insert(1);
+  dense_hash_set<int> other_set(std::move(moved_set));
+  EXPECT_TRUE(moved_set.begin() == moved_set.end());
+  moved_set.insert(2);
+  EXPECT_EQ(1u, moved_set.count(2));
+
+  // try_emplace() leaves its arguments alone if the key is there.
+  string key("x");
+  vector<int> v(3);
+  EXPECT_FALSE(a.try_emplace(std::move(key), std::move(v)).second);
+  EXPECT_EQ("x", key);
+  EXPECT_EQ(3u, v.size());
+  EXPECT_FALSE(a.insert_or_assign(key, v).second);
+  EXPECT_EQ(3u, a["x"].size());
+  EXPECT_TRUE(a.insert_or_assign("w", std::move(v)).second);
+  EXPECT_EQ(3u, a["w"].size());
+  a[string("v")].push_back(4);
+  EXPECT_EQ(4, a["v"][0]);
+
+  // If building the value throws, the map is as it was.
+  const size_t size_before = a.size();
+  bool threw = false;
+  try {
+    a.try_emplace("u", vector<int>().max_size() + 1);
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  EXPECT_TRUE(threw);
+  EXPECT_EQ(size_before, a.size());
+  EXPECT_EQ(0u, a.count("u"));
+  a["u"].push_back(5);
+  EXPECT_EQ(size_before + 1, a.size());
+
+  // Growing a set moves its strings rather than copying them.
+  dense_hash_set<string> s;
+  s.set_empty_key("");
+  string long_string(100, 'a');
+  const char* chars = long_string.data();
+  s.insert(std::move(long_string));
+  for (int i = 0; i < 1000; ++i)
+    s.emplace(static_cast<size_t>(i % 50 + 1), static_cast<char>('b' + i / 50));
+  EXPECT_EQ(1001u, s.size());
+  EXPECT_EQ(chars, s.find(string(100, 'a'))->data());
+}
+#endif
+
+// A string key that counts how often one is made from a const char*.
+struct CountedKey {
+  static int num_made;
+  string s;
+  CountedKey() { }
+  CountedKey(const char* p) : s(p) { ++num_made; }
+  bool operator==(const CountedKey& that) const { return s == that.s; }
+};
+int CountedKey::num_made = 0;
+
+// Hashes and compares CountedKeys and const char*s alike.
+struct TransparentHasher {
+  typedef void is_transparent;
+  size_t operator()(const char* a) const {
+    size_t hash = 0;
+    for (size_t i = 0; a[i]; i++ )
+      hash = 33 * hash + a[i];
+    return hash;
+  }
+  size_t operator()(const CountedKey& a) const {
+    return (*this)(a.s.c_str());
+  }
+  bool operator()(const char* a, const CountedKey& b) const {
+    return b.s == a;
+  }
+  bool operator()(const CountedKey& a, const CountedKey& b) const {
+    return a.s == b.s;
+  }
+};
+
+// ht holds keys "k0" to "k99".  Looks them up, and erases the even ones,
+// by const char*.
+template <class Table>
+void ExpectTransparentLookups(Table* ht) {
+  CountedKey::num_made = 0;
+  char buf[16];
+  for (int i = 0; i < 200; ++i) {
+    snprintf(buf, sizeof(buf), "k%d", i);
+    EXPECT_EQ(i < 100, ht->find(buf) != ht->end());
+    EXPECT_EQ(static_cast<size_t>(i < 100), ht->count(buf));
+    EXPECT_EQ(i < 100, ht->equal_range(buf).first != ht->end());
+  }
+  for (int i = 0; i < 100; i += 2) {
+    snprintf(buf, sizeof(buf), "k%d", i);
+    EXPECT_EQ(1u, ht->erase(buf));
+    EXPECT_EQ(0u, ht->erase(buf));
+  }
+  EXPECT_EQ(50u, ht->size());
+  EXPECT_EQ(0, CountedKey::num_made);
+}
+
+TEST(HashtableTest, TransparentLookup) {
+  char buf[16];
+  dense_hash_map<CountedKey, int, TransparentHasher, TransparentHasher> dm;
+  sparse_hash_map<CountedKey, int, TransparentHasher, TransparentHasher> sm;
+  dense_hash_set<CountedKey, TransparentHasher, TransparentHasher> ds;
+  sparse_hash_set<CountedKey, TransparentHasher, TransparentHasher> ss;
+  dm.set_empty_key("");
+  dm.set_deleted_key("-");
+  sm.set_deleted_key("-");
+  ds.set_empty_key("");
+  ds.set_deleted_key("-");
+  ss.set_deleted_key("-");
+  for (int i = 0; i < 100; ++i) {
+    snprintf(buf, sizeof(buf), "k%d", i);
+    dm[buf] = i;
+    sm[buf] = i;
+    ds.insert(buf);
+    ss.insert(buf);
+  }
+  ExpectTransparentLookups(&dm);
+  ExpectTransparentLookups(&sm);
+  ExpectTransparentLookups(&ds);
+  ExpectTransparentLookups(&ss);
+
+  // operator[] only makes a key when it inserts one.
+  EXPECT_EQ(99, dm["k99"]);
+  EXPECT_EQ(99, sm["k99"]);
+  EXPECT_EQ(0, CountedKey::num_made);
+  dm["new"] = 1;
+  sm["new"] = 1;
+  EXPECT_EQ(2, CountedKey::num_made);
+  EXPECT_EQ(1, dm.find(CountedKey("new"))->second);
+  EXPECT_EQ(1, sm.find(CountedKey("new"))->second);
+}
+
+// Checks that the batch routines do just what calls to find(), insert()
+// and erase() would.  Batches are long enough to fill the pipeline.
+template <class Table>
+void ExpectBatchesLikeSingles(Table* ht) {
+  typedef typename Table::value_type value_type;
+  typedef typename Table::iterator iterator;
+  vector<value_type> objs;
+  vector<int> keys;
+  for (int i = 0; i < 1000; ++i) {
+    objs.push_back(value_type(i * 3, i));
+    keys.push_back(i * 3);
+  }
+  vector<iterator> results(3000);
+  ht->find_batch(&keys[0], 0, &results[0]);    // no-ops on an empty table
+  EXPECT_EQ(0u, ht->erase_batch(&keys[0], keys.size()));
+
+  EXPECT_EQ(500u, ht->insert_batch(&objs[0], 500));
+  EXPECT_EQ(500u, ht->insert_batch(&objs[0], objs.size()));
+  EXPECT_EQ(0u, ht->insert_batch(&objs[0], 3));
+  EXPECT_EQ(1000u, ht->size());
+
+  vector<int> lookups;
+  for (int i = 0; i < 3000; ++i)
+    lookups.push_back(i);
+  ht->find_batch(&lookups[0], lookups.size(), &results[0]);
+  for (int i = 0; i < 3000; ++i) {
+    EXPECT_TRUE(results[i] == ht->find(i));
+    EXPECT_EQ(i % 3 == 0, results[i] != ht->end());
+  }
+
+  vector<int> evens;
+  for (int i = 0; i < 3000; i += 2)
+    evens.push_back(i);
+  EXPECT_EQ(500u, ht->erase_batch(&evens[0], evens.size()));
+  EXPECT_EQ(0u, ht->erase_batch(&evens[0], evens.size()));
+  EXPECT_EQ(500u, ht->size());
+  for (int i = 0; i < 3000; ++i)
+    EXPECT_EQ(static_cast<size_t>(i % 3 == 0 && i % 2 != 0), ht->count(i));
+
+  // And the const find_batch.
+  const Table& cht = *ht;
+  vector<typename Table::const_iterator> const_results(lookups.size());
+  cht.find_batch(&lookups[0], lookups.size(), &const_results[0]);
+  for (int i = 0; i < 3000; ++i)
+    EXPECT_TRUE(const_results[i] == cht.find(i));
+}
+
+TEST(HashtableTest, BatchOperations) {
+  dense_hash_map<int, int> dm;
+  dm.set_empty_key(-1);
+  dm.set_deleted_key(-2);
+  ExpectBatchesLikeSingles(&dm);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 CtrlCacheHashPolicy> dm_ctrl;
+  dm_ctrl.set_empty_key(-1);
+  dm_ctrl.set_deleted_key(-2);
+  ExpectBatchesLikeSingles(&dm_ctrl);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 RobinHoodPolicy> dm_rh;
+  dm_rh.set_empty_key(-1);
+  ExpectBatchesLikeSingles(&dm_rh);
+
+  sparse_hash_map<int, int> sm;
+  sm.set_deleted_key(-2);
+  ExpectBatchesLikeSingles(&sm);
+
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseCacheHashPolicy> sm_cached;
+  sm_cached.set_deleted_key(-2);
+  ExpectBatchesLikeSingles(&sm_cached);
+
+  // The sets, whose value_type is the key.
+  const int keys[] = { 1, 2, 3, 2, 1 };
+  dense_hash_set<int> ds;
+  ds.set_empty_key(-1);
+  ds.set_deleted_key(-2);
+  sparse_hash_set<int> ss;
+  ss.set_deleted_key(-2);
+  EXPECT_EQ(3u, ds.insert_batch(keys, 5));
+  EXPECT_EQ(3u, ss.insert_batch(keys, 5));
+  dense_hash_set<int>::iterator ds_results[5];
+  sparse_hash_set<int>::iterator ss_results[5];
+  ds.find_batch(keys, 5, ds_results);
+  ss.find_batch(keys, 5, ss_results);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(keys[i], *ds_results[i]);
+    EXPECT_EQ(keys[i], *ss_results[i]);
+  }
+  EXPECT_EQ(1u, ds.erase_batch(keys + 1, 1));
+  EXPECT_EQ(3u, ss.erase_batch(keys, 5));
+  EXPECT_EQ(2u, ds.size());
+  EXPECT_EQ(0u, ss.size());
+}
+
+struct IncrementalResizePolicy : public dense_hashtable_policy {
+  enum { incremental_resize_buckets = 4 };
+};
+struct IncrementalRobinHoodPolicy : public RobinHoodPolicy {
+  enum { incremental_resize_buckets = 4 };
+};
+struct IncrementalCtrlCacheHashPolicy : public CtrlCacheHashPolicy {
+  enum { incremental_resize_buckets = 2 };
+};
+
+TEST(HashtableTest, IncrementalResize) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         IncrementalResizePolicy> Map;
+  Map ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  // An insert hashes its key twice at most, plus the keys it moves out
+  // of 4 old buckets, even when it grows the table.
+  for (int i = 0; i < 10000; ++i) {
+    const int num_hashes = ht.hash_funct().num_hashes();
+    ht[i] = i;
+    EXPECT_LE(ht.hash_funct().num_hashes() - num_hashes, 6);
+  }
+  EXPECT_EQ(10000u, ht.size());
+  EXPECT_EQ(32768u, ht.bucket_count());
+
+  // At 70 elements, the table is part way through growing from 128
+  // buckets to 256.  Lookups, iteration and erasing see both halves.
+  ht.clear();
+  for (int i = 0; i < 70; ++i)
+    ht[i] = i;
+  EXPECT_EQ(256u, ht.bucket_count());
+  EXPECT_EQ(70u, ht.size());
+  Map copy(ht);
+  EXPECT_TRUE(copy == ht);
+  for (Map::iterator it = ht.begin(); it != ht.end(); ++it) {
+    if (it->first % 2)
+      ht.erase(it);
+  }
+  EXPECT_EQ(35u, ht.size());
+  for (int i = 0; i < 70; ++i) {
+    EXPECT_EQ(static_cast<size_t>(i % 2 == 0), ht.count(i));
+    EXPECT_EQ(i % 2 == 0, ht.find(i) != ht.end());
+  }
+  EXPECT_FALSE(copy == ht);
+  ht.insert(copy.begin(), copy.end());
+  EXPECT_TRUE(copy == ht);
+
+  ht.clear();
+  srand(22);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 IncrementalRobinHoodPolicy> ht2;
+  ht2.set_empty_key(-1);
+  ExpectSameAsMap(&ht2, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 IncrementalCtrlCacheHashPolicy> ht3;
+  ht3.set_empty_key(-1);
+  ht3.set_deleted_key(-2);
+  ExpectSameAsMap(&ht3, 50000, 20000);
+
+  // Without a deleted key, we can't mark moved entries, so we grow all
+  // at once.
+  Map ht4;
+  ht4.set_empty_key(-1);
+  for (int i = 0; i < 1000; ++i)
+    ht4[i] = i;
+  EXPECT_EQ(1000u, ht4.size());
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(i, ht4[i]);
+}
+
+struct IncrementalOneBucketPolicy : public dense_hashtable_policy {
+  enum { incremental_resize_buckets = 1 };
+};
+
+// Moving one bucket per insert, the new buckets can fill before the old
+// ones are empty, and the insert that finishes the move mustn't then
+// write into the bucket it found before the move.
+TEST(HashtableTest, IncrementalResizeFinishesMove) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         IncrementalOneBucketPolicy> Map;
+  for (int seed = 1; seed <= 20; ++seed) {
+    Map ht;
+    ht.set_empty_key(-1);
+    ht.set_deleted_key(-2);
+    srand(seed);
+    ExpectSameAsMap(&ht, 20000, 6400);
+  }
+#ifdef SPARSEHASH_CXX11
+  for (int seed = 1; seed <= 20; ++seed) {
+    Map ht;
+    ht.set_empty_key(-1);
+    ht.set_deleted_key(-2);
+    map<int, int> expected;
+    srand(seed);
+    for (int i = 0; i < 20000; ++i) {
+      const int key = rand() % 6400;
+      if (rand() % 3 == 0) {
+        EXPECT_EQ(expected.erase(key), ht.erase(key));
+      } else {
+        EXPECT_EQ(expected.insert(std::make_pair(key, i)).second,
+                  ht.try_emplace(key, i).second);
+      }
+    }
+    EXPECT_EQ(expected.size(), ht.size());
+    for (map<int, int>::const_iterator it = expected.begin();
+         it != expected.end(); ++it) {
+      Map::const_iterator pos = ht.find(it->first);
+      EXPECT_TRUE(pos != ht.end());
+      EXPECT_EQ(it->second, pos->second);
+    }
+  }
+#endif
+}
+
+struct OccupancyBitmapPolicy : public dense_hashtable_policy {
+  enum { use_occupancy_bitmap = true };
+};
+struct IncrementalBitmapPolicy : public OccupancyBitmapPolicy {
+  enum { incremental_resize_buckets = 4 };
+};
+struct GroupedBitmapCacheHashPolicy : public OccupancyBitmapPolicy {
+  enum { bucket_group_bytes = 64 };
+  enum { cache_hash = true };
+};
+
+TEST(HashtableTest, OccupancyBitmap) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         OccupancyBitmapPolicy> Map;
+  // No empty or deleted key, so every key can go in.
+  Map ht;
+  for (int i = -10; i < 10; ++i)
+    ht[i] = i + 100;
+  EXPECT_EQ(20u, ht.size());
+  EXPECT_EQ(1u, ht.erase(-1));
+  EXPECT_EQ(0u, ht.erase(-1));
+  EXPECT_EQ(0u, ht.count(-1));
+  EXPECT_EQ(98, ht[-2]);
+  ht[-1] = 5;
+  EXPECT_EQ(5, ht[-1]);
+  ht.set_empty_key(0);               // ignored: 0 is still a key
+  ht.set_deleted_key(1);
+  EXPECT_EQ(100, ht[0]);
+  EXPECT_EQ(101, ht[1]);
+
+  // Iterating and clearing never look at the keys in empty buckets.
+  ht.clear();
+  ht.resize(100000);
+  for (int i = 0; i < 10; ++i)
+    ht[i * 1000] = i;
+  const size_t num_buckets = ht.bucket_count();
+  const int compares_before = ht.key_eq().num_compares();
+  int num_seen = 0;
+  for (Map::const_iterator it = ht.begin(); it != ht.end(); ++it)
+    ++num_seen;
+  EXPECT_EQ(10, num_seen);
+  ht.clear_no_resize();
+  EXPECT_EQ(compares_before, ht.key_eq().num_compares());
+  EXPECT_EQ(num_buckets, ht.bucket_count());
+  EXPECT_TRUE(ht.begin() == ht.end());
+  EXPECT_EQ(0u, ht.count(0));
+
+  ht.clear();
+  srand(23);
+  ExpectSameAsMap(&ht, 50000, 20000);
+
+  // Serializing leaves out the empty buckets, as usual.
+  std::stringstream string_buffer;
+  EXPECT_TRUE(ht.serialize(Map::NopointerSerializer(), &string_buffer));
+  Map ht_in;
+  EXPECT_TRUE(ht_in.unserialize(Map::NopointerSerializer(), &string_buffer));
+  EXPECT_TRUE(ht == ht_in);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 IncrementalBitmapPolicy> ht2;
+  ExpectSameAsMap(&ht2, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 aligned_allocator_with_realloc<pair<const int, int> >,
+                 GroupedBitmapCacheHashPolicy> ht3;
+  ExpectSameAsMap(&ht3, 50000, 20000);
+
+  // Erasing a string frees it, and the empty string is a key like any
+  // other.
+  dense_hash_set<string, Hasher, Hasher, libc_allocator_with_realloc<string>,
+                 OccupancyBitmapPolicy> strs;
+  strs.insert("");
+  strs.insert(string(1000, 'x'));
+  strs.insert("y");
+  EXPECT_EQ(1u, strs.erase(string(1000, 'x')));
+  EXPECT_EQ(2u, strs.size());
+  EXPECT_EQ(1u, strs.count(""));
+  dense_hash_set<string, Hasher, Hasher, libc_allocator_with_realloc<string>,
+                 OccupancyBitmapPolicy> strs_copy(strs);
+  strs.clear_no_resize();
+  EXPECT_EQ(0u, strs.size());
+  EXPECT_EQ(0u, strs.count(""));
+  EXPECT_EQ(2u, strs_copy.size());
+}
+
+struct GenerationPolicy : public dense_hashtable_policy {
+  enum { use_generations = true };
+};
+struct WideGenerationCacheHashPolicy : public GenerationPolicy {
+  typedef unsigned short generation_type;
+  enum { cache_hash = true };
+};
+struct IncrementalGenerationPolicy : public GenerationPolicy {
+  enum { incremental_resize_buckets = 4 };
+};
+
+TEST(HashtableTest, Generations) {
+  typedef dense_hash_set<int, Hasher, Hasher, libc_allocator_with_realloc<int>,
+                         GenerationPolicy> Set;
+  Set ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  ht.resize(100000);
+  const size_t num_buckets = ht.bucket_count();
+  // Enough rounds for the 8-bit generation counter to wrap around.
+  for (int round = 0; round < 600; ++round) {
+    for (int i = 0; i < 10; ++i)
+      ht.insert(round + i * 7);
+    ht.erase(round);                 // leaves a deleted bucket behind
+    EXPECT_EQ(9u, ht.size());
+    EXPECT_EQ(0u, ht.count(round));
+    EXPECT_EQ(1u, ht.count(round + 7));
+    const int hashes_before = ht.hash_funct().num_hashes();
+    const int compares_before = ht.key_eq().num_compares();
+    ht.clear_no_resize();
+    EXPECT_EQ(hashes_before, ht.hash_funct().num_hashes());
+    EXPECT_EQ(compares_before, ht.key_eq().num_compares());
+    EXPECT_EQ(0u, ht.size());
+    EXPECT_TRUE(ht.begin() == ht.end());
+    EXPECT_EQ(0u, ht.count(round + 7));
+  }
+  EXPECT_EQ(num_buckets, ht.bucket_count());
+
+  // What was deleted in an old generation isn't deleted in this one.
+  ht.insert(5);
+  ht.erase(5);
+  ht.clear_no_resize();
+  ht.insert(5);
+  EXPECT_EQ(1u, ht.size());
+  EXPECT_EQ(1u, ht.count(5));
+
+  ht.clear();
+  srand(24);
+  set<int> expected;
+  for (int i = 0; i < 50000; ++i) {
+    const int key = rand() % 20000;
+    if (i % 5000 == 0) {
+      ht.clear_no_resize();
+      expected.clear();
+    } else if (rand() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), ht.erase(key));
+    } else {
+      ht.insert(key);
+      expected.insert(key);
+    }
+  }
+  EXPECT_EQ(expected.size(), ht.size());
+  EXPECT_TRUE(set<int>(ht.begin(), ht.end()) == expected);
+
+  Set ht_copy(ht);
+  EXPECT_TRUE(ht_copy == ht);
+  std::stringstream string_buffer;
+  EXPECT_TRUE(ht.serialize(Set::NopointerSerializer(), &string_buffer));
+  Set ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(Set::NopointerSerializer(), &string_buffer));
+  EXPECT_TRUE(ht == ht_in);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 WideGenerationCacheHashPolicy> ht2;
+  ht2.set_empty_key(-1);
+  ht2.set_deleted_key(-2);
+  ExpectSameAsMap(&ht2, 50000, 20000);
+  ht2.clear_no_resize();
+  ExpectSameAsMap(&ht2, 50000, 20000);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 IncrementalGenerationPolicy> ht3;
+  ht3.set_empty_key(-1);
+  ht3.set_deleted_key(-2);
+  ExpectSameAsMap(&ht3, 50000, 20000);
+  ht3.clear_no_resize();
+  ExpectSameAsMap(&ht3, 50000, 20000);
+}
+
+// Writes ht with write_mappable() and checks that a view of the file
+// finds everything ht has, and nothing else.
+template <class HT>
+void ExpectMappableViewMatches(HT* ht, const char* basename) {
+  string file(TmpFile(basename));
+  FILE* fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(ht->write_mappable(fp));
+  fclose(fp);
+
+  // attach() works on any suitably aligned copy of the file.
+  std::ifstream in(file.c_str(), std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  const string bytes = contents.str();
+  vector<double> aligned(bytes.size() / sizeof(double) + 8);
+  char* start = reinterpret_cast<char*>(&aligned[0]);
+  start += (64 - reinterpret_cast<size_t>(start) % 64) % 64;
+  memcpy(start, bytes.data(), bytes.size());
+  dense_hash_map_view<int, int> attached;
+  EXPECT_FALSE(attached.attach(start, 10));           // too short
+  EXPECT_TRUE(attached.attach(start, bytes.size()));
+  EXPECT_EQ(ht->size(), attached.size());
+
+#ifdef HAVE_SYS_MMAN_H
+  dense_hash_map_view<int, int> view;
+  EXPECT_FALSE(view.open((file + ".missing").c_str()));
+  EXPECT_TRUE(view.open(file.c_str()));
+#else
+  dense_hash_map_view<int, int>& view = attached;
+#endif
+  EXPECT_TRUE(view.is_open());
+  EXPECT_EQ(ht->size(), view.size());
+  // The file has a power of two of buckets, even if ht doesn't.
+  size_t file_buckets = 4;
+  while (file_buckets < ht->bucket_count())
+    file_buckets *= 2;
+  EXPECT_EQ(file_buckets, view.bucket_count());
+  for (typename HT::const_iterator it = ht->begin(); it != ht->end(); ++it) {
+    const pair<const int, int>* found = view.find(it->first);
+    EXPECT_TRUE(found != NULL);
+    EXPECT_EQ(it->first, found->first);
+    EXPECT_EQ(it->second, found->second);
+    EXPECT_TRUE(attached.find(it->first) != NULL);
+  }
+  for (int i = -10; i < 0; ++i)
+    EXPECT_EQ(0u, view.count(i * 1000));
+  view.close();
+  EXPECT_FALSE(view.is_open());
+  EXPECT_TRUE(view.find(1) == NULL);
+}
+
+TEST(HashtableTest, MappableView) {
+  dense_hash_map<int, int> ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  for (int i = 0; i < 5000; ++i)
+    ht[i * 7] = i;
+  for (int i = 0; i < 5000; i += 3)
+    ht.erase(i * 7);          // write_mappable() drops deleted buckets
+  ExpectMappableViewMatches(&ht, "mappable");
+
+  // Robin Hood puts entries where the default probe wouldn't look, so
+  // they're laid out again before they're written.
+  dense_hash_map<int, int, SPARSEHASH_HASH<int>, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 RobinHoodPolicy> rh;
+  rh.set_empty_key(-1);
+  for (int i = 0; i < 5000; ++i)
+    rh[i * 7] = -i;
+  ExpectMappableViewMatches(&rh, "mappable_rh");
+
+  // So do entries placed by an unmixed hash.
+  dense_hash_map<int, int, SPARSEHASH_HASH<int>, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 NoHashMixingPolicy> unmixed;
+  unmixed.set_empty_key(-1);
+  for (int i = 0; i < 5000; ++i)
+    unmixed[i * 4096] = i;
+  ExpectMappableViewMatches(&unmixed, "mappable_unmixed");
+
+  // A file whose values are a different size is refused.
+  dense_hash_map<int, double> other;
+  other.set_empty_key(-1);
+  other[1] = 1.0;
+  string file(TmpFile("mappable_other"));
+  FILE* fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(other.write_mappable(fp));
+  fclose(fp);
+#ifdef HAVE_SYS_MMAN_H
+  dense_hash_map_view<int, int> view;
+  EXPECT_FALSE(view.open(file.c_str()));
+  dense_hash_map_view<int, double> right_view;
+  EXPECT_TRUE(right_view.open(file.c_str()));
+  EXPECT_EQ(1.0, right_view.find(1)->second);
+#endif
+}
+
+struct SplitValuesPolicy : public dense_hashtable_policy {
+  enum { split_values = true };
+};
+struct SplitControlBytePolicy : public ControlBytePolicy {
+  enum { split_values = true };
+};
+struct SplitRobinHoodPolicy : public RobinHoodPolicy {
+  enum { split_values = true };
+};
+
+// A value much bigger than its key, which is what split_values is for.
+struct BigValue {
+  BigValue() { memset(words, 0, sizeof(words)); }
+  explicit BigValue(int i) {
+    for (int j = 0; j < 50; ++j) words[j] = i + j;
+  }
+  bool operator==(const BigValue& that) const {
+    return memcmp(words, that.words, sizeof(words)) == 0;
+  }
+  bool operator!=(const BigValue& that) const { return !(*this == that); }
+  int words[50];
+};
+
+TEST(HashtableTest, SplitValues) {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         SplitValuesPolicy> SplitMap;
+  SplitMap ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  EXPECT_EQ(-1, ht.empty_key());
+  srand(21);
+  ExpectSameAsMap(&ht, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 SplitControlBytePolicy> ctrl;
+  ctrl.set_empty_key(-1);
+  ctrl.set_deleted_key(-2);
+  ExpectSameAsMap(&ctrl, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 SplitRobinHoodPolicy> rh;
+  rh.set_empty_key(-1);
+  rh.set_deleted_key(-2);
+  ExpectSameAsMap(&rh, 50000, 20000);
+
+  // Erasing doesn't move the other values, so we can erase as we go.
+  ht.clear();
+  for (int i = 0; i < 1000; ++i)
+    ht[i] = i;
+  const int* value_of_998 = &ht[998];
+  for (SplitMap::iterator it = ht.begin(); it != ht.end(); ++it) {
+    if (it->first % 2)
+      ht.erase(it);
+  }
+  EXPECT_EQ(500u, ht.size());
+  EXPECT_EQ(value_of_998, &ht.find(998)->second);
+  EXPECT_TRUE(ht.find(999) == ht.end());
+  // Iteration is in insertion order.
+  int expected_key = 0;
+  for (SplitMap::const_iterator it = ht.begin(); it != ht.end(); ++it) {
+    EXPECT_EQ(expected_key, it->first);
+    expected_key += 2;
+  }
+  for (size_t i = 0; i < ht.bucket_count(); ++i) {
+    size_t num_in_bucket = 0;
+    for (SplitMap::local_iterator it = ht.begin(i); it != ht.end(i); ++it) {
+      EXPECT_EQ(i, ht.bucket(it->first));
+      ++num_in_bucket;
+    }
+    EXPECT_EQ(ht.bucket_size(i), num_in_bucket);
+  }
+
+  SplitMap copy(ht);
+  EXPECT_TRUE(copy == ht);
+  copy[1] = 1;
+  EXPECT_TRUE(copy != ht);
+  copy.swap(ht);
+  EXPECT_EQ(501u, ht.size());
+  EXPECT_EQ(1, ht[1]);
+  // resize() packs the slots, which must keep the buckets up to date.
+  ht.erase(1);
+  ht.resize(0);
+  EXPECT_TRUE(copy == ht);
+  for (int i = 0; i < 1000; i += 2)
+    EXPECT_EQ(i, ht.find(i)->second);
+
+  // Both ways of serializing.
+  string file(TmpFile("split_values"));
+  FILE* fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(fp != NULL);
+  EXPECT_TRUE(ht.serialize(SplitMap::NopointerSerializer(), fp));
+  EXPECT_TRUE(ht.serialize(PodSerializerOneByOne<pair<const int, int> >(),
+                           fp));
+  fclose(fp);
+  fp = fopen(file.c_str(), "rb");
+  EXPECT_TRUE(fp != NULL);
+  SplitMap ht_in, ht_in2;
+  ht_in.set_empty_key(-1);
+  ht_in2.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(SplitMap::NopointerSerializer(), fp));
+  EXPECT_TRUE(ht_in2.unserialize(
+      PodSerializerOneByOne<pair<const int, int> >(), fp));
+  fclose(fp);
+  EXPECT_TRUE(ht == ht_in);
+  EXPECT_TRUE(ht == ht_in2);
+
+  // write_mappable() writes what a dense_hashtable would.
+  fp = fopen(file.c_str(), "wb");
+  EXPECT_TRUE(ht.write_mappable(fp));
+  fclose(fp);
+#ifdef HAVE_SYS_MMAN_H
+  dense_hash_map_view<int, int, Hasher, Hasher> view;
+  EXPECT_TRUE(view.open(file.c_str()));
+  EXPECT_EQ(ht.size(), view.size());
+  for (SplitMap::const_iterator it = ht.begin(); it != ht.end(); ++it)
+    EXPECT_EQ(it->second, view.find(it->first)->second);
+#endif
+
+  dense_hash_map<int, BigValue, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, BigValue> >,
+                 SplitValuesPolicy> big;
+  big.set_empty_key(-1);
+  big.set_deleted_key(-2);
+  for (int i = 0; i < 10000; ++i)
+    big[i * 3] = BigValue(i);
+  for (int i = 0; i < 10000; i += 2)
+    big.erase(i * 3);
+  for (int i = 10000; i < 12000; ++i)
+    big.insert(std::make_pair(i * 3, BigValue(i)));
+  EXPECT_EQ(7000u, big.size());
+  for (int i = 0; i < 12000; ++i) {
+    if (i < 10000 && i % 2 == 0)
+      EXPECT_TRUE(big.find(i * 3) == big.end());
+    else
+      EXPECT_TRUE(big.find(i * 3)->second == BigValue(i));
+  }
+
+  dense_hash_map<string, string, SPARSEHASH_HASH<string>, std::equal_to<string>,
+                 libc_allocator_with_realloc<pair<const string, string> >,
+                 SplitValuesPolicy> strings;
+  strings.set_empty_key("");
+  strings.set_deleted_key("-");
+  for (int i = 0; i < 1000; ++i) {
+    char key[32];
+    snprintf(key, sizeof(key), "key%d", i);
+    strings[key] = string(200, static_cast<char>('a' + i % 26));
+  }
+  for (int i = 0; i < 1000; i += 3) {
+    char key[32];
+    snprintf(key, sizeof(key), "key%d", i);
+    EXPECT_EQ(1u, strings.erase(key));
+  }
+  strings.resize(0);
+  EXPECT_EQ(666u, strings.size());
+  EXPECT_EQ(string(200, 'b'), strings["key1"]);
+  EXPECT_EQ(0u, strings.count("key0"));
+}
+
+struct InlineBucketsPolicy : public dense_hashtable_policy {
+  enum { inline_buckets = 8 };
+};
+struct InlineSplitValuesPolicy : public SplitValuesPolicy {
+  enum { inline_buckets = 4 };
+};
+struct InlineRobinHoodPolicy : public RobinHoodPolicy {
+  enum { inline_buckets = 8 };
+};
+
+TEST(HashtableTest, InlineBuckets) {
+  typedef dense_hash_set<int, Hasher, Hasher, libc_allocator_with_realloc<int>,
+                         InlineBucketsPolicy> SmallSet;
+  SmallSet ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  EXPECT_EQ(-1, ht.empty_key());
+  for (int i = 0; i < 8; ++i)
+    EXPECT_TRUE(ht.insert(i * 4096).second);
+  EXPECT_FALSE(ht.insert(0).second);
+  // Eight fit in the object, and are found without hashing.
+  EXPECT_EQ(8u, ht.bucket_count());
+  EXPECT_EQ(8u, ht.size());
+  for (int i = 0; i < 8; ++i)
+    EXPECT_EQ(1u, ht.count(i * 4096));
+  EXPECT_EQ(0u, ht.count(1));
+  EXPECT_EQ(0, ht.hash_funct().num_hashes());
+  // The table isn't built until it's needed, so the object isn't much
+  // more than the slots.
+  EXPECT_LT(sizeof(ht), sizeof(dense_hash_set<int, Hasher, Hasher>) +
+                        8 * sizeof(int));
+  for (size_t i = 0; i < ht.bucket_count(); ++i) {
+    EXPECT_EQ(1u, ht.bucket_size(i));
+    EXPECT_EQ(i, ht.bucket(*ht.begin(i)));
+    EXPECT_TRUE(++ht.begin(i) == ht.end(i));
+  }
+
+  // Erasing frees a slot, which the next insert reuses.
+  for (SmallSet::iterator it = ht.begin(); it != ht.end(); ++it) {
+    if (*it % 8192)
+      ht.erase(it);
+  }
+  EXPECT_EQ(4u, ht.size());
+  EXPECT_TRUE(ht.insert(1).second);
+  EXPECT_EQ(8u, ht.bucket_count());
+  SmallSet copy(ht);
+  EXPECT_TRUE(copy == ht);
+
+  // The ninth distinct key moves everything into real buckets.
+  for (int i = 2; i < 100; ++i)
+    ht.insert(i);
+  EXPECT_LE(128u, ht.bucket_count());
+  EXPECT_EQ(103u, ht.size());
+  EXPECT_LT(0, ht.hash_funct().num_hashes());
+  for (int i = 0; i < 8; i += 2)
+    EXPECT_EQ(1u, ht.count(i * 4096));
+  EXPECT_EQ(1u, ht.erase(50));
+  EXPECT_EQ(102u, ht.size());
+
+  // Swapping and copying work between the two, both ways.
+  ht.swap(copy);
+  EXPECT_EQ(5u, ht.size());
+  EXPECT_EQ(8u, ht.bucket_count());
+  EXPECT_EQ(102u, copy.size());
+  EXPECT_EQ(1u, copy.count(99));
+  SmallSet copy2 = copy;
+  EXPECT_TRUE(copy2 == copy);
+  copy2 = ht;
+  EXPECT_TRUE(copy2 == ht);
+
+  // A small one writes what a dense_hash_set would, and reads it back.
+  std::stringstream buffer;
+  EXPECT_TRUE(ht.serialize(SmallSet::NopointerSerializer(), &buffer));
+  dense_hash_set<int, Hasher, Hasher> plain;
+  plain.set_empty_key(-1);
+  EXPECT_TRUE(plain.unserialize(SmallSet::NopointerSerializer(), &buffer));
+  EXPECT_EQ(5u, plain.size());
+  EXPECT_EQ(1u, plain.count(1));
+  buffer.clear();
+  buffer.seekg(0);
+  SmallSet ht_in;
+  ht_in.set_empty_key(-1);
+  EXPECT_TRUE(ht_in.unserialize(SmallSet::NopointerSerializer(), &buffer));
+  EXPECT_TRUE(ht_in == ht);
+
+  // clear() goes back to the slots.
+  copy.clear();
+  EXPECT_EQ(8u, copy.bucket_count());
+  EXPECT_EQ(0u, copy.size());
+  copy.insert(3);
+  EXPECT_EQ(1u, copy.count(3));
+
+  // Until there's a table, the slots hold on to its resize threads.
+  SmallSet threaded;
+  threaded.set_empty_key(-1);
+  threaded.set_resize_threads(4);
+  EXPECT_EQ(4, threaded.resize_threads());
+  for (int i = 0; i < 100; ++i)
+    threaded.insert(i);
+  EXPECT_EQ(4, threaded.resize_threads());
+
+  // Maps, including with the other knobs, behave as they always do.
+  srand(22);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 InlineBucketsPolicy> small_map;
+  small_map.set_empty_key(-1);
+  small_map.set_deleted_key(-2);
+  ExpectSameAsMap(&small_map, 1000, 8);
+  EXPECT_EQ(8u, small_map.bucket_count());
+  small_map.clear();
+  ExpectSameAsMap(&small_map, 50000, 20000);
+  small_map.clear();
+  ExpectSameAsMap(&small_map, 1000, 6);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 InlineSplitValuesPolicy> split;
+  split.set_empty_key(-1);
+  split.set_deleted_key(-2);
+  ExpectSameAsMap(&split, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 InlineRobinHoodPolicy> rh;
+  rh.set_empty_key(-1);
+  ExpectSameAsMap(&rh, 50000, 20000);
+
+  // Lots of little sets of strings, as in NestedHashtables.
+  dense_hash_map<int, dense_hash_set<string, Hasher, Hasher,
+                                     libc_allocator_with_realloc<string>,
+                                     InlineBucketsPolicy>,
+                 Hasher, Hasher> nested;
+  nested.set_empty_key(-1);
+  for (int i = 0; i < 100; ++i) {
+    nested[i].set_empty_key("");
+    for (int j = 0; j <= i % 12; ++j) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%d", j);
+      nested[i].insert(buf);
+    }
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(static_cast<size_t>(i % 12 + 1), nested[i].size());
+    EXPECT_EQ(i % 12 < 8 ? 8u : 32u, nested[i].bucket_count());
+    EXPECT_EQ(1u, nested[i].count("0"));
+  }
+}
+
+#ifdef SPARSEHASH_CXX11
+// More alignment than a long double needs.
+struct alignas(64) OverAligned {
+  int value;
+  explicit OverAligned(int v = 0) : value(v) { }
+  bool operator==(const OverAligned& that) const {
+    return value == that.value;
+  }
+};
+struct OverAlignedHasher {
+  size_t operator()(const OverAligned& v) const { return v.value; }
+};
+
+TEST(HashtableTest, InlineBucketsAlignmentAndMoves) {
+  // The slots are aligned as the values must be.
+  dense_hash_set<OverAligned, OverAlignedHasher, std::equal_to<OverAligned>,
+                 libc_allocator_with_realloc<OverAligned>,
+                 InlineBucketsPolicy> aligned;
+  aligned.set_empty_key(OverAligned(-1));
+  for (int i = 0; i < 8; ++i)
+    aligned.insert(OverAligned(i));
+  EXPECT_EQ(8u, aligned.bucket_count());
+  for (size_t i = 0; i < aligned.bucket_count(); ++i)
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(&*aligned.begin(i)) % 64);
+
+  // Moving and swapping move the values in the slots, not copy them.
+  typedef dense_hash_map<int, CopyCounted, Hasher, Hasher,
+                         libc_allocator_with_realloc<
+                             pair<const int, CopyCounted> >,
+                         InlineBucketsPolicy> SmallMap;
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         InlineBucketsPolicy> SmallIntMap;
+  // The moves can throw only if the values' copies and moves can.
+  EXPECT_TRUE(std::is_nothrow_move_constructible<SmallIntMap>::value);
+  EXPECT_TRUE(std::is_nothrow_move_assignable<SmallIntMap>::value);
+  EXPECT_FALSE(std::is_nothrow_move_constructible<SmallMap>::value);
+  SmallMap a;
+  a.set_empty_key(-1);
+  a.set_deleted_key(-2);
+  for (int i = 1; i <= 5; ++i)
+    a[i] = CopyCounted(i);
+  CopyCounted::num_copies = 0;
+  SmallMap b(std::move(a));
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ(5u, b.size());
+  EXPECT_EQ(-2, b.deleted_key());
+  EXPECT_EQ(-1, a.empty_key());
+  EXPECT_EQ(-2, a.deleted_key());
+  EXPECT_TRUE(a.begin() == a.end());
+  a[7] = CopyCounted(7);
+  a.swap(b);
+  EXPECT_EQ(5u, a.size());
+  EXPECT_EQ(1u, b.size());
+  EXPECT_EQ(7, b[7].value);
+  b = std::move(a);
+  EXPECT_EQ(5u, b.size());
+  EXPECT_EQ(0, CopyCounted::num_copies);
+  for (int i = 1; i <= 5; ++i)
+    EXPECT_EQ(i, b[i].value);
+}
+#endif  // SPARSEHASH_CXX11
+
+#ifdef SPARSEHASH_CXX11
+// A table that's been moved from is empty, and can be iterated over,
+// cleared, and inserted into, without setting its keys again.
+template <class Policy>
+void ExpectMovedFromUsable() {
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         Policy> Map;
+  Map a;
+  a.set_empty_key(-1);
+  a.set_deleted_key(-2);
+  for (int i = 0; i < 100; ++i)
+    a[i] = i;
+  Map b(std::move(a));
+  EXPECT_EQ(100u, b.size());
+  EXPECT_TRUE(a.empty());
+  EXPECT_TRUE(a.begin() == a.end());
+  EXPECT_TRUE(const_cast<const Map&>(a).begin() == a.end());
+  EXPECT_EQ(0u, a.count(1));
+  a.clear();
+  a[1] = 2;
+  EXPECT_EQ(1u, a.size());
+  EXPECT_EQ(2, a[1]);
+
+  b = std::move(a);
+  EXPECT_EQ(1u, b.size());
+  EXPECT_TRUE(a.begin() == a.end());
+  for (int i = 0; i < 100; ++i)
+    a.insert(pair<const int, int>(i, i));
+  EXPECT_EQ(100u, a.size());
+  EXPECT_EQ(1u, a.erase(50));
+  EXPECT_EQ(0u, a.count(50));
+}
+
+TEST(HashtableTest, MovedFromTables) {
+  ExpectMovedFromUsable<dense_hashtable_policy>();
+  ExpectMovedFromUsable<TypedCtrlCacheHashPolicy>();
+  ExpectMovedFromUsable<TypedLinearBucketGroupPolicy>();
+  ExpectMovedFromUsable<TypedRobinHoodPolicy>();
+  ExpectMovedFromUsable<TypedIncrementalPolicy>();
+  ExpectMovedFromUsable<TypedInlineBucketsPolicy>();
+  ExpectMovedFromUsable<TypedSplitValuesPolicy>();
+  ExpectMovedFromUsable<OccupancyBitmapPolicy>();
+  ExpectMovedFromUsable<GenerationPolicy>();
+}
+#endif  // SPARSEHASH_CXX11
+
+// Policy knobs that are off take no room, so with the default policy
+// the tables are as small as they were before there were any knobs.
+TEST(HashtableTest, DefaultPolicySize) {
+  if (sizeof(void*) != 8 || sizeof(size_t) != 8)
+    return;                            // the sizes below are for LP64
+  EXPECT_EQ(80u, sizeof(dense_hash_map<int, int>));
+  EXPECT_EQ(80u, sizeof(dense_hash_set<int>));
+  EXPECT_EQ(88u, sizeof(sparse_hash_map<int, int>));
+  EXPECT_EQ(88u, sizeof(sparse_hash_set<int>));
+}
+
+TEST(HashtableTest, MemoryUsage) {
+  memory_breakdown usage;
+  dense_hash_map<int, int> dense;
+  dense.set_empty_key(-1);
+  for (int i = 0; i < 1000; ++i)
+    dense[i] = i;
+  EXPECT_EQ(dense.memory_usage(), dense.memory_usage(&usage));
+  EXPECT_EQ(usage.total(), dense.memory_usage());
+  EXPECT_EQ(sizeof(dense), usage.object_bytes);
+  EXPECT_EQ(dense.bucket_count() * sizeof(pair<const int, int>),
+            usage.bucket_bytes);
+  EXPECT_EQ(0u, usage.bookkeeping_bytes);
+  EXPECT_EQ(1u, usage.num_allocations);
+  EXPECT_TRUE(usage.group_sizes.empty());
+
+  // The side arrays count as bookkeeping.
+  dense_hash_set<int, Hasher, Hasher, libc_allocator_with_realloc<int>,
+                 ControlBytePolicy> ctrl;
+  ctrl.set_empty_key(-1);
+  ctrl.insert(1);
+  ctrl.memory_usage(&usage);
+  EXPECT_LE(ctrl.bucket_count(), usage.bookkeeping_bytes);
+  EXPECT_EQ(2u, usage.num_allocations);
+
+  // An inline table allocates nothing until it outgrows its slots.
+  dense_hash_set<int, Hasher, Hasher, libc_allocator_with_realloc<int>,
+                 InlineBucketsPolicy> small;
+  small.set_empty_key(-1);
+  small.insert(1);
+  small.memory_usage(&usage);
+  EXPECT_EQ(sizeof(small), usage.total());
+  EXPECT_EQ(0u, usage.num_allocations);
+  for (int i = 0; i < 100; ++i)
+    small.insert(i);
+  small.memory_usage(&usage);
+  EXPECT_EQ(small.bucket_count() * sizeof(int), usage.bucket_bytes);
+
+  // A sparse table allocates only what it holds, one group at a time.
+  sparse_hash_map<int, int> sparse;
+  for (int i = 0; i < 1000; ++i)
+    sparse[i * 7] = i;
+  sparse.memory_usage(&usage, true);
+  EXPECT_EQ(sparse.size() * sizeof(pair<const int, int>), usage.bucket_bytes);
+  EXPECT_LT(0u, usage.bookkeeping_bytes);
+  size_t num_groups = 0, num_values = 0;
+  for (size_t n = 0; n < usage.group_sizes.size(); ++n) {
+    num_groups += usage.group_sizes[n];
+    num_values += n * usage.group_sizes[n];
+  }
+  EXPECT_EQ((sparse.bucket_count() + DEFAULT_SPARSEGROUP_SIZE - 1) /
+            DEFAULT_SPARSEGROUP_SIZE, num_groups);
+  EXPECT_EQ(sparse.size(), num_values);
+  EXPECT_EQ(num_groups - usage.group_sizes[0] + 1, usage.num_allocations);
+  const size_t without_hashes = usage.total() - usage.object_bytes;
+
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseCacheHashPolicy> cached;
+  for (int i = 0; i < 1000; ++i)
+    cached[i * 7] = i;
+  cached.memory_usage(&usage);
+  EXPECT_LE(without_hashes + 1000 * sizeof(size_t),
+            usage.total() - usage.object_bytes);
+
+  sparsetable<int> table(100);
+  table.set(3, 3);
+  table.set(99, 99);
+  EXPECT_EQ(table.memory_usage(), table.memory_usage(&usage, true));
+  EXPECT_EQ(2 * sizeof(int), usage.bucket_bytes);
+  EXPECT_EQ(3u, usage.num_allocations);
+  EXPECT_EQ(DEFAULT_SPARSEGROUP_SIZE + 1u, usage.group_sizes.size());
+  EXPECT_EQ(2u, usage.group_sizes[1]);
+  EXPECT_EQ(1u, usage.group_sizes[0]);
+}
+
+struct StatisticsPolicy : public dense_hashtable_policy {
+  typedef hashtable_statistics statistics;
+};
+struct CtrlStatisticsPolicy : public ControlBytePolicy {
+  typedef hashtable_statistics statistics;
+};
+struct RobinHoodStatisticsPolicy : public RobinHoodPolicy {
+  typedef hashtable_statistics statistics;
+};
+struct SparseStatisticsPolicy : public sparse_hashtable_policy {
+  typedef hashtable_statistics statistics;
+};
+
+// ht must be empty, with its deleted key (if it needs one) set.
+template <class Table>
+void CheckStatistics(Table* ht, bool counts_tombstones) {
+  for (int i = 0; i < 1000; ++i)
+    ht->insert(typename Table::value_type(i, i));
+  hashtable_stats stats = ht->statistics();
+  EXPECT_EQ(1000u, stats.misses);   // each insert looked first
+  EXPECT_LT(0u, stats.resizes);
+  EXPECT_LE(stats.resizes, stats.copies);
+  EXPECT_LE(0.0, stats.copy_seconds);
+
+  ht->reset_statistics();
+  for (int i = 0; i < 1500; ++i)
+    ht->count(i);
+  stats = ht->statistics();
+  EXPECT_EQ(1500u, stats.lookups);
+  EXPECT_EQ(1000u, stats.hits);
+  EXPECT_EQ(500u, stats.misses);
+  size_t num_lookups = 0;
+  for (int n = 0; n < hashtable_stats::kNumProbeLengths; ++n)
+    num_lookups += stats.probe_lengths[n];
+  EXPECT_EQ(stats.lookups, num_lookups);
+  EXPECT_EQ(0u, stats.resizes);
+  EXPECT_EQ(0u, stats.copies);
+
+  // Looking for what we erased probes past (at least) its own bucket.
+  for (int i = 0; i < 1000; i += 2)
+    ht->erase(i);
+  ht->reset_statistics();
+  for (int i = 0; i < 1000; i += 2)
+    ht->count(i);
+  stats = ht->statistics();
+  EXPECT_EQ(500u, stats.misses);
+  if (counts_tombstones)
+    EXPECT_LE(500u, stats.tombstones);
+  else
+    EXPECT_EQ(0u, stats.tombstones);
+}
+
+TEST(HashtableTest, Statistics) {
+  // By default there's nothing to count with, and so nothing counted.
+  dense_hash_map<int, int> plain;
+  plain.set_empty_key(-1);
+  plain[1] = 1;
+  EXPECT_EQ(0u, plain.statistics().lookups);
+  EXPECT_EQ(sizeof(dense_hash_map<int, int>), sizeof(plain));
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 StatisticsPolicy> dense;
+  dense.set_empty_key(-1);
+  dense.set_deleted_key(-2);
+  CheckStatistics(&dense, true);
+  // A copy starts where the original left off, plus the copying.
+  const hashtable_stats before = dense.statistics();
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 StatisticsPolicy> copy(dense);
+  EXPECT_EQ(before.lookups, copy.statistics().lookups);
+  EXPECT_EQ(before.copies + 1, copy.statistics().copies);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 CtrlStatisticsPolicy> ctrl;
+  ctrl.set_empty_key(-1);
+  ctrl.set_deleted_key(-2);
+  CheckStatistics(&ctrl, false);
+
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 RobinHoodStatisticsPolicy> rh;
+  rh.set_empty_key(-1);
+  CheckStatistics(&rh, false);
+
+  sparse_hash_map<int, int, Hasher, Hasher,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseStatisticsPolicy> sparse;
+  sparse.set_deleted_key(-2);
+  CheckStatistics(&sparse, true);
+}
+
+struct FastrangePolicy : public dense_hashtable_policy {
+  typedef linear_probing probing;
+  enum { fastrange_buckets = true };
+};
+struct FastrangeCacheHashPolicy : public FastrangePolicy {
+  enum { cache_hash = true };
+};
+struct IncrementalFastrangePolicy : public FastrangePolicy {
+  enum { incremental_resize_buckets = 64 };
+};
+struct IncrementalOneFastrangePolicy : public FastrangePolicy {
+  enum { incremental_resize_buckets = 1 };
+};
+
+// Counts the hashes of every copy, including the one the old buckets
+// keep while they're being moved.
+struct TotalHashCounter {
+  size_t operator()(int a) const {
+    ++num_hashes;
+    return static_cast<size_t>(a);
+  }
+  static int num_hashes;
+};
+int TotalHashCounter::num_hashes = 0;
+
+TEST(HashtableTest, FastrangeBuckets) {
+  using GOOGLE_NAMESPACE::sparsehash_internal::fastrange;
+  EXPECT_EQ(0u, fastrange(0, 1000));
+  EXPECT_EQ(999u, fastrange(~static_cast<size_t>(0), 1000));
+  EXPECT_EQ(500u, fastrange(static_cast<size_t>(1) <<
+                            (sizeof(size_t) * 8 - 1), 1000));
+
+  typedef dense_hash_map<int, int, Hasher, Hasher,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         FastrangePolicy> FastrangeMap;
+  // resize() gives just about the buckets asked for, not the next
+  // power of two up.
+  FastrangeMap ht;
+  ht.set_empty_key(-1);
+  ht.set_deleted_key(-2);
+  ht.resize(1000);
+  EXPECT_LE(2001u, ht.bucket_count());
+  EXPECT_GT(2010u, ht.bucket_count());
+  const size_t resized = ht.bucket_count();
+  for (int i = 0; i < 1000; ++i)
+    ht[i] = i;
+  EXPECT_EQ(resized, ht.bucket_count());
+
+  // Growing goes a quarter at a time, so it never gets very empty.
+  size_t num_buckets = ht.bucket_count();
+  for (int i = 1000; i < 100000; ++i) {
+    ht[i] = i;
+    if (ht.bucket_count() != num_buckets) {
+      EXPECT_GE(num_buckets + num_buckets / 4 + 1, ht.bucket_count());
+      num_buckets = ht.bucket_count();
+    }
+    EXPECT_LT(ht.size(), ht.bucket_count() / 2 + 1);
+  }
+  EXPECT_LT(0.4f, ht.load_factor());
+  for (int i = 0; i < 100000; ++i)
+    EXPECT_EQ(i, ht[i]);
+
+  // Erasing most of it shrinks it, a fifth at a time.
+  for (int i = 0; i < 99000; ++i)
+    ht.erase(i);
+  ht.insert(pair<const int, int>(-3, 0));
+  EXPECT_GT(num_buckets / 2, ht.bucket_count());
+  EXPECT_EQ(1001u, ht.size());
+
+  srand(25);
+  FastrangeMap random;
+  random.set_empty_key(-1);
+  random.set_deleted_key(-2);
+  ExpectSameAsMap(&random, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 FastrangeCacheHashPolicy> cached;
+  cached.set_empty_key(-1);
+  cached.set_deleted_key(-2);
+  ExpectSameAsMap(&cached, 50000, 20000);
+  dense_hash_map<int, int, Hasher, Hasher,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 IncrementalFastrangePolicy> incremental;
+  incremental.set_empty_key(-1);
+  incremental.set_deleted_key(-2);
+  ExpectSameAsMap(&incremental, 50000, 20000);
+
+  // Growing by a quarter leaves room for fewer inserts than there are
+  // old buckets, so each insert moves several, and none is left to move
+  // everything at once.
+  typedef dense_hash_map<int, int, TotalHashCounter, std::equal_to<int>,
+                         libc_allocator_with_realloc<pair<const int, int> >,
+                         IncrementalOneFastrangePolicy> IncrementalOneMap;
+  IncrementalOneMap one;
+  one.set_empty_key(-1);
+  one.set_deleted_key(-2);
+  for (int i = 0; i < 100000; ++i) {
+    const int num_hashes = TotalHashCounter::num_hashes;
+    one[i] = i;
+    EXPECT_GT(20, TotalHashCounter::num_hashes - num_hashes);
+  }
+  for (int seed = 1; seed <= 20; ++seed) {
+    IncrementalOneMap fuzzed;
+    fuzzed.set_empty_key(-1);
+    fuzzed.set_deleted_key(-2);
+    srand(seed);
+    ExpectSameAsMap(&fuzzed, 20000, 6400);
+  }
+
+  // It reads the files other tables write, and what it writes itself.
+  dense_hash_map<int, int> plain;
+  plain.set_empty_key(-1);
+  for (int i = 0; i < 3000; ++i)
+    plain[i * 3] = i;
+  std::stringstream buffer;
+  EXPECT_TRUE(plain.serialize(FastrangeMap::NopointerSerializer(), &buffer));
+  FastrangeMap in;
+  in.set_empty_key(-1);
+  EXPECT_TRUE(in.unserialize(FastrangeMap::NopointerSerializer(), &buffer));
+  EXPECT_EQ(3000u, in.size());
+  EXPECT_EQ(2999, in[8997]);
+  in.resize(7000);
+  EXPECT_NE(0u, in.bucket_count() & (in.bucket_count() - 1));
+  std::stringstream buffer2;
+  EXPECT_TRUE(in.serialize(FastrangeMap::NopointerSerializer(), &buffer2));
+  FastrangeMap in2;
+  in2.set_empty_key(-1);
+  EXPECT_TRUE(in2.unserialize(FastrangeMap::NopointerSerializer(), &buffer2));
+  EXPECT_TRUE(in2 == in);
+
+  // The mappable file gets a power of two of buckets.
+  dense_hash_map<int, int, SPARSEHASH_HASH<int>, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 FastrangePolicy> mappable;
+  mappable.set_empty_key(-1);
+  for (int i = 0; i < 5000; ++i)
+    mappable[i * 7] = i;
+  ExpectMappableViewMatches(&mappable, "mappable_fastrange");
+}
+
+// Hasher counts calls, which isn't safe from several threads.
+struct ThreadSafeIntHasher {
+  size_t operator()(int i) const {
+    return static_cast<size_t>(i) * 2654435761u;
+  }
+};
+
+// Grows *ht, which must be empty and set to resize on several threads,
+// far past the point where it resizes in parallel, deletes some of it,
+// and copies it.  serial gets the same treatment on one thread.
+template <class HT>
+void ExpectParallelResizeMatches(HT* ht, HT* serial) {
+  EXPECT_EQ(1, serial->resize_threads());
+  for (int i = 0; i < 200000; ++i) {
+    (*ht)[i * 7] = i;
+    (*serial)[i * 7] = i;
+  }
+  for (int i = 0; i < 200000; i += 3) {
+    ht->erase(i * 7);
+    serial->erase(i * 7);
+  }
+  EXPECT_EQ(serial->size(), ht->size());
+  EXPECT_TRUE(*serial == *ht);
+
+  HT copy(*ht);                        // copies with deleted buckets
+  EXPECT_EQ(ht->resize_threads(), copy.resize_threads());
+  EXPECT_TRUE(copy == *ht);
+  copy.resize(copy.size() * 4);        // grows by moving
+  EXPECT_TRUE(copy == *serial);
+  for (int i = 0; i < 200000; ++i) {
+    typename HT::const_iterator it = copy.find(i * 7);
+    if (i % 3 == 0) {
+      EXPECT_TRUE(it == copy.end());
+    } else {
+      EXPECT_TRUE(it != copy.end());
+      EXPECT_EQ(i, it->second);
+    }
+  }
+}
+
+TEST(HashtableTest, ParallelResize) {
+  dense_hash_map<int, int, ThreadSafeIntHasher> dm, dm_serial;
+  dm.set_empty_key(-1);
+  dm.set_deleted_key(-2);
+  dm.set_resize_threads(4);
+  dm_serial.set_empty_key(-1);
+  dm_serial.set_deleted_key(-2);
+  ExpectParallelResizeMatches(&dm, &dm_serial);
+
+  dm.set_resize_threads(0);            // means 1
+  EXPECT_EQ(1, dm.resize_threads());
+  dm.set_resize_threads(1000);         // at most 255
+  EXPECT_EQ(255, dm.resize_threads());
+
+  dense_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 GroupedBitmapCacheHashPolicy> dm_bitmap, dm_bitmap_serial;
+  dm_bitmap.set_resize_threads(3);
+  ExpectParallelResizeMatches(&dm_bitmap, &dm_bitmap_serial);
+
+  dense_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 WideGenerationCacheHashPolicy> dm_gen, dm_gen_serial;
+  dm_gen.set_empty_key(-1);
+  dm_gen.set_deleted_key(-2);
+  dm_gen.set_resize_threads(8);
+  dm_gen_serial.set_empty_key(-1);
+  dm_gen_serial.set_deleted_key(-2);
+  ExpectParallelResizeMatches(&dm_gen, &dm_gen_serial);
+
+  // Control bytes always resize on one thread.
+  dense_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 CtrlCacheHashPolicy> dm_ctrl, dm_ctrl_serial;
+  dm_ctrl.set_empty_key(-1);
+  dm_ctrl.set_deleted_key(-2);
+  dm_ctrl.set_resize_threads(4);
+  dm_ctrl_serial.set_empty_key(-1);
+  dm_ctrl_serial.set_deleted_key(-2);
+  ExpectParallelResizeMatches(&dm_ctrl, &dm_ctrl_serial);
+
+  sparse_hash_map<int, int, ThreadSafeIntHasher> sm, sm_serial;
+  sm.set_deleted_key(-2);
+  sm.set_resize_threads(4);
+  sm_serial.set_deleted_key(-2);
+  ExpectParallelResizeMatches(&sm, &sm_serial);
+
+  sparse_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                  libc_allocator_with_realloc<pair<const int, int> >,
+                  SparseCacheHashPolicy> sm_cached, sm_cached_serial;
+  sm_cached.set_deleted_key(-2);
+  sm_cached.set_resize_threads(5);
+  sm_cached_serial.set_deleted_key(-2);
+  ExpectParallelResizeMatches(&sm_cached, &sm_cached_serial);
+}
+
+#ifdef SPARSEHASH_CXX11
+TEST(HashtableTest, ConcurrentDenseHashMap) {
+  concurrent_dense_hash_map<int, int, ThreadSafeIntHasher> m;
+  m.set_empty_key(-1);
+  m.set_deleted_key(-2);
+  EXPECT_TRUE(m.empty());
+  EXPECT_TRUE(m.insert(pair<const int, int>(1, 10)));
+  EXPECT_FALSE(m.insert(pair<const int, int>(1, 11)));
+  int value = 0;
+  EXPECT_TRUE(m.find(1, &value));
+  EXPECT_EQ(10, value);
+  EXPECT_FALSE(m.insert_or_assign(1, 12));
+  EXPECT_TRUE(m.find(1, &value));
+  EXPECT_EQ(12, value);
+  EXPECT_TRUE(m.insert_or_assign(2, 20));
+  EXPECT_EQ(2u, m.size());
+  EXPECT_EQ(1u, m.erase(1));
+  EXPECT_EQ(0u, m.erase(1));
+  EXPECT_EQ(0u, m.count(1));
+  EXPECT_FALSE(m.find(1, &value));
+  EXPECT_EQ(1u, m.size());
+  m.clear();
+  EXPECT_TRUE(m.empty());
+  EXPECT_EQ(0u, m.count(2));
+  m.resize(1000);
+  EXPECT_LE(2000u, m.bucket_count());
+
+  // Readers race a writer who inserts, changes and erases enough to
+  // resize many times.  Every value a reader sees must be one the
+  // writer stored, and keys 0-99, which the writer never touches, must
+  // always be there.
+  for (int i = 0; i < 100; ++i)
+    m.insert(pair<const int, int>(i, i));
+  std::atomic<bool> done(false);
+  std::atomic<int> bad_reads(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; ++t) {
+    readers.push_back(std::thread([&m, &done, &bad_reads, t]() {
+      int v;
+      for (int round = 0; !done.load() || round < 100; ++round) {
+        for (int i = 0; i < 100; ++i) {
+          if (!m.find(i, &v) || v != i)
+            ++bad_reads;
+        }
+        const int key = 1000 + (round * 37 + t) % 30000;
+        if (m.find(key, &v) && v != key && v != -key)
+          ++bad_reads;
+      }
+    }));
+  }
+  for (int i = 1000; i < 31000; ++i) {
+    m.insert(pair<const int, int>(i, i));
+    if (i % 3 == 0)
+      m.insert_or_assign(i, -i);
+    if (i % 5 == 0)
+      m.erase(i);
+  }
+  done.store(true);
+  for (size_t t = 0; t < readers.size(); ++t)
+    readers[t].join();
+  EXPECT_EQ(0, bad_reads.load());
+  EXPECT_EQ(100u + 30000u - 6000u, m.size());
+  int v = 0;
+  EXPECT_TRUE(m.find(30999, &v));
+  EXPECT_EQ(-30999, v);
+  EXPECT_FALSE(m.find(30000, &v));
+}
+
+TEST(HashtableTest, ConcurrentDenseHashSet) {
+  concurrent_dense_hash_set<int, ThreadSafeIntHasher> s;
+  // There's no table until both keys are set.
+  EXPECT_EQ(0u, s.bucket_count());
+  EXPECT_TRUE(s.empty());
+  s.clear();
+  s.set_empty_key(-1);
+  EXPECT_EQ(0u, s.bucket_count());
+  s.set_deleted_key(-2);
+  EXPECT_LT(0u, s.bucket_count());
+  EXPECT_TRUE(s.empty());
+  EXPECT_TRUE(s.insert(1));
+  EXPECT_FALSE(s.insert(1));
+  EXPECT_TRUE(s.contains(1));
+  EXPECT_FALSE(s.contains(2));
+  EXPECT_EQ(1u, s.size());
+
+  // Several threads insert overlapping ranges, starting from the
+  // smallest table so that it resizes many times while they do.  Each
+  // key should be reported new exactly once.
+  concurrent_dense_hash_set<int, ThreadSafeIntHasher> big(1);
+  big.set_empty_key(-1);
+  big.set_deleted_key(-2);
+  static const int kThreads = 4;
+  static const int kKeys = 20000;
+  std::atomic<int> num_new(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.push_back(std::thread([&big, &num_new, t]() {
+      int inserted = 0;
+      for (int i = 0; i < kKeys; ++i) {
+        if (big.insert((i + t * kKeys / 2) % kKeys))
+          ++inserted;
+        EXPECT_TRUE(big.contains((i + t * kKeys / 2) % kKeys));
+      }
+      num_new += inserted;
+    }));
+  }
+  for (int t = 0; t < kThreads; ++t)
+    threads[t].join();
+  EXPECT_EQ(kKeys, num_new.load());
+  EXPECT_EQ(static_cast<size_t>(kKeys), big.size());
+  EXPECT_LE(static_cast<size_t>(kKeys), big.bucket_count());
+  for (int i = 0; i < kKeys; ++i)
+    EXPECT_TRUE(big.contains(i));
+  EXPECT_FALSE(big.contains(kKeys));
+  int seen = 0;
+  big.for_each([&seen](int) { ++seen; });
+  EXPECT_EQ(kKeys, seen);
+
+  big.clear();
+  EXPECT_TRUE(big.empty());
+  EXPECT_FALSE(big.contains(5));
+  EXPECT_TRUE(big.insert(5));
+}
+
+// Several threads fill *m, which must be set up and empty, at once;
+// then we check the bulk operations.
+template <class ShardedMap>
+void ExpectShardedMapWorks(ShardedMap* m) {
+  EXPECT_EQ(8, m->num_shards());
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; ++t) {
+    writers.push_back(std::thread([m, t]() {
+      for (int i = t; i < 20000; i += 4) {
+        m->insert(pair<const int, int>(i, i));
+        if (i % 10 == 0)
+          m->insert_or_assign(i, -i);
+        if (i % 7 == 0)
+          m->erase(i);
+      }
+    }));
+  }
+  for (size_t t = 0; t < writers.size(); ++t)
+    writers[t].join();
+  const size_t expected_size = 20000 - (20000 + 6) / 7;
+  EXPECT_EQ(expected_size, m->size());
+  int value = 0;
+  EXPECT_TRUE(m->find(30, &value));
+  EXPECT_EQ(-30, value);
+  EXPECT_EQ(0u, m->count(35));
+  EXPECT_FALSE(m->insert(pair<const int, int>(31, 0)));
+  EXPECT_TRUE(m->visit(31, [](pair<const int, int>& v) { v.second *= 2; }));
+  EXPECT_FALSE(m->visit(35, [](pair<const int, int>&) { }));
+  EXPECT_TRUE(m->find(31, &value));
+  EXPECT_EQ(62, value);
+
+  // Every key lives in the shard shard_of() says it does, and the
+  // shards all get some.
+  for (int i = 0; i < m->num_shards(); ++i) {
+    EXPECT_LT(0u, m->shard_map(i).size());
+    for (typename ShardedMap::map_type::const_iterator it =
+             m->shard_map(i).begin(); it != m->shard_map(i).end(); ++it)
+      EXPECT_EQ(i, m->shard_of(it->first));
+  }
+
+  std::atomic<long> sum(0);
+  std::atomic<size_t> seen(0);
+  m->for_each([&sum, &seen](pair<const int, int>& v) {
+    sum += v.first;
+    ++seen;
+  }, 3);
+  EXPECT_EQ(expected_size, seen.load());
+  long expected_sum = 0;
+  for (int i = 0; i < 20000; ++i)
+    if (i % 7 != 0) expected_sum += i;
+  EXPECT_EQ(expected_sum, sum.load());
+
+  std::vector<std::stringstream> streams(m->num_shards());
+  std::vector<std::stringstream*> fps;
+  for (int i = 0; i < m->num_shards(); ++i)
+    fps.push_back(&streams[i]);
+  EXPECT_TRUE(m->serialize(typename ShardedMap::map_type::NopointerSerializer(),
+                           &fps[0], 4));
+  m->clear();
+  EXPECT_TRUE(m->empty());
+  EXPECT_TRUE(m->unserialize(
+      typename ShardedMap::map_type::NopointerSerializer(), &fps[0], 2));
+  EXPECT_EQ(expected_size, m->size());
+  EXPECT_TRUE(m->find(30, &value));
+  EXPECT_EQ(-30, value);
+}
+
+TEST(HashtableTest, ShardedHashMap) {
+  sharded_dense_hash_map<int, int> dm(5);   // rounded up to 8
+  dm.set_empty_key(-1);
+  dm.set_deleted_key(-2);
+  ExpectShardedMapWorks(&dm);
+
+  sharded_sparse_hash_map<int, int> sm(8);
+  sm.set_deleted_key(-2);
+  ExpectShardedMapWorks(&sm);
+
+  sharded_dense_hash_map<int, int> one_shard(1, 100);
+  one_shard.set_empty_key(-1);
+  EXPECT_EQ(1, one_shard.num_shards());
+  EXPECT_TRUE(one_shard.insert(pair<const int, int>(1, 2)));
+  EXPECT_EQ(0, one_shard.shard_of(1));
+  EXPECT_EQ(1u, one_shard.size());
+}
+
+// Lookups are const, so threads may share a table that counts them,
+// and no count is lost.
+TEST(HashtableTest, StatisticsFromSeveralThreads) {
+  dense_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                 libc_allocator_with_realloc<pair<const int, int> >,
+                 StatisticsPolicy> ht;
+  ht.set_empty_key(-1);
+  for (int i = 0; i < 1000; ++i)
+    ht[i] = i;
+  ht.reset_statistics();
+  const dense_hash_map<int, int, ThreadSafeIntHasher, std::equal_to<int>,
+                       libc_allocator_with_realloc<pair<const int, int> >,
+                       StatisticsPolicy>& readers = ht;
+  static const int kThreads = 4;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.push_back(std::thread([&readers]() {
+      for (int i = 0; i < 2000; ++i)
+        readers.find(i);
+    }));
+  }
+  for (int t = 0; t < kThreads; ++t)
+    threads[t].join();
+  const hashtable_stats stats = ht.statistics();
+  EXPECT_EQ(static_cast<size_t>(kThreads * 2000), stats.lookups);
+  EXPECT_EQ(static_cast<size_t>(kThreads * 1000), stats.hits);
+  EXPECT_EQ(static_cast<size_t>(kThreads * 1000), stats.misses);
+}
+#endif  // SPARSEHASH_CXX11
+
 TEST(HashtableDeathTest, ResizeOverflow) {
   dense_hash_map<int, int> ht;
   EXPECT_DEATH(ht.resize(static_cast<size_t>(-1)),
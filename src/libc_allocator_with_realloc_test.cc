@@ -31,6 +31,8 @@
 
 #include <sparsehash/internal/sparseconfig.h>
 #include <config.h>
+#include <sparsehash/internal/aligned_allocator_with_realloc.h>
+#include <sparsehash/internal/huge_page_allocator_with_realloc.h>
 #include <sparsehash/internal/libc_allocator_with_realloc.h>
 #include <stdlib.h>
 #include <string>
@@ -44,6 +46,8 @@ using std::string;
 using std::basic_string;
 using std::char_traits;
 using std::vector;
+using GOOGLE_NAMESPACE::aligned_allocator_with_realloc;
+using GOOGLE_NAMESPACE::huge_page_allocator_with_realloc;
 using GOOGLE_NAMESPACE::libc_allocator_with_realloc;
 
 #define arraysize(a)  ( sizeof(a) / sizeof(*(a)) )
@@ -111,6 +115,113 @@ TEST(LibcAllocatorWithReallocTest, TestSTL) {
   }
 }
 
+static bool IsAligned(const void* p, size_t alignment) {
+  return reinterpret_cast<size_t>(p) % alignment == 0;
+}
+
+TEST(AlignedAllocatorWithReallocTest, Allocate) {
+  aligned_allocator_with_realloc<char> alloc;
+  aligned_allocator_with_realloc<int, 128> alloc128;
+
+  // Odd sizes, so malloc hands back pointers with all sorts of alignments.
+  vector<char*> arrays;
+  for (int i = 0; i < 64; ++i) {
+    arrays.push_back(alloc.allocate(i * 7 + 1));
+    EXPECT_TRUE(IsAligned(arrays.back(), 64));
+  }
+  for (int i = 0; i < 64; ++i) {
+    alloc.deallocate(arrays[i], i * 7 + 1);
+  }
+
+  int* p = alloc128.allocate(4096);
+  EXPECT_TRUE(IsAligned(p, 128));
+  for (int i = 0; i < 4096; ++i) {
+    p[i] = i;
+  }
+  // Grow and shrink a few times; realloc will move the data around.
+  const int sizes[] = { 8192, 100, 100000, 3000, 1 << 20 };
+  int num_valid = 4096;
+  for (size_t i = 0; i < arraysize(sizes); ++i) {
+    p = alloc128.reallocate(p, sizes[i]);
+    EXPECT_TRUE(IsAligned(p, 128));
+    if (sizes[i] < num_valid)
+      num_valid = sizes[i];
+    for (int j = 0; j < num_valid; ++j) {
+      EXPECT_EQ(j, p[j]);
+    }
+  }
+  alloc128.deallocate(p, 1 << 20);
+}
+
+TEST(AlignedAllocatorWithReallocTest, TestSTL) {
+  vector<int, aligned_allocator_with_realloc<int> > v;
+  for (int i = 0; i < 1000; ++i) {
+    v.push_back(i);
+    EXPECT_TRUE(IsAligned(&v[0], 64));
+  }
+  for (int i = 999; i >= 0; --i) {
+    EXPECT_EQ(i, v.back());
+    v.pop_back();
+  }
+}
+
+TEST(HugePageAllocatorWithReallocTest, Allocate) {
+  // With a 4K threshold, 1024 ints is the smallest array we map.
+  typedef huge_page_allocator_with_realloc<int, 4096> alloc_type;
+  alloc_type alloc;
+
+  int* small = alloc.allocate(100);
+  EXPECT_FALSE(alloc_type::is_mapped(small));
+  for (int i = 0; i < 100; ++i) {
+    small[i] = i;
+  }
+  small = alloc.reallocate(small, 200);
+  EXPECT_FALSE(alloc_type::is_mapped(small));
+  EXPECT_EQ(99, small[99]);
+
+  // Growing past the threshold moves it into a mapping, and growing
+  // further remaps it.  Shrinking keeps the mapping.
+  int* p = alloc.reallocate(small, 4096);
+  EXPECT_TRUE(alloc_type::is_mapped(p));
+  EXPECT_TRUE(IsAligned(p, 64));
+  for (int i = 0; i < 4096; ++i) {
+    p[i] = i;
+  }
+  const int sizes[] = { 8192, 1 << 20, 2000, 1 << 22, 5000, 3 << 20 };
+  int num_valid = 4096;
+  for (size_t i = 0; i < arraysize(sizes); ++i) {
+    p = alloc.reallocate(p, sizes[i]);
+    EXPECT_TRUE(alloc_type::is_mapped(p));
+    if (sizes[i] < num_valid)
+      num_valid = sizes[i];
+    for (int j = 0; j < num_valid; ++j) {
+      EXPECT_EQ(j, p[j]);
+    }
+    for (int j = num_valid; j < sizes[i]; ++j) {   // touch the new pages
+      p[j] = j;
+    }
+    num_valid = sizes[i];
+  }
+  alloc.deallocate(p, 3 << 20);
+
+  int* big = alloc.allocate(1 << 20);
+  EXPECT_TRUE(alloc_type::is_mapped(big));
+  big[0] = 1;
+  big[(1 << 20) - 1] = 2;
+  alloc.deallocate(big, 1 << 20);
+}
+
+TEST(HugePageAllocatorWithReallocTest, TestSTL) {
+  vector<int, huge_page_allocator_with_realloc<int, 4096> > v;
+  for (int i = 0; i < 100000; ++i) {
+    v.push_back(i);
+  }
+  for (int i = 99999; i >= 0; --i) {
+    EXPECT_EQ(i, v.back());
+    v.pop_back();
+  }
+}
+
 }  // namespace
 
 int main(int, char **) {
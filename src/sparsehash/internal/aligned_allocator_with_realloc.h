@@ -0,0 +1,191 @@
+// Copyright (c) 2010, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// An allocator like libc_allocator_with_realloc, except that every
+// array it hands out starts on an Alignment-byte boundary (by default,
+// a 64-byte cache line).  dense_hashtable uses it to keep each of its
+// bucket groups inside one cache line; see use_bucket_groups in
+// densehashtable.h.
+//
+// We get the alignment by asking malloc for a little more than we
+// need and remembering, just before the array we return, where the
+// malloc'ed block really starts and how big the array is.  That's
+// what lets reallocate() use realloc(): if realloc moves the block to
+// a place with a different alignment, we slide the data over to the
+// next boundary.  As with libc_allocator_with_realloc, only use
+// reallocate() on types that may be moved with memcpy.
+
+#ifndef UTIL_GTL_ALIGNED_ALLOCATOR_WITH_REALLOC_H_
+#define UTIL_GTL_ALIGNED_ALLOCATOR_WITH_REALLOC_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <stdlib.h>           // for malloc/realloc/free
+#include <stddef.h>           // for ptrdiff_t
+#include <string.h>           // for memmove
+#include <new>                // for placement new
+#include <sparsehash/internal/libc_allocator_with_realloc.h>  // can_realloc
+
+_START_GOOGLE_NAMESPACE_
+
+template<class T, size_t Alignment = 64>
+class aligned_allocator_with_realloc {
+ public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+
+  static const size_t alignment = Alignment;
+
+  aligned_allocator_with_realloc() {}
+  aligned_allocator_with_realloc(const aligned_allocator_with_realloc&) {}
+  ~aligned_allocator_with_realloc() {}
+
+  pointer address(reference r) const  { return &r; }
+  const_pointer address(const_reference r) const  { return &r; }
+
+  pointer allocate(size_type n, const_pointer = 0) {
+    const size_t bytes = n * sizeof(value_type);
+    char* raw = static_cast<char*>(malloc(raw_size(bytes)));
+    if (raw == NULL)
+      return NULL;
+    char* aligned = align(raw);
+    set_header(aligned, raw, bytes);
+    return reinterpret_cast<pointer>(aligned);
+  }
+  void deallocate(pointer p, size_type) {
+    if (p)
+      free(reinterpret_cast<char*>(p) - get_header(p)->offset);
+  }
+  pointer reallocate(pointer p, size_type n) {
+    // p points to a storage array whose objects may be moved with memcpy
+    if (p == NULL)
+      return allocate(n);
+    const size_t old_offset = get_header(p)->offset;
+    const size_t old_bytes = get_header(p)->bytes;
+    const size_t bytes = n * sizeof(value_type);
+    char* raw = static_cast<char*>(realloc(reinterpret_cast<char*>(p) -
+                                           old_offset, raw_size(bytes)));
+    if (raw == NULL)
+      return NULL;
+    char* aligned = align(raw);
+    if (static_cast<size_t>(aligned - raw) != old_offset) {
+      memmove(aligned, raw + old_offset,
+              bytes < old_bytes ? bytes : old_bytes);
+    }
+    set_header(aligned, raw, bytes);
+    return reinterpret_cast<pointer>(aligned);
+  }
+
+  size_type max_size() const  {
+    return (static_cast<size_type>(-1) - raw_size(0)) / sizeof(value_type);
+  }
+
+  void construct(pointer p, const value_type& val) {
+    new(p) value_type(val);
+  }
+  void destroy(pointer p) { p->~value_type(); }
+
+  template <class U>
+  aligned_allocator_with_realloc(
+      const aligned_allocator_with_realloc<U, Alignment>&) {}
+
+  template<class U>
+  struct rebind {
+    typedef aligned_allocator_with_realloc<U, Alignment> other;
+  };
+
+ private:
+  // Stored just before the array we return.
+  struct header {
+    size_t offset;            // how far past what malloc gave us
+    size_t bytes;             // how much of the array is in use
+  };
+
+  static size_t raw_size(size_t bytes) {
+    return bytes + sizeof(header) + Alignment - 1;
+  }
+  static char* align(char* raw) {
+    const size_t addr = reinterpret_cast<size_t>(raw + sizeof(header));
+    return raw + sizeof(header) +
+        ((Alignment - addr % Alignment) % Alignment);
+  }
+  static header* get_header(pointer p) {
+    return reinterpret_cast<header*>(reinterpret_cast<char*>(p)) - 1;
+  }
+  static void set_header(char* aligned, char* raw, size_t bytes) {
+    header* h = reinterpret_cast<header*>(aligned) - 1;
+    h->offset = aligned - raw;
+    h->bytes = bytes;
+  }
+};
+
+// aligned_allocator_with_realloc<void> specialization.
+template<size_t Alignment>
+class aligned_allocator_with_realloc<void, Alignment> {
+ public:
+  typedef void value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef void* pointer;
+  typedef const void* const_pointer;
+
+  template<class U>
+  struct rebind {
+    typedef aligned_allocator_with_realloc<U, Alignment> other;
+  };
+};
+
+template<class T, size_t Alignment>
+inline bool operator==(const aligned_allocator_with_realloc<T, Alignment>&,
+                       const aligned_allocator_with_realloc<T, Alignment>&) {
+  return true;
+}
+
+template<class T, size_t Alignment>
+inline bool operator!=(const aligned_allocator_with_realloc<T, Alignment>&,
+                       const aligned_allocator_with_realloc<T, Alignment>&) {
+  return false;
+}
+
+namespace sparsehash_internal {
+template <class T, size_t Alignment>
+struct can_realloc<aligned_allocator_with_realloc<T, Alignment> >
+    : true_type { };
+}  // namespace sparsehash_internal
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // UTIL_GTL_ALIGNED_ALLOCATOR_WITH_REALLOC_H_
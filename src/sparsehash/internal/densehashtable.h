@@ -48,6 +48,12 @@
 // (which suffers, alas, from clumping) and quadratic probing, which
 // is what we implement by default.
 //
+// Resizing (and purging deleted elements) normally copies everything
+// into a new table, so for a moment we hold both.  If the allocator
+// can realloc (like libc_allocator_with_realloc, the default) and
+// value_type has a trivial copy constructor and destructor, we instead
+// realloc the one table and move the elements around inside it.
+//
 // Type requirements: value_type is required to be Copy Constructible
 // and Default Constructible. It is not required to be (and commonly
 // isn't) Assignable.
@@ -71,7 +77,7 @@
 // For enlarge_factor, you can use this chart to try to trade-off
 // expected lookup time to the space taken up.  By default, this
 // code uses quadratic probing, though you can change it to linear
-// via JUMP_ below if you really want to.
+// with the probing knob of dense_hashtable_policy.
 //
 // From http://www.augustana.ca/~mohrj/courses/1999.fall/csc210/lecture_notes/hashing.html
 // NUMBER OF PROBES / LOOKUP       Successful            Unsuccessful
@@ -92,16 +98,27 @@
 #include <sparsehash/internal/sparseconfig.h>
 #include <assert.h>
 #include <stdio.h>              // for FILE, fwrite, fread
+#include <string.h>             // for memset
 #include <algorithm>            // For swap(), eg
 #include <iterator>             // For iterator tags
 #include <limits>               // for numeric_limits
 #include <memory>               // For uninitialized_fill
 #include <utility>              // for pair
+#include <vector>               // for vector<bool>, used by rehash_in_place
 #include <sparsehash/internal/hashtable-common.h>
 #include <sparsehash/internal/libc_allocator_with_realloc.h>
+#ifdef SPARSEHASH_CXX11
+#include <type_traits>          // for is_nothrow_copy_constructible
+#endif
 #include <sparsehash/type_traits.h>
 #include <stdexcept>                 // For length_error
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SPARSEHASH_CTRL_USE_SSE2 1
+# include <emmintrin.h>         // for the control-byte group matcher
+#endif
+
 _START_GOOGLE_NAMESPACE_
 
 namespace base {   // just to make google->opensource transition easier
@@ -112,11 +129,123 @@ using GOOGLE_NAMESPACE::is_same;
 using GOOGLE_NAMESPACE::remove_const;
 }
 
-// The probing method
-// Linear probing
-// #define JUMP_(key, num_probes)    ( 1 )
-// Quadratic probing
-#define JUMP_(key, num_probes)    ( num_probes )
+// hashtable-common.h #undefs this when it's done with it.
+#define SPARSEHASH_COMPILE_ASSERT(expr, msg) \
+  __attribute__((unused)) typedef SparsehashCompileAssert<(bool(expr))> msg[bool(expr) ? 1 : -1]
+
+namespace sparsehash_internal {
+
+// Support for dense_hashtable's control-byte mode (see
+// dense_hashtable_policy::use_control_bytes, below).  Every bucket has
+// a one-byte tag: kCtrlEmpty, kCtrlDeleted, or, for a full bucket, 7
+// bits of the key's hash.  Only the two special tags have the high bit
+// set.  A ctrl_group looks at kCtrlGroupWidth consecutive tags at once
+// and answers questions with a bitmask: bit i is set if tag i matches.
+static const unsigned char kCtrlEmpty = 0x80;
+static const unsigned char kCtrlDeleted = 0xfe;
+static const int kCtrlGroupWidth = 16;
+
+class ctrl_group {
+ public:
+  explicit ctrl_group(const unsigned char* tags) {
+#ifdef SPARSEHASH_CTRL_USE_SSE2
+    tags_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+#else
+    memcpy(tags_, tags, sizeof(tags_));
+#endif
+  }
+
+  unsigned int match(unsigned char tag) const {
+#ifdef SPARSEHASH_CTRL_USE_SSE2
+    const __m128i pattern = _mm_set1_epi8(static_cast<char>(tag));
+    return static_cast<unsigned int>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(tags_, pattern)));
+#else
+    unsigned int retval = 0;
+    for (int i = 0; i < kCtrlGroupWidth; ++i) {
+      if (tags_[i] == tag)
+        retval |= 1u << i;
+    }
+    return retval;
+#endif
+  }
+
+  unsigned int match_empty() const {
+    return match(kCtrlEmpty);
+  }
+
+  unsigned int match_empty_or_deleted() const {
+#ifdef SPARSEHASH_CTRL_USE_SSE2
+    return static_cast<unsigned int>(_mm_movemask_epi8(tags_));
+#else
+    unsigned int retval = 0;
+    for (int i = 0; i < kCtrlGroupWidth; ++i) {
+      if (tags_[i] & 0x80)
+        retval |= 1u << i;
+    }
+    return retval;
+#endif
+  }
+
+  // Index of the lowest set bit of a non-zero mask returned above.
+  static int lowest_bit(unsigned int mask) {
+    assert(mask != 0);
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int retval = 0;
+    while ( !(mask & 1) ) {
+      mask >>= 1;
+      ++retval;
+    }
+    return retval;
+#endif
+  }
+
+ private:
+#ifdef SPARSEHASH_CTRL_USE_SSE2
+  __m128i tags_;
+#else
+  unsigned char tags_[kCtrlGroupWidth];
+#endif
+};
+
+// The tag we store for a full bucket.  We fold the whole hash down to
+// 7 bits, rather than just taking the low bits, since the low bits
+// are also what picks the bucket and so tell us very little about
+// keys that probe the same group.
+template <typename SizeType>
+inline unsigned char ctrl_tag(SizeType hash) {
+  size_t h = hash;
+  h ^= h >> (sizeof(h) * 4);
+  h ^= h >> (sizeof(h) * 2);
+  h ^= h >> 7;
+  return static_cast<unsigned char>(h & 0x7f);
+}
+
+// Index of the lowest set bit of a non-zero word.  dense_hashtable's
+// occupancy bitmap (see dense_hashtable_policy::use_occupancy_bitmap,
+// below) uses this to skip over a whole word of empty buckets at once.
+template <typename Word>
+inline int lowest_set_bit(Word word) {
+  assert(word != 0);
+#if defined(__GNUC__)
+  if (sizeof(word) > sizeof(unsigned long))
+    return __builtin_ctzll(word);
+  if (sizeof(word) > sizeof(unsigned int))
+    return __builtin_ctzl(word);
+  return __builtin_ctz(word);
+#else
+  int retval = 0;
+  while ( !(word & 1) ) {
+    word >>= 1;
+    ++retval;
+  }
+  return retval;
+#endif
+}
+
+}  // namespace sparsehash_internal
 
 // Hashtable class, used to implement the hashed associative containers
 // hash_set and hash_map.
@@ -134,26 +263,81 @@ using GOOGLE_NAMESPACE::remove_const;
 // EqualKey: Given two Keys, says whether they are the same (that is,
 //           if they are both associated with the same Value).
 // Alloc: STL allocator to use to allocate memory.
+// Policy: compile-time tuning knobs; see dense_hashtable_policy below.
+
+// These are the knobs you can turn on a dense_hashtable at compile
+// time; the defaults give the classic layout described at the top of
+// this file.  To change one, derive from this struct, redefine just
+// that member, and pass your struct as the Policy template argument
+// of dense_hash_map or dense_hash_set.  doc/implementation.html
+// discusses each knob at length.
+//
+// use_control_bytes: a one-byte tag per bucket, matched 16 at a time,
+//    so key_equal is only called on a tag match.
+// bucket_group_bytes: if non-zero (a power of two), probe a group of
+//    buckets this many bytes big before moving on to the next group.
+// probing: how far each probe jumps; quadratic_probing,
+//    linear_probing or your own (see hashtable-common.h).
+// use_robin_hood: linear probing that keeps entries ordered by their
+//    displacement; erase() shifts entries back, invalidating iterators.
+// cache_hash: keep each occupied bucket's full hash beside it.
+// hash_mixing: what to do to the hash before picking a bucket (see
+//    hashtable-common.h).  The default mixes integer and pointer keys.
+// incremental_resize_buckets: if non-zero, grow gradually, moving the
+//    entries of this many old buckets per insert.
+// use_occupancy_bitmap: track empty and deleted buckets in a bitmap,
+//    so no empty or deleted key is needed.
+// use_generations: stamp buckets with generation_type, making
+//    clear_no_resize() O(1).  value_type must be trivially destructible.
+// split_values: dense_hash_map only; keep the values apart from the
+//    buckets (see internal/splitdensehashtable.h).
+// inline_buckets: if non-zero (at most 32), keep that many elements in
+//    the object itself (see internal/smalldensehashtable.h).
+// fastrange_buckets: allow any bucket count; needs linear_probing.
+// statistics: no_statistics or hashtable_statistics (see
+//    hashtable-common.h).
+struct dense_hashtable_policy {
+  enum { use_control_bytes = false };
+  enum { bucket_group_bytes = 0 };
+  typedef quadratic_probing probing;
+  enum { use_robin_hood = false };
+  typedef unsigned short robin_hood_displacement_type;
+  enum { cache_hash = false };
+  typedef default_hash_mixing hash_mixing;
+  enum { incremental_resize_buckets = 0 };
+  enum { use_occupancy_bitmap = false };
+  enum { use_generations = false };
+  typedef unsigned char generation_type;
+  enum { split_values = false };
+  enum { inline_buckets = 0 };
+  enum { fastrange_buckets = false };
+  typedef no_statistics statistics;
+};
 
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy = dense_hashtable_policy>
 class dense_hashtable;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct dense_hashtable_iterator;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct dense_hashtable_const_iterator;
 
 // We're just an array, but we need to skip over empty and deleted elements
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct dense_hashtable_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol> iterator;
+  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
 
   typedef std::forward_iterator_tag iterator_category;  // very little defined!
   typedef V value_type;
@@ -163,12 +347,13 @@ struct dense_hashtable_iterator {
   typedef typename value_alloc_type::pointer pointer;
 
   // "Real" constructor and default constructor
-  dense_hashtable_iterator(const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
-                           pointer it, pointer it_end, bool advance)
+  dense_hashtable_iterator(
+      const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      pointer it, pointer it_end, bool advance)
     : ht(h), pos(it), end(it_end)   {
     if (advance)  advance_past_empty_and_deleted();
   }
-  dense_hashtable_iterator() { }
+  dense_hashtable_iterator() : ht(NULL), pos(pointer()), end(pointer()) { }
   // The default destructor is fine; we don't define one
   // The default operator= is fine; we don't define one
 
@@ -179,8 +364,13 @@ struct dense_hashtable_iterator {
   // Arithmetic.  The only hard part is making sure that
   // we're not on an empty or marked-deleted array element
   void advance_past_empty_and_deleted() {
-    while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
-      ++pos;
+    if (Pol::use_occupancy_bitmap)
+      pos = ht->next_full_bucket(pos, end);
+    else
+      while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
+        ++pos;
+    if ( pos == end )                // maybe there are more buckets to see
+      ht->advance_to_next_buckets(this);
   }
   iterator& operator++()   {
     assert(pos != end); ++pos; advance_past_empty_and_deleted(); return *this;
@@ -193,20 +383,22 @@ struct dense_hashtable_iterator {
 
 
   // The actual data
-  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
   pointer pos, end;
 };
 
 
 // Now do it all again, but with const-ness!
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct dense_hashtable_const_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol> iterator;
+  typedef dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
 
   typedef std::forward_iterator_tag iterator_category;  // very little defined!
   typedef V value_type;
@@ -217,7 +409,7 @@ struct dense_hashtable_const_iterator {
 
   // "Real" constructor and default constructor
   dense_hashtable_const_iterator(
-      const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
+      const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
       pointer it, pointer it_end, bool advance)
     : ht(h), pos(it), end(it_end)   {
     if (advance)  advance_past_empty_and_deleted();
@@ -237,8 +429,13 @@ struct dense_hashtable_const_iterator {
   // Arithmetic.  The only hard part is making sure that
   // we're not on an empty or marked-deleted array element
   void advance_past_empty_and_deleted() {
-    while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
-      ++pos;
+    if (Pol::use_occupancy_bitmap)
+      pos = ht->next_full_bucket(pos, end);
+    else
+      while ( pos != end && (ht->test_empty(*this) || ht->test_deleted(*this)) )
+        ++pos;
+    if ( pos == end )                // maybe there are more buckets to see
+      ht->advance_to_next_buckets(this);
   }
   const_iterator& operator++()   {
     assert(pos != end); ++pos; advance_past_empty_and_deleted(); return *this;
@@ -251,15 +448,193 @@ struct dense_hashtable_const_iterator {
 
 
   // The actual data
-  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
   pointer pos, end;
 };
 
+namespace sparsehash_internal {
+struct ctrl_member_tag;
+struct probe_len_member_tag;
+struct hashes_member_tag;
+struct occupancy_member_tag;
+struct generations_member_tag;
+struct current_generation_member_tag;
+struct old_ht_member_tag;
+struct new_ht_member_tag;
+struct moved_through_member_tag;
+
+// What a dense_hashtable keeps only for the policy knobs that need it:
+// each piece is a policy_member, empty while its knob is off, so with
+// the default policy the table is no bigger than it ever was.  Table
+// is the dense_hashtable itself.
+template <class Table, class SizeType, class Policy>
+class dense_hashtable_optional_state
+    : private policy_member<ctrl_member_tag, unsigned char*,
+                            Policy::use_control_bytes>,
+      private policy_member<probe_len_member_tag,
+                            typename Policy::robin_hood_displacement_type*,
+                            Policy::use_robin_hood>,
+      private policy_member<hashes_member_tag, SizeType*, Policy::cache_hash>,
+      private policy_member<occupancy_member_tag, SizeType*,
+                            Policy::use_occupancy_bitmap>,
+      private policy_member<generations_member_tag,
+                            typename Policy::generation_type*,
+                            Policy::use_generations>,
+      private policy_member<current_generation_member_tag,
+                            typename Policy::generation_type,
+                            Policy::use_generations>,
+      private policy_member<old_ht_member_tag, Table*,
+                            (Policy::incremental_resize_buckets > 0)>,
+      private policy_member<new_ht_member_tag, Table*,
+                            (Policy::incremental_resize_buckets > 0)>,
+      private policy_member<moved_through_member_tag, SizeType,
+                            (Policy::incremental_resize_buckets > 0)> {
+ private:
+  typedef typename Policy::robin_hood_displacement_type displacement_type;
+  typedef typename Policy::generation_type generation_type;
+  enum { resizes_incrementally = Policy::incremental_resize_buckets > 0 };
+  typedef policy_member<ctrl_member_tag, unsigned char*,
+                        Policy::use_control_bytes> ctrl_member;
+  typedef policy_member<probe_len_member_tag, displacement_type*,
+                        Policy::use_robin_hood> probe_len_member;
+  typedef policy_member<hashes_member_tag, SizeType*,
+                        Policy::cache_hash> hashes_member;
+  typedef policy_member<occupancy_member_tag, SizeType*,
+                        Policy::use_occupancy_bitmap> occupancy_member;
+  typedef policy_member<generations_member_tag, generation_type*,
+                        Policy::use_generations> generations_member;
+  typedef policy_member<current_generation_member_tag, generation_type,
+                        Policy::use_generations> current_generation_member;
+  typedef policy_member<old_ht_member_tag, Table*,
+                        resizes_incrementally> old_ht_member;
+  typedef policy_member<new_ht_member_tag, Table*,
+                        resizes_incrementally> new_ht_member;
+  typedef policy_member<moved_through_member_tag, SizeType,
+                        resizes_incrementally> moved_through_member;
+
+ protected:
+  // Everything starts out NULL, or 0, except current_generation.
+  dense_hashtable_optional_state()
+      : current_generation_member(1) { }
+
+  // One tag per bucket, if Policy::use_control_bytes.
+  unsigned char* ctrl() const { return ctrl_member::get(); }
+  void set_ctrl_bytes(unsigned char* p) { ctrl_member::set(p); }
+  // 1 + displacement of each bucket, if Policy::use_robin_hood.
+  displacement_type* probe_len() const { return probe_len_member::get(); }
+  void set_probe_len(displacement_type* p) { probe_len_member::set(p); }
+  // The hash of each full bucket, if Policy::cache_hash.
+  SizeType* hashes() const { return hashes_member::get(); }
+  void set_hashes(SizeType* p) { hashes_member::set(p); }
+  // Full and deleted bits, if Policy::use_occupancy_bitmap.
+  SizeType* occupancy() const { return occupancy_member::get(); }
+  void set_occupancy(SizeType* p) { occupancy_member::set(p); }
+  // The generation of each bucket, if Policy::use_generations; buckets
+  // from any but current_generation are empty.
+  generation_type* generations() const { return generations_member::get(); }
+  void set_generations(generation_type* p) { generations_member::set(p); }
+  generation_type current_generation() const {
+    return current_generation_member::get();
+  }
+  void set_current_generation(generation_type g) {
+    current_generation_member::set(g);
+  }
+  // See INCREMENTAL RESIZING, in dense_hashtable.  If we're growing,
+  // old_ht has the buckets left to move; if we're an old_ht, new_ht is
+  // the table we're moving to.  old_ht's buckets before moved_through
+  // have been moved.
+  Table* old_ht() const { return old_ht_member::get(); }
+  void set_old_ht(Table* p) { old_ht_member::set(p); }
+  Table* new_ht() const { return new_ht_member::get(); }
+  void set_new_ht(Table* p) { new_ht_member::set(p); }
+  SizeType moved_through() const { return moved_through_member::get(); }
+  void set_moved_through(SizeType n) { moved_through_member::set(n); }
+
+  // All but new_ht, which points back at its own table.
+  void swap_optional_state(dense_hashtable_optional_state& other) {
+    dense_hashtable_optional_state tmp(*this);
+    set_ctrl_bytes(other.ctrl());
+    set_probe_len(other.probe_len());
+    set_hashes(other.hashes());
+    set_occupancy(other.occupancy());
+    set_generations(other.generations());
+    set_current_generation(other.current_generation());
+    set_old_ht(other.old_ht());
+    set_moved_through(other.moved_through());
+    other.set_ctrl_bytes(tmp.ctrl());
+    other.set_probe_len(tmp.probe_len());
+    other.set_hashes(tmp.hashes());
+    other.set_occupancy(tmp.occupancy());
+    other.set_generations(tmp.generations());
+    other.set_current_generation(tmp.current_generation());
+    other.set_old_ht(tmp.old_ht());
+    other.set_moved_through(tmp.moved_through());
+  }
+};
+}  // namespace sparsehash_internal
+
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
-class dense_hashtable {
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy>
+class dense_hashtable
+    : private sparsehash_internal::dense_hashtable_optional_state<
+          dense_hashtable<Value, Key, HashFcn, ExtractKey, SetKey, EqualKey,
+                          Alloc, Policy>,
+          typename Alloc::template rebind<Value>::other::size_type,
+          Policy> {
  private:
   typedef typename Alloc::template rebind<Value>::other value_alloc_type;
+  typedef typename Policy::robin_hood_displacement_type displacement_type;
+  typedef typename Policy::generation_type generation_type;
+  typedef sparsehash_internal::dense_hashtable_optional_state<
+      dense_hashtable, typename value_alloc_type::size_type, Policy>
+      optional_state;
+  using optional_state::ctrl;
+  using optional_state::set_ctrl_bytes;
+  using optional_state::probe_len;
+  using optional_state::set_probe_len;
+  using optional_state::hashes;
+  using optional_state::set_hashes;
+  using optional_state::occupancy;
+  using optional_state::set_occupancy;
+  using optional_state::generations;
+  using optional_state::set_generations;
+  using optional_state::current_generation;
+  using optional_state::set_current_generation;
+  using optional_state::old_ht;
+  using optional_state::set_old_ht;
+  using optional_state::new_ht;
+  using optional_state::set_new_ht;
+  using optional_state::moved_through;
+  using optional_state::set_moved_through;
+  using optional_state::swap_optional_state;
+
+  SPARSEHASH_COMPILE_ASSERT(!Policy::use_robin_hood ||
+                            (!Policy::use_control_bytes &&
+                             Policy::bucket_group_bytes == 0),
+                            use_robin_hood_excludes_other_probing_knobs);
+  SPARSEHASH_COMPILE_ASSERT(!Policy::use_occupancy_bitmap ||
+                            (!Policy::use_control_bytes &&
+                             !Policy::use_robin_hood),
+                            use_occupancy_bitmap_excludes_ctrl_and_rh);
+  SPARSEHASH_COMPILE_ASSERT(!Policy::use_generations ||
+                            (!Policy::use_control_bytes &&
+                             !Policy::use_robin_hood &&
+                             !Policy::use_occupancy_bitmap),
+                            use_generations_excludes_other_bucket_state);
+  SPARSEHASH_COMPILE_ASSERT(!Policy::use_generations ||
+                            has_trivial_destructor<Value>::value,
+                            use_generations_needs_trivial_destructor);
+  SPARSEHASH_COMPILE_ASSERT(!Policy::fastrange_buckets ||
+                            (!Policy::use_control_bytes &&
+                             !Policy::use_robin_hood &&
+                             Policy::bucket_group_bytes == 0 &&
+                             !Policy::use_occupancy_bitmap),
+                            fastrange_buckets_excludes_power_of_two_knobs);
+  SPARSEHASH_COMPILE_ASSERT(!Policy::fastrange_buckets ||
+                            (base::is_same<typename Policy::probing,
+                                           linear_probing>::value),
+                            fastrange_buckets_needs_linear_probing);
 
  public:
   typedef Key key_type;
@@ -275,11 +650,13 @@ class dense_hashtable {
   typedef typename value_alloc_type::pointer pointer;
   typedef typename value_alloc_type::const_pointer const_pointer;
   typedef dense_hashtable_iterator<Value, Key, HashFcn,
-                                   ExtractKey, SetKey, EqualKey, Alloc>
+                                   ExtractKey, SetKey, EqualKey, Alloc,
+                                   Policy>
   iterator;
 
   typedef dense_hashtable_const_iterator<Value, Key, HashFcn,
-                                         ExtractKey, SetKey, EqualKey, Alloc>
+                                         ExtractKey, SetKey, EqualKey, Alloc,
+                                         Policy>
   const_iterator;
 
   // These come from tr1.  For us they're the same as regular iterators.
@@ -308,14 +685,19 @@ class dense_hashtable {
   static const size_type HT_DEFAULT_STARTING_BUCKETS = 32;
 
   // ITERATOR FUNCTIONS
-  iterator begin()             { return iterator(this, table,
-                                                 table + num_buckets, true); }
+  // While we're growing incrementally, we start in the old buckets.
+  iterator begin() {
+    const dense_hashtable* ht = old_ht() ? old_ht() : this;
+    return iterator(ht, ht->table, ht->table + ht->num_buckets, true);
+  }
   iterator end()               { return iterator(this, table + num_buckets,
-                                                 table + num_buckets, true); }
-  const_iterator begin() const { return const_iterator(this, table,
-                                                       table+num_buckets,true);}
+                                                 table + num_buckets, false); }
+  const_iterator begin() const {
+    const dense_hashtable* ht = old_ht() ? old_ht() : this;
+    return const_iterator(ht, ht->table, ht->table + ht->num_buckets, true);
+  }
   const_iterator end() const   { return const_iterator(this, table + num_buckets,
-                                                       table+num_buckets,true);}
+                                                       table+num_buckets,false);}
 
   // These come from tr1 unordered_map.  They iterate over 'bucket' n.
   // We'll just consider bucket n to be the n-th element of the table.
@@ -347,6 +729,9 @@ class dense_hashtable {
 
   // Accessor function for statistics gathering.
   int num_table_copies() const { return settings.num_ht_copies(); }
+  // The counts Policy::statistics has kept; all zero with no_statistics.
+  hashtable_stats statistics() const { return settings.stats_snapshot(); }
+  void reset_statistics()            { settings.reset_stats(); }
 
  private:
   // Annoyingly, we can't copy values around, because they might have
@@ -357,12 +742,219 @@ class dense_hashtable {
     dst->~value_type();   // delete the old value, if any
     new(dst) value_type(src);
   }
+#ifdef SPARSEHASH_CXX11
+  void set_value(pointer dst, value_type&& src) {
+    dst->~value_type();
+    new(dst) value_type(std::move(src));
+  }
+#endif
+
+  // Like set_value, but for when we're done with src: it's moved from,
+  // if we can.  (The key part of a map's pair<const Key, T> is still
+  // copied, since it's const.)
+  void move_value(pointer dst, reference src) {
+#ifdef SPARSEHASH_CXX11
+    set_value(dst, std::move(src));
+#else
+    set_value(dst, src);
+#endif
+  }
 
   void destroy_buckets(size_type first, size_type last) {
     for ( ; first != last; ++first)
       table[first].~value_type();
   }
 
+  // SIDE-ARRAY HELPER FUNCTIONS
+  // Some policies keep per-bucket state in an array next to table:
+  // ctrl for use_control_bytes, probe_len for use_robin_hood, hashes
+  // for cache_hash, occupancy for use_occupancy_bitmap, generations
+  // for use_generations.  They are allocated with our allocator,
+  // rebound, and are resized and cleared along with table.
+  static bool use_side_arrays() {
+    return (Policy::use_control_bytes || Policy::use_robin_hood ||
+            Policy::cache_hash || Policy::use_occupancy_bitmap ||
+            Policy::use_generations);
+  }
+
+  template <class T> T* allocate_side_array(size_type n) {
+    typename Alloc::template rebind<T>::other alloc(
+        static_cast<const value_alloc_type&>(val_info));
+    T* retval = alloc.allocate(n);
+    assert(retval);
+    return retval;
+  }
+
+  template <class T> void deallocate_side_array(T* array, size_type n) {
+    if (array) {
+      typename Alloc::template rebind<T>::other alloc(
+          static_cast<const value_alloc_type&>(val_info));
+      alloc.deallocate(array, n);
+    }
+  }
+
+  void allocate_side_arrays(size_type n) {
+    if (Policy::use_control_bytes)
+      set_ctrl_bytes(allocate_side_array<unsigned char>(ctrl_size(n)));
+    if (Policy::use_robin_hood)
+      set_probe_len(allocate_side_array<displacement_type>(n));
+    if (Policy::cache_hash)
+      set_hashes(allocate_side_array<size_type>(n));
+    if (Policy::use_occupancy_bitmap)
+      set_occupancy(allocate_side_array<size_type>(occupancy_size(n)));
+    if (Policy::use_generations)
+      set_generations(allocate_side_array<generation_type>(n));
+  }
+
+  void deallocate_side_arrays(size_type n) {
+    deallocate_side_array(ctrl(), ctrl_size(n));
+    deallocate_side_array(probe_len(), n);
+    deallocate_side_array(hashes(), n);
+    deallocate_side_array(occupancy(), occupancy_size(n));
+    deallocate_side_array(generations(), n);
+    set_ctrl_bytes(NULL);
+    set_probe_len(NULL);
+    set_hashes(NULL);
+    set_occupancy(NULL);
+    set_generations(NULL);
+  }
+
+  // Marks all n buckets as empty.  (hashes only means anything for
+  // full buckets, so it needs no resetting.)
+  void reset_side_arrays(size_type n) {
+    if (Policy::use_control_bytes)
+      memset(ctrl(), sparsehash_internal::kCtrlEmpty, ctrl_size(n));
+    if (Policy::use_robin_hood)
+      memset(probe_len(), 0, n * sizeof(*probe_len()));
+    if (Policy::use_occupancy_bitmap)
+      memset(occupancy(), 0, occupancy_size(n) * sizeof(*occupancy()));
+    if (Policy::use_generations) {
+      memset(generations(), 0, n * sizeof(*generations()));
+      set_current_generation(1);
+    }
+  }
+
+  // GENERATION HELPER FUNCTIONS
+  // These are only used when Policy::use_generations is set.  A bucket
+  // is full or deleted only if generations[] for it is
+  // current_generation; otherwise it's empty.  Generation 0 is never
+  // current, so a bucket stamped 0 is always empty.
+  bool stale(size_type bucknum) const {
+    return generations()[bucknum] != current_generation();
+  }
+
+  // Makes every bucket stale, usually without touching any of them.
+  void next_generation() {
+    set_current_generation(current_generation() + 1);
+    if (current_generation() == 0)   // wrapped around: start again at 1
+      reset_side_arrays(num_buckets);
+  }
+
+  // CACHED-HASH HELPER FUNCTIONS
+  // Without Policy::cache_hash these do nothing, and every hash matches.
+  bool hash_matches(size_type bucknum, size_type hashval) const {
+    return !Policy::cache_hash || hashes()[bucknum] == hashval;
+  }
+  void set_hash(size_type bucknum, size_type hashval) {
+    if (Policy::cache_hash)
+      hashes()[bucknum] = hashval;
+  }
+  void move_hash(size_type dst, size_type src) {
+    if (Policy::cache_hash)
+      hashes()[dst] = hashes()[src];
+  }
+
+  // OCCUPANCY-BITMAP HELPER FUNCTIONS
+  // These are only used when Policy::use_occupancy_bitmap is set.
+  // occupancy holds two words for every OCCUPANCY_WORD_BITS buckets:
+  // in the first, bit i is set if the i-th of those buckets is full;
+  // in the second, if it's deleted.  A bucket with neither bit set is
+  // empty.  Keeping the two words together means testing a bucket
+  // touches one cache line.
+  static const size_type OCCUPANCY_WORD_BITS = sizeof(size_type) * 8;
+
+  static size_type occupancy_size(size_type n) {
+    return 2 * ((n + OCCUPANCY_WORD_BITS - 1) / OCCUPANCY_WORD_BITS);
+  }
+  size_type* full_word(size_type bucknum) const {
+    return occupancy() + 2 * (bucknum / OCCUPANCY_WORD_BITS);
+  }
+  static size_type bucket_bit(size_type bucknum) {
+    return size_type(1) << (bucknum % OCCUPANCY_WORD_BITS);
+  }
+  void set_full_bit(size_type bucknum) {
+    size_type* word = full_word(bucknum);
+    word[0] |= bucket_bit(bucknum);
+    word[1] &= ~bucket_bit(bucknum);
+  }
+  void set_deleted_bit(size_type bucknum) {
+    size_type* word = full_word(bucknum);
+    word[0] &= ~bucket_bit(bucknum);
+    word[1] |= bucket_bit(bucknum);
+  }
+
+ public:
+  // For the iterators: the first full bucket at or after pos, or end
+  // if there's none before it.  Only for use_occupancy_bitmap.
+  template <class Pointer>
+  Pointer next_full_bucket(Pointer pos, Pointer end) const {
+    const size_type first = pos - table;
+    const size_type last = end - table;
+    size_type bucknum = first;
+    while (bucknum < last) {
+      const size_type bits = (full_word(bucknum)[0] >>
+                              (bucknum % OCCUPANCY_WORD_BITS));
+      if (bits) {
+        bucknum += sparsehash_internal::lowest_set_bit(bits);
+        break;
+      }
+      bucknum = (bucknum / OCCUPANCY_WORD_BITS + 1) * OCCUPANCY_WORD_BITS;
+    }
+    return bucknum < last ? pos + (bucknum - first) : end;
+  }
+
+ private:
+  // CONTROL-BYTE HELPER FUNCTIONS
+  // These are only used when Policy::use_control_bytes is set.  ctrl
+  // holds one tag per bucket, plus kCtrlGroupWidth-1 extra tags at the
+  // end that mirror the first ones, so we can load a whole group
+  // starting at any bucket without worrying about wrapping around.
+  static size_type ctrl_size(size_type n) {
+    return n + sparsehash_internal::kCtrlGroupWidth - 1;
+  }
+
+  void set_ctrl(size_type bucknum, unsigned char tag) {
+    ctrl()[bucknum] = tag;
+    // Keep the mirror at the end up to date.  When the whole table is
+    // smaller than a group, a bucket may be mirrored more than once.
+    for (size_type i = bucknum + num_buckets; i < ctrl_size(num_buckets);
+         i += num_buckets) {
+      ctrl()[i] = tag;
+    }
+  }
+
+  // Where obj would go, found by walking the probe sequence for its
+  // hash until we hit a group with a free bucket in it.
+  size_type find_empty_ctrl(size_type hashval) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type bucknum = hashval & bucket_count_minus_one;
+    size_type num_probes = 0;
+    while ( 1 ) {
+      const unsigned int free_mask =
+          sparsehash_internal::ctrl_group(ctrl() + bucknum)
+          .match_empty_or_deleted();
+      if ( free_mask )
+        return (bucknum + sparsehash_internal::ctrl_group::lowest_bit(
+            free_mask)) & bucket_count_minus_one;
+      ++num_probes;
+      bucknum = (bucknum + sparsehash_internal::kCtrlGroupWidth *
+                           probe_jump(num_probes))
+                & bucket_count_minus_one;
+      assert(num_probes <= bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+  }
+
   // DELETE HELPER FUNCTIONS
   // This lets the user describe a key that will indicate deleted
   // table entries.  This key should be an "impossible" entry --
@@ -371,8 +963,12 @@ class dense_hashtable {
   // at.  This is just because I don't know how to assign just a key.)
  private:
   void squash_deleted() {           // gets rid of any deleted entries we have
-    if ( num_deleted ) {            // get rid of deleted before writing
-      dense_hashtable tmp(*this);   // copying will get rid of deleted
+    finish_resize();                // the old buckets are full of them
+    if ( num_deleted && can_rehash_in_place() ) {
+      rehash_in_place(settings.min_buckets(num_elements - num_deleted,
+                                           HT_DEFAULT_STARTING_BUCKETS));
+    } else if ( num_deleted ) {     // get rid of deleted before writing
+      dense_hashtable tmp(MoveDontCopy, *this);  // drops deleted
       swap(tmp);                    // now we are tmp
     }
     assert(num_deleted == 0);
@@ -388,6 +984,8 @@ class dense_hashtable {
 
  public:
   void set_deleted_key(const key_type &key) {
+    if (Policy::use_occupancy_bitmap)
+      return;                       // we don't need one
     // the empty indicator (if specified) and the deleted indicator
     // must be different
     assert((!settings.use_empty() || !equals(key, get_key(val_info.emptyval)))
@@ -398,6 +996,8 @@ class dense_hashtable {
     key_info.delkey = key;
   }
   void clear_deleted_key() {
+    if (Policy::use_occupancy_bitmap)
+      return;
     squash_deleted();
     settings.set_use_deleted(false);
   }
@@ -412,16 +1012,28 @@ class dense_hashtable {
   bool test_deleted(size_type bucknum) const {
     // Invariant: !use_deleted() implies num_deleted is 0.
     assert(settings.use_deleted() || num_deleted == 0);
+    if (Policy::use_control_bytes)
+      return ctrl()[bucknum] == sparsehash_internal::kCtrlDeleted;
+    if (Policy::use_robin_hood)
+      return false;                // we never leave deleted buckets
+    if (Policy::use_occupancy_bitmap)
+      return (full_word(bucknum)[1] & bucket_bit(bucknum)) != 0;
+    if (Policy::use_generations && stale(bucknum))
+      return false;                // whatever key is left in it
     return num_deleted > 0 && test_deleted_key(get_key(table[bucknum]));
   }
   bool test_deleted(const iterator &it) const {
     // Invariant: !use_deleted() implies num_deleted is 0.
     assert(settings.use_deleted() || num_deleted == 0);
+    if (use_side_arrays())
+      return test_deleted(static_cast<size_type>(it.pos - table));
     return num_deleted > 0 && test_deleted_key(get_key(*it));
   }
   bool test_deleted(const const_iterator &it) const {
     // Invariant: !use_deleted() implies num_deleted is 0.
     assert(settings.use_deleted() || num_deleted == 0);
+    if (use_side_arrays())
+      return test_deleted(static_cast<size_type>(it.pos - table));
     return num_deleted > 0 && test_deleted_key(get_key(*it));
   }
 
@@ -435,10 +1047,25 @@ class dense_hashtable {
   bool set_deleted(iterator &it) {
     check_use_deleted("set_deleted()");
     bool retval = !test_deleted(it);
+    if (Policy::use_occupancy_bitmap) {
+      erase_value(&(*it));
+      set_deleted_bit(it.pos - table);
+      return retval;
+    }
     // &* converts from iterator to value-type.
     set_key(&(*it), key_info.delkey);
+    if (Policy::use_control_bytes)
+      set_ctrl(it.pos - table, sparsehash_internal::kCtrlDeleted);
     return retval;
   }
+  // With the occupancy bitmap, nothing looks at what's in a deleted
+  // bucket, but we don't want it holding on to memory or other resources
+  // until something else takes its place.
+  void erase_value(pointer v) {
+    if (!has_trivial_destructor<value_type>::value)
+      set_value(v, val_info.emptyval);
+  }
+
   // Set it so test_deleted is false.  true if object used to be deleted.
   bool clear_deleted(iterator &it) {
     check_use_deleted("clear_deleted()");
@@ -454,7 +1081,14 @@ class dense_hashtable {
   bool set_deleted(const_iterator &it) {
     check_use_deleted("set_deleted()");
     bool retval = !test_deleted(it);
+    if (Policy::use_occupancy_bitmap) {
+      erase_value(const_cast<pointer>(&(*it)));
+      set_deleted_bit(it.pos - table);
+      return retval;
+    }
     set_key(const_cast<pointer>(&(*it)), key_info.delkey);
+    if (Policy::use_control_bytes)
+      set_ctrl(it.pos - table, sparsehash_internal::kCtrlDeleted);
     return retval;
   }
   // Set it so test_deleted is false.  true if object used to be deleted.
@@ -474,26 +1108,68 @@ class dense_hashtable {
   // True if the item at position bucknum is "empty" marker
   bool test_empty(size_type bucknum) const {
     assert(settings.use_empty());  // we always need to know what's empty!
+    if (Policy::use_control_bytes)
+      return ctrl()[bucknum] == sparsehash_internal::kCtrlEmpty;
+    if (Policy::use_robin_hood)
+      return probe_len()[bucknum] == 0;
+    if (Policy::use_occupancy_bitmap)
+      return ((full_word(bucknum)[0] | full_word(bucknum)[1]) &
+              bucket_bit(bucknum)) == 0;
+    if (Policy::use_generations)     // we never make a bucket empty again
+      return stale(bucknum);
     return equals(get_key(val_info.emptyval), get_key(table[bucknum]));
   }
   bool test_empty(const iterator &it) const {
     assert(settings.use_empty());  // we always need to know what's empty!
+    if (use_side_arrays())
+      return test_empty(static_cast<size_type>(it.pos - table));
     return equals(get_key(val_info.emptyval), get_key(*it));
   }
   bool test_empty(const const_iterator &it) const {
     assert(settings.use_empty());  // we always need to know what's empty!
+    if (use_side_arrays())
+      return test_empty(static_cast<size_type>(it.pos - table));
     return equals(get_key(val_info.emptyval), get_key(*it));
   }
 
+  // Also for the iterators.  If we're the old buckets of a table that's
+  // growing incrementally, iterating goes on from our end to its buckets.
+  template <class Iterator>
+  void advance_to_next_buckets(Iterator* it) const {
+    if (new_ht())
+      *it = Iterator(new_ht(), new_ht()->table,
+                     new_ht()->table + new_ht()->num_buckets, true);
+  }
+
  private:
   void fill_range_with_empty(pointer table_start, pointer table_end) {
     std::uninitialized_fill(table_start, table_end, val_info.emptyval);
   }
 
+  // Once we know what's empty, we can allocate our buckets.
+  void allocate_first_table() {
+    assert(!table);                  // must set before first use
+    // num_buckets was set in constructor even though table was NULL,
+    // unless we've been moved from, and have none.
+    if (num_buckets == 0) {
+      num_buckets = settings.min_buckets(0, 0);
+      settings.reset_thresholds(bucket_count());
+    }
+    table = val_info.allocate(num_buckets);
+    assert(table);
+    fill_range_with_empty(table, table + num_buckets);
+    if (use_side_arrays()) {
+      allocate_side_arrays(num_buckets);
+      reset_side_arrays(num_buckets);
+    }
+  }
+
  public:
   // TODO(csilvers): change all callers of this to pass in a key instead,
   //                 and take a const key_type instead of const value_type.
   void set_empty_key(const_reference val) {
+    if (Policy::use_occupancy_bitmap)
+      return;                        // we don't need one
     // Once you set the empty key, you can't change it
     assert(!settings.use_empty() && "Calling set_empty_key multiple times");
     // The deleted indicator (if specified) and the empty indicator
@@ -502,12 +1178,7 @@ class dense_hashtable {
            && "Setting the empty key the same as the deleted key");
     settings.set_use_empty(true);
     set_value(&val_info.emptyval, val);
-
-    assert(!table);                  // must set before first use
-    // num_buckets was set in constructor even though table was NULL
-    table = val_info.allocate(num_buckets);
-    assert(table);
-    fill_range_with_empty(table, table + num_buckets);
+    allocate_first_table();
   }
   // TODO(user): return a key_type rather than a value_type
   value_type empty_key() const {
@@ -517,7 +1188,9 @@ class dense_hashtable {
 
   // FUNCTIONS CONCERNING SIZE
  public:
-  size_type size() const      { return num_elements - num_deleted; }
+  size_type size() const {
+    return num_elements - num_deleted + (old_ht() ? old_ht()->size() : 0);
+  }
   size_type max_size() const  { return val_info.max_size(); }
   bool empty() const          { return size() == 0; }
   size_type bucket_count() const      { return num_buckets; }
@@ -529,16 +1202,115 @@ class dense_hashtable {
     return begin(i) == end(i) ? 0 : 1;
   }
 
+  // How many bytes the table takes, from the number of buckets, without
+  // looking at them; *usage, if given, says where they go (see
+  // memory_breakdown in hashtable-common.h).  We have no groups, so
+  // usage->group_sizes is always left empty.  Old buckets we're still
+  // moving entries out of count as well.
+  size_type memory_usage(memory_breakdown* usage = NULL,
+                         bool /*with_group_sizes*/ = false) const {
+    memory_breakdown ignored;
+    if (usage == NULL)  usage = &ignored;
+    *usage = memory_breakdown();
+    usage->object_bytes = sizeof(*this);
+    if (table) {
+      usage->bucket_bytes = num_buckets * sizeof(value_type);
+      ++usage->num_allocations;
+    }
+    if (ctrl())
+      add_side_array(usage, ctrl_size(num_buckets) * sizeof(*ctrl()));
+    if (probe_len())
+      add_side_array(usage, num_buckets * sizeof(*probe_len()));
+    if (hashes())  add_side_array(usage, num_buckets * sizeof(*hashes()));
+    if (occupancy())
+      add_side_array(usage,
+                     occupancy_size(num_buckets) * sizeof(*occupancy()));
+    if (generations())
+      add_side_array(usage, num_buckets * sizeof(*generations()));
+    if (old_ht()) {
+      memory_breakdown old_usage;
+      old_ht()->memory_usage(&old_usage);
+      usage->bucket_bytes += old_usage.bucket_bytes;
+      usage->bookkeeping_bytes += (old_usage.object_bytes +
+                                   old_usage.bookkeeping_bytes);
+      usage->num_allocations += old_usage.num_allocations + 1;
+    }
+    return usage->total();
+  }
+
  private:
+  static void add_side_array(memory_breakdown* usage, size_type bytes) {
+    usage->bookkeeping_bytes += bytes;
+    ++usage->num_allocations;
+  }
+
   // Because of the above, size_type(-1) is never legal; use it for errors
   static const size_type ILLEGAL_BUCKET = size_type(-1);
 
+  // PROBING
+  // The bucket the probe sequence for hashval starts at.
+  size_type home_bucket(size_type hashval) const {
+    if (Policy::fastrange_buckets)
+      return static_cast<size_type>(
+          sparsehash_internal::fastrange(hashval, num_buckets));
+    return hashval & (num_buckets - 1);
+  }
+  // The next bucket count up or down from n, when growing or shrinking
+  // a step at a time.
+  static size_type grown(size_type n) {
+    return Policy::fastrange_buckets ? n + n / 4 : n * 2;
+  }
+  static size_type shrunk(size_type n) {
+    return Policy::fastrange_buckets ? n - n / 5 : n / 2;
+  }
+
+  static bool use_bucket_groups() {
+    return Policy::bucket_group_bytes != 0 && !Policy::use_control_bytes;
+  }
+
+  // When use_bucket_groups(), how many buckets make up a group: as many
+  // as fit in Policy::bucket_group_bytes, rounded down to a power of
+  // two, but never more than the whole table.
+  size_type bucket_group_size() const {
+    size_type group_size = 1;
+    while (group_size * 2 * sizeof(value_type) <=
+           static_cast<size_type>(Policy::bucket_group_bytes))
+      group_size *= 2;
+    return group_size < bucket_count() ? group_size : bucket_count();
+  }
+
+  // How far probe number num_probes is from the one before it.
+  static size_type probe_jump(size_type num_probes) {
+    return static_cast<size_type>(Policy::probing::jump(num_probes));
+  }
+
+  // The bucket to look at after bucknum, when we're about to make
+  // probe number num_probes (the first bucket we look at is probe 0).
+  // Normally we jump as Policy::probing says.  With bucket groups, we
+  // walk the group we're in, wrapping around inside it, and only jump
+  // (by whole groups) once we've seen all of it.
+  size_type next_bucket(size_type bucknum, size_type num_probes) const {
+    if (Policy::fastrange_buckets)          // always linear probing
+      return bucknum + 1 == num_buckets ? 0 : bucknum + 1;
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    if (!use_bucket_groups())
+      return (bucknum + probe_jump(num_probes)) & bucket_count_minus_one;
+    const size_type group_size = bucket_group_size();
+    bucknum = ((bucknum & ~(group_size - 1)) |
+               ((bucknum + 1) & (group_size - 1)));
+    if ((num_probes & (group_size - 1)) == 0)  // done with this group
+      bucknum = ((bucknum + probe_jump(num_probes / group_size) * group_size)
+                 & bucket_count_minus_one);
+    return bucknum;
+  }
+
   // Used after a string of deletes.  Returns true if we actually shrunk.
   // TODO(csilvers): take a delta so we can take into account inserts
   // done after shrinking.  Maybe make part of the Settings class?
   bool maybe_shrink() {
     assert(num_elements >= num_deleted);
-    assert((bucket_count() & (bucket_count()-1)) == 0); // is a power of two
+    assert(Policy::fastrange_buckets ||
+           (bucket_count() & (bucket_count()-1)) == 0);  // a power of two
     assert(bucket_count() >= HT_MIN_BUCKETS);
     bool retval = false;
 
@@ -552,13 +1324,18 @@ class dense_hashtable {
     if (shrink_threshold > 0 && num_remain < shrink_threshold &&
         bucket_count() > HT_DEFAULT_STARTING_BUCKETS) {
       const float shrink_factor = settings.shrink_factor();
-      size_type sz = bucket_count() / 2;    // find how much we should shrink
+      size_type sz = shrunk(bucket_count()); // find how much we should shrink
       while (sz > HT_DEFAULT_STARTING_BUCKETS &&
              num_remain < sz * shrink_factor) {
-        sz /= 2;                            // stay a power of 2
+        sz = shrunk(sz);                    // stay a power of 2, if need be
+      }
+      settings.record_resize();
+      if (can_rehash_in_place()) {
+        rehash_in_place(settings.min_buckets(num_remain, sz));
+      } else {
+        dense_hashtable tmp(MoveDontCopy, *this, sz);  // Do the resizing
+        swap(tmp);                          // now we are tmp
       }
-      dense_hashtable tmp(*this, sz);       // Do the actual resizing
-      swap(tmp);                            // now we are tmp
       retval = true;
     }
     settings.set_consider_shrink(false);    // because we just considered it
@@ -569,7 +1346,32 @@ class dense_hashtable {
   // When you resize, you say, "make it big enough for this many more elements"
   // Returns true if we actually resized, false if size was already ok.
   bool resize_delta(size_type delta) {
-    bool did_resize = false;
+    if (old_ht()) {
+      const size_type num_in_use = num_elements + old_ht()->size();
+      // If enough has been erased that we'd shrink, finish moving
+      // first, as maybe_shrink() below needs everything in our buckets.
+      const bool shrinking = settings.consider_shrink() &&
+                             size() < settings.shrink_threshold();
+      if (!shrinking && num_in_use + delta <= settings.enlarge_threshold()) {
+        // Move enough that the old buckets are empty before the new ones
+        // fill up.  Growing by a quarter, as with fastrange_buckets,
+        // leaves room for fewer inserts than there are old buckets.
+        const size_type inserts_left =
+            (settings.enlarge_threshold() - num_in_use) / (delta ? delta : 1);
+        const size_type buckets_left = old_ht()->num_buckets - moved_through();
+        size_type num_to_move = buckets_left;
+        if (inserts_left > 0)
+          num_to_move = (buckets_left + inserts_left - 1) / inserts_left;
+        move_old_buckets((std::max)(
+            num_to_move,
+            static_cast<size_type>(Policy::incremental_resize_buckets)));
+        return true;                    // we moved things, if not much
+      }
+    }
+    // Moving what's left may fill the bucket our caller picked, so
+    // that counts as resizing too.  Then see if we need to grow again.
+    bool did_resize = old_ht() != NULL;
+    finish_resize();
     if ( settings.consider_shrink() ) {  // see if lots of deletes happened
       if ( maybe_shrink() )
         did_resize = true;
@@ -611,17 +1413,254 @@ class dense_hashtable {
       // through the trouble of copying (in order to purge the
       // deleted elements).
       const size_type target =
-          static_cast<size_type>(settings.shrink_size(resize_to*2));
+          static_cast<size_type>(settings.shrink_size(grown(resize_to)));
       if (num_elements - num_deleted + delta >= target) {
         // Good, we won't be below the shrink threshhold even if we double.
-        resize_to *= 2;
+        resize_to = grown(resize_to);
       }
     }
-    dense_hashtable tmp(*this, resize_to);
+    settings.record_resize();
+    if (can_resize_incrementally() && resize_to > bucket_count()) {
+      start_resize(resize_to);
+      return true;
+    }
+    if (can_rehash_in_place()) {
+      rehash_in_place(resize_to);
+      return true;
+    }
+    dense_hashtable tmp(MoveDontCopy, *this, resize_to);
     swap(tmp);                             // now we are tmp
     return true;
   }
 
+  // INCREMENTAL RESIZING
+  // With Policy::incremental_resize_buckets, growing moves our buckets
+  // into old_ht, a table of their own, and gives us new empty ones.
+  // old_ht->new_ht points back at us.  The entries in old buckets
+  // before moved_through have been moved into ours, and marked deleted
+  // (or, with Robin Hood, erased) in old_ht.  Inserts check old_ht for
+  // the key, and move it over if it's there, so a key is never in both.
+  bool can_resize_incrementally() const {
+    return (Policy::incremental_resize_buckets > 0 && table != NULL &&
+            (Policy::use_robin_hood || settings.use_deleted()));
+  }
+
+  void start_resize(size_type new_num_buckets) {
+    assert(!old_ht());
+    // old_ht comes from our allocator, like everything else we hold.
+    dense_hashtable* old = allocate_side_array<dense_hashtable>(1);
+    try {
+      new(old) dense_hashtable(0, settings, key_info, key_info, key_info,
+                               get_allocator());
+    } catch (...) {
+      deallocate_side_array(old, 1);
+      throw;
+    }
+    old->settings = settings;
+    old->key_info = key_info;
+    old->set_value(&old->val_info.emptyval, val_info.emptyval);
+    old->swap(*this);                  // it has our buckets, we have none
+    clear_to_size(new_num_buckets);
+    set_old_ht(old);
+    old_ht()->set_new_ht(this);
+    set_moved_through(0);
+    settings.inc_num_ht_copies();
+  }
+
+  // The first bucket on hashval's probe sequence that we could put an
+  // entry in.  For when we know its key isn't here.
+  size_type find_free_position(size_type hashval) const {
+    if (Policy::use_control_bytes)
+      return find_empty_ctrl(hashval);
+    if (Policy::use_robin_hood)
+      return find_insert_position_rh(hashval);
+    size_type num_probes = 0;
+    size_type bucknum = home_bucket(hashval);
+    while ( !test_empty(bucknum) && !test_deleted(bucknum) ) {
+      ++num_probes;
+      bucknum = next_bucket(bucknum, num_probes);
+      assert(num_probes < bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+    return bucknum;
+  }
+
+  // Moves the entry in bucket old_pos of old_ht into our bucket pos,
+  // which must be where find_position() said it goes.  Erasing it from
+  // old_ht needs SetKey, which some tables that never grow incrementally
+  // can't instantiate (eg dense_hash_map<const int, int>), so we only
+  // compile this for the tables that do.
+  typedef base::integral_constant<bool,
+      (Policy::incremental_resize_buckets > 0)> resizes_incrementally;
+  void move_from_old(size_type old_pos, size_type pos, size_type hashval) {
+    move_from_old(old_pos, pos, hashval, resizes_incrementally());
+  }
+  void move_from_old(size_type, size_type, size_type, base::false_type) {
+    assert(false && "we never have old_ht");
+  }
+  void move_from_old(size_type old_pos, size_type pos, size_type hashval,
+                     base::true_type) {
+    prepare_insert_at(pos, hashval);
+    move_value(&table[pos], old_ht()->table[old_pos]);
+    old_ht()->erase(const_iterator(old_ht(), old_ht()->table + old_pos,
+                                   old_ht()->table + old_ht()->num_buckets,
+                                   false));
+  }
+  // Erases pos, which is in old_ht's buckets.  Likewise, we only
+  // compile the call for tables that can have an old_ht: for the rest,
+  // old_ht() is always NULL.
+  template <class Iterator>
+  void erase_from_old(const Iterator&, base::false_type) {
+    assert(false && "we never have old_ht");
+  }
+  template <class Iterator>
+  void erase_from_old(const Iterator& pos, base::true_type) {
+    assert(pos.ht == old_ht());
+    old_ht()->erase(pos);
+  }
+
+  // Moves the entries in the next num_to_move old buckets into ours,
+  // and frees old_ht once it's empty.
+  void move_old_buckets(size_type num_to_move) {
+    assert(old_ht());
+    for ( ; num_to_move > 0 && moved_through() < old_ht()->num_buckets;
+          --num_to_move, set_moved_through(moved_through() + 1)) {
+      // A Robin Hood erase moves the next entry back into the bucket,
+      // so we keep going until it stays empty.
+      while ( !old_ht()->test_empty(moved_through()) &&
+              !old_ht()->test_deleted(moved_through()) ) {
+        const size_type hashval = old_ht()->bucket_hash(moved_through());
+        move_from_old(moved_through(), find_free_position(hashval), hashval);
+      }
+    }
+    if (moved_through() == old_ht()->num_buckets || old_ht()->size() == 0) {
+      delete_old_ht();
+    }
+  }
+
+  // Destroys old_ht, if we have one, and gives its memory back.
+  void delete_old_ht() {
+    if (old_ht()) {
+      old_ht()->~dense_hashtable();
+      deallocate_side_array(old_ht(), 1);
+      set_old_ht(NULL);
+    }
+  }
+
+  void finish_resize() {
+    if (old_ht())
+      move_old_buckets(old_ht()->num_buckets);
+  }
+
+  // Where key is in old_ht, if it hasn't been moved yet.
+  template <class K>
+  size_type find_unmoved_position(const K& key, size_type hashval) const {
+    if (!old_ht())
+      return ILLEGAL_BUCKET;
+    return old_ht()->find_position(key, hashval).first;
+  }
+  iterator old_iterator(size_type old_pos) {
+    return iterator(old_ht(), old_ht()->table + old_pos,
+                    old_ht()->table + old_ht()->num_buckets, false);
+  }
+  const_iterator old_iterator(size_type old_pos) const {
+    return const_iterator(old_ht(), old_ht()->table + old_pos,
+                          old_ht()->table + old_ht()->num_buckets, false);
+  }
+
+  // Resizing normally copies us into a second table, so for a moment
+  // we need room for both.  When the allocator can realloc and values
+  // can be moved bitwise, we instead realloc the bucket array and move
+  // entries around inside it.  (Policies that keep side arrays always
+  // take the copying path, as do big tables that may resize on several
+  // threads.)
+  bool can_rehash_in_place() const {
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+    if (settings.resize_threads() > 1 &&
+        static_cast<size_t>(num_elements) >= HT_MIN_PARALLEL_RESIZE)
+      return false;
+#endif
+    return (!use_side_arrays() && table != NULL &&
+            sparsehash_internal::can_realloc<value_alloc_type>::value &&
+            has_trivial_copy<value_type>::value &&
+            has_trivial_destructor<value_type>::value);
+  }
+
+  // Resizes the table to new_num_buckets (which may be the current size,
+  // if we just want to get rid of deleted buckets), redistributing the
+  // entries in place.  We walk the old buckets in order, and take each
+  // entry we haven't placed yet to the first bucket on its probe
+  // sequence that isn't holding a placed ("settled") entry.  If that's
+  // where it already is, it stays.  If it's empty (or deleted), we move
+  // it there.  If it holds another unplaced entry, we swap the two and
+  // go on with the one we got back.  Settled entries never move, so
+  // every bucket before one on its probe sequence stays full, and
+  // find_position() will find it.  When shrinking, every entry ends up
+  // below new_num_buckets, so we can realloc the array down afterwards.
+  void rehash_in_place(size_type new_num_buckets) {
+    assert(Policy::fastrange_buckets ||
+           (new_num_buckets & (new_num_buckets - 1)) == 0);
+    assert(new_num_buckets >= HT_MIN_BUCKETS);
+    assert(new_num_buckets >= num_elements - num_deleted);
+    const double start = settings.start_copy();
+    const size_type old_num_buckets = num_buckets;
+    if (new_num_buckets > old_num_buckets) {
+      table = val_info.realloc_or_die(table, new_num_buckets);
+      fill_range_with_empty(table + old_num_buckets, table + new_num_buckets);
+    }
+    // Old buckets before bucknum, and all new ones, are empty or settled.
+    // Old buckets after it are settled only if this says so.
+    std::vector<bool> settled(old_num_buckets);
+    const bool purge_deleted = num_deleted > 0;
+    num_elements -= num_deleted;
+    num_deleted = 0;
+    num_buckets = new_num_buckets;       // so we probe with the new mask
+
+    for (size_type bucknum = 0; bucknum < old_num_buckets; ++bucknum) {
+      if (settled[bucknum] || test_empty(bucknum))
+        continue;
+      if (purge_deleted && equals(key_info.delkey, get_key(table[bucknum]))) {
+        set_value(&table[bucknum], val_info.emptyval);
+        continue;
+      }
+      while (true) {
+        size_type num_probes = 0;
+        size_type target = home_bucket(hash(get_key(table[bucknum])));
+        while (bucknum < target && target < old_num_buckets ?
+               settled[target] :
+               target != bucknum && !test_empty(target)) {
+          ++num_probes;
+          target = next_bucket(target, num_probes);
+          assert(num_probes < bucket_count()
+                 && "Hashtable is full: an error in key_equal<> or hash<>");
+        }
+        if (target == bucknum)             // already in the right place
+          break;
+        if (test_empty(target) ||
+            (purge_deleted &&
+             equals(key_info.delkey, get_key(table[target])))) {
+          set_value(&table[target], table[bucknum]);   // move it there
+          set_value(&table[bucknum], val_info.emptyval);
+          if (target < old_num_buckets)
+            settled[target] = true;
+          break;
+        }
+        const value_type tmp(table[target]);   // swap, and keep going
+        set_value(&table[target], table[bucknum]);
+        set_value(&table[bucknum], tmp);
+        settled[target] = true;
+      }
+    }
+    if (new_num_buckets < old_num_buckets) {
+      // All that's left past the new end is empty buckets.
+      destroy_buckets(new_num_buckets, old_num_buckets);
+      table = val_info.realloc_or_die(table, new_num_buckets);
+    }
+    settings.reset_thresholds(bucket_count());
+    settings.inc_num_ht_copies();
+    settings.record_copy(start);
+  }
+
   // We require table be not-NULL and empty before calling this.
   void resize_table(size_type /*old_size*/, size_type new_size,
                     base::true_type) {
@@ -633,37 +1672,240 @@ class dense_hashtable {
     table = val_info.allocate(new_size);
   }
 
+  // This is used as a tag for the copy constructor, saying to destroy
+  // its arg.  To make sure the outside world can't do a destructive
+  // copy, we make the typename private.
+  enum MoveDontCopyT {MoveDontCopy};
+
+  // The hash of the entry in bucket bucknum.
+  size_type bucket_hash(size_type bucknum) const {
+    return Policy::cache_hash ? hashes()[bucknum]
+                              : hash(get_key(table[bucknum]));
+  }
+
+  // Makes room for an entry with hash hashval in the first empty bucket
+  // on its probe sequence, and returns that bucket; the caller then
+  // stores the value there.  Only for copying from another table, when
+  // we know there are no duplicates and no deleted buckets.
+  size_type insert_unique_position(size_type hashval) {
+    size_type bucknum;
+    if (Policy::use_control_bytes) {
+      bucknum = find_empty_ctrl(hashval);
+    } else if (Policy::use_robin_hood) {
+      bucknum = find_insert_position_rh(hashval);
+      make_room_rh(bucknum, hashval);
+    } else {
+      size_type num_probes = 0;              // how many times we've probed
+      for (bucknum = home_bucket(hashval);
+           !test_empty(bucknum);                               // not empty
+           bucknum = next_bucket(bucknum, num_probes)) {
+        ++num_probes;
+        assert(num_probes < bucket_count()
+               && "Hashtable is full: an error in key_equal<> or hash<>");
+      }
+    }
+    mark_full(bucknum, hashval);
+    num_elements++;
+    return bucknum;
+  }
+
+  // Updates the side arrays for a bucket that's about to hold an entry
+  // with hash hashval.  Doesn't touch num_elements or num_deleted.
+  void mark_full(size_type bucknum, size_type hashval) {
+    set_hash(bucknum, hashval);
+    if (Policy::use_control_bytes)
+      set_ctrl(bucknum, sparsehash_internal::ctrl_tag(hashval));
+    if (Policy::use_occupancy_bitmap)
+      set_full_bit(bucknum);
+    if (Policy::use_generations)
+      generations()[bucknum] = current_generation();
+  }
+
   // Used to actually do the rehashing when we grow/shrink a hashtable
   void copy_from(const dense_hashtable &ht, size_type min_buckets_wanted) {
+    const double start = settings.start_copy();
     clear_to_size(settings.min_buckets(ht.size(), min_buckets_wanted));
 
     // We use a normal iterator to get non-deleted bcks from ht
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
-    assert((bucket_count() & (bucket_count()-1)) == 0);      // a power of two
+    assert(Policy::fastrange_buckets ||
+           (bucket_count() & (bucket_count()-1)) == 0);  // a power of two
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+    const int num_ranges = parallel_resize_ranges(ht);
+    if (num_ranges > 1) {
+      // We only read from ht; the const_cast is so we can share the
+      // code with move_from.
+      parallel_fill_from(const_cast<dense_hashtable&>(ht), num_ranges, false);
+      settings.inc_num_ht_copies();
+      settings.record_copy(start);
+      return;
+    }
+#endif
+    // (If ht is growing incrementally, it.ht is sometimes ht.old_ht.)
     for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
-      size_type num_probes = 0;              // how many times we've probed
-      size_type bucknum;
-      const size_type bucket_count_minus_one = bucket_count() - 1;
-      for (bucknum = hash(get_key(*it)) & bucket_count_minus_one;
-           !test_empty(bucknum);                               // not empty
-           bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one) {
-        ++num_probes;
-        assert(num_probes < bucket_count()
-               && "Hashtable is full: an error in key_equal<> or hash<>");
-      }
-      set_value(&table[bucknum], *it);       // copies the value to here
-      num_elements++;
+      const size_type hashval = it.ht->bucket_hash(it.pos - it.ht->table);
+      set_value(&table[insert_unique_position(hashval)], *it);
     }
     settings.inc_num_ht_copies();
+    settings.record_copy(start);
   }
 
+  // Like copy_from, but moves the values out of ht, which we're about
+  // to throw away anyway.  This is what resizing uses.
+  void move_from(dense_hashtable &ht, size_type min_buckets_wanted) {
+    const double start = settings.start_copy();
+    clear_to_size(settings.min_buckets(ht.size(), min_buckets_wanted));
+    assert(Policy::fastrange_buckets ||
+           (bucket_count() & (bucket_count()-1)) == 0);  // a power of two
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+    const int num_ranges = parallel_resize_ranges(ht);
+    if (num_ranges > 1) {
+      parallel_fill_from(ht, num_ranges, true);
+      settings.inc_num_ht_copies();
+      settings.record_copy(start);
+      return;
+    }
+#endif
+    // Moving a value out of its bucket can make the bucket look empty
+    // (or deleted), but the iterator only ever looks at later buckets.
+    for ( iterator it = ht.begin(); it != ht.end(); ++it ) {
+      const size_type hashval = it.ht->bucket_hash(it.pos - it.ht->table);
+      move_value(&table[insert_unique_position(hashval)], *it);
+    }
+    settings.inc_num_ht_copies();
+    settings.record_copy(start);
+  }
+
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+  // PARALLEL RESIZING
+  // With settings.resize_threads() > 1, copy_from and move_from fill a
+  // big table on several threads.  We cut our buckets into one
+  // contiguous range per thread, and an entry belongs to the range its
+  // first probe lands in.  First each thread sorts its share of ht's
+  // buckets by range.  Then each thread inserts the entries of one
+  // range, probing as usual; no other thread writes inside that range,
+  // so we need no locks.  The few entries whose probe sequence leaves
+  // their range before finding an empty bucket are put aside, and
+  // inserted on this thread at the end.  Ranges are whole multiples of
+  // OCCUPANCY_WORD_BITS buckets, so they never share an occupancy word.
+  // Control bytes and Robin Hood, whose inserts may touch buckets far
+  // away, and tables still growing incrementally resize on one thread.
+  // So do small tables, where starting threads costs more than it saves.
+  static const size_t HT_MIN_PARALLEL_RESIZE = 1 << 16;   // elements
+  static const size_t HT_MIN_RESIZE_RANGE = 1 << 12;      // buckets
+
+  // How many ranges (and threads) to use to fill us from ht; 1 means
+  // we shouldn't resize in parallel at all.
+  int parallel_resize_ranges(const dense_hashtable& ht) const {
+    if (Policy::use_control_bytes || Policy::use_robin_hood ||
+        ht.old_ht() != NULL ||
+        static_cast<size_t>(ht.size()) < HT_MIN_PARALLEL_RESIZE)
+      return 1;
+    int n = settings.resize_threads();
+    if (n > 255)                 // range numbers must fit in a byte
+      n = 255;
+    const size_t max_ranges = bucket_count() / HT_MIN_RESIZE_RANGE;
+    if (max_ranges < static_cast<size_t>(n))
+      n = static_cast<int>(max_ranges);
+    return n < 1 ? 1 : n;
+  }
+
+  // Like insert_unique_position, but gives up, returning ILLEGAL_BUCKET,
+  // as soon as the probe sequence leaves buckets [lo, hi).  It doesn't
+  // update anything, so it's safe while other threads fill other ranges.
+  size_type find_empty_in_range(size_type hashval,
+                                size_type lo, size_type hi) const {
+    size_type num_probes = 0;
+    size_type bucknum = home_bucket(hashval);
+    while (bucknum >= lo && bucknum < hi) {
+      if (test_empty(bucknum))
+        return bucknum;
+      ++num_probes;
+      assert(num_probes < bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+      bucknum = next_bucket(bucknum, num_probes);
+    }
+    return ILLEGAL_BUCKET;
+  }
+
+  // The value in ht's bucket src goes in our bucket dst.
+  void fill_bucket(size_type dst, dense_hashtable& ht, size_type src,
+                   bool move_values) {
+    if (move_values)
+      move_value(&table[dst], ht.table[src]);
+    else
+      set_value(&table[dst], ht.table[src]);
+  }
+
+  // The guts of copy_from and move_from when num_ranges > 1.  We must
+  // already be cleared to the right size.
+  void parallel_fill_from(dense_hashtable& ht, int num_ranges,
+                          bool move_values) {
+    typedef std::pair<size_type, size_type> entry;   // ht bucket, hash
+    const size_type src_buckets = ht.num_buckets;
+    const size_type chunk = (src_buckets + num_ranges - 1) / num_ranges;
+    size_type range_size = (bucket_count() + num_ranges - 1) / num_ranges;
+    range_size = ((range_size + OCCUPANCY_WORD_BITS - 1) /
+                  OCCUPANCY_WORD_BITS * OCCUPANCY_WORD_BITS);
+    // parts[w * num_ranges + r] is what thread w found for range r.
+    std::vector<std::vector<entry> > parts(num_ranges * num_ranges);
+    std::vector<std::vector<entry> > put_aside(num_ranges);
+    std::vector<size_type> num_filled(num_ranges, 0);
+
+    // Each part gets about an equal share; leave a little slack.
+    const size_t part_guess = ht.size() / (num_ranges * num_ranges);
+    sparsehash_internal::run_in_parallel(num_ranges, [&](int w) {
+      for (int r = 0; r < num_ranges; ++r)
+        parts[w * num_ranges + r].reserve(part_guess + part_guess / 8 + 16);
+      const size_type begin = std::min<size_type>(src_buckets, w * chunk);
+      const size_type end = std::min<size_type>(src_buckets, begin + chunk);
+      for (size_type i = begin; i < end; ++i) {
+        if (ht.test_empty(i) || ht.test_deleted(i))
+          continue;
+        const size_type hashval = ht.bucket_hash(i);
+        const size_type r = home_bucket(hashval) / range_size;
+        parts[w * num_ranges + r].push_back(entry(i, hashval));
+      }
+    });
+
+    sparsehash_internal::run_in_parallel(num_ranges, [&](int r) {
+      const size_type lo = static_cast<size_type>(r * range_size);
+      const size_type hi = std::min<size_type>(bucket_count(), lo + range_size);
+      for (int w = 0; w < num_ranges; ++w) {
+        const std::vector<entry>& part = parts[w * num_ranges + r];
+        for (size_t j = 0; j < part.size(); ++j) {
+          const size_type pos = find_empty_in_range(part[j].second, lo, hi);
+          if (pos == ILLEGAL_BUCKET) {
+            put_aside[r].push_back(part[j]);
+            continue;
+          }
+          mark_full(pos, part[j].second);
+          fill_bucket(pos, ht, part[j].first, move_values);
+          ++num_filled[r];
+        }
+      }
+    });
+
+    for (int r = 0; r < num_ranges; ++r)
+      num_elements += num_filled[r];
+    for (int r = 0; r < num_ranges; ++r) {
+      for (size_t j = 0; j < put_aside[r].size(); ++j) {
+        const entry& e = put_aside[r][j];
+        fill_bucket(insert_unique_position(e.second), ht, e.first,
+                    move_values);
+      }
+    }
+  }
+#endif  // SPARSEHASH_PARALLEL_RESIZE
+
   // Required by the spec for hashed associative container
  public:
   // Though the docs say this should be num_buckets, I think it's much
   // more useful as num_elements.  As a special feature, calling with
   // req_elements==0 will cause us to shrink if we can, saving space.
   void resize(size_type req_elements) {       // resize to this or larger
+    finish_resize();
     if ( settings.consider_shrink() || req_elements == 0 )
       maybe_shrink();
     if ( req_elements > num_elements )
@@ -683,6 +1925,18 @@ class dense_hashtable {
     settings.reset_thresholds(bucket_count());
   }
 
+  // How many threads a big copy or resize may spread its rehashing
+  // over: 1 (the default) to 255.  It only takes effect when
+  // SPARSEHASH_PARALLEL_RESIZE is defined (see hashtable-common.h), and
+  // then the hasher, and moving or copying a value_type, must be safe
+  // to call from several threads at once.
+  int resize_threads() const {
+    return settings.resize_threads();
+  }
+  void set_resize_threads(int n) {
+    settings.set_resize_threads(n);
+  }
+
   // CONSTRUCTORS -- as required by the specs, we take a size,
   // but also let you specify a hashfunction, key comparator,
   // and key extractor.  We also define a copy constructor and =.
@@ -705,6 +1959,13 @@ class dense_hashtable {
     // table is NULL until emptyval is set.  However, we set num_buckets
     // here so we know how much space to allocate once emptyval is set
     settings.reset_thresholds(bucket_count());
+    if (Policy::use_occupancy_bitmap) {
+      // The bitmap says what's empty and what's deleted, so we're ready
+      // to go now.  (The flags just say so to the rest of the code.)
+      settings.set_use_empty(true);
+      settings.set_use_deleted(true);
+      allocate_first_table();
+    }
   }
 
   // As a convenience for resize(), we allow an optional second argument
@@ -729,6 +1990,57 @@ class dense_hashtable {
     copy_from(ht, min_buckets_wanted);   // copy_from() ignores deleted entries
   }
 
+  // Like the copy constructor, but moves ht's values rather than copying
+  // them, leaving ht fit only to be destroyed.  Used for resizing.
+  dense_hashtable(MoveDontCopyT, dense_hashtable& ht,
+                  size_type min_buckets_wanted = HT_DEFAULT_STARTING_BUCKETS)
+      : settings(ht.settings),
+        key_info(ht.key_info),
+        num_deleted(0),
+        num_elements(0),
+        num_buckets(0),
+        val_info(ht.val_info),
+        table(NULL) {
+    if (!ht.settings.use_empty()) {
+      assert(ht.empty());
+      num_buckets = settings.min_buckets(ht.size(), min_buckets_wanted);
+      settings.reset_thresholds(bucket_count());
+      return;
+    }
+    settings.reset_thresholds(bucket_count());
+    move_from(ht, min_buckets_wanted);   // move_from() ignores deleted entries
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Moving allocates nothing, but it copies emptyval, so it can throw
+  // only if copying a value_type can.
+  static const bool nothrow_move =
+      std::is_nothrow_copy_constructible<value_type>::value;
+
+  // Takes over ht's buckets.  ht is left empty, with no buckets, and
+  // keeps its empty and deleted keys; it gets buckets again when it's
+  // cleared or inserted into.
+  dense_hashtable(dense_hashtable&& ht) SPARSEHASH_NOEXCEPT_IF(nothrow_move)
+      : settings(ht.settings),
+        key_info(ht.key_info),
+        num_deleted(0),
+        num_elements(0),
+        num_buckets(0),
+        val_info(ht.val_info),
+        table(NULL) {
+    settings.reset_thresholds(bucket_count());
+    swap(ht);
+  }
+
+  dense_hashtable& operator= (dense_hashtable&& ht)
+      SPARSEHASH_NOEXCEPT_IF(nothrow_move) {
+    if (&ht == this)  return *this;        // don't move onto ourselves
+    dense_hashtable tmp(std::move(ht));    // frees what used to be ours
+    swap(tmp);
+    return *this;
+  }
+#endif
+
   dense_hashtable& operator= (const dense_hashtable& ht) {
     if (&ht == this)  return *this;        // don't copy onto ourselves
     if (!ht.settings.use_empty()) {
@@ -747,10 +2059,12 @@ class dense_hashtable {
   }
 
   ~dense_hashtable() {
+    delete_old_ht();
     if (table) {
       destroy_buckets(0, num_buckets);
       val_info.deallocate(table, num_buckets);
     }
+    deallocate_side_arrays(num_buckets);
   }
 
   // Many STL algorithms use swap instead of copy constructors
@@ -760,12 +2074,14 @@ class dense_hashtable {
     std::swap(num_deleted, ht.num_deleted);
     std::swap(num_elements, ht.num_elements);
     std::swap(num_buckets, ht.num_buckets);
-    { value_type tmp;     // for annoying reasons, swap() doesn't work
-      set_value(&tmp, val_info.emptyval);
+    { value_type tmp(val_info.emptyval);  // swap() doesn't work on pairs
       set_value(&val_info.emptyval, ht.val_info.emptyval);
       set_value(&ht.val_info.emptyval, tmp);
     }
     std::swap(table, ht.table);
+    swap_optional_state(ht);
+    if (old_ht())  old_ht()->set_new_ht(this);
+    if (ht.old_ht())  ht.old_ht()->set_new_ht(&ht);
     settings.reset_thresholds(bucket_count());  // also resets consider_shrink
     ht.settings.reset_thresholds(ht.bucket_count());
     // we purposefully don't swap the allocator, which may not be swap-able
@@ -773,20 +2089,24 @@ class dense_hashtable {
 
  private:
   void clear_to_size(size_type new_num_buckets) {
+    delete_old_ht();
+    if (use_side_arrays() && (!table || new_num_buckets != num_buckets)) {
+      deallocate_side_arrays(num_buckets);
+      allocate_side_arrays(new_num_buckets);
+    }
     if (!table) {
       table = val_info.allocate(new_num_buckets);
     } else {
       destroy_buckets(0, num_buckets);
       if (new_num_buckets != num_buckets) {   // resize, if necessary
-        typedef base::integral_constant<bool,
-            base::is_same<value_alloc_type,
-                          libc_allocator_with_realloc<value_type> >::value>
-            realloc_ok;
+        typedef sparsehash_internal::can_realloc<value_alloc_type> realloc_ok;
         resize_table(num_buckets, new_num_buckets, realloc_ok());
       }
     }
     assert(table);
     fill_range_with_empty(table, table + new_num_buckets);
+    if (use_side_arrays())
+      reset_side_arrays(new_num_buckets);
     num_elements = 0;
     num_deleted = 0;
     num_buckets = new_num_buckets;          // our new size
@@ -799,7 +2119,7 @@ class dense_hashtable {
     // If the table is already empty, and the number of buckets is
     // already as we desire, there's nothing to do.
     const size_type new_num_buckets = settings.min_buckets(0, 0);
-    if (num_elements == 0 && new_num_buckets == num_buckets) {
+    if (num_elements == 0 && new_num_buckets == num_buckets && !old_ht()) {
       return;
     }
     clear_to_size(new_num_buckets);
@@ -809,10 +2129,25 @@ class dense_hashtable {
   // Mimicks the stl_hashtable's behaviour when clear()-ing in that it
   // does not modify the bucket count
   void clear_no_resize() {
-    if (num_elements > 0) {
+    delete_old_ht();
+    if (Policy::use_generations) {
+      // Stale buckets read as empty, and there's nothing to destroy.
+      if (num_elements > 0)
+        next_generation();
+    } else if (Policy::use_occupancy_bitmap && num_elements > 0) {
+      // Only full buckets can hold anything that needs freeing, and
+      // what's in the others doesn't matter, so the bitmap is enough.
+      if (!has_trivial_destructor<value_type>::value) {
+        for (iterator it = begin(); it != end(); ++it)
+          set_value(&*it, val_info.emptyval);
+      }
+      reset_side_arrays(num_buckets);
+    } else if (num_elements > 0 || num_deleted > 0) {
       assert(table);
       destroy_buckets(0, num_buckets);
       fill_range_with_empty(table, table + num_buckets);
+      if (use_side_arrays())
+        reset_side_arrays(num_buckets);
     }
     // don't consider to shrink before another erase()
     settings.reset_thresholds(bucket_count());
@@ -827,67 +2162,241 @@ class dense_hashtable {
   // if object is not found; 2nd is ILLEGAL_BUCKET if it is.
   // Note: because of deletions where-to-insert is not trivial: it's the
   // first deleted bucket we see, as long as we don't find the key later
-  std::pair<size_type, size_type> find_position(const key_type &key) const {
+  // The lookup routines take any key type K that hasher and key_equal
+  // accept; see enable_if_transparent in hashtable-common.h.
+  template <class K>
+  std::pair<size_type, size_type> find_position(const K &key) const {
+    return find_position(key, hash(key));
+  }
+
+  // Same, for when the caller has already hashed the key.
+  template <class K>
+  std::pair<size_type, size_type> find_position(const K &key,
+                                                size_type hashval) const {
+    if (Policy::use_control_bytes)
+      return find_position_ctrl(key, hashval);
+    if (Policy::use_robin_hood)
+      return find_position_rh(key, hashval);
     size_type num_probes = 0;              // how many times we've probed
-    const size_type bucket_count_minus_one = bucket_count() - 1;
-    size_type bucknum = hash(key) & bucket_count_minus_one;
+    size_type bucknum = home_bucket(hashval);
     size_type insert_pos = ILLEGAL_BUCKET; // where we would insert
     while ( 1 ) {                          // probe until something happens
       if ( test_empty(bucknum) ) {         // bucket is empty
+        settings.record_lookup(num_probes, false);
         if ( insert_pos == ILLEGAL_BUCKET )   // found no prior place to insert
           return std::pair<size_type,size_type>(ILLEGAL_BUCKET, bucknum);
         else
           return std::pair<size_type,size_type>(ILLEGAL_BUCKET, insert_pos);
 
       } else if ( test_deleted(bucknum) ) {// keep searching, but mark to insert
+        settings.record_tombstone();
         if ( insert_pos == ILLEGAL_BUCKET )
           insert_pos = bucknum;
 
-      } else if ( equals(key, get_key(table[bucknum])) ) {
+      } else if ( hash_matches(bucknum, hashval) &&
+                  equals(key, get_key(table[bucknum])) ) {
+        settings.record_lookup(num_probes, true);
         return std::pair<size_type,size_type>(bucknum, ILLEGAL_BUCKET);
       }
       ++num_probes;                        // we're doing another probe
-      bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one;
+      bucknum = next_bucket(bucknum, num_probes);
       assert(num_probes < bucket_count()
              && "Hashtable is full: an error in key_equal<> or hash<>");
     }
   }
 
+  // The control-byte version of find_position.  We probe a group of
+  // kCtrlGroupWidth buckets at a time, and only call equals() on
+  // buckets whose tag matches the 7 bits of hash we keep for key.
+  // Like above, a group holding an empty bucket ends the probe.
+  template <class K>
+  std::pair<size_type, size_type> find_position_ctrl(const K &key,
+                                                     size_type hashval) const {
+    typedef sparsehash_internal::ctrl_group ctrl_group;
+    const unsigned char tag = sparsehash_internal::ctrl_tag(hashval);
+    size_type num_probes = 0;              // how many groups we've probed
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type bucknum = hashval & bucket_count_minus_one;
+    size_type insert_pos = ILLEGAL_BUCKET; // where we would insert
+    while ( 1 ) {                          // probe until something happens
+      const ctrl_group group(ctrl() + bucknum);
+      for (unsigned int m = group.match(tag); m != 0; m &= m - 1) {
+        const size_type pos = ((bucknum + ctrl_group::lowest_bit(m))
+                               & bucket_count_minus_one);
+        if ( hash_matches(pos, hashval) &&
+             equals(key, get_key(table[pos])) ) {
+          settings.record_lookup(num_probes, true);
+          return std::pair<size_type,size_type>(pos, ILLEGAL_BUCKET);
+        }
+      }
+      if ( insert_pos == ILLEGAL_BUCKET ) {
+        const unsigned int free_mask = group.match_empty_or_deleted();
+        if ( free_mask )
+          insert_pos = ((bucknum + ctrl_group::lowest_bit(free_mask))
+                        & bucket_count_minus_one);
+      }
+      if ( group.match_empty() ) {         // key can't be any further along
+        settings.record_lookup(num_probes, false);
+        return std::pair<size_type,size_type>(ILLEGAL_BUCKET, insert_pos);
+      }
+      ++num_probes;                        // we're doing another probe
+      bucknum = ((bucknum + sparsehash_internal::kCtrlGroupWidth *
+                            probe_jump(num_probes))
+                 & bucket_count_minus_one);
+      assert(num_probes <= bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+  }
+
+  // The Robin Hood version of find_position.  probe_len[bucknum] is 0 for
+  // an empty bucket, and otherwise 1 + how far its entry is from the
+  // bucket it hashes to.  As we probe, we compare that with how far
+  // key would be from home.  Only an entry with the same displacement
+  // has the same home bucket, and one with less means key isn't here:
+  // key would have taken that bucket when it was inserted.
+  template <class K>
+  std::pair<size_type, size_type> find_position_rh(const K &key,
+                                                   size_type hashval) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type bucknum = hashval & bucket_count_minus_one;
+    for (size_type d = 1; ; ++d) {         // d is 1 + key's displacement
+      if ( probe_len()[bucknum] < d ) {           // empty, or closer to home
+        settings.record_lookup(d - 1, false);
+        return std::pair<size_type,size_type>(ILLEGAL_BUCKET, bucknum);
+      }
+      if ( probe_len()[bucknum] == d && hash_matches(bucknum, hashval) &&
+           equals(key, get_key(table[bucknum])) ) {
+        settings.record_lookup(d - 1, true);
+        return std::pair<size_type,size_type>(bucknum, ILLEGAL_BUCKET);
+      }
+      bucknum = (bucknum + 1) & bucket_count_minus_one;
+      assert(d <= bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+  }
+
+  // Where find_position_rh() would put a new entry with this hash.
+  size_type find_insert_position_rh(size_type hashval) const {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type bucknum = hashval & bucket_count_minus_one;
+    for (size_type d = 1; probe_len()[bucknum] >= d; ++d)
+      bucknum = (bucknum + 1) & bucket_count_minus_one;
+    return bucknum;
+  }
+
+  // Makes room for an entry with hash hashval in bucket pos, which must
+  // be where find_position_rh() says it goes.  The entries from pos up
+  // to the next empty bucket each move over by one, and so get one
+  // further from home.  The caller then stores the value in pos.
+  void make_room_rh(size_type pos, size_type hashval) {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    const displacement_type max_dist =
+        (std::numeric_limits<displacement_type>::max)();
+    const size_type new_dist =
+        ((pos - hashval) & bucket_count_minus_one) + 1;
+    size_type last = pos;                  // the empty bucket ending the run
+    for ( ; probe_len()[last] != 0;
+          last = (last + 1) & bucket_count_minus_one) {
+      if (probe_len()[last] == max_dist)
+        throw std::length_error("robin hood displacement overflow");
+    }
+    if (new_dist > max_dist)
+      throw std::length_error("robin hood displacement overflow");
+    while (last != pos) {
+      const size_type prev = (last + bucket_count_minus_one)
+                             & bucket_count_minus_one;
+      move_value(&table[last], table[prev]);
+      move_hash(last, prev);
+      probe_len()[last] = probe_len()[prev] + 1;
+      last = prev;
+    }
+    set_hash(pos, hashval);
+    probe_len()[pos] = static_cast<displacement_type>(new_dist);
+  }
+
+  // Empties bucket pos, then moves the rest of its run back by one,
+  // up to the first entry that's already home (or an empty bucket).
+  void erase_rh(size_type pos) {
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type next = (pos + 1) & bucket_count_minus_one;
+    while (probe_len()[next] > 1) {
+      move_value(&table[pos], table[next]);
+      move_hash(pos, next);
+      probe_len()[pos] = probe_len()[next] - 1;
+      pos = next;
+      next = (next + 1) & bucket_count_minus_one;
+    }
+    set_value(&table[pos], val_info.emptyval);
+    probe_len()[pos] = 0;
+    --num_elements;
+    settings.set_consider_shrink(true);  // will think about shrink after next insert
+  }
+
+  // Erasing moves entries around, so we can't erase a range of buckets
+  // as we walk over it; we erase by key instead.
+  template <class Iterator>
+  void erase_range_rh(Iterator f, Iterator l) {
+    std::vector<key_type> keys;
+    for ( ; f != l; ++f)
+      keys.push_back(get_key(*f));
+    for (typename std::vector<key_type>::const_iterator it = keys.begin();
+         it != keys.end(); ++it)
+      erase(*it);
+  }
+
  public:
 
-  iterator find(const key_type& key) {
+  template <class K>
+  iterator find(const K& key) {
     if ( size() == 0 ) return end();
-    std::pair<size_type, size_type> pos = find_position(key);
-    if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
+    const size_type hashval = hash(key);
+    std::pair<size_type, size_type> pos = find_position(key, hashval);
+    if ( pos.first != ILLEGAL_BUCKET )
+      return iterator(this, table + pos.first, table + num_buckets, false);
+    const size_type old_pos = find_unmoved_position(key, hashval);
+    if ( old_pos == ILLEGAL_BUCKET )       // alas, not there
       return end();
     else
-      return iterator(this, table + pos.first, table + num_buckets, false);
+      return old_iterator(old_pos);
   }
 
-  const_iterator find(const key_type& key) const {
+  template <class K>
+  const_iterator find(const K& key) const {
     if ( size() == 0 ) return end();
-    std::pair<size_type, size_type> pos = find_position(key);
-    if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
+    const size_type hashval = hash(key);
+    std::pair<size_type, size_type> pos = find_position(key, hashval);
+    if ( pos.first != ILLEGAL_BUCKET )
+      return const_iterator(this, table + pos.first, table+num_buckets, false);
+    const size_type old_pos = find_unmoved_position(key, hashval);
+    if ( old_pos == ILLEGAL_BUCKET )       // alas, not there
       return end();
     else
-      return const_iterator(this, table + pos.first, table+num_buckets, false);
+      return old_iterator(old_pos);
   }
 
   // This is a tr1 method: the bucket a given key is in, or what bucket
   // it would be put in, if it were to be inserted.  Shrug.
-  size_type bucket(const key_type& key) const {
+  template <class K>
+  size_type bucket(const K& key) const {
+    if ( num_buckets == 0 ) return 0;     // we've been moved from
     std::pair<size_type, size_type> pos = find_position(key);
     return pos.first == ILLEGAL_BUCKET ? pos.second : pos.first;
   }
 
   // Counts how many elements have key key.  For maps, it's either 0 or 1.
-  size_type count(const key_type &key) const {
-    std::pair<size_type, size_type> pos = find_position(key);
+  template <class K>
+  size_type count(const K &key) const {
+    if ( size() == 0 ) return 0;
+    const size_type hashval = hash(key);
+    std::pair<size_type, size_type> pos = find_position(key, hashval);
+    if ( pos.first == ILLEGAL_BUCKET )
+      pos.first = find_unmoved_position(key, hashval);
     return pos.first == ILLEGAL_BUCKET ? 0 : 1;
   }
 
   // Likewise, equal_range doesn't really make sense for us.  Oh well.
-  std::pair<iterator,iterator> equal_range(const key_type& key) {
+  template <class K>
+  std::pair<iterator,iterator> equal_range(const K& key) {
     iterator pos = find(key);      // either an iterator or end
     if (pos == end()) {
       return std::pair<iterator,iterator>(pos, pos);
@@ -896,8 +2405,8 @@ class dense_hashtable {
       return std::pair<iterator,iterator>(startpos, pos);
     }
   }
-  std::pair<const_iterator,const_iterator> equal_range(const key_type& key)
-      const {
+  template <class K>
+  std::pair<const_iterator,const_iterator> equal_range(const K& key) const {
     const_iterator pos = find(key);      // either an iterator or end
     if (pos == end()) {
       return std::pair<const_iterator,const_iterator>(pos, pos);
@@ -910,11 +2419,43 @@ class dense_hashtable {
 
   // INSERTION ROUTINES
  private:
-  // Private method used by insert_noresize and find_or_insert.
-  iterator insert_at(const_reference obj, size_type pos) {
+  // find_position(), for a key we're about to insert.  If we're growing
+  // incrementally and key hasn't been moved yet, we move it now.
+  template <class K>
+  std::pair<size_type, size_type> find_position_to_insert(
+      const K& key, size_type hashval) {
+    // First, double-check we're not inserting delkey or emptyval
+    assert((Policy::use_occupancy_bitmap || !settings.use_empty() ||
+            !equals(key, get_key(val_info.emptyval)))
+           && "Inserting the empty key");
+    assert((Policy::use_occupancy_bitmap || !settings.use_deleted() ||
+            !equals(key, key_info.delkey))
+           && "Inserting the deleted key");
+    if ( num_buckets == 0 )              // we've been moved from
+      clear_to_size(settings.min_buckets(0, 0));
+    const std::pair<size_type, size_type> pos = find_position(key, hashval);
+    if ( pos.first == ILLEGAL_BUCKET ) {
+      const size_type old_pos = find_unmoved_position(key, hashval);
+      if ( old_pos != ILLEGAL_BUCKET ) {
+        move_from_old(old_pos, pos.second, hashval);
+        return std::pair<size_type,size_type>(pos.second, ILLEGAL_BUCKET);
+      }
+    }
+    return pos;
+  }
+
+  // Does the bookkeeping for a new entry in bucket pos, which must be
+  // where find_position() said it goes; the caller then stores the
+  // value there.  hashval is the hash of its key.
+  void prepare_insert_at(size_type pos, size_type hashval) {
     if (size() >= max_size()) {
       throw std::length_error("insert overflow");
     }
+    if (Policy::use_robin_hood) {
+      make_room_rh(pos, hashval);
+      ++num_elements;
+      return;
+    }
     if ( test_deleted(pos) ) {      // just replace if it's been del.
       // shrug: shouldn't need to be const.
       const_iterator delpos(this, table + pos, table + num_buckets, false);
@@ -924,27 +2465,64 @@ class dense_hashtable {
     } else {
       ++num_elements;               // replacing an empty bucket
     }
+    mark_full(pos, hashval);
+  }
+
+  // Private method used by insert_noresize and find_or_insert.
+  // hashval is hash(get_key(obj)).
+  iterator insert_at(const_reference obj, size_type pos, size_type hashval) {
+    prepare_insert_at(pos, hashval);
     set_value(&table[pos], obj);
     return iterator(this, table + pos, table + num_buckets, false);
   }
 
+#ifdef SPARSEHASH_CXX11
+  iterator insert_at(value_type&& obj, size_type pos, size_type hashval) {
+    prepare_insert_at(pos, hashval);
+    set_value(&table[pos], std::move(obj));
+    return iterator(this, table + pos, table + num_buckets, false);
+  }
+
+  // Like insert_at, but constructs the value from args.  We build it
+  // before touching the table, so that if its constructor throws, the
+  // counts, the side arrays and the bucket are all as they were.
+  template <class... Args>
+  iterator emplace_at(size_type pos, size_type hashval, Args&&... args) {
+    value_type obj(std::forward<Args>(args)...);
+    return insert_at(std::move(obj), pos, hashval);
+  }
+#endif
+
   // If you know *this is big enough to hold obj, use this routine
   std::pair<iterator, bool> insert_noresize(const_reference obj) {
-    // First, double-check we're not inserting delkey or emptyval
-    assert((!settings.use_empty() || !equals(get_key(obj),
-                                             get_key(val_info.emptyval)))
-           && "Inserting the empty key");
-    assert((!settings.use_deleted() || !equals(get_key(obj), key_info.delkey))
-           && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(get_key(obj));
+    const size_type hashval = hash(get_key(obj));
+    const std::pair<size_type,size_type> pos =
+        find_position_to_insert(get_key(obj), hashval);
+    if ( pos.first != ILLEGAL_BUCKET) {      // object was already there
+      return std::pair<iterator,bool>(iterator(this, table + pos.first,
+                                          table + num_buckets, false),
+                                 false);          // false: we didn't insert
+    } else {                                 // pos.second says where to put it
+      return std::pair<iterator,bool>(insert_at(obj, pos.second, hashval),
+                                      true);
+    }
+  }
+
+#ifdef SPARSEHASH_CXX11
+  std::pair<iterator, bool> insert_noresize(value_type&& obj) {
+    const size_type hashval = hash(get_key(obj));
+    const std::pair<size_type,size_type> pos =
+        find_position_to_insert(get_key(obj), hashval);
     if ( pos.first != ILLEGAL_BUCKET) {      // object was already there
       return std::pair<iterator,bool>(iterator(this, table + pos.first,
                                           table + num_buckets, false),
                                  false);          // false: we didn't insert
     } else {                                 // pos.second says where to put it
-      return std::pair<iterator,bool>(insert_at(obj, pos.second), true);
+      return std::pair<iterator,bool>(
+          insert_at(std::move(obj), pos.second, hashval), true);
     }
   }
+#endif
 
   // Specializations of insert(it, it) depending on the power of the iterator:
   // (1) Iterator supports operator-, resize before inserting
@@ -974,6 +2552,21 @@ class dense_hashtable {
     return insert_noresize(obj);
   }
 
+#ifdef SPARSEHASH_CXX11
+  std::pair<iterator, bool> insert(value_type&& obj) {
+    resize_delta(1);                      // adding an object, grow if need be
+    return insert_noresize(std::move(obj));
+  }
+
+  // We need the key to know where the value goes, so we construct the
+  // value first, then move it into its bucket.
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    value_type obj(std::forward<Args>(args)...);
+    return insert(std::move(obj));
+  }
+#endif
+
   // When inserting a lot at a time, we specialize on the type of iterator
   template <class InputIterator>
   void insert(InputIterator f, InputIterator l) {
@@ -984,14 +2577,11 @@ class dense_hashtable {
 
   // DefaultValue is a functor that takes a key and returns a value_type
   // representing the default value to be inserted if none is found.
-  template <class DefaultValue>
-  value_type& find_or_insert(const key_type& key) {
-    // First, double-check we're not inserting emptykey or delkey
-    assert((!settings.use_empty() || !equals(key, get_key(val_info.emptyval)))
-           && "Inserting the empty key");
-    assert((!settings.use_deleted() || !equals(key, key_info.delkey))
-           && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(key);
+  template <class DefaultValue, class K>
+  value_type& find_or_insert(const K& key) {
+    const size_type hashval = hash(key);
+    const std::pair<size_type,size_type> pos = find_position_to_insert(key,
+                                                                       hashval);
     DefaultValue default_value;
     if ( pos.first != ILLEGAL_BUCKET) {  // object was already there
       return table[pos.first];
@@ -999,20 +2589,50 @@ class dense_hashtable {
       // Since we resized, we can't use pos, so recalculate where to insert.
       return *insert_noresize(default_value(key)).first;
     } else {                             // no need to rehash, insert right here
-      return *insert_at(default_value(key), pos.second);
+      return *insert_at(default_value(key), pos.second, hashval);
+    }
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Like find_or_insert, but if key isn't there, constructs its value
+  // from args (see emplace_at()).  The bool is true if we inserted.
+  template <class... Args>
+  std::pair<iterator, bool> find_or_emplace(const key_type& key,
+                                            Args&&... args) {
+    const size_type hashval = hash(key);
+    std::pair<size_type,size_type> pos = find_position_to_insert(key, hashval);
+    if ( pos.first != ILLEGAL_BUCKET) {  // object was already there
+      return std::pair<iterator,bool>(iterator(this, table + pos.first,
+                                               table + num_buckets, false),
+                                      false);
+    }
+    if (resize_delta(1)) {               // needed to rehash to make room
+      // Since we resized, we can't use pos, so recalculate where to insert.
+      pos = find_position(key, hashval);
     }
+    return std::pair<iterator,bool>(
+        emplace_at(pos.second, hashval, std::forward<Args>(args)...), true);
   }
+#endif
 
 
   // DELETION ROUTINES
-  size_type erase(const key_type& key) {
+  template <class K>
+  size_type erase(const K& key) {
     // First, double-check we're not trying to erase delkey or emptyval.
-    assert((!settings.use_empty() || !equals(key, get_key(val_info.emptyval)))
+    assert((Policy::use_occupancy_bitmap || !settings.use_empty() ||
+            !equals(key, get_key(val_info.emptyval)))
            && "Erasing the empty key");
-    assert((!settings.use_deleted() || !equals(key, key_info.delkey))
+    assert((Policy::use_occupancy_bitmap || !settings.use_deleted() ||
+            !equals(key, key_info.delkey))
            && "Erasing the deleted key");
+    if ( old_ht() && find_position(key).first == ILLEGAL_BUCKET )
+      return old_ht()->erase(key);    // it may not have been moved yet
     const_iterator pos = find(key);   // shrug: shouldn't need to be const
-    if ( pos != end() ) {
+    if ( pos != end() && Policy::use_robin_hood ) {
+      erase_rh(pos.pos - table);
+      return 1;
+    } else if ( pos != end() ) {
       assert(!test_deleted(pos));  // or find() shouldn't have returned it
       set_deleted(pos);
       ++num_deleted;
@@ -1026,6 +2646,14 @@ class dense_hashtable {
   // We return the iterator past the deleted item.
   void erase(iterator pos) {
     if ( pos == end() ) return;    // sanity check
+    if ( pos.ht != this ) {        // it's in buckets we're growing out of
+      erase_from_old(pos, resizes_incrementally());
+      return;
+    }
+    if (Policy::use_robin_hood) {
+      erase_rh(pos.pos - table);
+      return;
+    }
     if ( set_deleted(pos) ) {      // true if object has been newly deleted
       ++num_deleted;
       settings.set_consider_shrink(true); // will think about shrink after next insert
@@ -1033,6 +2661,15 @@ class dense_hashtable {
   }
 
   void erase(iterator f, iterator l) {
+    if (Policy::use_robin_hood) {
+      erase_range_rh(f, l);
+      return;
+    }
+    if (old_ht()) {                  // the range may be in two tables
+      while (f != l)
+        erase(f++);
+      return;
+    }
     for ( ; f != l; ++f) {
       if ( set_deleted(f)  )       // should always be true
         ++num_deleted;
@@ -1047,12 +2684,29 @@ class dense_hashtable {
   // if it's const or not.
   void erase(const_iterator pos) {
     if ( pos == end() ) return;    // sanity check
+    if ( pos.ht != this ) {        // it's in buckets we're growing out of
+      erase_from_old(pos, resizes_incrementally());
+      return;
+    }
+    if (Policy::use_robin_hood) {
+      erase_rh(pos.pos - table);
+      return;
+    }
     if ( set_deleted(pos) ) {      // true if object has been newly deleted
       ++num_deleted;
       settings.set_consider_shrink(true); // will think about shrink after next insert
     }
   }
   void erase(const_iterator f, const_iterator l) {
+    if (Policy::use_robin_hood) {
+      erase_range_rh(f, l);
+      return;
+    }
+    if (old_ht()) {                  // the range may be in two tables
+      while (f != l)
+        erase(f++);
+      return;
+    }
     for ( ; f != l; ++f) {
       if ( set_deleted(f)  )       // should always be true
         ++num_deleted;
@@ -1061,6 +2715,131 @@ class dense_hashtable {
   }
 
 
+  // BATCH ROUTINES
+  // These look up, insert or erase n keys at once.  When the table is
+  // much bigger than the cache, that's faster than one at a time: we
+  // hash keys BATCH_DEPTH ahead of the one we're probing for, and
+  // prefetch the buckets they start at, so the cache misses overlap.
+ private:
+  static const size_type BATCH_DEPTH = 16;
+
+  // Hashes key, and prefetches the buckets we'll look at first for it.
+  template <class K>
+  size_type hash_and_prefetch(const K& key) const {
+    const size_type hashval = hash(key);
+    const size_type bucknum = home_bucket(hashval);
+    SPARSEHASH_PREFETCH(table + bucknum);
+    if (Policy::use_control_bytes)
+      SPARSEHASH_PREFETCH(ctrl() + bucknum);
+    if (Policy::use_robin_hood)
+      SPARSEHASH_PREFETCH(probe_len() + bucknum);
+    if (Policy::cache_hash)
+      SPARSEHASH_PREFETCH(hashes() + bucknum);
+    return hashval;
+  }
+
+  // For find_batch, const and not: Iterator is iterator or const_iterator.
+  template <class Table, class K, class Iterator>
+  static void find_batch(Table* ht, const K* keys, size_type n,
+                         Iterator* results) {
+    if (ht->size() == 0) {
+      std::fill(results, results + n, ht->end());
+      return;
+    }
+    size_type hashvals[BATCH_DEPTH];
+    for (size_type i = 0; i < n && i < BATCH_DEPTH; ++i)
+      hashvals[i] = ht->hash_and_prefetch(keys[i]);
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = hashvals[i % BATCH_DEPTH];
+      if (i + BATCH_DEPTH < n)
+        hashvals[i % BATCH_DEPTH] = ht->hash_and_prefetch(keys[i+BATCH_DEPTH]);
+      const std::pair<size_type, size_type> pos =
+          ht->find_position(keys[i], hashval);
+      if (pos.first != ILLEGAL_BUCKET) {
+        results[i] = Iterator(ht, ht->table + pos.first,
+                              ht->table + ht->num_buckets, false);
+        continue;
+      }
+      const size_type old_pos = ht->find_unmoved_position(keys[i], hashval);
+      if (old_pos == ILLEGAL_BUCKET)
+        results[i] = ht->end();
+      else
+        results[i] = ht->old_iterator(old_pos);
+    }
+  }
+
+ public:
+  // Sets results[i] to find(keys[i]), for i < n.
+  template <class K>
+  void find_batch(const K* keys, size_type n, iterator* results) {
+    find_batch(this, keys, n, results);
+  }
+  template <class K>
+  void find_batch(const K* keys, size_type n, const_iterator* results) const {
+    find_batch(this, keys, n, results);
+  }
+
+  // Inserts objs[0] to objs[n-1].  Like insert(f, l), this grows the
+  // table for all n first, even if some are already there.  Returns how
+  // many we inserted.
+  size_type insert_batch(const value_type* objs, size_type n) {
+    resize_delta(n);
+    size_type hashvals[BATCH_DEPTH];
+    for (size_type i = 0; i < n && i < BATCH_DEPTH; ++i)
+      hashvals[i] = hash_and_prefetch(get_key(objs[i]));
+    size_type num_inserted = 0;
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = hashvals[i % BATCH_DEPTH];
+      if (i + BATCH_DEPTH < n)
+        hashvals[i % BATCH_DEPTH] =
+            hash_and_prefetch(get_key(objs[i + BATCH_DEPTH]));
+      const std::pair<size_type, size_type> pos =
+          find_position_to_insert(get_key(objs[i]), hashval);
+      if (pos.first == ILLEGAL_BUCKET) {
+        insert_at(objs[i], pos.second, hashval);
+        ++num_inserted;
+      }
+    }
+    return num_inserted;
+  }
+
+  // Erases keys[0] to keys[n-1].  Returns how many were there to erase.
+  template <class K>
+  size_type erase_batch(const K* keys, size_type n) {
+    if (size() == 0)
+      return 0;
+    size_type hashvals[BATCH_DEPTH];
+    for (size_type i = 0; i < n && i < BATCH_DEPTH; ++i)
+      hashvals[i] = hash_and_prefetch(keys[i]);
+    size_type num_erased = 0;
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = hashvals[i % BATCH_DEPTH];
+      if (i + BATCH_DEPTH < n)
+        hashvals[i % BATCH_DEPTH] = hash_and_prefetch(keys[i + BATCH_DEPTH]);
+      assert((Policy::use_occupancy_bitmap || !settings.use_empty() ||
+              !equals(keys[i], get_key(val_info.emptyval)))
+             && "Erasing the empty key");
+      assert((Policy::use_occupancy_bitmap || !settings.use_deleted() ||
+              !equals(keys[i], key_info.delkey))
+             && "Erasing the deleted key");
+      const std::pair<size_type, size_type> pos = find_position(keys[i],
+                                                                hashval);
+      if (pos.first != ILLEGAL_BUCKET) {
+        erase(const_iterator(this, table + pos.first, table + num_buckets,
+                             false));
+        ++num_erased;
+      } else if (old_ht()) {
+        const size_type old_pos = find_unmoved_position(keys[i], hashval);
+        if (old_pos != ILLEGAL_BUCKET) {
+          old_ht()->erase(old_iterator(old_pos));
+          ++num_erased;
+        }
+      }
+    }
+    return num_erased;
+  }
+
+
   // COMPARISON
   bool operator==(const dense_hashtable& ht) const {
     if (size() != ht.size()) {
@@ -1092,6 +2871,41 @@ class dense_hashtable {
   // Every time the disk format changes, this should probably change too
   typedef unsigned long MagicNumberType;
   static const MagicNumberType MAGIC_NUMBER = 0x13578642;
+  // The magic number also says where the entries are.  MAGIC_NUMBER
+  // files use the default probe sequence on the unmixed hash, which is
+  // all there was once; MIXED_MAGIC_NUMBER ones the same probe
+  // sequence on the hash mixed by fibonacci_hash_mixing, as tables
+  // with integer keys use by default.  Tables whose policy changes the
+  // probe sequence (or mixes the hash some other way) put entries in
+  // buckets where neither would look for them, so we give their files
+  // another magic number, which only they accept.  They rehash after
+  // reading, so they can read any kind of file.  Everybody reads
+  // MAGIC_NUMBER files, rehashing if they have to.
+  static const MagicNumberType REHASH_MAGIC_NUMBER = 0x13578643;
+  static const MagicNumberType MIXED_MAGIC_NUMBER = 0x13578645;
+
+  static bool default_probing() {
+    return (!Policy::use_control_bytes && Policy::bucket_group_bytes == 0 &&
+            !Policy::use_robin_hood && !Policy::fastrange_buckets &&
+            base::is_same<typename Policy::probing, quadratic_probing>::value);
+  }
+  // Which of the magic numbers above fits our layout.
+  static MagicNumberType layout_magic() {
+    typedef typename Policy::hash_mixing hash_mixing;
+    if (!default_probing())
+      return REHASH_MAGIC_NUMBER;
+    if (!Settings::mixes_hash())
+      return MAGIC_NUMBER;
+    if (base::is_same<hash_mixing, default_hash_mixing>::value ||
+        base::is_same<hash_mixing, fibonacci_hash_mixing>::value)
+      return MIXED_MAGIC_NUMBER;
+    return REHASH_MAGIC_NUMBER;
+  }
+  // The layout of a table with the default policy and our key_type.
+  static MagicNumberType default_layout_magic() {
+    return (default_hash_mixing::mixes<key_type>() ?
+            MIXED_MAGIC_NUMBER : MAGIC_NUMBER);
+  }
 
  public:
   // I/O -- this is an add-on for writing hash table to disk
@@ -1108,13 +2922,133 @@ class dense_hashtable {
   template <typename ValueSerializer, typename OUTPUT>
   bool serialize(ValueSerializer serializer, OUTPUT *fp) {
     squash_deleted();           // so we don't have to worry about delkey
-    if ( !sparsehash_internal::write_bigendian_number(fp, MAGIC_NUMBER, 4) )
+    return write_header(fp) && write_buckets(serializer, fp);
+  }
+
+  // The same, for values with no pointers in them.  We buffer what we
+  // write, and write each run of full buckets with one call, but the
+  // file is just what the version above writes.
+  template <typename OUTPUT>
+  bool serialize(NopointerSerializer serializer, OUTPUT *fp) {
+    squash_deleted();
+    if ( !write_header(fp) )
+      return false;
+    sparsehash_internal::buffered_output<OUTPUT> out(fp);
+    return write_buckets(serializer, &out) && out.flush();
+  }
+
+  // INPUT: anything we've written an overload of read_data() for.
+  // ValueSerializer: a functor.  operator()(INPUT*, value_type*)
+  template <typename ValueSerializer, typename INPUT>
+  bool unserialize(ValueSerializer serializer, INPUT *fp) {
+    bool rehash;
+    return read_header(fp, &rehash) && read_buckets(serializer, fp, rehash);
+  }
+
+  // The same, for values with no pointers in them, reading ahead as
+  // far as the end of the table.
+  template <typename INPUT>
+  bool unserialize(NopointerSerializer serializer, INPUT *fp) {
+    bool rehash;
+    if ( !read_header(fp, &rehash) )
+      return false;
+    const size_t bitmap_bytes = (static_cast<size_t>(num_buckets) + 7) / 8;
+    sparsehash_internal::buffered_input<INPUT> in(
+        fp, bitmap_bytes + static_cast<size_t>(num_elements) *
+                           sizeof(value_type));
+    return read_buckets(serializer, &in, rehash);
+  }
+
+  // Writes the table in the format dense_hash_map_view maps: a
+  // mappable_table_header (see hashtable-common.h), then the bucket
+  // array just as dense_hashtable's default policy lays it out, so a
+  // reader can probe it in place.  Only for trivially copyable values,
+  // and the reader must use the same hasher.  Empty buckets hold the
+  // empty key, so the table must have one: use_occupancy_bitmap, which
+  // lets every key be inserted, has nothing to mark them with.  Tables
+  // with any other policy are laid out again in a scratch copy first,
+  // which takes as much memory as the bucket array does (with
+  // fastrange_buckets, up to twice as much, since the file needs a
+  // power of two of them).
+  template <typename OUTPUT>
+  bool write_mappable(OUTPUT *fp) {
+    SPARSEHASH_COMPILE_ASSERT(has_trivial_copy<value_type>::value,
+                              write_mappable_needs_trivially_copyable_values);
+    SPARSEHASH_COMPILE_ASSERT(!Policy::use_occupancy_bitmap,
+                              write_mappable_needs_an_empty_key);
+    assert(settings.use_empty() && "empty_key not set for write_mappable");
+    squash_deleted();
+    size_type file_buckets = num_buckets;
+    if (Policy::fastrange_buckets) {
+      for (file_buckets = HT_MIN_BUCKETS; file_buckets < num_buckets; )
+        file_buckets *= 2;
+    }
+    sparsehash_internal::mappable_table_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = sparsehash_internal::MAPPABLE_MAGIC_NUMBER;
+    header.word_size = sizeof(size_t);
+    header.value_size = sizeof(value_type);
+    header.num_buckets = file_buckets;
+    header.num_elements = num_elements;
+    const size_t align = sparsehash_internal::MAPPABLE_DATA_ALIGNMENT;
+    header.data_offset = ((sizeof(header) + sizeof(value_type) + align - 1) /
+                          align * align);
+    if ( !sparsehash_internal::write_data(fp, &header, sizeof(header)) )
+      return false;
+    if ( !sparsehash_internal::write_data(fp, &val_info.emptyval,
+                                          sizeof(value_type)) )
+      return false;
+    const char zeros[sparsehash_internal::MAPPABLE_DATA_ALIGNMENT] = { 0 };
+    const size_t padding = (header.data_offset - sizeof(header) -
+                            sizeof(value_type));
+    if ( padding > 0 && !sparsehash_internal::write_data(fp, zeros, padding) )
+      return false;
+
+    if (layout_magic() == default_layout_magic() &&
+        !Policy::use_generations) {
+      // Empty buckets hold emptyval, and everything is where
+      // find_position() looks for it: the table is the file.
+      return sparsehash_internal::write_data(
+          fp, table, static_cast<size_t>(num_buckets) * sizeof(value_type));
+    }
+    std::vector<char> scratch(static_cast<size_t>(file_buckets) *
+                              sizeof(value_type));
+    value_type* const buckets = reinterpret_cast<value_type*>(&scratch[0]);
+    for (size_type i = 0; i < file_buckets; ++i)
+      memcpy(static_cast<void*>(buckets + i), &val_info.emptyval,
+             sizeof(value_type));
+    const size_type bucket_count_minus_one = file_buckets - 1;
+    for (const_iterator it = begin(); it != end(); ++it) {
+      size_type num_probes = 0;
+      const size_type hashval = default_hash_mixing::mix<key_type>(
+          settings.unmixed_hash(get_key(*it)));
+      size_type bucknum = hashval & bucket_count_minus_one;
+      while (!equals(get_key(val_info.emptyval), get_key(buckets[bucknum]))) {
+        ++num_probes;
+        bucknum = (bucknum + num_probes) & bucket_count_minus_one;  // quadratic
+      }
+      memcpy(static_cast<void*>(buckets + bucknum), &*it, sizeof(value_type));
+    }
+    return sparsehash_internal::write_data(fp, &scratch[0], scratch.size());
+  }
+
+ private:
+  template <typename OUTPUT>
+  bool write_header(OUTPUT *fp) const {
+    if ( !sparsehash_internal::write_bigendian_number(
+             fp, layout_magic(), 4) )
       return false;
     if ( !sparsehash_internal::write_bigendian_number(fp, num_buckets, 8) )
       return false;
     if ( !sparsehash_internal::write_bigendian_number(fp, num_elements, 8) )
       return false;
-    // Now write a bitmap of non-empty buckets.
+    return true;
+  }
+
+  // Writes a bitmap of the non-empty buckets, a byte at a time, each
+  // byte followed by the values of the buckets it marks.
+  template <typename ValueSerializer, typename OUTPUT>
+  bool write_buckets(ValueSerializer serializer, OUTPUT *fp) const {
     for ( size_type i = 0; i < num_buckets; i += 8 ) {
       unsigned char bits = 0;
       for ( int bit = 0; bit < 8; ++bit ) {
@@ -1123,51 +3057,124 @@ class dense_hashtable {
       }
       if ( !sparsehash_internal::write_data(fp, &bits, sizeof(bits)) )
         return false;
-      for ( int bit = 0; bit < 8; ++bit ) {
-        if ( bits & (1 << bit) ) {
-          if ( !serializer(fp, table[i + bit]) ) return false;
+      for ( int bit = 0; bit < 8; ) {    // write each run of full buckets
+        if ( !(bits & (1 << bit)) ) {
+          ++bit;
+          continue;
         }
+        int end_bit = bit + 1;
+        while ( end_bit < 8 && (bits & (1 << end_bit)) )
+          ++end_bit;
+        if ( !write_values(serializer, fp, table + i + bit, end_bit - bit) )
+          return false;
+        bit = end_bit;
       }
     }
     return true;
   }
 
-  // INPUT: anything we've written an overload of read_data() for.
-  // ValueSerializer: a functor.  operator()(INPUT*, value_type*)
-  template <typename ValueSerializer, typename INPUT>
-  bool unserialize(ValueSerializer serializer, INPUT *fp) {
+  template <typename ValueSerializer, typename OUTPUT>
+  static bool write_values(ValueSerializer serializer, OUTPUT *fp,
+                           const value_type* values, int count) {
+    for ( int j = 0; j < count; ++j ) {
+      if ( !serializer(fp, values[j]) ) return false;
+    }
+    return true;
+  }
+  template <typename OUTPUT>
+  static bool write_values(NopointerSerializer, OUTPUT *fp,
+                           const value_type* values, int count) {
+    return sparsehash_internal::write_data(fp, values,
+                                           count * sizeof(value_type));
+  }
+
+  // Sets *rehash if the file's entries aren't where we'd look for them.
+  template <typename INPUT>
+  bool read_header(INPUT *fp, bool *rehash) {
     assert(settings.use_empty() && "empty_key not set for read");
 
     clear();                        // just to be consistent
     MagicNumberType magic_read;
     if ( !sparsehash_internal::read_bigendian_number(fp, &magic_read, 4) )
       return false;
-    if ( magic_read != MAGIC_NUMBER ) {
+    if ( magic_read != MAGIC_NUMBER && magic_read != layout_magic() &&
+         layout_magic() != REHASH_MAGIC_NUMBER ) {
       return false;
     }
+    if ( magic_read != MAGIC_NUMBER && magic_read != MIXED_MAGIC_NUMBER &&
+         magic_read != REHASH_MAGIC_NUMBER ) {
+      return false;
+    }
+    *rehash = (magic_read != layout_magic() ||
+               layout_magic() == REHASH_MAGIC_NUMBER);
     size_type new_num_buckets;
     if ( !sparsehash_internal::read_bigendian_number(fp, &new_num_buckets, 8) )
       return false;
     clear_to_size(new_num_buckets);
     if ( !sparsehash_internal::read_bigendian_number(fp, &num_elements, 8) )
       return false;
+    return true;
+  }
 
-    // Read the bitmap of non-empty buckets.
+  // Reads what write_buckets() wrote.
+  template <typename ValueSerializer, typename INPUT>
+  bool read_buckets(ValueSerializer serializer, INPUT *fp, bool rehash) {
     for (size_type i = 0; i < num_buckets; i += 8) {
       unsigned char bits;
       if ( !sparsehash_internal::read_data(fp, &bits, sizeof(bits)) )
         return false;
-      for ( int bit = 0; bit < 8; ++bit ) {
-        if ( i + bit < num_buckets && (bits & (1 << bit)) ) {  // not empty
-          if ( !serializer(fp, &table[i + bit]) ) return false;
+      for ( int bit = 0; bit < 8; ) {
+        if ( i + bit >= num_buckets || !(bits & (1 << bit)) ) {  // empty
+          ++bit;
+          continue;
+        }
+        int end_bit = bit + 1;
+        while ( end_bit < 8 && i + end_bit < num_buckets &&
+                (bits & (1 << end_bit)) )
+          ++end_bit;
+        if ( !read_values(serializer, fp, table + i + bit, end_bit - bit) )
+          return false;
+        for ( ; bit < end_bit; ++bit ) {
+          if (Policy::cache_hash)      // hashes aren't in the file
+            hashes()[i + bit] = hash(get_key(table[i + bit]));
+          // Just enough for the iterators to see the bucket is full.
+          if (Policy::use_control_bytes)
+            set_ctrl(i + bit, 0);
+          if (Policy::use_robin_hood)
+            probe_len()[i + bit] = 1;
+          if (Policy::use_occupancy_bitmap)
+            set_full_bit(i + bit);
+          if (Policy::use_generations)
+            generations()[i + bit] = current_generation();
         }
       }
     }
+    if (rehash) {
+      // The buckets are where the writer's probe sequence put them,
+      // which need not be where ours would look: rehash to fix that.
+      dense_hashtable tmp(MoveDontCopy, *this, num_buckets);
+      swap(tmp);
+    }
     return true;
   }
 
+  template <typename ValueSerializer, typename INPUT>
+  static bool read_values(ValueSerializer serializer, INPUT *fp,
+                          value_type* values, int count) {
+    for ( int j = 0; j < count; ++j ) {
+      if ( !serializer(fp, &values[j]) ) return false;
+    }
+    return true;
+  }
+  template <typename INPUT>
+  static bool read_values(NopointerSerializer, INPUT *fp,
+                          value_type* values, int count) {
+    return sparsehash_internal::read_data(fp, values,
+                                          count * sizeof(value_type));
+  }
+
  private:
-  template <class A>
+  template <class A, bool = sparsehash_internal::can_realloc<A>::value>
   class alloc_impl : public A {
    public:
     typedef typename A::pointer pointer;
@@ -1186,17 +3193,15 @@ class dense_hashtable {
     }
   };
 
-  // A template specialization of alloc_impl for
-  // libc_allocator_with_realloc that can handle realloc_or_die.
+  // A template specialization of alloc_impl for allocators that
+  // can handle realloc_or_die, such as libc_allocator_with_realloc.
   template <class A>
-  class alloc_impl<libc_allocator_with_realloc<A> >
-      : public libc_allocator_with_realloc<A> {
+  class alloc_impl<A, true> : public A {
    public:
-    typedef typename libc_allocator_with_realloc<A>::pointer pointer;
-    typedef typename libc_allocator_with_realloc<A>::size_type size_type;
+    typedef typename A::pointer pointer;
+    typedef typename A::size_type size_type;
 
-    alloc_impl(const libc_allocator_with_realloc<A>& a)
-        : libc_allocator_with_realloc<A>(a) { }
+    alloc_impl(const A& a) : A(a) { }
 
     pointer realloc_or_die(pointer ptr, size_type n) {
       pointer retval = this->reallocate(ptr, n);
@@ -1232,13 +3237,27 @@ class dense_hashtable {
   // zero-size functors.  Since ExtractKey and hasher's operator() might
   // have the same function signature, they must be packaged in
   // different classes.
+  // The statistics, being empty unless they're turned on, go here too.
   struct Settings :
       sparsehash_internal::sh_hashtable_settings<key_type, hasher,
-                                                 size_type, HT_MIN_BUCKETS> {
+                                                 size_type, HT_MIN_BUCKETS,
+                                                 typename Policy::hash_mixing>,
+      Policy::statistics {
     explicit Settings(const hasher& hf)
-        : sparsehash_internal::sh_hashtable_settings<key_type, hasher,
-                                                     size_type, HT_MIN_BUCKETS>(
+        : sparsehash_internal::sh_hashtable_settings<
+              key_type, hasher, size_type, HT_MIN_BUCKETS,
+              typename Policy::hash_mixing>(
             hf, HT_OCCUPANCY_PCT / 100.0f, HT_EMPTY_PCT / 100.0f) {}
+
+    // With Policy::fastrange_buckets, any bucket count will do.
+    size_type min_buckets(size_type num_elts, size_type min_buckets_wanted) {
+      if (Policy::fastrange_buckets)
+        return this->min_buckets_any_size(num_elts, min_buckets_wanted);
+      return sparsehash_internal::sh_hashtable_settings<
+          key_type, hasher, size_type, HT_MIN_BUCKETS,
+          typename Policy::hash_mixing>::min_buckets(num_elts,
+                                                     min_buckets_wanted);
+    }
   };
 
   // Packages ExtractKey and SetKey functors.
@@ -1247,7 +3266,8 @@ class dense_hashtable {
     KeyInfo(const ExtractKey& ek, const SetKey& sk, const EqualKey& eq)
         : ExtractKey(ek),
           SetKey(sk),
-          EqualKey(eq) {
+          EqualKey(eq),
+          delkey() {
     }
 
     // We want to return the exact same type as ExtractKey: Key or const Key&
@@ -1257,7 +3277,8 @@ class dense_hashtable {
     void set_key(pointer v, const key_type& k) const {
       SetKey::operator()(v, k);
     }
-    bool equals(const key_type& a, const key_type& b) const {
+    template <class K>
+    bool equals(const K& a, const key_type& b) const {
       return EqualKey::operator()(a, b);
     }
 
@@ -1267,10 +3288,12 @@ class dense_hashtable {
   };
 
   // Utility functions to access the templated operators
-  size_type hash(const key_type& v) const {
+  template <class K>
+  size_type hash(const K& v) const {
     return settings.hash(v);
   }
-  bool equals(const key_type& a, const key_type& b) const {
+  template <class K>
+  bool equals(const K& a, const key_type& b) const {
     return key_info.equals(a, b);
   }
   typename ExtractKey::result_type get_key(const_reference v) const {
@@ -1294,17 +3317,23 @@ class dense_hashtable {
 
 
 // We need a global swap as well
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-inline void swap(dense_hashtable<V,K,HF,ExK,SetK,EqK,A> &x,
-                 dense_hashtable<V,K,HF,ExK,SetK,EqK,A> &y) {
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+inline void swap(dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> &x,
+                 dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> &y) {
   x.swap(y);
 }
 
-#undef JUMP_
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::size_type
-  dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::ILLEGAL_BUCKET;
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::size_type
+  dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::ILLEGAL_BUCKET;
+
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::size_type
+  dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::OCCUPANCY_WORD_BITS;
 
 // How full we let the table get before we resize.  Knuth says .8 is
 // good -- higher causes us to probe too much, though saves memory.
@@ -1312,16 +3341,20 @@ const typename dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::size_type
 // more space (a trade-off densehashtable explicitly chooses to make).
 // Feel free to play around with different values, though, via
 // max_load_factor() and/or set_resizing_parameters().
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT = 50;
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::HT_OCCUPANCY_PCT = 50;
 
 // How empty we let the table get before we resize lower.
 // It should be less than OCCUPANCY_PCT / 2 or we thrash resizing.
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_EMPTY_PCT
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const int dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::HT_EMPTY_PCT
   = static_cast<int>(0.4 *
-                     dense_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT);
+                     dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::
+                         HT_OCCUPANCY_PCT);
 
+#undef SPARSEHASH_COMPILE_ASSERT
 _END_GOOGLE_NAMESPACE_
 
 #endif /* _DENSEHASHTABLE_H_ */
@@ -44,8 +44,52 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stddef.h>                  // for size_t
+#include <string.h>                  // for memcpy
 #include <iosfwd>
 #include <stdexcept>                 // For length_error
+#include <vector>                    // for memory_breakdown
+#include <sparsehash/type_traits.h>  // for is_integral, is_pointer
+
+// With C++11 (rvalue references and variadic templates), the dense
+// containers can move values in and out of buckets and construct them
+// in place.  Without it, they copy.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+# define SPARSEHASH_CXX11 1
+#endif
+// Marks the move operations that can't throw, or that can't when cond
+// holds.  MSVC 2013 has moves but not noexcept.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+# define SPARSEHASH_NOEXCEPT noexcept
+# define SPARSEHASH_NOEXCEPT_IF(cond) noexcept(cond)
+#else
+# define SPARSEHASH_NOEXCEPT
+# define SPARSEHASH_NOEXCEPT_IF(cond)
+#endif
+
+// Define SPARSEHASH_PARALLEL_RESIZE before including any of our headers
+// to let a big resize spread its work over set_resize_threads() threads.
+// It needs C++11.  Without it, every resize runs on the calling thread
+// and we don't include <thread>.  The macro changes the bodies of inline
+// functions, so every file in a program must agree on it: define it in
+// the build flags, not in one source file.
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+# ifndef SPARSEHASH_CXX11
+#  error SPARSEHASH_PARALLEL_RESIZE needs C++11
+# endif
+# include <sparsehash/internal/run_in_parallel.h>
+#endif
+
+// Tells the CPU we'll soon read the memory at addr.  It's only a hint,
+// so addr needn't be a valid address.
+#if defined(__GNUC__)
+# define SPARSEHASH_PREFETCH(addr)  __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+# include <xmmintrin.h>
+# define SPARSEHASH_PREFETCH(addr)  \
+  _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+# define SPARSEHASH_PREFETCH(addr)  ((void)0)
+#endif
 
 _START_GOOGLE_NAMESPACE_
 
@@ -53,6 +97,48 @@ template <bool> struct SparsehashCompileAssert { };
 #define SPARSEHASH_COMPILE_ASSERT(expr, msg) \
   __attribute__((unused)) typedef SparsehashCompileAssert<(bool(expr))> msg[bool(expr) ? 1 : -1]
 
+// Hash mixers, for the hash_mixing typedef of dense_hashtable_policy
+// and sparse_hashtable_policy.  The tables pick buckets by the low
+// bits of the hash, so a hash whose low bits don't vary -- the
+// identity hash most standard libraries use for integers, given keys
+// that are all multiples of 1024, say -- puts everything in a few
+// buckets.  A mixer scrambles the hash before the table uses it.
+// mix<Key>(hash) is what the table uses instead of hash, for keys of
+// type Key, and mixes<Key>() is whether that's anything but hash.
+//
+// default_hash_mixing: fibonacci_hash_mixing for integer and pointer
+//    keys, which are the ones usually hashed by the identity (pointers
+//    are munged first, see sh_hashtable_settings); nothing for the
+//    rest.  The default.
+// fibonacci_hash_mixing: multiplies by 2^64 (or 2^32) divided by the
+//    golden ratio, which spreads every bit of the hash over the upper
+//    half of the product, then folds the upper half onto the lower.
+//    A multiply, a shift and an xor.
+// no_hash_mixing: uses the hash as it is.  For hash functions that are
+//    already good in their low bits, where mixing is wasted work.
+struct fibonacci_hash_mixing {
+  template <class Key> static size_t mix(size_t hash) {
+    const size_t mult = (sizeof(size_t) == 8 ?
+                         static_cast<size_t>(0x9E3779B97F4A7C15ULL) :
+                         static_cast<size_t>(0x9E3779B9UL));
+    hash *= mult;
+    return hash ^ (hash >> (sizeof(size_t) * 4));
+  }
+  template <class Key> static bool mixes() { return true; }
+};
+struct no_hash_mixing {
+  template <class Key> static size_t mix(size_t hash) { return hash; }
+  template <class Key> static bool mixes() { return false; }
+};
+struct default_hash_mixing {
+  template <class Key> static size_t mix(size_t hash) {
+    return (mixes<Key>() ? fibonacci_hash_mixing::mix<Key>(hash) : hash);
+  }
+  template <class Key> static bool mixes() {
+    return is_integral<Key>::value || is_pointer<Key>::value;
+  }
+};
+
 namespace sparsehash_internal {
 
 // Adaptor methods for reading/writing data from an INPUT or OUPTUT
@@ -186,6 +272,96 @@ bool write_bigendian_number(OUTPUT* fp, IntType value, size_t length) {
   return true;
 }
 
+// Wrappers that the NopointerSerializer fast paths of serialize() and
+// unserialize() put around the caller's stream, so that writing or
+// reading a value costs a memcpy rather than a call into stdio or
+// iostreams.  They're legal OUTPUTs and INPUTs themselves (they have
+// Write() and Read()).  Big enough writes and reads skip the buffer.
+static const size_t SERIALIZE_BUFFER_SIZE = 1 << 16;
+
+template <typename OUTPUT>
+class buffered_output {
+ public:
+  explicit buffered_output(OUTPUT* fp)
+      : fp_(fp), buffer_(new char[SERIALIZE_BUFFER_SIZE]), used_(0) { }
+  ~buffered_output() { delete[] buffer_; }   // the caller must flush()
+
+  size_t Write(const void* data, size_t length) {
+    if (used_ + length > SERIALIZE_BUFFER_SIZE) {
+      if (!flush())
+        return 0;
+      if (length >= SERIALIZE_BUFFER_SIZE)
+        return write_data(fp_, data, length) ? length : 0;
+    }
+    memcpy(buffer_ + used_, data, length);
+    used_ += length;
+    return length;
+  }
+
+  bool flush() {
+    const size_t length = used_;
+    used_ = 0;
+    return length == 0 || write_data(fp_, buffer_, length);
+  }
+
+ private:
+  buffered_output(const buffered_output&);
+  void operator=(const buffered_output&);
+
+  OUTPUT* fp_;
+  char* buffer_;
+  size_t used_;
+};
+
+// Reads ahead, but never past the remaining bytes the caller says are
+// left of what it's reading, so fp is left just where unbuffered reads
+// would leave it.
+template <typename INPUT>
+class buffered_input {
+ public:
+  buffered_input(INPUT* fp, size_t remaining)
+      : fp_(fp), buffer_(new char[SERIALIZE_BUFFER_SIZE]),
+        pos_(0), end_(0), remaining_(remaining) { }
+  ~buffered_input() { delete[] buffer_; }
+
+  size_t Read(void* data, size_t length) {
+    if (pos_ + length > end_) {
+      const size_t buffered = end_ - pos_;
+      memcpy(data, buffer_ + pos_, buffered);
+      pos_ = end_ = 0;
+      char* const rest = static_cast<char*>(data) + buffered;
+      const size_t rest_length = length - buffered;
+      if (rest_length > remaining_)
+        return 0;
+      if (rest_length >= SERIALIZE_BUFFER_SIZE) {
+        remaining_ -= rest_length;
+        return read_data(fp_, rest, rest_length) ? length : 0;
+      }
+      end_ = (remaining_ < SERIALIZE_BUFFER_SIZE ?
+              remaining_ : SERIALIZE_BUFFER_SIZE);
+      remaining_ -= end_;
+      if (!read_data(fp_, buffer_, end_))
+        return 0;
+      memcpy(rest, buffer_, rest_length);
+      pos_ = rest_length;
+      return length;
+    }
+    memcpy(data, buffer_ + pos_, length);
+    pos_ += length;
+    return length;
+  }
+
+ private:
+  buffered_input(const buffered_input&);
+  void operator=(const buffered_input&);
+
+  INPUT* fp_;
+  char* buffer_;
+  size_t pos_;           // next byte of buffer_ to hand out
+  size_t end_;           // how much of buffer_ holds data
+  size_t remaining_;     // how much is left to read from fp_
+};
+
 // If your keys and values are simple enough, you can pass this
 // serializer to serialize()/unserialize().  "Simple enough" means
 // value_type is a POD type that contains no pointers.  Note,
@@ -203,6 +379,76 @@ template <typename value_type> struct pod_serializer {
   }
 };
 
+// The header of the file dense_hashtable::write_mappable() writes and
+// dense_hash_map_view maps.  After it comes the empty bucket, then
+// zeros up to data_offset, then the bucket array exactly as it is in
+// memory.  Everything is in the writer's byte order and word size, so
+// only the same kind of machine can read it back.
+struct mappable_table_header {
+  unsigned int magic;              // MAPPABLE_MAGIC_NUMBER
+  unsigned int word_size;          // sizeof(size_t)
+  size_t value_size;               // sizeof(value_type)
+  size_t num_buckets;              // always a power of two
+  size_t num_elements;
+  size_t data_offset;              // where the buckets start
+};
+static const unsigned int MAPPABLE_MAGIC_NUMBER = 0x13578644;
+// data_offset is a multiple of this, so that the buckets, once the
+// file is mapped at a page boundary, start on a cache line.
+static const size_t MAPPABLE_DATA_ALIGNMENT = 64;
+
+
+// enable_if_transparent<HashFcn, EqualKey, K, Result>::type is Result
+// if both HashFcn and EqualKey define is_transparent (the way
+// std::equal_to<> does), and doesn't exist otherwise.  The containers
+// use it to offer lookups by any type K those functors take, next to
+// the usual ones by key_type, so that looking up a table of strings by
+// a const char*, say, doesn't have to build a string.  (K only has to
+// appear so the test happens when the lookup is instantiated.)
+template <class T>
+struct has_is_transparent {
+  typedef char yes;
+  struct no { char dummy[2]; };
+  template <class U> static yes test(typename U::is_transparent*);
+  template <class U> static no test(...);
+  static const bool value = sizeof(test<T>(0)) == sizeof(yes);
+};
+
+template <bool Enable, class Result> struct enable_if_transparent_impl { };
+template <class Result> struct enable_if_transparent_impl<true, Result> {
+  typedef Result type;
+};
+
+template <class HashFcn, class EqualKey, class K, class Result>
+struct enable_if_transparent
+    : enable_if_transparent_impl<(has_is_transparent<HashFcn>::value &&
+                                  has_is_transparent<EqualKey>::value),
+                                 Result> {
+};
+
+// Which of num_buckets buckets hash goes in, when num_buckets needn't
+// be a power of two: the upper half of hash * num_buckets, which is
+// hash / 2^(bits in size_t) scaled to [0, num_buckets).  This is
+// Lemire's "fastrange"; it costs a multiply where a power-of-two
+// table's mask costs an and.  It looks only at the upper bits of
+// hash, so those must be as good as the lower ones.
+inline size_t fastrange(size_t hash, size_t num_buckets) {
+#if defined(__SIZEOF_INT128__)
+  if (sizeof(size_t) == 8) {
+    __extension__ typedef unsigned __int128 uint128;
+    return static_cast<size_t>((static_cast<uint128>(hash) * num_buckets)
+                               >> 64);
+  }
+#endif
+  // Multiply a half-word at a time, keeping the carries.
+  const int half = sizeof(size_t) * 4;
+  const size_t lower = (static_cast<size_t>(1) << half) - 1;
+  const size_t hash_lo = hash & lower, hash_hi = hash >> half;
+  const size_t n_lo = num_buckets & lower, n_hi = num_buckets >> half;
+  const size_t t = hash_hi * n_lo + ((hash_lo * n_lo) >> half);
+  const size_t mid = hash_lo * n_hi + (t & lower);
+  return hash_hi * n_hi + (t >> half) + (mid >> half);
+}
 
 // Settings contains parameters for growing and shrinking the table.
 // It also packages zero-size functor (ie. hasher).
@@ -215,14 +461,17 @@ template <typename value_type> struct pod_serializer {
 // isn't perfect: even when the key is a pointer, we can't tell
 // for sure that the hash is the identity hash.  If it's not, this
 // is needless work (and possibly, though not likely, harmful).
+// After that, HashMixing (see above) may scramble it some more.
 
 template<typename Key, typename HashFunc,
-         typename SizeType, int HT_MIN_BUCKETS>
+         typename SizeType, int HT_MIN_BUCKETS,
+         typename HashMixing = default_hash_mixing>
 class sh_hashtable_settings : public HashFunc {
  public:
   typedef Key key_type;
   typedef HashFunc hasher;
   typedef SizeType size_type;
+  typedef HashMixing hash_mixing;
 
  public:
   sh_hashtable_settings(const hasher& hf,
@@ -234,15 +483,28 @@ class sh_hashtable_settings : public HashFunc {
         consider_shrink_(false),
         use_empty_(false),
         use_deleted_(false),
+        resize_threads_(1),
         num_ht_copies_(0) {
     set_enlarge_factor(ht_occupancy_flt);
     set_shrink_factor(ht_empty_flt);
   }
 
-  size_type hash(const key_type& v) const {
+  // v is a key_type, or with is_transparent_lookup, anything hasher
+  // takes.  Either way we munge as for key_type, so the hashes agree.
+  template <class K>
+  size_type hash(const K& v) const {
+    return HashMixing::template mix<Key>(unmixed_hash(v));
+  }
+  // The hash before HashMixing gets to it.
+  template <class K>
+  size_type unmixed_hash(const K& v) const {
     // We munge the hash value when we don't trust hasher::operator().
     return hash_munger<Key>::MungedHash(hasher::operator()(v));
   }
+  // Whether hash() is anything but unmixed_hash().
+  static bool mixes_hash() {
+    return HashMixing::template mixes<Key>();
+  }
 
   float enlarge_factor() const {
     return enlarge_factor_;
@@ -305,6 +567,14 @@ class sh_hashtable_settings : public HashFunc {
     ++num_ht_copies_;
   }
 
+  int resize_threads() const {
+    return resize_threads_;
+  }
+  void set_resize_threads(int n) {
+    resize_threads_ = static_cast<unsigned char>(n < 1 ? 1 :
+                                                 n > 255 ? 255 : n);
+  }
+
   // Reset the enlarge and shrink thresholds
   void reset_thresholds(size_type num_buckets) {
     set_enlarge_threshold(enlarge_size(num_buckets));
@@ -341,6 +611,29 @@ class sh_hashtable_settings : public HashFunc {
     return sz;
   }
 
+  // The same, for tables whose bucket count needn't be a power of two:
+  // the fewest buckets, but at least min_buckets_wanted, that hold
+  // num_elts.  When that's more than min_buckets_wanted, we take at
+  // least 1.25 times as many, so a table growing from its bucket count
+  // doesn't copy itself again a few inserts later.
+  size_type min_buckets_any_size(size_type num_elts,
+                                 size_type min_buckets_wanted) {
+    size_type sz = (min_buckets_wanted < HT_MIN_BUCKETS ?
+                    static_cast<size_type>(HT_MIN_BUCKETS) :
+                    min_buckets_wanted);
+    if (num_elts < enlarge_size(sz))
+      return sz;
+    const double needed = static_cast<double>(num_elts) / enlarge_factor();
+    if (needed >= static_cast<double>(static_cast<size_type>(-1) / 2)) {
+      throw std::length_error("resize overflow");  // protect against overflow
+    }
+    size_type fewest = static_cast<size_type>(needed) + 1;
+    while (num_elts >= enlarge_size(fewest))    // float rounding
+      ++fewest;
+    const size_type step = sz + sz / 4;
+    return fewest > step ? fewest : step;
+  }
+
  private:
   template<class HashKey> class hash_munger {
    public:
@@ -369,12 +662,154 @@ class sh_hashtable_settings : public HashFunc {
   bool consider_shrink_;
   bool use_empty_;    // used only by densehashtable, not sparsehashtable
   bool use_deleted_;  // false until delkey has been set
+  // how many threads copy_from and move_from may use; 1 means no others.
+  // A byte fits in the padding before num_ht_copies_.
+  unsigned char resize_threads_;
   // num_ht_copies is a counter incremented every Copy/Move
   unsigned int num_ht_copies_;
 };
 
+// Holds a T that a table only needs for some settings of its policy.
+// When Enabled is false it holds nothing: get() is always T() and
+// set() does nothing, so a table that inherits it (much as Settings
+// inherits the statistics) doesn't pay for a knob that's off.  Tag
+// tells apart two of them with the same T.
+template <class Tag, class T, bool Enabled>
+class policy_member {
+ public:
+  explicit policy_member(const T& v = T()) : value_(v) { }
+  T get() const { return value_; }
+  void set(const T& v) { value_ = v; }
+
+ private:
+  T value_;
+};
+
+template <class Tag, class T>
+class policy_member<Tag, T, false> {
+ public:
+  explicit policy_member(const T& = T()) { }
+  T get() const { return T(); }
+  void set(const T&) { }
+};
+
 }  // namespace sparsehash_internal
 
+// Probe sequences, for the probing typedef of dense_hashtable_policy
+// and sparse_hashtable_policy.  jump(num_probes) is how far probe
+// number num_probes is from the one before it (the first probe is
+// probe 0).  In a power-of-two table, both of these visit every bucket
+// before they come back to one.
+//
+// quadratic_probing: jumps of 1, 2, 3, ..., so probe n is n(n+1)/2
+//    buckets past the first ("triangular" probing).  Keys that hash to
+//    neighbouring buckets soon go their separate ways, so this copes
+//    well with clustered keys.  The default.
+// linear_probing: jumps of 1.  Consecutive probes mostly share a cache
+//    line, and the hardware prefetcher follows the rest, so with small
+//    values and a good hash this is usually faster; but runs of full
+//    buckets grow long if the hash clusters.
+struct quadratic_probing {
+  static size_t jump(size_t num_probes) { return num_probes; }
+};
+struct linear_probing {
+  static size_t jump(size_t) { return 1; }
+};
+
+// What a table costs, as memory_usage() reports it.  Everything is in
+// bytes, and counted from the sizes of the types and arrays involved,
+// without walking the elements; what the allocator adds to each
+// allocation (its header, and rounding up) isn't included, but
+// num_allocations says how many there are, so you can add it.
+//
+// object_bytes: the table object itself, including the copies of the
+//    empty and deleted keys that it keeps.
+// bucket_bytes: the values, and the room for them: every bucket of a
+//    dense table, full or not; just the full ones in a sparse table,
+//    whose groups allocate exactly that many values.
+// bookkeeping_bytes: everything else on the heap: a dense table's side
+//    arrays (control bytes, cached hashes, and so on), or a sparse
+//    table's groups (each with its bitmap) and the vector holding them.
+// group_sizes: only filled in if you ask for it, and only for sparse
+//    tables: group_sizes[n] is how many groups hold n values, and so
+//    allocate n * sizeof(value_type) bytes (none at all, for n == 0).
+struct memory_breakdown {
+  memory_breakdown()
+      : object_bytes(0), bucket_bytes(0), bookkeeping_bytes(0),
+        num_allocations(0) { }
+
+  size_t total() const {
+    return object_bytes + bucket_bytes + bookkeeping_bytes;
+  }
+
+  size_t object_bytes;
+  size_t bucket_bytes;
+  size_t bookkeeping_bytes;
+  size_t num_allocations;
+  std::vector<size_t> group_sizes;
+};
+
+// STATISTICS
+// Policy::statistics is told about everything a table does that says
+// how well it's working.  no_statistics, the default, ignores it all,
+// takes no room (tables hold it as an empty base class) and compiles
+// to nothing.  hashtable_statistics, in <sparsehash/hashtable_statistics>
+// (which only tables that count need include), counts it up;
+// statistics() on the table gives you a hashtable_stats with the
+// counts so far.
+//
+// lookups: how many times the table looked for a key, whether to find,
+//    insert or erase it.  hits + misses == lookups.
+// probe_lengths[n]: how many of those lookups probed n buckets past
+//    the one the key hashes to (n groups, with control bytes).  The
+//    last entry counts all lookups that went at least that far.
+// tombstones: how many deleted buckets the lookups probed past.  A
+//    table that needs lots of these wants resize(0) to clear them out.
+// resizes: how many times the table grew or shrank its buckets.
+// copies, copy_seconds: calls to copy_from() and move_from(), which
+//    fill a new table from an old one when resizing or copying, and to
+//    dense_hashtable's rehash_in_place(), which resizes without them;
+//    and how long they took (by the wall clock with C++11; otherwise
+//    clock()).
+//
+// A copy of a table starts with the counts of the one it was copied
+// from.  Const lookups still bump the counts, and a table may be shared
+// by several threads that only read it, so with C++11 the counts are
+// relaxed atomics: those lookups are all counted, without racing, and
+// a snapshot taken meanwhile may have some counts from a little later
+// than others.  Without C++11, they're plain integers, and only count
+// right in a table used from one thread at a time.
+struct hashtable_stats {
+  enum { kNumProbeLengths = 16 };
+
+  hashtable_stats()
+      : lookups(0), hits(0), misses(0), tombstones(0), resizes(0),
+        copies(0), copy_seconds(0.0) {
+    for (int i = 0; i < kNumProbeLengths; ++i)
+      probe_lengths[i] = 0;
+  }
+
+  size_t lookups;
+  size_t hits;
+  size_t misses;
+  size_t probe_lengths[kNumProbeLengths];
+  size_t tombstones;
+  size_t resizes;
+  size_t copies;
+  double copy_seconds;
+};
+
+struct no_statistics {
+  enum { enabled = false };
+  void record_lookup(size_t /*num_probes*/, bool /*found*/) const { }
+  void record_tombstone() const { }
+  void record_resize() const { }
+  double start_copy() const { return 0.0; }
+  void record_copy(double /*start*/) const { }
+  hashtable_stats stats_snapshot() const { return hashtable_stats(); }
+  void reset_stats() { }
+};
+
 #undef SPARSEHASH_COMPILE_ASSERT
 _END_GOOGLE_NAMESPACE_
 
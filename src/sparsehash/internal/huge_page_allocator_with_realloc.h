@@ -0,0 +1,351 @@
+// Copyright (c) 2010, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// An allocator like libc_allocator_with_realloc, except that arrays of
+// at least Threshold bytes are mapped directly with mmap() and backed
+// by 2MB huge pages where the OS allows it.  A big dense_hash_map
+// probes all over its bucket array, and with 4K pages nearly every
+// probe is also a TLB miss; with huge pages, far fewer are.
+//
+// On Linux, we first ask for explicit hugetlb pages (MAP_HUGETLB),
+// which only succeeds if the administrator has reserved some.
+// Otherwise we map normal pages on a 2MB boundary and mark them
+// MADV_HUGEPAGE, so transparent huge pages will back them.
+// reallocate() grows a mapping with mremap(), which moves the pages
+// rather than copying them, and shrinks one by handing the no longer
+// needed pages back with MADV_DONTNEED.  Smaller arrays, and all
+// arrays on other systems, come from malloc() and realloc().
+//
+// Like aligned_allocator_with_realloc, we keep a small header just
+// before the array we return, to know how it was allocated and how
+// big it is.  As with libc_allocator_with_realloc, only use
+// reallocate() on types that may be moved with memcpy.
+
+#ifndef UTIL_GTL_HUGE_PAGE_ALLOCATOR_WITH_REALLOC_H_
+#define UTIL_GTL_HUGE_PAGE_ALLOCATOR_WITH_REALLOC_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <stdlib.h>           // for malloc/realloc/free
+#include <stddef.h>           // for ptrdiff_t
+#include <string.h>           // for memcpy
+#include <new>                // for placement new
+#include <sparsehash/internal/libc_allocator_with_realloc.h>  // can_realloc
+#if defined(__linux__)
+#include <sys/mman.h>         // for mmap/mremap/madvise/munmap
+#define SPARSEHASH_HAVE_HUGE_PAGES 1
+#endif
+
+_START_GOOGLE_NAMESPACE_
+
+template<class T, size_t Threshold = (2 << 20)>
+class huge_page_allocator_with_realloc {
+ public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+
+  static const size_t threshold = Threshold;
+  static const size_t huge_page_size = 2 << 20;
+
+  huge_page_allocator_with_realloc() {}
+  huge_page_allocator_with_realloc(const huge_page_allocator_with_realloc&) {}
+  ~huge_page_allocator_with_realloc() {}
+
+  pointer address(reference r) const  { return &r; }
+  const_pointer address(const_reference r) const  { return &r; }
+
+  pointer allocate(size_type n, const_pointer = 0) {
+    const size_t bytes = n * sizeof(value_type);
+    if (use_pages(bytes))
+      return map_array(bytes);
+    header* h = static_cast<header*>(malloc(sizeof(header) + bytes));
+    if (h == NULL)
+      return NULL;
+    h->mapped = 0;
+    h->bytes = bytes;
+    h->hugetlb = false;
+    return array_of(h);
+  }
+  void deallocate(pointer p, size_type) {
+    if (p == NULL)
+      return;
+    header* h = get_header(p);
+    if (h->mapped)
+      unmap(h, h->mapped);
+    else
+      free(h);
+  }
+  pointer reallocate(pointer p, size_type n) {
+    // p points to a storage array whose objects may be moved with memcpy
+    if (p == NULL)
+      return allocate(n);
+    header* h = get_header(p);
+    const size_t bytes = n * sizeof(value_type);
+    if (h->mapped == 0) {
+      if (use_pages(bytes))
+        return move_array(p, bytes);
+      h = static_cast<header*>(realloc(h, sizeof(header) + bytes));
+      if (h == NULL)
+        return NULL;
+      h->bytes = bytes;
+      return array_of(h);
+    }
+    if (sizeof(header) + bytes <= h->mapped) {
+      // Keep the mapping, so we can grow into it again, but give back
+      // the huge pages we no longer use.
+      release_pages(h, bytes);
+      h->bytes = bytes;
+      return p;
+    }
+    return remap_array(p, bytes);
+  }
+
+  size_type max_size() const  {
+    return (static_cast<size_type>(-1) - sizeof(header) - huge_page_size) /
+        sizeof(value_type);
+  }
+
+  void construct(pointer p, const value_type& val) {
+    new(p) value_type(val);
+  }
+  void destroy(pointer p) { p->~value_type(); }
+
+  // Says whether the array at p is backed by mmap'ed pages rather
+  // than by malloc.  Mostly useful for tests.
+  static bool is_mapped(const_pointer p) {
+    return p != NULL && get_header(const_cast<pointer>(p))->mapped != 0;
+  }
+
+  template <class U>
+  huge_page_allocator_with_realloc(
+      const huge_page_allocator_with_realloc<U, Threshold>&) {}
+
+  template<class U>
+  struct rebind {
+    typedef huge_page_allocator_with_realloc<U, Threshold> other;
+  };
+
+ private:
+  // Stored just before the array we return.  For mapped arrays it is
+  // at the start of the mapping; for the others, at the start of what
+  // malloc gave us.  Its size keeps the array on a cache line when it
+  // is mapped.
+  struct header {
+    size_t mapped;            // bytes mapped, or 0 if we used malloc
+    size_t bytes;             // how much of the array is in use
+    bool hugetlb;             // true if backed by explicit hugetlb pages
+    char padding[64 - 2 * sizeof(size_t) - sizeof(bool)];
+  };
+
+  static pointer array_of(header* h) {
+    return reinterpret_cast<pointer>(h + 1);
+  }
+  static header* get_header(pointer p) {
+    return reinterpret_cast<header*>(p) - 1;
+  }
+  static size_t round_to_huge_page(size_t bytes) {
+    return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+  }
+
+#ifdef SPARSEHASH_HAVE_HUGE_PAGES
+  static bool use_pages(size_t bytes) {
+    return bytes >= Threshold;
+  }
+
+  // Returns a huge-page-aligned mapping of mapped bytes, or NULL.
+  static char* map_pages(size_t mapped, bool* hugetlb) {
+    void* p;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    // Ask for 2MB pages specifically: the default hugetlb size may be
+    // bigger, and then mapped wouldn't be a multiple of it.
+    p = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+             (21 << MAP_HUGE_SHIFT), -1, 0);
+    if (p != MAP_FAILED) {
+      *hugetlb = true;
+      return static_cast<char*>(p);
+    }
+#endif
+    // Map an extra huge page, and trim the ends so what's left starts
+    // on a huge page boundary.  Otherwise the kernel can't back the
+    // first and last 2MB of it with huge pages.
+    p = mmap(NULL, mapped + huge_page_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      return NULL;
+    char* raw = static_cast<char*>(p);
+    const size_t addr = reinterpret_cast<size_t>(raw);
+    const size_t head = ((huge_page_size - addr % huge_page_size) %
+                         huge_page_size);
+    if (head > 0)
+      munmap(raw, head);
+    munmap(raw + head + mapped, huge_page_size - head);
+#ifdef MADV_HUGEPAGE
+    madvise(raw + head, mapped, MADV_HUGEPAGE);
+#endif
+    *hugetlb = false;
+    return raw + head;
+  }
+
+  static void unmap(header* h, size_t mapped) {
+    munmap(h, mapped);
+  }
+
+  static pointer map_array(size_t bytes) {
+    const size_t mapped = round_to_huge_page(sizeof(header) + bytes);
+    bool hugetlb;
+    char* raw = map_pages(mapped, &hugetlb);
+    if (raw == NULL)
+      return NULL;
+    header* h = reinterpret_cast<header*>(raw);
+    h->mapped = mapped;
+    h->bytes = bytes;
+    h->hugetlb = hugetlb;
+    return array_of(h);
+  }
+
+  // Moves a malloc'ed array into a mapping, once it has grown big enough.
+  static pointer move_array(pointer p, size_t bytes) {
+    header* h = get_header(p);
+    pointer retval = map_array(bytes);
+    if (retval == NULL)
+      return NULL;
+    memcpy(static_cast<void*>(retval), static_cast<void*>(p),
+           h->bytes < bytes ? h->bytes : bytes);
+    free(h);
+    return retval;
+  }
+
+  // Grows a mapping.  mremap() can often extend it where it is; if
+  // not, we map a fresh aligned region and have mremap() move the old
+  // pages on top of it, so the array stays huge-page aligned and
+  // nothing is copied.  hugetlb mappings can't always be remapped, so
+  // for those we fall back to copying.
+  static pointer remap_array(pointer p, size_t bytes) {
+    header* h = get_header(p);
+    const size_t mapped = round_to_huge_page(sizeof(header) + bytes);
+    if (!h->hugetlb) {
+      if (mremap(h, h->mapped, mapped, 0) != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+        madvise(h, mapped, MADV_HUGEPAGE);
+#endif
+        h->mapped = mapped;
+        h->bytes = bytes;
+        return p;
+      }
+#ifdef MREMAP_FIXED
+      bool hugetlb;
+      char* target = map_pages(mapped, &hugetlb);
+      if (target == NULL)
+        return NULL;
+      if (!hugetlb) {
+        void* moved = mremap(h, h->mapped, mapped,
+                             MREMAP_MAYMOVE | MREMAP_FIXED, target);
+        if (moved != MAP_FAILED) {
+          h = static_cast<header*>(moved);
+          h->mapped = mapped;
+          h->bytes = bytes;
+          return array_of(h);
+        }
+      }
+      munmap(target, mapped);
+#endif
+    }
+    pointer retval = map_array(bytes);
+    if (retval == NULL)
+      return NULL;
+    memcpy(static_cast<void*>(retval), static_cast<void*>(p),
+           h->bytes < bytes ? h->bytes : bytes);
+    unmap(h, h->mapped);
+    return retval;
+  }
+
+  // Hands back every whole huge page past the first bytes of the array.
+  static void release_pages(header* h, size_t bytes) {
+    char* raw = reinterpret_cast<char*>(h);
+    const size_t keep = round_to_huge_page(sizeof(header) + bytes);
+    const size_t in_use = round_to_huge_page(sizeof(header) + h->bytes);
+    if (keep < in_use)
+      madvise(raw + keep, in_use - keep, MADV_DONTNEED);
+  }
+#else
+  // Without mmap and friends, we always use malloc.
+  static bool use_pages(size_t) { return false; }
+  static void unmap(header*, size_t) { }
+  static pointer map_array(size_t) { return NULL; }
+  static pointer move_array(pointer, size_t) { return NULL; }
+  static pointer remap_array(pointer, size_t) { return NULL; }
+  static void release_pages(header*, size_t) { }
+#endif
+};
+
+// huge_page_allocator_with_realloc<void> specialization.
+template<size_t Threshold>
+class huge_page_allocator_with_realloc<void, Threshold> {
+ public:
+  typedef void value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef void* pointer;
+  typedef const void* const_pointer;
+
+  template<class U>
+  struct rebind {
+    typedef huge_page_allocator_with_realloc<U, Threshold> other;
+  };
+};
+
+template<class T, size_t Threshold>
+inline bool operator==(const huge_page_allocator_with_realloc<T, Threshold>&,
+                       const huge_page_allocator_with_realloc<T, Threshold>&) {
+  return true;
+}
+
+template<class T, size_t Threshold>
+inline bool operator!=(const huge_page_allocator_with_realloc<T, Threshold>&,
+                       const huge_page_allocator_with_realloc<T, Threshold>&) {
+  return false;
+}
+
+namespace sparsehash_internal {
+template <class T, size_t Threshold>
+struct can_realloc<huge_page_allocator_with_realloc<T, Threshold> >
+    : true_type { };
+}  // namespace sparsehash_internal
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // UTIL_GTL_HUGE_PAGE_ALLOCATOR_WITH_REALLOC_H_
@@ -36,6 +36,7 @@
 #include <stdlib.h>           // for malloc/realloc/free
 #include <stddef.h>           // for ptrdiff_t
 #include <new>                // for placement new
+#include <sparsehash/type_traits.h>  // for true_type, false_type
 
 _START_GOOGLE_NAMESPACE_
 
@@ -117,6 +118,15 @@ inline bool operator!=(const libc_allocator_with_realloc<T>&,
   return false;
 }
 
+namespace sparsehash_internal {
+// Says whether dense_hashtable can call realloc_or_die() on an
+// allocator.  Each allocator we provide that wraps realloc() says so
+// next to its definition.
+template <class A> struct can_realloc : false_type { };
+template <class T>
+struct can_realloc<libc_allocator_with_realloc<T> > : true_type { };
+}  // namespace sparsehash_internal
+
 _END_GOOGLE_NAMESPACE_
 
 #endif  // UTIL_GTL_LIBC_ALLOCATOR_WITH_REALLOC_H_
@@ -0,0 +1,96 @@
+// Copyright (c) 2005, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// run_in_parallel(n, f) calls f(0), f(1), ..., f(n-1), each on its own
+// thread (f(0) on the calling one), and returns once they've all
+// returned.  If any of them throws, it rethrows the first such
+// exception after joining the rest.  If we can't start a thread, that
+// call just runs on this thread once the others are done.
+//
+// The sharded maps use it for their bulk operations, and the other
+// tables for resizing when SPARSEHASH_PARALLEL_RESIZE is defined (see
+// hashtable-common.h).  It's kept out of hashtable-common.h so that
+// tables that don't resize in parallel don't need <thread>.  This
+// needs C++11.
+
+#ifndef _RUN_IN_PARALLEL_H_
+#define _RUN_IN_PARALLEL_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <stddef.h>                  // for size_t
+#include <exception>                 // for exception_ptr
+#include <thread>
+#include <vector>
+
+_START_GOOGLE_NAMESPACE_
+
+namespace sparsehash_internal {
+
+template <class Functor>
+void call_catching(Functor* f, int i, std::exception_ptr* error) {
+  try {
+    (*f)(i);
+  } catch (...) {
+    *error = std::current_exception();
+  }
+}
+
+template <class Functor>
+void run_in_parallel(int n, Functor f) {
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(n);
+  std::vector<int> not_started;
+  threads.reserve(n);     // so push_back can't throw once a thread is up
+  not_started.reserve(n);
+  for (int i = 1; i < n; ++i) {
+    try {
+      threads.push_back(std::thread(call_catching<Functor>,
+                                    &f, i, &errors[i]));
+    } catch (...) {               // out of threads, or out of memory
+      not_started.push_back(i);
+    }
+  }
+  call_catching(&f, 0, &errors[0]);
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  for (size_t i = 0; i < not_started.size(); ++i)
+    call_catching(&f, not_started[i], &errors[not_started[i]]);
+  for (int i = 0; i < n; ++i) {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+  }
+}
+
+}  // namespace sparsehash_internal
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // _RUN_IN_PARALLEL_H_
@@ -0,0 +1,285 @@
+// Copyright (c) 2005, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// The guts of sharded_dense_hash_map and sharded_sparse_hash_map.
+// sharded_hashtable<Map> splits its keys among a power-of-two number of
+// Maps ("shards"), each with its own mutex.  A key goes to the shard
+// picked by the high bits of its hash, after multiplying the hash by
+// 2^64 divided by the golden ratio so that every bit of it counts (the
+// shard's own table then uses the low bits).  Each shard grows and
+// shrinks on its own, under its own lock, so a resize only holds up
+// the keys in that shard.
+//
+// Every operation locks the one shard it needs; there are no
+// iterators, since they'd have to hold a lock.  The bulk operations
+// (for_each, size, clear, serialize) take each shard's lock in turn,
+// and for_each and serialize can work on several shards at once, on
+// several threads.  This needs C++11.
+
+#ifndef _SHARDEDHASHTABLE_H_
+#define _SHARDEDHASHTABLE_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <assert.h>
+#include <stddef.h>                  // for size_t
+#include <algorithm>                 // for find
+#include <memory>                    // for align
+#include <new>                       // for placement new
+#include <utility>                   // for pair
+#include <vector>
+#include <sparsehash/internal/hashtable-common.h>
+
+#ifndef SPARSEHASH_CXX11
+# error sharded hash maps need C++11
+#endif
+
+#include <mutex>
+#include <sparsehash/internal/run_in_parallel.h>
+
+_START_GOOGLE_NAMESPACE_
+
+template <class Map>
+class sharded_hashtable {
+ public:
+  typedef Map map_type;
+  typedef typename Map::key_type key_type;
+  typedef typename Map::data_type data_type;
+  typedef typename Map::value_type value_type;
+  typedef typename Map::hasher hasher;
+  typedef typename Map::key_equal key_equal;
+  typedef typename Map::allocator_type allocator_type;
+  typedef typename Map::size_type size_type;
+
+  // num_shards is rounded up to a power of two.
+  sharded_hashtable(int num_shards, size_type expected_max_items_in_table,
+                    const hasher& hf, const key_equal& eql,
+                    const allocator_type& alloc)
+      : hash_(hf), shard_bits_(0) {
+    while ((1 << shard_bits_) < num_shards)
+      ++shard_bits_;
+    // new doesn't promise to line shards up on cache lines before
+    // C++17, so we do it ourselves, and build each shard in place.
+    size_t space = sizeof(shard) * this->num_shards() + alignof(shard);
+    storage_ = new char[space];
+    void* p = storage_;
+    shards_ = static_cast<shard*>(
+        std::align(alignof(shard), sizeof(shard) * this->num_shards(),
+                   p, space));
+    int i = 0;
+    try {
+      for (; i < this->num_shards(); ++i) {
+        new(&shards_[i]) shard(expected_max_items_in_table /
+                               this->num_shards(), hf, eql, alloc);
+      }
+    } catch (...) {
+      destroy_shards(i);
+      throw;
+    }
+  }
+  ~sharded_hashtable() {
+    destroy_shards(num_shards());
+  }
+
+  int num_shards() const { return 1 << shard_bits_; }
+
+  // Which shard key lives in.
+  int shard_of(const key_type& key) const {
+    if (shard_bits_ == 0)
+      return 0;
+    const size_t mult = (sizeof(size_t) == 8 ?
+                         static_cast<size_t>(0x9E3779B97F4A7C15ULL) :
+                         static_cast<size_t>(0x9E3779B9UL));
+    const size_t h = static_cast<size_t>(hash_(key)) * mult;
+    return static_cast<int>(h >> (sizeof(size_t) * 8 - shard_bits_));
+  }
+
+  // The i-th shard itself, without locking it.  This is for setting up
+  // the shards (with set_empty_key() and the like) before any other
+  // thread sees the table.
+  Map& shard_map(int i) {
+    assert(i >= 0 && i < num_shards());
+    return shards_[i].map;
+  }
+
+  // LOOKUP AND CHANGE, each under the lock of key's shard.
+  bool find(const key_type& key, data_type* value) const {
+    const shard& s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    typename Map::const_iterator it = s.map.find(key);
+    if (it == s.map.end())
+      return false;
+    if (value)
+      *value = it->second;
+    return true;
+  }
+  size_type count(const key_type& key) const {
+    return find(key, NULL) ? 1 : 0;
+  }
+
+  // Calls f(value) on key's entry, if it's there, with its shard
+  // locked.  f may change the data part.  Returns whether it found it.
+  template <class Functor>
+  bool visit(const key_type& key, Functor f) {
+    shard& s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    typename Map::iterator it = s.map.find(key);
+    if (it == s.map.end())
+      return false;
+    f(*it);
+    return true;
+  }
+
+  bool insert(const value_type& obj) {
+    shard& s = shards_[shard_of(obj.first)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.map.insert(obj).second;
+  }
+  bool insert_or_assign(const key_type& key, const data_type& value) {
+    shard& s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::pair<typename Map::iterator, bool> result =
+        s.map.insert(value_type(key, value));
+    if (!result.second)
+      result.first->second = value;
+    return result.second;
+  }
+  size_type erase(const key_type& key) {
+    shard& s = shards_[shard_of(key)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.map.erase(key);
+  }
+
+  // BULK OPERATIONS
+  // These lock one shard at a time, so if other threads are changing
+  // the table, they see it as it was when they got to each shard.
+  size_type size() const {
+    size_type total = 0;
+    for (int i = 0; i < num_shards(); ++i) {
+      std::lock_guard<std::mutex> lock(shards_[i].mutex);
+      total += shards_[i].map.size();
+    }
+    return total;
+  }
+  bool empty() const { return size() == 0; }
+
+  void clear() {
+    for (int i = 0; i < num_shards(); ++i) {
+      std::lock_guard<std::mutex> lock(shards_[i].mutex);
+      shards_[i].map.clear();
+    }
+  }
+
+  // Calls f(value) on every entry, with its shard locked; f may change
+  // the data part.  With num_threads > 1, several shards are done at
+  // once, so f must be safe to call from several threads.
+  template <class Functor>
+  void for_each(Functor f, int num_threads = 1) {
+    for_each_shard([&f](Map& map) {
+      for (typename Map::iterator it = map.begin(); it != map.end(); ++it)
+        f(*it);
+    }, num_threads);
+  }
+
+  // Writes shard i to fps[i], with the shard's serialize(); so fps must
+  // hold num_shards() streams.  Returns false if any shard fails.  As
+  // with for_each, num_threads > 1 writes several shards at once.
+  template <typename ValueSerializer, typename OUTPUT>
+  bool serialize(ValueSerializer serializer, OUTPUT* const* fps,
+                 int num_threads = 1) {
+    std::vector<char> ok(num_shards(), true);
+    for_each_shard_index([&](int i, Map& map) {
+      ok[i] = map.serialize(serializer, fps[i]);
+    }, num_threads);
+    return std::find(ok.begin(), ok.end(), false) == ok.end();
+  }
+  // Reads back what serialize() wrote, with as many shards as it had.
+  template <typename ValueSerializer, typename INPUT>
+  bool unserialize(ValueSerializer serializer, INPUT* const* fps,
+                   int num_threads = 1) {
+    std::vector<char> ok(num_shards(), true);
+    for_each_shard_index([&](int i, Map& map) {
+      ok[i] = map.unserialize(serializer, fps[i]);
+    }, num_threads);
+    return std::find(ok.begin(), ok.end(), false) == ok.end();
+  }
+
+ private:
+  sharded_hashtable(const sharded_hashtable&);
+  void operator=(const sharded_hashtable&);
+
+  // Each shard starts on a cache line of its own, so threads working
+  // on different shards don't slow each other down.
+  struct alignas(64) shard {
+    shard(size_type n, const hasher& hf, const key_equal& eql,
+          const allocator_type& alloc)
+        : map(n, hf, eql, alloc) { }
+    mutable std::mutex mutex;
+    Map map;
+  };
+
+  // Destroys the first n shards and frees them all.
+  void destroy_shards(int n) {
+    while (n > 0)
+      shards_[--n].~shard();
+    delete[] storage_;
+  }
+
+  template <class Functor>
+  void for_each_shard(Functor f, int num_threads) {
+    for_each_shard_index([&f](int, Map& map) { f(map); }, num_threads);
+  }
+
+  // Calls f(i, shard i's map) for every shard, with it locked.  Thread
+  // t of num_threads does shards t, t + num_threads, and so on.
+  template <class Functor>
+  void for_each_shard_index(Functor f, int num_threads) {
+    if (num_threads > num_shards())
+      num_threads = num_shards();
+    if (num_threads < 1)
+      num_threads = 1;
+    sharded_hashtable* self = this;
+    sparsehash_internal::run_in_parallel(num_threads, [&](int t) {
+      for (int i = t; i < self->num_shards(); i += num_threads) {
+        std::lock_guard<std::mutex> lock(self->shards_[i].mutex);
+        f(i, self->shards_[i].map);
+      }
+    });
+  }
+
+  hasher hash_;
+  int shard_bits_;
+  char* storage_;                    // what shards_ lives in
+  shard* shards_;
+};
+
+_END_GOOGLE_NAMESPACE_
+
+#endif  // _SHARDEDHASHTABLE_H_
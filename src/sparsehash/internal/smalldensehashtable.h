@@ -0,0 +1,1155 @@
+// Copyright (c) 2005, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// The table behind a dense_hash_map or dense_hash_set whose Policy
+// sets inline_buckets (see dense_hashtable_policy in densehashtable.h).
+// A dense_hashtable allocates its buckets -- 32 of them, to start
+// with -- as soon as it's told its empty key, however little goes in
+// it.  That's most of the cost of a table that only ever holds a few
+// things.  This one keeps its first N elements in the object itself,
+// in N slots with a bitmask saying which are in use, and finds them by
+// comparing the key with each in turn, without hashing it.  Only when
+// an insert finds all N slots full does it start using the table it
+// wraps (a dense_hashtable or split_dense_hashtable), which is when
+// that table is first allocated: the N elements are moved into it, and
+// from then on it does all the work, just as if the slots weren't
+// there.  clear() goes back to the slots, and frees the table.  Until
+// then, all we keep of it is a pointer, and what it'd be built with.
+//
+// While the elements are in the slots, bucket_count() is N, and each
+// slot is a bucket.  erase() just frees the slot, so it doesn't need a
+// deleted key, or move anything else.
+//
+// You probably shouldn't use this code directly.  Use dense_hash_map<>
+// or dense_hash_set<> instead.
+
+#ifndef _SMALLDENSEHASHTABLE_H_
+#define _SMALLDENSEHASHTABLE_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <assert.h>
+#include <stddef.h>                  // for size_t
+#include <algorithm>                 // For swap(), eg
+#include <iterator>                  // For iterator tags
+#include <utility>                   // for pair
+#include <vector>
+#include <sparsehash/internal/densehashtable.h>
+#include <sparsehash/internal/hashtable-common.h>
+#include <sparsehash/type_traits.h>
+#ifdef SPARSEHASH_CXX11
+#include <type_traits>               // for is_nothrow_copy_constructible
+#endif
+
+_START_GOOGLE_NAMESPACE_
+
+// We #undef this at the bottom of the file.
+#define SPARSEHASH_COMPILE_ASSERT(expr, msg) \
+  __attribute__((unused)) typedef SparsehashCompileAssert<(bool(expr))> msg[bool(expr) ? 1 : -1]
+
+namespace sparsehash_internal {
+
+// Uninitialized room for N Ts, aligned as a T must be.  Before C++11,
+// we can only align it as well as any of the types below is, which is
+// all a T is likely to need.
+template <class T, size_t N>
+struct inline_buffer {
+#ifdef SPARSEHASH_CXX11
+  alignas(T) char bytes[N * sizeof(T)];
+#else
+  union {
+    char bytes[N * sizeof(T)];
+    long double align_long_double;
+    double align_double;
+    void* align_pointer;
+    size_t align_size_t;
+  };
+#endif
+
+  T* get()                { return reinterpret_cast<T*>(bytes); }
+  const T* get() const    { return reinterpret_cast<const T*>(bytes); }
+};
+
+}  // namespace sparsehash_internal
+
+template <class HT, class ExtractKey, class SetKey, size_t N>
+class small_dense_hashtable;
+
+template <class HT, class ExK, class SetK, size_t N>
+struct small_dense_hashtable_iterator;
+
+template <class HT, class ExK, class SetK, size_t N>
+struct small_dense_hashtable_const_iterator;
+
+// In the slots, pos walks them, skipping the free ones, and big is
+// unused; after that, pos is NULL and big does the walking.
+template <class HT, class ExK, class SetK, size_t N>
+struct small_dense_hashtable_iterator {
+  typedef small_dense_hashtable_iterator<HT,ExK,SetK,N> iterator;
+  typedef small_dense_hashtable_const_iterator<HT,ExK,SetK,N> const_iterator;
+  typedef typename HT::iterator big_iterator;
+
+  typedef std::forward_iterator_tag iterator_category;  // very little defined!
+  typedef typename HT::value_type value_type;
+  typedef typename HT::difference_type difference_type;
+  typedef typename HT::size_type size_type;
+  typedef typename HT::reference reference;
+  typedef typename HT::pointer pointer;
+
+  // "Real" constructor and default constructor
+  small_dense_hashtable_iterator(const small_dense_hashtable<HT,ExK,SetK,N> *h,
+                                 pointer it, pointer it_end,
+                                 const big_iterator& b, bool advance)
+    : ht(h), pos(it), end(it_end), big(b) {
+    if (advance)  advance_past_free();
+  }
+  small_dense_hashtable_iterator()
+    : ht(NULL), pos(pointer()), end(pointer()) { }
+  // The default destructor is fine; we don't define one
+  // The default operator= is fine; we don't define one
+
+  // Happy dereferencer
+  reference operator*() const { return pos ? *pos : *big; }
+  pointer operator->() const { return &(operator*()); }
+
+  // Arithmetic.
+  void advance_past_free() {
+    while ( pos != end && ht->test_free_slot(pos) )
+      ++pos;
+  }
+  iterator& operator++()   {
+    if (pos) {
+      assert(pos != end); ++pos; advance_past_free();
+    } else {
+      ++big;
+    }
+    return *this;
+  }
+  iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+
+  // Comparison.
+  bool operator==(const iterator& it) const {
+    return pos == it.pos && big == it.big;
+  }
+  bool operator!=(const iterator& it) const { return !(*this == it); }
+
+
+  // The actual data
+  const small_dense_hashtable<HT,ExK,SetK,N> *ht;
+  pointer pos, end;
+  big_iterator big;
+};
+
+
+// Now do it all again, but with const-ness!
+template <class HT, class ExK, class SetK, size_t N>
+struct small_dense_hashtable_const_iterator {
+  typedef small_dense_hashtable_iterator<HT,ExK,SetK,N> iterator;
+  typedef small_dense_hashtable_const_iterator<HT,ExK,SetK,N> const_iterator;
+  typedef typename HT::const_iterator big_iterator;
+
+  typedef std::forward_iterator_tag iterator_category;  // very little defined!
+  typedef typename HT::value_type value_type;
+  typedef typename HT::difference_type difference_type;
+  typedef typename HT::size_type size_type;
+  typedef typename HT::const_reference reference;
+  typedef typename HT::const_pointer pointer;
+
+  // "Real" constructor and default constructor
+  small_dense_hashtable_const_iterator(
+      const small_dense_hashtable<HT,ExK,SetK,N> *h,
+      pointer it, pointer it_end, const big_iterator& b, bool advance)
+    : ht(h), pos(it), end(it_end), big(b) {
+    if (advance)  advance_past_free();
+  }
+  small_dense_hashtable_const_iterator()
+    : ht(NULL), pos(pointer()), end(pointer()) { }
+  // This lets us convert regular iterators to const iterators
+  small_dense_hashtable_const_iterator(const iterator &it)
+    : ht(it.ht), pos(it.pos), end(it.end), big(it.big) { }
+  // The default destructor is fine; we don't define one
+  // The default operator= is fine; we don't define one
+
+  // Happy dereferencer
+  reference operator*() const { return pos ? *pos : *big; }
+  pointer operator->() const { return &(operator*()); }
+
+  // Arithmetic.
+  void advance_past_free() {
+    while ( pos != end && ht->test_free_slot(pos) )
+      ++pos;
+  }
+  const_iterator& operator++()   {
+    if (pos) {
+      assert(pos != end); ++pos; advance_past_free();
+    } else {
+      ++big;
+    }
+    return *this;
+  }
+  const_iterator operator++(int) { const_iterator tmp(*this); ++*this; return tmp; }
+
+  // Comparison.
+  bool operator==(const const_iterator& it) const {
+    return pos == it.pos && big == it.big;
+  }
+  bool operator!=(const const_iterator& it) const { return !(*this == it); }
+
+
+  // The actual data
+  const small_dense_hashtable<HT,ExK,SetK,N> *ht;
+  pointer pos, end;
+  big_iterator big;
+};
+
+template <class HT, class ExtractKey, class SetKey, size_t N>
+class small_dense_hashtable {
+ public:
+  typedef typename HT::key_type key_type;
+  typedef typename HT::value_type value_type;
+  typedef typename HT::hasher hasher;
+  typedef typename HT::key_equal key_equal;
+  typedef typename HT::allocator_type allocator_type;
+
+  typedef typename HT::size_type size_type;
+  typedef typename HT::difference_type difference_type;
+  typedef typename HT::reference reference;
+  typedef typename HT::const_reference const_reference;
+  typedef typename HT::pointer pointer;
+  typedef typename HT::const_pointer const_pointer;
+  typedef small_dense_hashtable_iterator<HT, ExtractKey, SetKey, N> iterator;
+  typedef small_dense_hashtable_const_iterator<HT, ExtractKey, SetKey, N>
+      const_iterator;
+  // HT's local iterators are just its iterators, so ours can be too.
+  typedef iterator local_iterator;
+  typedef const_iterator const_local_iterator;
+
+ private:
+  typedef unsigned int slot_mask;    // bit i says whether slot i is in use
+  SPARSEHASH_COMPILE_ASSERT(N > 0 && N <= sizeof(slot_mask) * 8,
+                            inline_buckets_must_fit_in_a_slot_mask);
+
+ public:
+  // ITERATOR FUNCTIONS
+  iterator begin() {
+    if (big)
+      return iterator(this, NULL, NULL, big->begin(), false);
+    return iterator(this, slots(), slots() + N,
+                    typename iterator::big_iterator(), true);
+  }
+  iterator end() {
+    if (big)
+      return iterator(this, NULL, NULL, big->end(), false);
+    return iterator(this, slots() + N, slots() + N,
+                    typename iterator::big_iterator(), false);
+  }
+  const_iterator begin() const {
+    if (big)
+      return const_iterator(this, NULL, NULL, big->begin(), false);
+    return const_iterator(this, slots(), slots() + N,
+                          typename const_iterator::big_iterator(), true);
+  }
+  const_iterator end() const {
+    if (big)
+      return const_iterator(this, NULL, NULL, big->end(), false);
+    return const_iterator(this, slots() + N, slots() + N,
+                          typename const_iterator::big_iterator(), false);
+  }
+
+  // These come from tr1 unordered_map.  They iterate over 'bucket' n.
+  local_iterator begin(size_type i) {
+    if (big)
+      return local_iterator(this, NULL, NULL, big->begin(i), false);
+    return local_iterator(this, slots() + i, slots() + i + 1,
+                          typename iterator::big_iterator(), false);
+  }
+  local_iterator end(size_type i) {
+    local_iterator it = begin(i);
+    if (big)
+      it.big = big->end(i);
+    else if (!test_free_slot(it.pos))
+      ++it;
+    return it;
+  }
+  const_local_iterator begin(size_type i) const {
+    if (big)
+      return const_local_iterator(this, NULL, NULL, big->begin(i), false);
+    return const_local_iterator(this, slots() + i, slots() + i + 1,
+                                typename const_iterator::big_iterator(),
+                                false);
+  }
+  const_local_iterator end(size_type i) const {
+    const_local_iterator it = begin(i);
+    if (big)
+      it.big = big->end(i);
+    else if (!test_free_slot(it.pos))
+      ++it;
+    return it;
+  }
+
+  // ACCESSOR FUNCTIONS for the things we templatize on, basically
+  hasher hash_funct() const {
+    return big ? big->hash_funct() : static_cast<const hasher&>(params);
+  }
+  key_equal key_eq() const {
+    return big ? big->key_eq() : static_cast<const key_equal&>(key_info);
+  }
+  allocator_type get_allocator() const {
+    return big ? big->get_allocator()
+               : static_cast<const allocator_type&>(params);
+  }
+
+  // Lookups in the slots aren't counted: they don't probe.  clear()
+  // starts the counts over, along with the table.
+  hashtable_stats statistics() const {
+    return big ? big->statistics() : hashtable_stats();
+  }
+  void reset_statistics() {
+    if (big)
+      big->reset_statistics();
+  }
+
+  // True if the slot at p holds nothing.  Public so the iterators can
+  // use it.
+  bool test_free_slot(const_pointer p) const {
+    return (used & (slot_mask(1) << (p - slots()))) == 0;
+  }
+
+  // DELETE AND EMPTY KEYS
+  // We hang on to them ourselves, and only tell the table once we
+  // start using it.
+  void set_empty_key(const_reference val) {
+    assert(!use_empty && "Calling set_empty_key multiple times");
+    new(emptyval.get()) value_type(val);
+    use_empty = true;
+    if (big)
+      big->set_empty_key(val);
+  }
+  value_type empty_key() const {
+    assert(use_empty);
+    return *emptyval.get();
+  }
+
+  void set_deleted_key(const key_type &key) {
+    assert((!use_empty || !equals(key, get_key(*emptyval.get())))
+           && "Passed the empty-key to set_deleted_key");
+    if (big)
+      big->set_deleted_key(key);
+    key_info.delkey = key;
+    use_deleted = true;
+  }
+  void clear_deleted_key() {
+    if (big)
+      big->clear_deleted_key();
+    use_deleted = false;
+  }
+  key_type deleted_key() const {
+    assert(use_deleted && "Must set deleted key before calling deleted_key");
+    return key_info.delkey;
+  }
+
+  // FUNCTIONS CONCERNING SIZE
+  size_type size() const        { return big ? big->size() : num_small; }
+  size_type max_size() const    { return table_like_big().max_size(); }
+  bool empty() const            { return size() == 0; }
+  size_type bucket_count() const {
+    return big ? big->bucket_count() : N;
+  }
+  size_type max_bucket_count() const {
+    return big ? big->max_bucket_count() : table_like_big().max_bucket_count();
+  }
+  size_type bucket_size(size_type i) const {
+    if (big)
+      return big->bucket_size(i);
+    return test_free_slot(slots() + i) ? 0 : 1;
+  }
+  // In the slots, a key that isn't here would go in the first free one.
+  template <class K>
+  size_type bucket(const K& key) const {
+    if (big)
+      return big->bucket(key);
+    const size_type slot = find_slot(key);
+    if (slot != N)
+      return slot;
+    const size_type free_slot = first_free_slot();
+    return free_slot == N ? 0 : free_slot;
+  }
+
+  // The slots live in *this, so until we start using the table, we
+  // have no heap memory at all.  After that, there's the table object,
+  // as well as whatever it has allocated.
+  size_type memory_usage(memory_breakdown* usage = NULL,
+                         bool with_group_sizes = false) const {
+    memory_breakdown ignored;
+    if (usage == NULL)  usage = &ignored;
+    if (big) {
+      big->memory_usage(usage, with_group_sizes);
+      usage->bookkeeping_bytes += sizeof(HT);
+      ++usage->num_allocations;
+    } else {
+      *usage = memory_breakdown();
+    }
+    usage->object_bytes = sizeof(*this);
+    return usage->total();
+  }
+
+  // Asking for more room than the slots have starts using the table.
+  void resize(size_type req_elements) {
+    if (big)
+      big->resize(req_elements);
+    else if (req_elements > N)
+      promote(req_elements);
+  }
+  // Until there's a table, we hold on to these, for when there is.
+  void get_resizing_parameters(float* shrink, float* grow) const {
+    if (big)
+      big->get_resizing_parameters(shrink, grow);
+    else
+      table_like_big().get_resizing_parameters(shrink, grow);
+  }
+  void set_resizing_parameters(float shrink, float grow) {
+    if (big) {
+      big->set_resizing_parameters(shrink, grow);
+    } else {
+      params.shrink = shrink;
+      params.grow = grow;
+    }
+  }
+  int resize_threads() const {
+    return big ? big->resize_threads() : table_like_big().resize_threads();
+  }
+  void set_resize_threads(int n) {
+    if (big)
+      big->set_resize_threads(n);
+    else
+      params.resize_threads = n;
+  }
+
+  // CONSTRUCTORS -- as required by the specs, we take a size,
+  // but also let you specify a hashfunction, key comparator,
+  // and key extractor.  We also define a copy constructor and =.
+  // If we're told to expect more than the slots hold, we don't bother
+  // with them.
+  explicit small_dense_hashtable(size_type expected_max_items_in_table = 0,
+                                 const hasher& hf = hasher(),
+                                 const key_equal& eql = key_equal(),
+                                 const ExtractKey& ext = ExtractKey(),
+                                 const SetKey& set = SetKey(),
+                                 const allocator_type& alloc =
+                                     allocator_type())
+      : big(NULL),
+        params(hf, alloc),
+        key_info(ext, set, eql),
+        use_empty(false),
+        use_deleted(false),
+        used(0),
+        num_small(0) {
+    if (expected_max_items_in_table > N)
+      big = new_table(expected_max_items_in_table);
+  }
+
+  small_dense_hashtable(const small_dense_hashtable& ht)
+      : big(NULL),
+        params(ht.params),
+        key_info(ht.key_info),
+        use_empty(false),
+        use_deleted(ht.use_deleted),
+        used(0),
+        num_small(0) {
+    if (ht.big) {
+      table_alloc_type alloc(ht.get_allocator());
+      HT* copy = alloc.allocate(1);
+      try {
+        new(copy) HT(*ht.big);
+      } catch (...) {
+        alloc.deallocate(copy, 1);
+        throw;
+      }
+      big = copy;
+    }
+    try {
+      copy_empty_value(ht);
+      for (size_type i = 0; i < N; ++i) {
+        if (!ht.test_free_slot(ht.slots() + i)) {
+          new(slots() + i) value_type(ht.slots()[i]);
+          fill_slot(i);
+        }
+      }
+    } catch (...) {
+      // Our destructor won't run, so undo what we've built so far.
+      destroy_values();
+      throw;
+    }
+  }
+
+  small_dense_hashtable& operator= (const small_dense_hashtable& ht) {
+    if (&ht == this)  return *this;        // don't copy onto ourselves
+    small_dense_hashtable tmp(ht);
+    swap(tmp);
+    return *this;
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Moving copies the empty value and moves the slots' values (which,
+  // for a map, copies their keys), so it can throw only if those can.
+  static const bool nothrow_move =
+      std::is_nothrow_copy_constructible<value_type>::value &&
+      std::is_nothrow_move_constructible<value_type>::value;
+
+  // Takes ht's elements; ht is left empty, with its empty and deleted
+  // keys, as a moved-from dense_hashtable is.
+  small_dense_hashtable(small_dense_hashtable&& ht)
+      SPARSEHASH_NOEXCEPT_IF(nothrow_move)
+      : big(NULL),
+        params(ht.params),
+        key_info(ht.key_info),
+        use_empty(false),
+        use_deleted(ht.use_deleted),
+        used(0),
+        num_small(0) {
+    copy_empty_value(ht);
+    take_values(ht);
+  }
+  small_dense_hashtable& operator= (small_dense_hashtable&& ht)
+      SPARSEHASH_NOEXCEPT_IF(nothrow_move) {
+    if (&ht != this) {
+      small_dense_hashtable tmp(std::move(ht));
+      swap(tmp);
+    }
+    return *this;
+  }
+#endif
+
+  ~small_dense_hashtable() {
+    destroy_values();
+  }
+
+  // Many STL algorithms use swap instead of copy constructors.  The
+  // slots are in the objects, so we have to move them one at a time,
+  // by way of a third table.  If a value throws on the way, both tables
+  // are still valid, though whatever was in the third is lost.
+  void swap(small_dense_hashtable& ht) {
+    if (&ht == this)  return;
+    small_dense_hashtable tmp(0, hash_funct(), key_eq(), key_info, key_info,
+                              get_allocator());
+    tmp.copy_empty_value(*this);
+    tmp.take_values(*this);
+    destroy_empty_value();
+    copy_empty_value(ht);
+    take_values(ht);
+    ht.destroy_empty_value();
+    ht.copy_empty_value(tmp);
+    ht.take_values(tmp);
+    std::swap(key_info, ht.key_info);
+    std::swap(use_deleted, ht.use_deleted);
+    params.swap(ht.params);
+  }
+
+  // It's always nice to be able to clear a table without deallocating
+  // it, but we do: we go back to the slots.
+  void clear() {
+    destroy_slots();
+    if (big) {
+      // Remember what the table was told, for the next one.
+      static_cast<hasher&>(params) = big->hash_funct();
+      big->get_resizing_parameters(&params.shrink, &params.grow);
+      params.resize_threads = big->resize_threads();
+      delete_table(big);
+      big = NULL;
+    }
+  }
+
+  // Clear the table without resizing it: if we're using the table,
+  // we go on using it.
+  void clear_no_resize() {
+    destroy_slots();
+    if (big)
+      big->clear_no_resize();
+  }
+
+  // LOOKUP ROUTINES
+  template <class K>
+  iterator find(const K& key) {
+    if (big)
+      return iterator(this, NULL, NULL, big->find(key), false);
+    const size_type slot = find_slot(key);
+    return slot == N ? end() : slot_iterator(slot);
+  }
+
+  template <class K>
+  const_iterator find(const K& key) const {
+    if (big)
+      return const_iterator(this, NULL, NULL, big->find(key), false);
+    const size_type slot = find_slot(key);
+    if (slot == N)
+      return end();
+    return const_iterator(this, slots() + slot, slots() + N,
+                          typename const_iterator::big_iterator(), false);
+  }
+
+  template <class K>
+  size_type count(const K &key) const {
+    if (big)
+      return big->count(key);
+    return find_slot(key) == N ? 0 : 1;
+  }
+
+  template <class K>
+  std::pair<iterator,iterator> equal_range(const K& key) {
+    iterator pos = find(key);      // either an iterator or end
+    if (pos == end()) {
+      return std::pair<iterator,iterator>(pos, pos);
+    } else {
+      const iterator startpos = pos++;
+      return std::pair<iterator,iterator>(startpos, pos);
+    }
+  }
+  template <class K>
+  std::pair<const_iterator,const_iterator> equal_range(const K& key) const {
+    const_iterator pos = find(key);      // either an iterator or end
+    if (pos == end()) {
+      return std::pair<const_iterator,const_iterator>(pos, pos);
+    } else {
+      const const_iterator startpos = pos++;
+      return std::pair<const_iterator,const_iterator>(startpos, pos);
+    }
+  }
+
+  // INSERTION ROUTINES
+  std::pair<iterator, bool> insert(const_reference obj) {
+    if (!big) {
+      const size_type slot = find_slot_to_insert(get_key(obj));
+      if (slot < N && !test_free_slot(slots() + slot))
+        return std::pair<iterator, bool>(slot_iterator(slot), false);
+      if (slot < N) {
+        new(slots() + slot) value_type(obj);
+        return std::pair<iterator, bool>(fill_slot(slot), true);
+      }
+      promote(N + 1);
+    }
+    return wrap(big->insert(obj));
+  }
+#ifdef SPARSEHASH_CXX11
+  std::pair<iterator, bool> insert(value_type&& obj) {
+    if (!big) {
+      const size_type slot = find_slot_to_insert(get_key(obj));
+      if (slot < N && !test_free_slot(slots() + slot))
+        return std::pair<iterator, bool>(slot_iterator(slot), false);
+      if (slot < N) {
+        new(slots() + slot) value_type(std::move(obj));
+        return std::pair<iterator, bool>(fill_slot(slot), true);
+      }
+      promote(N + 1);
+    }
+    return wrap(big->insert(std::move(obj)));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    if (big)
+      return wrap(big->emplace(std::forward<Args>(args)...));
+    value_type obj(std::forward<Args>(args)...);
+    return insert(std::move(obj));
+  }
+#endif
+
+  // When inserting a lot at a time, we specialize on the type of iterator
+  template <class InputIterator>
+  void insert(InputIterator f, InputIterator l) {
+    for ( ; f != l; ++f)
+      insert(*f);
+  }
+
+  // DefaultValue is a functor that takes a key and returns a value_type
+  // representing the default value to be inserted if none is found.
+  template <class DefaultValue, class K>
+  value_type& find_or_insert(const K& key) {
+    if (!big) {
+      const size_type slot = find_slot_to_insert(key);
+      if (slot < N && !test_free_slot(slots() + slot))
+        return slots()[slot];
+      if (slot < N) {
+        DefaultValue default_value;
+        new(slots() + slot) value_type(default_value(key));
+        return *fill_slot(slot);
+      }
+      promote(N + 1);
+    }
+    return big->template find_or_insert<DefaultValue>(key);
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Like find_or_insert, but builds the value from args, in place.
+  template <class... Args>
+  std::pair<iterator, bool> find_or_emplace(const key_type& key,
+                                            Args&&... args) {
+    if (!big) {
+      const size_type slot = find_slot_to_insert(key);
+      if (slot < N && !test_free_slot(slots() + slot))
+        return std::pair<iterator, bool>(slot_iterator(slot), false);
+      if (slot < N) {
+        new(slots() + slot) value_type(std::forward<Args>(args)...);
+        return std::pair<iterator, bool>(fill_slot(slot), true);
+      }
+      promote(N + 1);
+    }
+    return wrap(big->find_or_emplace(key, std::forward<Args>(args)...));
+  }
+#endif
+
+  // DELETION ROUTINES
+  template <class K>
+  size_type erase(const K& key) {
+    if (big)
+      return big->erase(key);
+    const size_type slot = find_slot(key);
+    if (slot == N)
+      return 0;
+    free_slot(slot);
+    return 1;
+  }
+
+  // We return the iterator past the deleted item.
+  void erase(iterator pos) {
+    if ( pos == end() ) return;    // sanity check
+    if (pos.pos)
+      free_slot(pos.pos - slots());
+    else
+      big->erase(pos.big);
+  }
+
+  void erase(iterator f, iterator l) {
+    if (big) {
+      big->erase(f.big, l.big);
+    } else {
+      for ( ; f != l; ++f)
+        erase(f);
+    }
+  }
+
+  // We allow you to erase a const_iterator just like we allow you to
+  // erase an iterator.  This is in parallel to 'delete': you can delete
+  // a const pointer too.
+  void erase(const_iterator pos) {
+    if ( pos == end() ) return;    // sanity check
+    if (pos.pos)
+      free_slot(pos.pos - slots());
+    else
+      big->erase(pos.big);
+  }
+  void erase(const_iterator f, const_iterator l) {
+    if (big) {
+      big->erase(f.big, l.big);
+    } else {
+      for ( ; f != l; ++f)
+        erase(f);
+    }
+  }
+
+  // BATCH ROUTINES
+  // In the slots, there are no cache misses to overlap, so we just
+  // look the keys up one by one.
+  template <class K>
+  void find_batch(const K* keys, size_type n, iterator* results) {
+    if (big) {
+      std::vector<typename HT::iterator> found(n);
+      big->find_batch(keys, n, found.empty() ? NULL : &found[0]);
+      for (size_type i = 0; i < n; ++i)
+        results[i] = iterator(this, NULL, NULL, found[i], false);
+    } else {
+      for (size_type i = 0; i < n; ++i)
+        results[i] = find(keys[i]);
+    }
+  }
+  template <class K>
+  void find_batch(const K* keys, size_type n, const_iterator* results) const {
+    if (big) {
+      std::vector<typename HT::const_iterator> found(n);
+      big->find_batch(keys, n, found.empty() ? NULL : &found[0]);
+      for (size_type i = 0; i < n; ++i)
+        results[i] = const_iterator(this, NULL, NULL, found[i], false);
+    } else {
+      for (size_type i = 0; i < n; ++i)
+        results[i] = find(keys[i]);
+    }
+  }
+  size_type insert_batch(const value_type* objs, size_type n) {
+    if (big)
+      return big->insert_batch(objs, n);
+    size_type num_inserted = 0;
+    for (size_type i = 0; i < n; ++i) {
+      if (insert(objs[i]).second)
+        ++num_inserted;
+    }
+    return num_inserted;
+  }
+  template <class K>
+  size_type erase_batch(const K* keys, size_type n) {
+    if (big)
+      return big->erase_batch(keys, n);
+    size_type num_erased = 0;
+    for (size_type i = 0; i < n; ++i)
+      num_erased += erase(keys[i]);
+    return num_erased;
+  }
+
+
+  // COMPARISON
+  bool operator==(const small_dense_hashtable& ht) const {
+    if (size() != ht.size()) {
+      return false;
+    } else if (this == &ht) {
+      return true;
+    } else {
+      // Iterate through the elements in "this" and see if the
+      // corresponding element is in ht
+      for ( const_iterator it = begin(); it != end(); ++it ) {
+        const_iterator it2 = ht.find(get_key(*it));
+        if ((it2 == ht.end()) || (*it != *it2)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+  bool operator!=(const small_dense_hashtable& ht) const {
+    return !(*this == ht);
+  }
+
+
+  // I/O
+  // We write just what the table would, so what one of us writes, a
+  // table of type HT can read, and the other way around.  In the
+  // slots, that means copying them into a table first.
+  typedef typename HT::NopointerSerializer NopointerSerializer;
+
+  template <typename ValueSerializer, typename OUTPUT>
+  bool serialize(ValueSerializer serializer, OUTPUT *fp) {
+    if (big)
+      return big->serialize(serializer, fp);
+    HT tmp(table_like_big());
+    copy_slots_to(&tmp);
+    return tmp.serialize(serializer, fp);
+  }
+
+  // Whatever we read goes in the table, however little it is.
+  template <typename ValueSerializer, typename INPUT>
+  bool unserialize(ValueSerializer serializer, INPUT *fp) {
+    destroy_slots();
+    if (!big)
+      promote(0);
+    return big->unserialize(serializer, fp);
+  }
+
+  template <typename OUTPUT>
+  bool write_mappable(OUTPUT *fp) {
+    if (big)
+      return big->write_mappable(fp);
+    HT tmp(table_like_big());
+    copy_slots_to(&tmp);
+    return tmp.write_mappable(fp);
+  }
+
+ private:
+  pointer slots()             { return slot_buffer.get(); }
+  const_pointer slots() const { return slot_buffer.get(); }
+
+  // The slot holding key, or N if none does.  Only while we're using
+  // the slots.
+  template <class K>
+  size_type find_slot(const K& key) const {
+    for (size_type i = 0; i < N && (used >> i) != 0; ++i) {
+      if (((used >> i) & 1) && equals(key, get_key(slots()[i])))
+        return i;
+    }
+    return N;
+  }
+
+  size_type first_free_slot() const {
+    size_type i = 0;
+    while (i < N && ((used >> i) & 1))
+      ++i;
+    return i;
+  }
+
+  // The slot holding key, if there's one; if not, the free slot it
+  // should go in; and if there's none of those, N.
+  template <class K>
+  size_type find_slot_to_insert(const K& key) const {
+    assert(use_empty);  // we always need to know what's empty!
+    assert(!equals(key, get_key(*emptyval.get())) && "Inserting the empty key");
+    assert((!use_deleted || !equals(key, key_info.delkey))
+           && "Inserting the deleted key");
+    const size_type slot = find_slot(key);
+    return slot == N ? first_free_slot() : slot;
+  }
+
+  iterator slot_iterator(size_type slot) {
+    return iterator(this, slots() + slot, slots() + N,
+                    typename iterator::big_iterator(), false);
+  }
+
+  // Marks the slot we just built a value in as in use.
+  iterator fill_slot(size_type slot) {
+    used |= slot_mask(1) << slot;
+    ++num_small;
+    return slot_iterator(slot);
+  }
+
+  void free_slot(size_type slot) {
+    slots()[slot].~value_type();
+    used &= ~(slot_mask(1) << slot);
+    --num_small;
+  }
+
+  void destroy_slots() {
+    for (size_type i = 0; i < N; ++i) {
+      if ((used >> i) & 1)
+        slots()[i].~value_type();
+    }
+    used = 0;
+    num_small = 0;
+  }
+
+  std::pair<iterator, bool> wrap(const std::pair<typename HT::iterator,
+                                                 bool>& res) {
+    return std::pair<iterator, bool>(
+        iterator(this, NULL, NULL, res.first, false), res.second);
+  }
+
+  // Tells ht what's empty and what's deleted, and puts everything in
+  // the slots in it.
+  void copy_slots_to(HT* ht) const {
+    if (use_empty)
+      ht->set_empty_key(*emptyval.get());
+    if (use_deleted)
+      ht->set_deleted_key(key_info.delkey);
+    ht->resize(num_small);
+    for (size_type i = 0; i < N; ++i) {
+      if ((used >> i) & 1)
+        ht->insert(slots()[i]);
+    }
+  }
+
+  // Starts using the table, with room for at least min_elements, and
+  // moves everything in the slots to it.
+  void promote(size_type min_elements) {
+    assert(!big);
+    big = new_table(0);
+    if (use_empty)
+      big->set_empty_key(*emptyval.get());
+    if (use_deleted)
+      big->set_deleted_key(key_info.delkey);
+    big->resize(min_elements);
+    for (size_type i = 0; i < N; ++i) {
+      if ((used >> i) & 1) {
+#ifdef SPARSEHASH_CXX11
+        big->insert(std::move(slots()[i]));
+#else
+        big->insert(slots()[i]);
+#endif
+        slots()[i].~value_type();
+      }
+    }
+    used = 0;
+    num_small = 0;
+  }
+
+  // An empty table, built the way big would be if we started using it
+  // now.
+  HT table_like_big() const {
+    HT ht(0, hash_funct(), key_eq(), key_info, key_info, get_allocator());
+    params.apply_to(&ht);
+    return ht;
+  }
+
+  // Allocates a table like that, expecting expected_max_items.
+  HT* new_table(size_type expected_max_items) const {
+    table_alloc_type alloc(get_allocator());
+    HT* ht = alloc.allocate(1);
+    try {
+      new(ht) HT(expected_max_items, hash_funct(), key_eq(), key_info,
+                 key_info, get_allocator());
+    } catch (...) {
+      alloc.deallocate(ht, 1);
+      throw;
+    }
+    params.apply_to(ht);
+    return ht;
+  }
+
+  void delete_table(HT* ht) const {
+    table_alloc_type alloc(ht->get_allocator());
+    ht->~HT();
+    alloc.deallocate(ht, 1);
+  }
+
+  // Takes ht's table and slots; we must have none of our own.  Each
+  // slot is built here before it's freed in ht, so if one throws, it
+  // and those after it stay in ht.
+  void take_values(small_dense_hashtable& ht) {
+    assert(!big && used == 0);
+    for (size_type i = 0; i < N; ++i) {
+      if ((ht.used >> i) & 1) {
+#ifdef SPARSEHASH_CXX11
+        new(slots() + i) value_type(std::move(ht.slots()[i]));
+#else
+        new(slots() + i) value_type(ht.slots()[i]);
+#endif
+        fill_slot(i);
+        ht.free_slot(i);
+      }
+    }
+    std::swap(big, ht.big);
+  }
+
+  // Copies ht's empty value, if it has one; we must have none.
+  void copy_empty_value(const small_dense_hashtable& ht) {
+    assert(!use_empty);
+    if (ht.use_empty) {
+      new(emptyval.get()) value_type(*ht.emptyval.get());
+      use_empty = true;
+    }
+  }
+  void destroy_empty_value() {
+    if (use_empty)
+      emptyval.get()->~value_type();
+    use_empty = false;
+  }
+
+  // Destroys everything we hold, and the table.
+  void destroy_values() {
+    destroy_slots();
+    if (big)
+      delete_table(big);
+    big = NULL;
+    destroy_empty_value();
+  }
+
+  // Package functors with another class to eliminate memory needed for
+  // zero-size functors.  The table has its own; these are what we
+  // pass it, and use in the slots.
+  class KeyInfo : public ExtractKey, public SetKey, public key_equal {
+   public:
+    KeyInfo(const ExtractKey& ek, const SetKey& sk, const key_equal& eq)
+        : ExtractKey(ek),
+          SetKey(sk),
+          key_equal(eq) {
+    }
+
+    // We want to return the exact same type as ExtractKey: Key or const Key&
+    typename ExtractKey::result_type get_key(const_reference v) const {
+      return ExtractKey::operator()(v);
+    }
+    template <class K1, class K2>
+    bool equals(const K1& a, const K2& b) const {
+      return key_equal::operator()(a, b);
+    }
+
+    // Which key is the deleted one, for when we start using the table.
+    typename base::remove_const<key_type>::type delkey;
+  };
+
+  template <class K1, class K2>
+  bool equals(const K1& a, const K2& b) const {
+    return key_info.equals(a, b);
+  }
+  typename ExtractKey::result_type get_key(const_reference v) const {
+    return key_info.get_key(v);
+  }
+
+  // What we build the table with, besides key_info, and what we've been
+  // told to set in it, until there is one.  A negative grow means we
+  // haven't been told, and the table's own defaults apply.
+  class Params : public hasher, public allocator_type {
+   public:
+    Params(const hasher& hf, const allocator_type& alloc)
+        : hasher(hf),
+          allocator_type(alloc),
+          shrink(-1.0f),
+          grow(-1.0f),
+          resize_threads(1) {
+    }
+
+    void apply_to(HT* ht) const {
+      if (grow >= 0)
+        ht->set_resizing_parameters(shrink, grow);
+      ht->set_resize_threads(resize_threads);
+    }
+
+    // As with the table, we purposefully don't swap the allocator.
+    void swap(Params& other) {
+      std::swap(static_cast<hasher&>(*this), static_cast<hasher&>(other));
+      std::swap(shrink, other.shrink);
+      std::swap(grow, other.grow);
+      std::swap(resize_threads, other.resize_threads);
+    }
+
+    float shrink, grow;
+    int resize_threads;
+  };
+
+  typedef typename allocator_type::template rebind<HT>::other table_alloc_type;
+
+  // The actual data
+  HT* big;                          // the table, once we're using it
+  Params params;
+  KeyInfo key_info;
+  bool use_empty;                   // whether emptyval is set
+  bool use_deleted;                 // whether key_info.delkey is set
+  slot_mask used;
+  size_type num_small;              // how many slots are in use
+  sparsehash_internal::inline_buffer<value_type, N> slot_buffer;
+  sparsehash_internal::inline_buffer<value_type, 1> emptyval;
+};
+
+namespace sparsehash_internal {
+
+// The table behind a dense_hash_map or dense_hash_set: HT, or HT with
+// Policy::inline_buckets slots in front of it.
+template <class HT, class ExtractKey, class SetKey, class Policy,
+          size_t N = Policy::inline_buckets>
+struct with_inline_buckets {
+  // The table would allocate its bitmap as soon as it was constructed.
+  SPARSEHASH_COMPILE_ASSERT(!Policy::use_occupancy_bitmap,
+                            inline_buckets_and_occupancy_bitmap_dont_mix);
+  typedef small_dense_hashtable<HT, ExtractKey, SetKey, N> type;
+};
+template <class HT, class ExtractKey, class SetKey, class Policy>
+struct with_inline_buckets<HT, ExtractKey, SetKey, Policy, 0> {
+  typedef HT type;
+};
+
+}  // namespace sparsehash_internal
+
+#undef SPARSEHASH_COMPILE_ASSERT
+_END_GOOGLE_NAMESPACE_
+
+#endif /* _SMALLDENSEHASHTABLE_H_ */
@@ -74,7 +74,7 @@
 // For enlarge_factor, you can use this chart to try to trade-off
 // expected lookup time to the space taken up.  By default, this
 // code uses quadratic probing, though you can change it to linear
-// via _JUMP below if you really want to.
+// with the probing knob of sparse_hashtable_policy.
 //
 // From http://www.augustana.ca/~mohrj/courses/1999.fall/csc210/lecture_notes/hashing.html
 // NUMBER OF PROBES / LOOKUP       Successful            Unsuccessful
@@ -101,6 +101,7 @@
 #include <iterator>                  // for iterator tags
 #include <limits>                    // for numeric_limits
 #include <utility>                   // for pair
+#include <vector>                    // for parallel resizing
 #include <sparsehash/type_traits.h>        // for remove_const
 #include <sparsehash/internal/hashtable-common.h>
 #include <sparsehash/sparsetable>    // IWYU pragma: export
@@ -109,19 +110,10 @@
 _START_GOOGLE_NAMESPACE_
 
 namespace base {   // just to make google->opensource transition easier
+using GOOGLE_NAMESPACE::is_same;
 using GOOGLE_NAMESPACE::remove_const;
 }
 
-#ifndef SPARSEHASH_STAT_UPDATE
-#define SPARSEHASH_STAT_UPDATE(x) ((void) 0)
-#endif
-
-// The probing method
-// Linear probing
-// #define JUMP_(key, num_probes)    ( 1 )
-// Quadratic probing
-#define JUMP_(key, num_probes)    ( num_probes )
-
 // The smaller this is, the faster lookup is (because the group bitmap is
 // smaller) and the faster insert is, because there's less to move.
 // On the other hand, there are more groups.  Since group::size_type is
@@ -144,27 +136,79 @@ static const u_int16_t DEFAULT_GROUP_SIZE = 48;   // fits in 1.5 words
 // EqualKey: Given two Keys, says whether they are the same (that is,
 //           if they are both associated with the same Value).
 // Alloc: STL allocator to use to allocate memory.
+// Policy: compile-time tuning knobs; see sparse_hashtable_policy below.
+
+// These are the knobs you can turn on a sparse_hashtable at compile
+// time.  To change one, derive from this struct and redefine just the
+// enum you care about, then pass your struct as the Policy template
+// argument (the last one) of sparse_hash_map or sparse_hash_set.
+//
+// cache_hash: keep the full hash of every occupied bucket in a second
+//    sparsetable, parallel to the first.  A probe compares hashes
+//    before calling key_equal, and resizing reuses them instead of
+//    calling the hasher again.  Costs sizeof(size_type) extra bytes per
+//    element, plus a second set of group bitmaps, so it's only worth
+//    it when hashing or comparing keys is expensive (eg long strings).
+//    Hashes aren't written to disk; unserialize() and
+//    read_nopointer_data() recompute them.
+//
+// probing: how far each probe is from the one before it:
+//    quadratic_probing (the default) or linear_probing, both described
+//    in hashtable-common.h.  A table whose probing isn't the default
+//    rehashes after unserialize(), so it can read what any table
+//    writes; but the file it writes is marked so that only such a
+//    table will read it.
+//
+// hash_mixing: what to do to the hasher's result before picking a
+//    bucket with it: default_hash_mixing (which mixes the hashes of
+//    integer and pointer keys), fibonacci_hash_mixing or
+//    no_hash_mixing, all described in hashtable-common.h.  This
+//    changes where entries go, so the magic number at the start of the
+//    file says whether they were put there with a mixed hash (see
+//    sparsetable).  A table that mixes reads files from tables that
+//    don't, and rehashes them as it does; files it writes itself are
+//    read as they are.  A table that doesn't mix -- or one from before
+//    there was mixing -- refuses files from one that does, so what a
+//    sparse_hash_map<int, ...> writes can't be read by older code.
+//
+// statistics: no_statistics (the default) or hashtable_statistics,
+//    which counts lookups, hits and misses, probe lengths, tombstones
+//    probed past, resizes and the time spent copying; statistics() on
+//    the table returns the counts.  Both are described in
+//    hashtable-common.h; hashtable_statistics needs
+//    #include <sparsehash/hashtable_statistics>.
+struct sparse_hashtable_policy {
+  enum { cache_hash = false };
+  typedef quadratic_probing probing;
+  typedef default_hash_mixing hash_mixing;
+  typedef no_statistics statistics;
+};
 
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy = sparse_hashtable_policy>
 class sparse_hashtable;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct sparse_hashtable_iterator;
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct sparse_hashtable_const_iterator;
 
 // As far as iterating, we're basically just a sparsetable
 // that skips over deleted elements.
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct sparse_hashtable_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef sparse_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef sparse_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef sparse_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>       iterator;
+  typedef sparse_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
   typedef typename sparsetable<V,DEFAULT_GROUP_SIZE,value_alloc_type>::nonempty_iterator
       st_iterator;
 
@@ -176,8 +220,9 @@ struct sparse_hashtable_iterator {
   typedef typename value_alloc_type::pointer pointer;
 
   // "Real" constructor and default constructor
-  sparse_hashtable_iterator(const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
-                            st_iterator it, st_iterator it_end)
+  sparse_hashtable_iterator(
+      const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      st_iterator it, st_iterator it_end)
     : ht(h), pos(it), end(it_end)   { advance_past_deleted(); }
   sparse_hashtable_iterator() { }      // not ever used internally
   // The default destructor is fine; we don't define one
@@ -204,19 +249,21 @@ struct sparse_hashtable_iterator {
 
 
   // The actual data
-  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
   st_iterator pos, end;
 };
 
 // Now do it all again, but with const-ness!
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct sparse_hashtable_const_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef sparse_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A>       iterator;
-  typedef sparse_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A> const_iterator;
+  typedef sparse_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>       iterator;
+  typedef sparse_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
   typedef typename sparsetable<V,DEFAULT_GROUP_SIZE,value_alloc_type>::const_nonempty_iterator
       st_iterator;
 
@@ -228,8 +275,9 @@ struct sparse_hashtable_const_iterator {
   typedef typename value_alloc_type::const_pointer pointer;
 
   // "Real" constructor and default constructor
-  sparse_hashtable_const_iterator(const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
-                                  st_iterator it, st_iterator it_end)
+  sparse_hashtable_const_iterator(
+      const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      st_iterator it, st_iterator it_end)
     : ht(h), pos(it), end(it_end)   { advance_past_deleted(); }
   // This lets us convert regular iterators to const iterators
   sparse_hashtable_const_iterator() { }      // never used internally
@@ -259,18 +307,20 @@ struct sparse_hashtable_const_iterator {
 
 
   // The actual data
-  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
   st_iterator pos, end;
 };
 
 // And once again, but this time freeing up memory as we iterate
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
 struct sparse_hashtable_destructive_iterator {
  private:
   typedef typename A::template rebind<V>::other value_alloc_type;
 
  public:
-  typedef sparse_hashtable_destructive_iterator<V,K,HF,ExK,SetK,EqK,A> iterator;
+  typedef sparse_hashtable_destructive_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      iterator;
   typedef typename sparsetable<V,DEFAULT_GROUP_SIZE,value_alloc_type>::destructive_iterator
       st_iterator;
 
@@ -282,9 +332,9 @@ struct sparse_hashtable_destructive_iterator {
   typedef typename value_alloc_type::pointer pointer;
 
   // "Real" constructor and default constructor
-  sparse_hashtable_destructive_iterator(const
-                                        sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *h,
-                                        st_iterator it, st_iterator it_end)
+  sparse_hashtable_destructive_iterator(
+      const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      st_iterator it, st_iterator it_end)
     : ht(h), pos(it), end(it_end)   { advance_past_deleted(); }
   sparse_hashtable_destructive_iterator() { }          // never used internally
   // The default destructor is fine; we don't define one
@@ -311,15 +361,74 @@ struct sparse_hashtable_destructive_iterator {
 
 
   // The actual data
-  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> *ht;
+  const sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
   st_iterator pos, end;
 };
 
+namespace sparsehash_internal {
+// If Policy::cache_hash, hashes() is a sparsetable holding the hash of
+// every full bucket of a sparse_hashtable's table, in the same bucket.
+// Otherwise it's a stand-in whose members do nothing, made afresh on
+// every call, so the table keeps no room for hashes it doesn't cache.
+template <class Value, class Alloc, bool Enabled>
+class sparse_hash_cache {
+ protected:
+  typedef typename Alloc::template rebind<Value>::other::size_type size_type;
+  typedef typename Alloc::template rebind<size_type>::other hash_alloc_type;
+  typedef sparsetable<size_type, DEFAULT_GROUP_SIZE, hash_alloc_type>
+      HashCache;
+
+  explicit sparse_hash_cache(const hash_alloc_type& a) : hashes_(0, a) { }
+  HashCache& hashes() { return hashes_; }
+  const HashCache& hashes() const { return hashes_; }
+
+ private:
+  HashCache hashes_;
+};
+
+template <class Value, class Alloc>
+class sparse_hash_cache<Value, Alloc, false> {
+ protected:
+  typedef typename Alloc::template rebind<Value>::other::size_type size_type;
+  typedef typename Alloc::template rebind<size_type>::other hash_alloc_type;
+  struct HashCache {
+    struct iterator {
+      iterator& operator++() { return *this; }
+      size_type operator*() const { return 0; }
+    };
+    typedef iterator const_nonempty_iterator;
+    typedef iterator destructive_iterator;
+
+    const_nonempty_iterator nonempty_begin() const { return iterator(); }
+    destructive_iterator destructive_begin() const { return iterator(); }
+    size_type unsafe_get(size_type) const { return 0; }
+    void set(size_type, size_type) const { }
+    void set_uncounted(size_type, size_type) const { }
+    void recount_nonempty() const { }
+    void resize(size_type) const { }
+    void clear() const { }
+    void swap(const HashCache&) const { }
+    void prefetch(size_type) const { }
+    void prefetch_group(size_type) const { }
+    void memory_usage(memory_breakdown*) const { }
+  };
+
+  explicit sparse_hash_cache(const hash_alloc_type&) { }
+  HashCache hashes() const { return HashCache(); }
+};
+}  // namespace sparsehash_internal
 
 template <class Value, class Key, class HashFcn,
-          class ExtractKey, class SetKey, class EqualKey, class Alloc>
-class sparse_hashtable {
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy>
+class sparse_hashtable
+    : private sparsehash_internal::sparse_hash_cache<Value, Alloc,
+                                                     Policy::cache_hash> {
  private:
+  typedef sparsehash_internal::sparse_hash_cache<Value, Alloc,
+                                                 Policy::cache_hash>
+      hash_cache;
+  using hash_cache::hashes;
   typedef typename Alloc::template rebind<Value>::other value_alloc_type;
 
  public:
@@ -336,15 +445,15 @@ class sparse_hashtable {
   typedef typename value_alloc_type::pointer pointer;
   typedef typename value_alloc_type::const_pointer const_pointer;
   typedef sparse_hashtable_iterator<Value, Key, HashFcn, ExtractKey,
-                                    SetKey, EqualKey, Alloc>
+                                    SetKey, EqualKey, Alloc, Policy>
   iterator;
 
   typedef sparse_hashtable_const_iterator<Value, Key, HashFcn, ExtractKey,
-                                          SetKey, EqualKey, Alloc>
+                                          SetKey, EqualKey, Alloc, Policy>
   const_iterator;
 
   typedef sparse_hashtable_destructive_iterator<Value, Key, HashFcn, ExtractKey,
-                                                SetKey, EqualKey, Alloc>
+                                                SetKey, EqualKey, Alloc, Policy>
   destructive_iterator;
 
   // These come from tr1.  For us they're the same as regular iterators.
@@ -434,6 +543,9 @@ class sparse_hashtable {
 
   // Accessor function for statistics gathering.
   int num_table_copies() const { return settings.num_ht_copies(); }
+  // The counts Policy::statistics has kept; all zero with no_statistics.
+  hashtable_stats statistics() const { return settings.stats_snapshot(); }
+  void reset_statistics()            { settings.reset_stats(); }
 
  private:
   // We need to copy values when we set the special marker for deleted
@@ -516,6 +628,12 @@ class sparse_hashtable {
     return num_deleted > 0 && test_deleted_key(get_key(*it));
   }
 
+ private:
+  // For when we walk table directly, rather than with our iterators.
+  bool test_deleted_value(const_reference v) const {
+    return num_deleted > 0 && test_deleted_key(get_key(v));
+  }
+
  private:
   void check_use_deleted(const char* caller) {
     (void)caller;    // could log it if the assert failed
@@ -568,6 +686,25 @@ class sparse_hashtable {
     return begin(i) == end(i) ? 0 : 1;
   }
 
+  // The sparsetable's memory (see sparsetable::memory_usage()), with the
+  // cached hashes, if any, counted as bookkeeping.  group_sizes describes
+  // the groups of values only.
+  size_type memory_usage(memory_breakdown* usage = NULL,
+                         bool with_group_sizes = false) const {
+    memory_breakdown ignored;
+    if (usage == NULL)  usage = &ignored;
+    table.memory_usage(usage, with_group_sizes);
+    usage->object_bytes = sizeof(*this);
+    if (Policy::cache_hash) {
+      memory_breakdown hash_usage;
+      hashes().memory_usage(&hash_usage);
+      usage->bookkeeping_bytes += (hash_usage.bucket_bytes +
+                                   hash_usage.bookkeeping_bytes);
+      usage->num_allocations += hash_usage.num_allocations;
+    }
+    return usage->total();
+  }
+
  private:
   // Because of the above, size_type(-1) is never legal; use it for errors
   static const size_type ILLEGAL_BUCKET = size_type(-1);
@@ -596,6 +733,7 @@ class sparse_hashtable {
              num_remain < static_cast<size_type>(sz * shrink_factor)) {
         sz /= 2;                            // stay a power of 2
       }
+      settings.record_resize();
       sparse_hashtable tmp(MoveDontCopy, *this, sz);
       swap(tmp);                            // now we are tmp
       retval = true;
@@ -652,6 +790,7 @@ class sparse_hashtable {
       }
     }
 
+    settings.record_resize();
     sparse_hashtable tmp(MoveDontCopy, *this, resize_to);
     swap(tmp);                             // now we are tmp
     return true;
@@ -659,6 +798,7 @@ class sparse_hashtable {
 
   // Used to actually do the rehashing when we grow/shrink a hashtable
   void copy_from(const sparse_hashtable &ht, size_type min_buckets_wanted) {
+    const double start = settings.start_copy();
     clear();            // clear table, set num_deleted to 0
 
     // If we need to change the size of our table, do it now
@@ -666,6 +806,7 @@ class sparse_hashtable {
         settings.min_buckets(ht.size(), min_buckets_wanted);
     if ( resize_to > bucket_count() ) {      // we don't have enough buckets
       table.resize(resize_to);               // sets the number of buckets
+      resize_hashes();
       settings.reset_thresholds(bucket_count());
     }
 
@@ -673,20 +814,33 @@ class sparse_hashtable {
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
     assert((bucket_count() & (bucket_count()-1)) == 0);      // a power of two
-    for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
-      size_type num_probes = 0;              // how many times we've probed
-      size_type bucknum;
-      const size_type bucket_count_minus_one = bucket_count() - 1;
-      for (bucknum = hash(get_key(*it)) & bucket_count_minus_one;
-           table.test(bucknum);                          // not empty
-           bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one) {
-        ++num_probes;
-        assert(num_probes < bucket_count()
-               && "Hashtable is full: an error in key_equal<> or hash<>");
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+    const int num_ranges = parallel_resize_ranges(ht);
+    if (num_ranges > 1) {
+      parallel_copy_from(ht, num_ranges);
+      settings.inc_num_ht_copies();
+      settings.record_copy(start);
+      return;
+    }
+#endif
+    if (Policy::cache_hash) {
+      // ht.hashes is full in just the same buckets as ht.table, so we
+      // can walk the two side by side.
+      typename HashCache::const_nonempty_iterator h =
+          ht.hashes().nonempty_begin();
+      for ( typename Table::const_nonempty_iterator it =
+                ht.table.nonempty_begin();
+            it != ht.table.nonempty_end(); ++it, ++h ) {
+        if ( !ht.test_deleted_value(*it) )
+          insert_unique_noresize(*it, *h);
+      }
+    } else {
+      for ( const_iterator it = ht.begin(); it != ht.end(); ++it ) {
+        insert_unique_noresize(*it, hash(get_key(*it)));
       }
-      table.set(bucknum, *it);               // copies the value to here
     }
     settings.inc_num_ht_copies();
+    settings.record_copy(start);
   }
 
   // Implementation is like copy_from, but it destroys the table of the
@@ -694,6 +848,7 @@ class sparse_hashtable {
   // useful in resizing, since we're throwing away the "from" guy anyway.
   void move_from(MoveDontCopyT mover, sparse_hashtable &ht,
                  size_type min_buckets_wanted) {
+    const double start = settings.start_copy();
     clear();            // clear table, set num_deleted to 0
 
     // If we need to change the size of our table, do it now
@@ -704,6 +859,7 @@ class sparse_hashtable {
       resize_to = settings.min_buckets(ht.size(), min_buckets_wanted);
     if ( resize_to > bucket_count() ) {      // we don't have enough buckets
       table.resize(resize_to);               // sets the number of buckets
+      resize_hashes();
       settings.reset_thresholds(bucket_count());
     }
 
@@ -711,23 +867,164 @@ class sparse_hashtable {
     // We could use insert() here, but since we know there are
     // no duplicates and no deleted items, we can be more efficient
     assert( (bucket_count() & (bucket_count()-1)) == 0);      // a power of two
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+    // In parallel we can't free ht's groups as we go, so for a moment
+    // we hold two copies of everything.
+    const int num_ranges = parallel_resize_ranges(ht);
+    if (num_ranges > 1) {
+      parallel_copy_from(ht, num_ranges);
+      settings.inc_num_ht_copies();
+      settings.record_copy(start);
+      return;
+    }
+#endif
     // THIS IS THE MAJOR LINE THAT DIFFERS FROM COPY_FROM():
-    for ( destructive_iterator it = ht.destructive_begin();
-          it != ht.destructive_end(); ++it ) {
-      size_type num_probes = 0;              // how many times we've probed
-      size_type bucknum;
-      for ( bucknum = hash(get_key(*it)) & (bucket_count()-1);  // h % buck_cnt
-            table.test(bucknum);                          // not empty
-            bucknum = (bucknum + JUMP_(key, num_probes)) & (bucket_count()-1) ) {
-        ++num_probes;
-        assert(num_probes < bucket_count()
-               && "Hashtable is full: an error in key_equal<> or hash<>");
+    if (Policy::cache_hash) {
+      typename HashCache::destructive_iterator h =
+          ht.hashes().destructive_begin();
+      for ( typename Table::destructive_iterator it =
+                ht.table.destructive_begin();
+            it != ht.table.destructive_end(); ++it, ++h ) {
+        if ( !ht.test_deleted_value(*it) )
+          insert_unique_noresize(*it, *h);
+      }
+    } else {
+      for ( destructive_iterator it = ht.destructive_begin();
+            it != ht.destructive_end(); ++it ) {
+        insert_unique_noresize(*it, hash(get_key(*it)));
       }
-      table.set(bucknum, *it);               // copies the value to here
     }
     settings.inc_num_ht_copies();
+    settings.record_copy(start);
   }
 
+  // How far probe number num_probes is from the one before it.
+  static size_type probe_jump(size_type num_probes) {
+    return static_cast<size_type>(Policy::probing::jump(num_probes));
+  }
+  // Puts obj, whose key hashes to hashval, in the first empty bucket
+  // on its probe sequence.  Only for copying from another table, when
+  // we know there are no duplicates and no deleted buckets.
+  void insert_unique_noresize(const_reference obj, size_type hashval) {
+    size_type num_probes = 0;              // how many times we've probed
+    size_type bucknum;
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    for (bucknum = hashval & bucket_count_minus_one;
+         table.test(bucknum);                            // not empty
+         bucknum = (bucknum + probe_jump(num_probes)) & bucket_count_minus_one) {
+      ++num_probes;
+      assert(num_probes < bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+    }
+    table.set(bucknum, obj);               // copies the value to here
+    set_hash(bucknum, hashval);
+  }
+
+#ifdef SPARSEHASH_PARALLEL_RESIZE
+  // PARALLEL RESIZING
+  // With settings.resize_threads() > 1, copy_from and move_from fill a
+  // big table on several threads, the way dense_hashtable does: we cut
+  // our buckets into one contiguous range per thread, each thread sorts
+  // its share of ht's buckets by the range their first probe lands in,
+  // and then each thread inserts the entries of one range.  Ranges are
+  // made of whole sparsetable groups, so no two threads ever touch the
+  // same group, and we use set_uncounted() and count the buckets at the
+  // end.  Entries whose probe sequence leaves their range are inserted
+  // on this thread afterwards.
+  static const size_t HT_MIN_PARALLEL_RESIZE = 1 << 16;   // elements
+  static const size_t HT_MIN_RESIZE_RANGE = 1 << 12;      // buckets
+
+  // How many ranges (and threads) to use to fill us from ht; 1 means
+  // we shouldn't resize in parallel at all.
+  int parallel_resize_ranges(const sparse_hashtable& ht) const {
+    if (static_cast<size_t>(ht.size()) < HT_MIN_PARALLEL_RESIZE)
+      return 1;
+    int n = settings.resize_threads();
+    const size_t max_ranges = bucket_count() / HT_MIN_RESIZE_RANGE;
+    if (max_ranges < static_cast<size_t>(n))
+      n = static_cast<int>(max_ranges);
+    return n < 1 ? 1 : n;
+  }
+
+  // Like insert_unique_noresize, but gives up, returning ILLEGAL_BUCKET,
+  // as soon as the probe sequence leaves buckets [lo, hi).
+  size_type find_empty_in_range(size_type hashval,
+                                size_type lo, size_type hi) const {
+    size_type num_probes = 0;
+    const size_type bucket_count_minus_one = bucket_count() - 1;
+    size_type bucknum = hashval & bucket_count_minus_one;
+    while (bucknum >= lo && bucknum < hi) {
+      if (!table.test(bucknum))
+        return bucknum;
+      ++num_probes;
+      assert(num_probes < bucket_count()
+             && "Hashtable is full: an error in key_equal<> or hash<>");
+      bucknum = (bucknum + probe_jump(num_probes)) & bucket_count_minus_one;
+    }
+    return ILLEGAL_BUCKET;
+  }
+
+  // The guts of copy_from and move_from when num_ranges > 1.  We must
+  // already be cleared to the right size.
+  void parallel_copy_from(const sparse_hashtable& ht, int num_ranges) {
+    typedef std::pair<size_type, size_type> entry;   // ht bucket, hash
+    const size_type src_buckets = ht.bucket_count();
+    const size_type chunk = (src_buckets + num_ranges - 1) / num_ranges;
+    size_type range_size = (bucket_count() + num_ranges - 1) / num_ranges;
+    range_size = ((range_size + DEFAULT_GROUP_SIZE - 1) /
+                  DEFAULT_GROUP_SIZE * DEFAULT_GROUP_SIZE);
+    // parts[w * num_ranges + r] is what thread w found for range r.
+    std::vector<std::vector<entry> > parts(num_ranges * num_ranges);
+    std::vector<std::vector<entry> > put_aside(num_ranges);
+
+    // Each part gets about an equal share; leave a little slack.
+    const size_t part_guess = ht.size() / (num_ranges * num_ranges);
+    sparsehash_internal::run_in_parallel(num_ranges, [&](int w) {
+      for (int r = 0; r < num_ranges; ++r)
+        parts[w * num_ranges + r].reserve(part_guess + part_guess / 8 + 16);
+      const size_type begin = std::min<size_type>(src_buckets, w * chunk);
+      const size_type end = std::min<size_type>(src_buckets, begin + chunk);
+      for (size_type i = begin; i < end; ++i) {
+        if (!ht.table.test(i) || ht.test_deleted_value(ht.table.unsafe_get(i)))
+          continue;
+        const size_type hashval = (Policy::cache_hash ?
+                                   ht.hashes().unsafe_get(i) :
+                                   hash(get_key(ht.table.unsafe_get(i))));
+        const size_type r = (hashval & (bucket_count() - 1)) / range_size;
+        parts[w * num_ranges + r].push_back(entry(i, hashval));
+      }
+    });
+
+    sparsehash_internal::run_in_parallel(num_ranges, [&](int r) {
+      const size_type lo = static_cast<size_type>(r * range_size);
+      const size_type hi = std::min<size_type>(bucket_count(), lo + range_size);
+      for (int w = 0; w < num_ranges; ++w) {
+        const std::vector<entry>& part = parts[w * num_ranges + r];
+        for (size_t j = 0; j < part.size(); ++j) {
+          const size_type pos = find_empty_in_range(part[j].second, lo, hi);
+          if (pos == ILLEGAL_BUCKET) {
+            put_aside[r].push_back(part[j]);
+            continue;
+          }
+          table.set_uncounted(pos, ht.table.unsafe_get(part[j].first));
+          if (Policy::cache_hash)
+            hashes().set_uncounted(pos, part[j].second);
+        }
+      }
+    });
+
+    table.recount_nonempty();
+    if (Policy::cache_hash)
+      hashes().recount_nonempty();
+    for (int r = 0; r < num_ranges; ++r) {
+      for (size_t j = 0; j < put_aside[r].size(); ++j) {
+        const entry& e = put_aside[r][j];
+        insert_unique_noresize(ht.table.unsafe_get(e.first), e.second);
+      }
+    }
+  }
+#endif  // SPARSEHASH_PARALLEL_RESIZE
+
 
   // Required by the spec for hashed associative container
  public:
@@ -754,6 +1051,16 @@ class sparse_hashtable {
     settings.reset_thresholds(bucket_count());
   }
 
+  // Threads (1-255) for rehashing a big table into a new sparsetable;
+  // see dense_hashtable::resize_threads().  Each thread fills its own
+  // sparsegroups, so only the hasher and value copies run concurrently.
+  int resize_threads() const {
+    return settings.resize_threads();
+  }
+  void set_resize_threads(int n) {
+    settings.set_resize_threads(n);
+  }
+
   // CONSTRUCTORS -- as required by the specs, we take a size,
   // but also let you specify a hashfunction, key comparator,
   // and key extractor.  We also define a copy constructor and =.
@@ -764,13 +1071,16 @@ class sparse_hashtable {
                             const ExtractKey& ext = ExtractKey(),
                             const SetKey& set = SetKey(),
                             const Alloc& alloc = Alloc())
-      : settings(hf),
+      : hash_cache(hash_alloc_type(alloc)),
+        settings(hf),
         key_info(ext, set, eql),
+        rehash_on_read(false),
         num_deleted(0),
         table((expected_max_items_in_table == 0
                ? HT_DEFAULT_STARTING_BUCKETS
                : settings.min_buckets(expected_max_items_in_table, 0)),
               alloc) {
+    resize_hashes();
     settings.reset_thresholds(bucket_count());
   }
 
@@ -780,8 +1090,10 @@ class sparse_hashtable {
   // into us instead of copying.
   sparse_hashtable(const sparse_hashtable& ht,
                    size_type min_buckets_wanted = HT_DEFAULT_STARTING_BUCKETS)
-      : settings(ht.settings),
+      : hash_cache(hash_alloc_type(ht.get_allocator())),
+        settings(ht.settings),
         key_info(ht.key_info),
+        rehash_on_read(false),
         num_deleted(0),
         table(0, ht.get_allocator()) {
     settings.reset_thresholds(bucket_count());
@@ -789,8 +1101,10 @@ class sparse_hashtable {
   }
   sparse_hashtable(MoveDontCopyT mover, sparse_hashtable& ht,
                    size_type min_buckets_wanted = HT_DEFAULT_STARTING_BUCKETS)
-      : settings(ht.settings),
+      : hash_cache(hash_alloc_type(ht.get_allocator())),
+        settings(ht.settings),
         key_info(ht.key_info),
+        rehash_on_read(false),
         num_deleted(0),
         table(0, ht.get_allocator()) {
     settings.reset_thresholds(bucket_count());
@@ -813,7 +1127,9 @@ class sparse_hashtable {
     std::swap(settings, ht.settings);
     std::swap(key_info, ht.key_info);
     std::swap(num_deleted, ht.num_deleted);
+    std::swap(rehash_on_read, ht.rehash_on_read);
     table.swap(ht.table);
+    hashes().swap(ht.hashes());
     settings.reset_thresholds(bucket_count());  // also resets consider_shrink
     ht.settings.reset_thresholds(ht.bucket_count());
     // we purposefully don't swap the allocator, which may not be swap-able
@@ -823,6 +1139,7 @@ class sparse_hashtable {
   void clear() {
     if (!empty() || (num_deleted != 0)) {
       table.clear();
+      hashes().clear();
     }
     settings.reset_thresholds(bucket_count());
     num_deleted = 0;
@@ -835,30 +1152,41 @@ class sparse_hashtable {
   // if object is not found; 2nd is ILLEGAL_BUCKET if it is.
   // Note: because of deletions where-to-insert is not trivial: it's the
   // first deleted bucket we see, as long as we don't find the key later
-  std::pair<size_type, size_type> find_position(const key_type &key) const {
+  // The lookup routines take any key type K that hasher and key_equal
+  // accept; see enable_if_transparent in hashtable-common.h.
+  template <class K>
+  std::pair<size_type, size_type> find_position(const K &key) const {
+    return find_position(key, hash(key));
+  }
+
+  // Same, for when the caller has already hashed the key.
+  template <class K>
+  std::pair<size_type, size_type> find_position(const K &key,
+                                                size_type hashval) const {
     size_type num_probes = 0;              // how many times we've probed
     const size_type bucket_count_minus_one = bucket_count() - 1;
-    size_type bucknum = hash(key) & bucket_count_minus_one;
+    size_type bucknum = hashval & bucket_count_minus_one;
     size_type insert_pos = ILLEGAL_BUCKET; // where we would insert
-    SPARSEHASH_STAT_UPDATE(total_lookups += 1);
     while ( 1 ) {                          // probe until something happens
       if ( !table.test(bucknum) ) {        // bucket is empty
-        SPARSEHASH_STAT_UPDATE(total_probes += num_probes);
+        settings.record_lookup(num_probes, false);
         if ( insert_pos == ILLEGAL_BUCKET )  // found no prior place to insert
           return std::pair<size_type,size_type>(ILLEGAL_BUCKET, bucknum);
         else
           return std::pair<size_type,size_type>(ILLEGAL_BUCKET, insert_pos);
 
       } else if ( test_deleted(bucknum) ) {// keep searching, but mark to insert
+        settings.record_tombstone();
         if ( insert_pos == ILLEGAL_BUCKET )
           insert_pos = bucknum;
 
-      } else if ( equals(key, get_key(table.unsafe_get(bucknum))) ) {
-        SPARSEHASH_STAT_UPDATE(total_probes += num_probes);
+      } else if ( hash_matches(bucknum, hashval) &&
+                  equals(key, get_key(table.unsafe_get(bucknum))) ) {
+        settings.record_lookup(num_probes, true);
         return std::pair<size_type,size_type>(bucknum, ILLEGAL_BUCKET);
       }
       ++num_probes;                        // we're doing another probe
-      bucknum = (bucknum + JUMP_(key, num_probes)) & bucket_count_minus_one;
+      bucknum = (bucknum + probe_jump(num_probes)) & bucket_count_minus_one;
       assert(num_probes < bucket_count()
              && "Hashtable is full: an error in key_equal<> or hash<>");
     }
@@ -866,7 +1194,8 @@ class sparse_hashtable {
 
  public:
 
-  iterator find(const key_type& key) {
+  template <class K>
+  iterator find(const K& key) {
     if ( size() == 0 ) return end();
     std::pair<size_type, size_type> pos = find_position(key);
     if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
@@ -875,7 +1204,8 @@ class sparse_hashtable {
       return iterator(this, table.get_iter(pos.first), table.nonempty_end());
   }
 
-  const_iterator find(const key_type& key) const {
+  template <class K>
+  const_iterator find(const K& key) const {
     if ( size() == 0 ) return end();
     std::pair<size_type, size_type> pos = find_position(key);
     if ( pos.first == ILLEGAL_BUCKET )     // alas, not there
@@ -887,19 +1217,22 @@ class sparse_hashtable {
 
   // This is a tr1 method: the bucket a given key is in, or what bucket
   // it would be put in, if it were to be inserted.  Shrug.
-  size_type bucket(const key_type& key) const {
+  template <class K>
+  size_type bucket(const K& key) const {
     std::pair<size_type, size_type> pos = find_position(key);
     return pos.first == ILLEGAL_BUCKET ? pos.second : pos.first;
   }
 
   // Counts how many elements have key key.  For maps, it's either 0 or 1.
-  size_type count(const key_type &key) const {
+  template <class K>
+  size_type count(const K &key) const {
     std::pair<size_type, size_type> pos = find_position(key);
     return pos.first == ILLEGAL_BUCKET ? 0 : 1;
   }
 
   // Likewise, equal_range doesn't really make sense for us.  Oh well.
-  std::pair<iterator,iterator> equal_range(const key_type& key) {
+  template <class K>
+  std::pair<iterator,iterator> equal_range(const K& key) {
     iterator pos = find(key);      // either an iterator or end
     if (pos == end()) {
       return std::pair<iterator,iterator>(pos, pos);
@@ -908,8 +1241,8 @@ class sparse_hashtable {
       return std::pair<iterator,iterator>(startpos, pos);
     }
   }
-  std::pair<const_iterator,const_iterator> equal_range(const key_type& key)
-      const {
+  template <class K>
+  std::pair<const_iterator,const_iterator> equal_range(const K& key) const {
     const_iterator pos = find(key);      // either an iterator or end
     if (pos == end()) {
       return std::pair<const_iterator,const_iterator>(pos, pos);
@@ -923,7 +1256,7 @@ class sparse_hashtable {
   // INSERTION ROUTINES
  private:
   // Private method used by insert_noresize and find_or_insert.
-  iterator insert_at(const_reference obj, size_type pos) {
+  iterator insert_at(const_reference obj, size_type pos, size_type hashval) {
     if (size() >= max_size()) {
       throw std::length_error("insert overflow");
     }
@@ -933,6 +1266,7 @@ class sparse_hashtable {
       --num_deleted;                // used to be, now it isn't
     }
     table.set(pos, obj);
+    set_hash(pos, hashval);
     return iterator(this, table.get_iter(pos), table.nonempty_end());
   }
 
@@ -941,13 +1275,16 @@ class sparse_hashtable {
     // First, double-check we're not inserting delkey
     assert((!settings.use_deleted() || !equals(get_key(obj), key_info.delkey))
            && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(get_key(obj));
+    const size_type hashval = hash(get_key(obj));
+    const std::pair<size_type,size_type> pos = find_position(get_key(obj),
+                                                             hashval);
     if ( pos.first != ILLEGAL_BUCKET) {      // object was already there
       return std::pair<iterator,bool>(iterator(this, table.get_iter(pos.first),
                                                table.nonempty_end()),
                                       false);     // false: we didn't insert
     } else {                                 // pos.second says where to put it
-      return std::pair<iterator,bool>(insert_at(obj, pos.second), true);
+      return std::pair<iterator,bool>(insert_at(obj, pos.second, hashval),
+                                      true);
     }
   }
 
@@ -989,12 +1326,13 @@ class sparse_hashtable {
 
   // DefaultValue is a functor that takes a key and returns a value_type
   // representing the default value to be inserted if none is found.
-  template <class DefaultValue>
-  value_type& find_or_insert(const key_type& key) {
+  template <class DefaultValue, class K>
+  value_type& find_or_insert(const K& key) {
     // First, double-check we're not inserting delkey
     assert((!settings.use_deleted() || !equals(key, key_info.delkey))
            && "Inserting the deleted key");
-    const std::pair<size_type,size_type> pos = find_position(key);
+    const size_type hashval = hash(key);
+    const std::pair<size_type,size_type> pos = find_position(key, hashval);
     DefaultValue default_value;
     if ( pos.first != ILLEGAL_BUCKET) {  // object was already there
       return *table.get_iter(pos.first);
@@ -1002,12 +1340,13 @@ class sparse_hashtable {
       // Since we resized, we can't use pos, so recalculate where to insert.
       return *insert_noresize(default_value(key)).first;
     } else {                             // no need to rehash, insert right here
-      return *insert_at(default_value(key), pos.second);
+      return *insert_at(default_value(key), pos.second, hashval);
     }
   }
 
   // DELETION ROUTINES
-  size_type erase(const key_type& key) {
+  template <class K>
+  size_type erase(const K& key) {
     // First, double-check we're not erasing delkey.
     assert((!settings.use_deleted() || !equals(key, key_info.delkey))
            && "Erasing the deleted key");
@@ -1067,6 +1406,145 @@ class sparse_hashtable {
   }
 
 
+  // BATCH ROUTINES
+  // These look up, insert or erase n keys at once.  When the table is
+  // much bigger than the cache, that's faster than one at a time.  A
+  // lookup here costs two dependent cache misses, the group's bitmap and
+  // then the value, so we pipeline: we hash keys BATCH_DEPTH ahead of the
+  // one we're probing for and prefetch their groups, and halfway there
+  // (when the group has likely arrived) prefetch their values.
+ private:
+  static const size_type BATCH_DEPTH = 16;
+
+  // Hashes key, and prefetches the group its first bucket is in.
+  template <class K>
+  size_type hash_and_prefetch_group(const K& key) const {
+    const size_type hashval = hash(key);
+    const size_type bucknum = hashval & (bucket_count() - 1);
+    table.prefetch_group(bucknum);
+    if (Policy::cache_hash)
+      hashes().prefetch_group(bucknum);
+    return hashval;
+  }
+  // Prefetches the first bucket for hashval, which needs its group.
+  void prefetch_bucket(size_type hashval) const {
+    const size_type bucknum = hashval & (bucket_count() - 1);
+    table.prefetch(bucknum);
+    if (Policy::cache_hash)
+      hashes().prefetch(bucknum);
+  }
+
+  // Fills hashvals[] for the first keys in a batch, and starts them on
+  // their way into the cache.  key_of gets a key from an item: it's
+  // IdentityKey for keys, or ExtractKey for values.
+  template <class T, class GetKey>
+  void start_batch(const T* items, size_type n, const GetKey& key_of,
+                   size_type* hashvals) const {
+    for (size_type i = 0; i < n && i < BATCH_DEPTH; ++i)
+      hashvals[i] = hash_and_prefetch_group(key_of(items[i]));
+    for (size_type i = 0; i < n && i < BATCH_DEPTH / 2; ++i)
+      prefetch_bucket(hashvals[i]);
+  }
+  // Returns the hash of items[i], and moves the pipeline along by one.
+  template <class T, class GetKey>
+  size_type next_in_batch(const T* items, size_type n, size_type i,
+                          const GetKey& key_of, size_type* hashvals) const {
+    const size_type hashval = hashvals[i % BATCH_DEPTH];
+    if (i + BATCH_DEPTH < n)
+      hashvals[i % BATCH_DEPTH] =
+          hash_and_prefetch_group(key_of(items[i + BATCH_DEPTH]));
+    if (i + BATCH_DEPTH / 2 < n)
+      prefetch_bucket(hashvals[(i + BATCH_DEPTH / 2) % BATCH_DEPTH]);
+    return hashval;
+  }
+
+  struct IdentityKey {
+    template <class K> const K& operator()(const K& key) const { return key; }
+  };
+
+  // For find_batch, const and not: Iterator is iterator or const_iterator.
+  template <class Table, class K, class Iterator>
+  static void find_batch(Table* ht, const K* keys, size_type n,
+                         Iterator* results) {
+    if (ht->size() == 0) {
+      std::fill(results, results + n, ht->end());
+      return;
+    }
+    size_type hashvals[BATCH_DEPTH];
+    ht->start_batch(keys, n, IdentityKey(), hashvals);
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = ht->next_in_batch(keys, n, i, IdentityKey(),
+                                                  hashvals);
+      const std::pair<size_type, size_type> pos =
+          ht->find_position(keys[i], hashval);
+      if (pos.first == ILLEGAL_BUCKET)
+        results[i] = ht->end();
+      else
+        results[i] = Iterator(ht, ht->table.get_iter(pos.first),
+                              ht->table.nonempty_end());
+    }
+  }
+
+ public:
+  // Sets results[i] to find(keys[i]), for i < n.
+  template <class K>
+  void find_batch(const K* keys, size_type n, iterator* results) {
+    find_batch(this, keys, n, results);
+  }
+  template <class K>
+  void find_batch(const K* keys, size_type n, const_iterator* results) const {
+    find_batch(this, keys, n, results);
+  }
+
+  // Inserts objs[0] to objs[n-1].  Like insert(f, l), this grows the
+  // table for all n first, even if some are already there.  Returns how
+  // many we inserted.
+  size_type insert_batch(const value_type* objs, size_type n) {
+    resize_delta(n);
+    size_type hashvals[BATCH_DEPTH];
+    const ExtractKey& key_of = key_info;
+    start_batch(objs, n, key_of, hashvals);
+    size_type num_inserted = 0;
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = next_in_batch(objs, n, i, key_of, hashvals);
+      assert((!settings.use_deleted() ||
+              !equals(get_key(objs[i]), key_info.delkey))
+             && "Inserting the deleted key");
+      const std::pair<size_type, size_type> pos =
+          find_position(get_key(objs[i]), hashval);
+      if (pos.first == ILLEGAL_BUCKET) {
+        insert_at(objs[i], pos.second, hashval);
+        ++num_inserted;
+      }
+    }
+    return num_inserted;
+  }
+
+  // Erases keys[0] to keys[n-1].  Returns how many were there to erase.
+  template <class K>
+  size_type erase_batch(const K* keys, size_type n) {
+    if (size() == 0)
+      return 0;
+    size_type hashvals[BATCH_DEPTH];
+    start_batch(keys, n, IdentityKey(), hashvals);
+    size_type num_erased = 0;
+    for (size_type i = 0; i < n; ++i) {
+      const size_type hashval = next_in_batch(keys, n, i, IdentityKey(),
+                                              hashvals);
+      assert((!settings.use_deleted() || !equals(keys[i], key_info.delkey))
+             && "Erasing the deleted key");
+      const std::pair<size_type, size_type> pos = find_position(keys[i],
+                                                                hashval);
+      if (pos.first != ILLEGAL_BUCKET) {
+        erase(const_iterator(this, table.get_iter(pos.first),
+                             table.nonempty_end()));
+        ++num_erased;
+      }
+    }
+    return num_erased;
+  }
+
+
   // COMPARISON
   bool operator==(const sparse_hashtable& ht) const {
     if (size() != ht.size()) {
@@ -1105,15 +1583,22 @@ class sparse_hashtable {
   template <typename OUTPUT>
   bool write_metadata(OUTPUT *fp) {
     squash_deleted();           // so we don't have to worry about delkey
-    return table.write_metadata(fp);
+    return table.write_metadata(fp, layout_magic());
   }
 
   template <typename INPUT>
   bool read_metadata(INPUT *fp) {
     num_deleted = 0;            // since we got rid before writing
-    const bool result = table.read_metadata(fp);
+    MagicNumberType magic_read;
+    bool rehash = false;
+    bool result = table.read_metadata(fp, &magic_read);
+    if (result && !readable_layout(magic_read, &rehash)) {
+      table.clear();
+      result = false;
+    }
+    rehash_on_read = result && rehash;
     settings.reset_thresholds(bucket_count());
-    return result;
+    return result;              // read_nopointer_data() fills in hashes
   }
 
   // Only meaningful if value_type is a POD.
@@ -1125,7 +1610,13 @@ class sparse_hashtable {
   // Only meaningful if value_type is a POD.
   template <typename INPUT>
   bool read_nopointer_data(INPUT *fp) {
-    return table.read_nopointer_data(fp);
+    const bool result = table.read_nopointer_data(fp);
+    rehash_cached_hashes();
+    // Entries written with another layout aren't where we'd probe for them.
+    if (result && rehash_on_read)
+      rehash_in_place();
+    rehash_on_read = false;
+    return result;
   }
 
   // INPUT and OUTPUT must be either a FILE, *or* a C++ stream
@@ -1140,32 +1631,110 @@ class sparse_hashtable {
   template <typename ValueSerializer, typename OUTPUT>
   bool serialize(ValueSerializer serializer, OUTPUT *fp) {
     squash_deleted();           // so we don't have to worry about delkey
-    return table.serialize(serializer, fp);
+    return table.serialize(serializer, fp, layout_magic());
   }
 
   // ValueSerializer: a functor.  operator()(INPUT*, value_type*)
   template <typename ValueSerializer, typename INPUT>
   bool unserialize(ValueSerializer serializer, INPUT *fp) {
     num_deleted = 0;            // since we got rid before writing
-    const bool result = table.unserialize(serializer, fp);
+    MagicNumberType magic_read;
+    bool rehash = false;
+    bool result = table.unserialize(serializer, fp, &magic_read);
+    if (result && !readable_layout(magic_read, &rehash)) {
+      table.clear();
+      result = false;
+    }
+    rehash_cached_hashes();
     settings.reset_thresholds(bucket_count());
+    if (result && rehash)
+      rehash_in_place();
     return result;
   }
 
  private:
+  // The buckets are where the writer's probe sequence and hash put
+  // them, which need not be where ours would look: rehash to fix that.
+  void rehash_in_place() {
+    sparse_hashtable tmp(MoveDontCopy, *this, bucket_count());
+    swap(tmp);
+  }
+
   // Table is the main storage class.
   typedef sparsetable<value_type, DEFAULT_GROUP_SIZE, value_alloc_type> Table;
+  typedef typename Table::MagicNumberType MagicNumberType;
+
+  // What we write in place of the sparsetable's usual magic number: the
+  // same choice dense_hashtable makes.  MAGIC_NUMBER says our buckets
+  // are where an older table, with the default probing and no hash
+  // mixing, would look for them; MIXED_MAGIC_NUMBER, where one with the
+  // default probing and default_hash_mixing would; otherwise the reader
+  // has to rehash.
+  static MagicNumberType layout_magic() {
+    typedef typename Policy::hash_mixing hash_mixing;
+    if (!base::is_same<typename Policy::probing, quadratic_probing>::value)
+      return Table::REHASH_MAGIC_NUMBER;
+    if (!Settings::mixes_hash())
+      return Table::MAGIC_NUMBER;
+    if (base::is_same<hash_mixing, default_hash_mixing>::value ||
+        base::is_same<hash_mixing, fibonacci_hash_mixing>::value)
+      return Table::MIXED_MAGIC_NUMBER;
+    return Table::REHASH_MAGIC_NUMBER;
+  }
+  // Whether we can read a file with this magic number, and if so,
+  // whether we have to rehash what we read.  As with dense_hashtable,
+  // every table reads MAGIC_NUMBER files, but the others only if it
+  // writes them itself or rehashes everything it reads.
+  static bool readable_layout(MagicNumberType magic_read, bool *rehash) {
+    if (magic_read != Table::MAGIC_NUMBER && magic_read != layout_magic() &&
+        layout_magic() != Table::REHASH_MAGIC_NUMBER)
+      return false;
+    *rehash = (magic_read != layout_magic() ||
+               layout_magic() == Table::REHASH_MAGIC_NUMBER);
+    return true;
+  }
+
+  // See sparse_hash_cache, above.
+  typedef typename hash_cache::hash_alloc_type hash_alloc_type;
+  typedef typename hash_cache::HashCache HashCache;
+
+  void resize_hashes() {
+    if (Policy::cache_hash)
+      hashes().resize(bucket_count());
+  }
+  bool hash_matches(size_type bucknum, size_type hashval) const {
+    return !Policy::cache_hash || hashes().unsafe_get(bucknum) == hashval;
+  }
+  void set_hash(size_type bucknum, size_type hashval) {
+    if (Policy::cache_hash)
+      hashes().set(bucknum, hashval);
+  }
+  // After reading table from disk, where we don't keep hashes.
+  void rehash_cached_hashes() {
+    if (!Policy::cache_hash)
+      return;
+    hashes().clear();
+    resize_hashes();
+    for ( typename Table::const_nonempty_iterator it = table.nonempty_begin();
+          it != table.nonempty_end(); ++it ) {
+      hashes().set(table.get_pos(it), hash(get_key(*it)));
+    }
+  }
 
   // Package templated functors with the other types to eliminate memory
   // needed for storing these zero-size operators.  Since ExtractKey and
   // hasher's operator() might have the same function signature, they
   // must be packaged in different classes.
+  // The statistics, being empty unless they're turned on, go here too.
   struct Settings :
       sparsehash_internal::sh_hashtable_settings<key_type, hasher,
-                                                 size_type, HT_MIN_BUCKETS> {
+                                                 size_type, HT_MIN_BUCKETS,
+                                                 typename Policy::hash_mixing>,
+      Policy::statistics {
     explicit Settings(const hasher& hf)
-        : sparsehash_internal::sh_hashtable_settings<key_type, hasher,
-                                                     size_type, HT_MIN_BUCKETS>(
+        : sparsehash_internal::sh_hashtable_settings<
+              key_type, hasher, size_type, HT_MIN_BUCKETS,
+              typename Policy::hash_mixing>(
             hf, HT_OCCUPANCY_PCT / 100.0f, HT_EMPTY_PCT / 100.0f) {}
   };
 
@@ -1185,7 +1754,8 @@ class sparse_hashtable {
     void set_key(pointer v, const key_type& k) const {
       SetKey::operator()(v, k);
     }
-    bool equals(const key_type& a, const key_type& b) const {
+    template <class K>
+    bool equals(const K& a, const key_type& b) const {
       return EqualKey::operator()(a, b);
     }
 
@@ -1195,10 +1765,12 @@ class sparse_hashtable {
   };
 
   // Utility functions to access the templated operators
-  size_type hash(const key_type& v) const {
+  template <class K>
+  size_type hash(const K& v) const {
     return settings.hash(v);
   }
-  bool equals(const key_type& a, const key_type& b) const {
+  template <class K>
+  bool equals(const K& a, const key_type& b) const {
     return key_info.equals(a, b);
   }
   typename ExtractKey::result_type get_key(const_reference v) const {
@@ -1212,35 +1784,39 @@ class sparse_hashtable {
   // Actual data
   Settings settings;
   KeyInfo key_info;
+  bool rehash_on_read;     // read_metadata() saw a layout we must rehash
   size_type num_deleted;   // how many occupied buckets are marked deleted
   Table table;     // holds num_buckets and num_elements too
 };
 
 
 // We need a global swap as well
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-inline void swap(sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> &x,
-                 sparse_hashtable<V,K,HF,ExK,SetK,EqK,A> &y) {
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+inline void swap(sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> &x,
+                 sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> &y) {
   x.swap(y);
 }
 
-#undef JUMP_
 
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const typename sparse_hashtable<V,K,HF,ExK,SetK,EqK,A>::size_type
-  sparse_hashtable<V,K,HF,ExK,SetK,EqK,A>::ILLEGAL_BUCKET;
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const typename sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::size_type
+  sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::ILLEGAL_BUCKET;
 
 // How full we let the table get before we resize.  Knuth says .8 is
 // good -- higher causes us to probe too much, though saves memory
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int sparse_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT = 80;
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const int sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::HT_OCCUPANCY_PCT = 80;
 
 // How empty we let the table get before we resize lower.
 // It should be less than OCCUPANCY_PCT / 2 or we thrash resizing
-template <class V, class K, class HF, class ExK, class SetK, class EqK, class A>
-const int sparse_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_EMPTY_PCT
-  = static_cast<int>(0.4 *
-                     sparse_hashtable<V,K,HF,ExK,SetK,EqK,A>::HT_OCCUPANCY_PCT);
+template <class V, class K, class HF, class ExK, class SetK,
+          class EqK, class A, class Pol>
+const int sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::HT_EMPTY_PCT
+  = static_cast<int>(
+      0.4 * sparse_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol>::HT_OCCUPANCY_PCT);
 
 _END_GOOGLE_NAMESPACE_
 
@@ -0,0 +1,991 @@
+// Copyright (c) 2005, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// The table behind a dense_hash_map whose Policy sets split_values
+// (see dense_hashtable_policy in densehashtable.h).  A dense_hashtable
+// keeps whole values in its buckets, so with big values every probe
+// drags value bytes into the cache just to compare a key, and the
+// empty half of the bucket array is mostly empty values.  Here the
+// buckets only hold (key, slot) pairs: they're an ordinary
+// dense_hashtable, with all the Policy knobs that implies, and the
+// values live in a separate array of slots, filled in the order they
+// were inserted.  A lookup probes the small buckets, and only goes to
+// the slot array once it has found its key.
+//
+// The slot array grows by doubling, like a vector, and (since the
+// buckets say which slot each key is in) it doesn't move when the
+// buckets are resized.  erase() marks the slot deleted, with the
+// deleted key, as a dense_hashtable would mark the bucket, and leaves
+// everything else where it is, so it doesn't invalidate iterators or
+// pointers any more than a dense_hashtable's erase() does.  When the
+// slot array is full, and at least a quarter of it is deleted slots,
+// the next insert packs the live values together instead of growing
+// it.  Iterators walk the slot array, skipping the deleted slots.
+//
+// Every key is stored twice, in its bucket and in its value.  Unlike
+// a dense_hashtable, this needs set_deleted_key() before erase()
+// whatever the other knobs say, since it marks the slots with it.
+//
+// You probably shouldn't use this code directly.  Use dense_hash_map<>
+// instead.
+
+#ifndef _SPLITDENSEHASHTABLE_H_
+#define _SPLITDENSEHASHTABLE_H_
+
+#include <sparsehash/internal/sparseconfig.h>
+#include <assert.h>
+#include <stddef.h>                  // for size_t
+#include <algorithm>                 // For swap(), eg
+#include <iterator>                  // For iterator tags
+#include <utility>                   // for pair
+#include <vector>
+#include <sparsehash/internal/densehashtable.h>
+#include <sparsehash/internal/hashtable-common.h>
+
+_START_GOOGLE_NAMESPACE_
+
+template <class Value, class Key, class HashFcn,
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy>
+class split_dense_hashtable;
+
+template <class V, class K, class HF, class ExK, class SetK, class EqK,
+          class A, class Pol>
+struct split_dense_hashtable_iterator;
+
+template <class V, class K, class HF, class ExK, class SetK, class EqK,
+          class A, class Pol>
+struct split_dense_hashtable_const_iterator;
+
+// Walks the slot array, skipping deleted slots.
+template <class V, class K, class HF, class ExK, class SetK, class EqK,
+          class A, class Pol>
+struct split_dense_hashtable_iterator {
+ private:
+  typedef typename A::template rebind<V>::other value_alloc_type;
+
+ public:
+  typedef split_dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol> iterator;
+  typedef split_dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
+
+  typedef std::forward_iterator_tag iterator_category;  // very little defined!
+  typedef V value_type;
+  typedef typename value_alloc_type::difference_type difference_type;
+  typedef typename value_alloc_type::size_type size_type;
+  typedef typename value_alloc_type::reference reference;
+  typedef typename value_alloc_type::pointer pointer;
+
+  // "Real" constructor and default constructor
+  split_dense_hashtable_iterator(
+      const split_dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      pointer it, pointer it_end, bool advance)
+    : ht(h), pos(it), end(it_end)   {
+    if (advance)  advance_past_deleted();
+  }
+  split_dense_hashtable_iterator()
+    : ht(NULL), pos(pointer()), end(pointer()) { }
+  // The default destructor is fine; we don't define one
+  // The default operator= is fine; we don't define one
+
+  // Happy dereferencer
+  reference operator*() const { return *pos; }
+  pointer operator->() const { return &(operator*()); }
+
+  // Arithmetic.  Every slot before the end holds a value, so all we
+  // have to skip is the deleted ones.
+  void advance_past_deleted() {
+    while ( pos != end && ht->test_deleted_slot(pos) )
+      ++pos;
+  }
+  iterator& operator++()   {
+    assert(pos != end); ++pos; advance_past_deleted(); return *this;
+  }
+  iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+
+  // Comparison.
+  bool operator==(const iterator& it) const { return pos == it.pos; }
+  bool operator!=(const iterator& it) const { return pos != it.pos; }
+
+
+  // The actual data
+  const split_dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
+  pointer pos, end;
+};
+
+
+// Now do it all again, but with const-ness!
+template <class V, class K, class HF, class ExK, class SetK, class EqK,
+          class A, class Pol>
+struct split_dense_hashtable_const_iterator {
+ private:
+  typedef typename A::template rebind<V>::other value_alloc_type;
+
+ public:
+  typedef split_dense_hashtable_iterator<V,K,HF,ExK,SetK,EqK,A,Pol> iterator;
+  typedef split_dense_hashtable_const_iterator<V,K,HF,ExK,SetK,EqK,A,Pol>
+      const_iterator;
+
+  typedef std::forward_iterator_tag iterator_category;  // very little defined!
+  typedef V value_type;
+  typedef typename value_alloc_type::difference_type difference_type;
+  typedef typename value_alloc_type::size_type size_type;
+  typedef typename value_alloc_type::const_reference reference;
+  typedef typename value_alloc_type::const_pointer pointer;
+
+  // "Real" constructor and default constructor
+  split_dense_hashtable_const_iterator(
+      const split_dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *h,
+      pointer it, pointer it_end, bool advance)
+    : ht(h), pos(it), end(it_end)   {
+    if (advance)  advance_past_deleted();
+  }
+  split_dense_hashtable_const_iterator()
+    : ht(NULL), pos(pointer()), end(pointer()) { }
+  // This lets us convert regular iterators to const iterators
+  split_dense_hashtable_const_iterator(const iterator &it)
+    : ht(it.ht), pos(it.pos), end(it.end) { }
+  // The default destructor is fine; we don't define one
+  // The default operator= is fine; we don't define one
+
+  // Happy dereferencer
+  reference operator*() const { return *pos; }
+  pointer operator->() const { return &(operator*()); }
+
+  // Arithmetic.
+  void advance_past_deleted() {
+    while ( pos != end && ht->test_deleted_slot(pos) )
+      ++pos;
+  }
+  const_iterator& operator++()   {
+    assert(pos != end); ++pos; advance_past_deleted(); return *this;
+  }
+  const_iterator operator++(int) { const_iterator tmp(*this); ++*this; return tmp; }
+
+  // Comparison.
+  bool operator==(const const_iterator& it) const { return pos == it.pos; }
+  bool operator!=(const const_iterator& it) const { return pos != it.pos; }
+
+
+  // The actual data
+  const split_dense_hashtable<V,K,HF,ExK,SetK,EqK,A,Pol> *ht;
+  pointer pos, end;
+};
+
+template <class Value, class Key, class HashFcn,
+          class ExtractKey, class SetKey, class EqualKey, class Alloc,
+          class Policy>
+class split_dense_hashtable {
+ private:
+  typedef typename Alloc::template rebind<Value>::other value_alloc_type;
+
+ public:
+  typedef Key key_type;
+  typedef Value value_type;
+  typedef HashFcn hasher;
+  typedef EqualKey key_equal;
+  typedef Alloc allocator_type;
+
+  typedef typename value_alloc_type::size_type size_type;
+  typedef typename value_alloc_type::difference_type difference_type;
+  typedef typename value_alloc_type::reference reference;
+  typedef typename value_alloc_type::const_reference const_reference;
+  typedef typename value_alloc_type::pointer pointer;
+  typedef typename value_alloc_type::const_pointer const_pointer;
+  typedef split_dense_hashtable_iterator<Value, Key, HashFcn,
+                                         ExtractKey, SetKey, EqualKey,
+                                         Alloc, Policy>
+      iterator;
+  typedef split_dense_hashtable_const_iterator<Value, Key, HashFcn,
+                                               ExtractKey, SetKey, EqualKey,
+                                               Alloc, Policy>
+      const_iterator;
+  // A bucket holds at most one key, so its local iterator covers just
+  // that key's slot.
+  typedef iterator local_iterator;
+  typedef const_iterator const_local_iterator;
+
+ private:
+  // The buckets: each holds a key and the slot its value is in.
+  typedef std::pair<Key, size_type> index_entry;
+  struct IndexKey {
+    typedef const Key& result_type;
+    const Key& operator()(const index_entry& e) const { return e.first; }
+  };
+  struct SetIndexKey {
+    void operator()(index_entry* e, const Key& k) const { e->first = k; }
+  };
+  typedef typename Alloc::template rebind<index_entry>::other index_alloc_type;
+  typedef dense_hashtable<index_entry, Key, HashFcn, IndexKey, SetIndexKey,
+                          EqualKey, index_alloc_type, Policy> index_table;
+
+  // How many slots we allocate the first time we need any.
+  static const size_type HT_MIN_SLOTS = 4;
+  // Every time the disk format changes, this should probably change too
+  typedef unsigned long MagicNumberType;
+  static const MagicNumberType MAGIC_NUMBER = 0x13578646;
+
+ public:
+  // ITERATOR FUNCTIONS
+  iterator begin()             { return iterator(this, values,
+                                                 values + num_slots, true); }
+  iterator end()               { return iterator(this, values + num_slots,
+                                                 values + num_slots, true); }
+  const_iterator begin() const { return const_iterator(this, values,
+                                                       values + num_slots,
+                                                       true); }
+  const_iterator end() const   { return const_iterator(this,
+                                                       values + num_slots,
+                                                       values + num_slots,
+                                                       true); }
+
+  // These come from tr1 unordered_map.  They iterate over 'bucket' n.
+  local_iterator begin(size_type i) {
+    if (index.bucket_size(i) == 0)
+      return end();
+    const size_type slot = index.begin(i)->second;
+    return local_iterator(this, values + slot, values + slot + 1, false);
+  }
+  local_iterator end(size_type i) {
+    local_iterator it = begin(i);
+    if (it != end())
+      ++it;
+    return it;
+  }
+  const_local_iterator begin(size_type i) const {
+    if (index.bucket_size(i) == 0)
+      return end();
+    const size_type slot = index.begin(i)->second;
+    return const_local_iterator(this, values + slot, values + slot + 1,
+                                false);
+  }
+  const_local_iterator end(size_type i) const {
+    const_local_iterator it = begin(i);
+    if (it != end())
+      ++it;
+    return it;
+  }
+
+  // ACCESSOR FUNCTIONS for the things we templatize on, basically
+  hasher hash_funct() const               { return index.hash_funct(); }
+  key_equal key_eq() const                { return index.key_eq(); }
+  allocator_type get_allocator() const {
+    return allocator_type(allocator);
+  }
+
+  // Only the index probes, so its statistics are ours.
+  hashtable_stats statistics() const  { return index.statistics(); }
+  void reset_statistics()             { index.reset_statistics(); }
+
+  // True if the slot at p holds a value we erased.  Public so the
+  // iterators can use it.
+  bool test_deleted_slot(const_pointer p) const {
+    return (num_deleted_slots > 0 &&
+            equals(key_info.delkey, get_key(*p)));
+  }
+
+  // DELETE AND EMPTY KEYS
+  void set_empty_key(const_reference val) {
+    index.set_empty_key(index_entry(get_key(val), 0));
+  }
+  value_type empty_key() const {
+    value_type retval;
+    set_key(&retval, index.empty_key().first);
+    return retval;
+  }
+
+  void set_deleted_key(const key_type &key) {
+    // It's only safe to change what "deleted" means if we purge
+    // deleted slots.
+    pack_slots();
+    index.set_deleted_key(key);
+    use_deleted = true;
+    key_info.delkey = key;
+  }
+  void clear_deleted_key() {
+    pack_slots();
+    index.clear_deleted_key();
+    use_deleted = false;
+  }
+  key_type deleted_key() const {
+    assert(use_deleted && "Must set deleted key before calling deleted_key");
+    return key_info.delkey;
+  }
+
+  // FUNCTIONS CONCERNING SIZE
+  size_type size() const              { return index.size(); }
+  size_type max_size() const          { return index.max_size(); }
+  bool empty() const                  { return size() == 0; }
+  size_type bucket_count() const      { return index.bucket_count(); }
+  size_type max_bucket_count() const  { return index.max_bucket_count(); }
+  size_type bucket_size(size_type i) const {
+    return index.bucket_size(i);
+  }
+  template <class K>
+  size_type bucket(const K& key) const {
+    return index.bucket(key);
+  }
+
+  // The index's buckets plus our slot array, which counts as buckets too.
+  size_type memory_usage(memory_breakdown* usage = NULL,
+                         bool with_group_sizes = false) const {
+    memory_breakdown ignored;
+    if (usage == NULL)  usage = &ignored;
+    index.memory_usage(usage, with_group_sizes);
+    usage->object_bytes = sizeof(*this);
+    if (values) {
+      usage->bucket_bytes += slot_capacity * sizeof(value_type);
+      ++usage->num_allocations;
+    }
+    return usage->total();
+  }
+
+  // Resizes the buckets as a dense_hashtable does, and makes the slot
+  // array just big enough for req_elements (or everything in it, if
+  // that's more), after throwing out the deleted slots.
+  void resize(size_type req_elements) {
+    pack_slots();
+    index.resize(req_elements);
+    reallocate_slots(std::max(req_elements, num_slots));
+  }
+  void get_resizing_parameters(float* shrink, float* grow) const {
+    index.get_resizing_parameters(shrink, grow);
+  }
+  void set_resizing_parameters(float shrink, float grow) {
+    index.set_resizing_parameters(shrink, grow);
+  }
+  int resize_threads() const          { return index.resize_threads(); }
+  void set_resize_threads(int n)      { index.set_resize_threads(n); }
+
+  // CONSTRUCTORS -- as required by the specs, we take a size,
+  // but also let you specify a hashfunction, key comparator,
+  // and key extractor.  We also define a copy constructor and =.
+  // DESTRUCTOR -- needs to free the slot array
+  explicit split_dense_hashtable(size_type expected_max_items_in_table = 0,
+                                 const HashFcn& hf = HashFcn(),
+                                 const EqualKey& eql = EqualKey(),
+                                 const ExtractKey& ext = ExtractKey(),
+                                 const SetKey& set = SetKey(),
+                                 const Alloc& alloc = Alloc())
+      : index(expected_max_items_in_table, hf, eql, IndexKey(), SetIndexKey(),
+              index_alloc_type(alloc)),
+        key_info(ext, set, eql),
+        allocator(alloc),
+        use_deleted(false),
+        values(NULL),
+        num_slots(0),
+        num_deleted_slots(0),
+        slot_capacity(0) {
+    reallocate_slots(expected_max_items_in_table);
+  }
+
+  // The slots are copied as they are, deleted ones and all, since
+  // the copied buckets point into them.
+  split_dense_hashtable(const split_dense_hashtable& ht)
+      : index(ht.index),
+        key_info(ht.key_info),
+        allocator(ht.allocator),
+        use_deleted(ht.use_deleted),
+        values(NULL),
+        num_slots(0),
+        num_deleted_slots(ht.num_deleted_slots),
+        slot_capacity(0) {
+    reallocate_slots(ht.num_slots);
+    for ( ; num_slots < ht.num_slots; ++num_slots)
+      new(values + num_slots) value_type(ht.values[num_slots]);
+  }
+
+  split_dense_hashtable& operator= (const split_dense_hashtable& ht) {
+    if (&ht == this)  return *this;        // don't copy onto ourselves
+    split_dense_hashtable tmp(ht);
+    swap(tmp);
+    return *this;
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Takes ht's buckets and slots.  ht is left empty, as a moved-from
+  // dense_hashtable is, with its empty and deleted keys.
+  split_dense_hashtable(split_dense_hashtable&& ht)
+      SPARSEHASH_NOEXCEPT_IF(std::is_nothrow_move_constructible<
+                                 index_table>::value &&
+                             std::is_nothrow_copy_constructible<
+                                 key_type>::value)
+      : index(std::move(ht.index)),
+        key_info(ht.key_info),
+        allocator(ht.allocator),
+        use_deleted(ht.use_deleted),
+        values(ht.values),
+        num_slots(ht.num_slots),
+        num_deleted_slots(ht.num_deleted_slots),
+        slot_capacity(ht.slot_capacity) {
+    ht.values = NULL;
+    ht.num_slots = 0;
+    ht.num_deleted_slots = 0;
+    ht.slot_capacity = 0;
+  }
+  split_dense_hashtable& operator= (split_dense_hashtable&& ht)
+      SPARSEHASH_NOEXCEPT_IF(std::is_nothrow_move_constructible<
+                                 index_table>::value &&
+                             std::is_nothrow_copy_constructible<
+                                 key_type>::value) {
+    if (&ht != this) {
+      split_dense_hashtable tmp(std::move(ht));
+      swap(tmp);
+    }
+    return *this;
+  }
+#endif
+
+  ~split_dense_hashtable() {
+    destroy_slots();
+    deallocate_slots();
+  }
+
+  // Many STL algorithms use swap instead of copy constructors
+  void swap(split_dense_hashtable& ht) {
+    std::swap(key_info, ht.key_info);
+    std::swap(allocator, ht.allocator);
+    std::swap(use_deleted, ht.use_deleted);
+    std::swap(values, ht.values);
+    std::swap(num_slots, ht.num_slots);
+    std::swap(num_deleted_slots, ht.num_deleted_slots);
+    std::swap(slot_capacity, ht.slot_capacity);
+    index.swap(ht.index);
+  }
+
+  // It's always nice to be able to clear a table without deallocating it
+  void clear() {
+    destroy_slots();
+    deallocate_slots();
+    index.clear();
+  }
+
+  // Clear the table without resizing it: the buckets and the slot
+  // array stay as big as they are.
+  void clear_no_resize() {
+    destroy_slots();
+    index.clear_no_resize();
+  }
+
+  // LOOKUP ROUTINES
+  template <class K>
+  iterator find(const K& key) {
+    typename index_table::const_iterator it = find_entry(key);
+    if ( it == index.end() )
+      return end();
+    return slot_iterator(it->second);
+  }
+
+  template <class K>
+  const_iterator find(const K& key) const {
+    typename index_table::const_iterator it = find_entry(key);
+    if ( it == index.end() )
+      return end();
+    return const_iterator(this, values + it->second, values + num_slots,
+                          false);
+  }
+
+  template <class K>
+  size_type count(const K &key) const {
+    return index.count(key);
+  }
+
+  template <class K>
+  std::pair<iterator,iterator> equal_range(const K& key) {
+    iterator pos = find(key);      // either an iterator or end
+    if (pos == end()) {
+      return std::pair<iterator,iterator>(pos, pos);
+    } else {
+      const iterator startpos = pos++;
+      return std::pair<iterator,iterator>(startpos, pos);
+    }
+  }
+  template <class K>
+  std::pair<const_iterator,const_iterator> equal_range(const K& key) const {
+    const_iterator pos = find(key);      // either an iterator or end
+    if (pos == end()) {
+      return std::pair<const_iterator,const_iterator>(pos, pos);
+    } else {
+      const const_iterator startpos = pos++;
+      return std::pair<const_iterator,const_iterator>(startpos, pos);
+    }
+  }
+
+  // INSERTION ROUTINES
+  std::pair<iterator, bool> insert(const_reference obj) {
+    typename index_table::const_iterator it = find_entry(get_key(obj));
+    if ( it != index.end() )
+      return std::pair<iterator, bool>(slot_iterator(it->second), false);
+    make_room_for_slot();
+    new(values + num_slots) value_type(obj);
+    return std::pair<iterator, bool>(add_slot(), true);
+  }
+#ifdef SPARSEHASH_CXX11
+  std::pair<iterator, bool> insert(value_type&& obj) {
+    typename index_table::const_iterator it = find_entry(get_key(obj));
+    if ( it != index.end() )
+      return std::pair<iterator, bool>(slot_iterator(it->second), false);
+    make_room_for_slot();
+    new(values + num_slots) value_type(std::move(obj));
+    return std::pair<iterator, bool>(add_slot(), true);
+  }
+
+  // Builds the value in the next free slot, then drops it again if its
+  // key is already here.
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    make_room_for_slot();
+    pointer slot = values + num_slots;
+    new(slot) value_type(std::forward<Args>(args)...);
+    typename index_table::const_iterator it = find_entry(get_key(*slot));
+    if ( it != index.end() ) {
+      slot->~value_type();
+      return std::pair<iterator, bool>(slot_iterator(it->second), false);
+    }
+    return std::pair<iterator, bool>(add_slot(), true);
+  }
+#endif
+
+  // When inserting a lot at a time, we specialize on the type of iterator
+  template <class InputIterator>
+  void insert(InputIterator f, InputIterator l) {
+    for ( ; f != l; ++f)
+      insert(*f);
+  }
+
+  // DefaultValue is a functor that takes a key and returns a value_type
+  // representing the default value to be inserted if none is found.
+  template <class DefaultValue, class K>
+  value_type& find_or_insert(const K& key) {
+    typename index_table::const_iterator it = find_entry(key);
+    if ( it != index.end() )
+      return values[it->second];
+    DefaultValue default_value;
+    make_room_for_slot();
+    new(values + num_slots) value_type(default_value(key));
+    return *add_slot();
+  }
+
+#ifdef SPARSEHASH_CXX11
+  // Like find_or_insert, but builds the value from args, in place.
+  template <class... Args>
+  std::pair<iterator, bool> find_or_emplace(const key_type& key,
+                                            Args&&... args) {
+    typename index_table::const_iterator it = find_entry(key);
+    if ( it != index.end() )
+      return std::pair<iterator, bool>(slot_iterator(it->second), false);
+    make_room_for_slot();
+    new(values + num_slots) value_type(std::forward<Args>(args)...);
+    return std::pair<iterator, bool>(add_slot(), true);
+  }
+#endif
+
+  // DELETION ROUTINES
+  template <class K>
+  size_type erase(const K& key) {
+    typename index_table::iterator it = index.find(key);
+    if ( it == index.end() )
+      return 0;
+    const size_type slot = it->second;
+    index.erase(it);
+    erase_slot(slot);
+    return 1;
+  }
+
+  // We return the iterator past the deleted item.
+  void erase(iterator pos) {
+    if ( pos == end() ) return;    // sanity check
+    erase(get_key(*pos));
+  }
+
+  void erase(iterator f, iterator l) {
+    for ( ; f != l; ++f)
+      erase(f);
+  }
+
+  // We allow you to erase a const_iterator just like we allow you to
+  // erase an iterator.  This is in parallel to 'delete': you can delete
+  // a const pointer too.
+  void erase(const_iterator pos) {
+    if ( pos == end() ) return;    // sanity check
+    erase(get_key(*pos));
+  }
+  void erase(const_iterator f, const_iterator l) {
+    for ( ; f != l; ++f)
+      erase(f);
+  }
+
+  // BATCH ROUTINES
+  // find_batch() looks the keys up in the buckets all at once, so their
+  // cache misses overlap; then it goes to the slots of the ones it found.
+  template <class K>
+  void find_batch(const K* keys, size_type n, iterator* results) {
+    std::vector<typename index_table::const_iterator> found(n);
+    static_cast<const index_table&>(index).find_batch(
+        keys, n, found.empty() ? NULL : &found[0]);
+    for (size_type i = 0; i < n; ++i) {
+      results[i] = (found[i] == index.end() ?
+                    end() : slot_iterator(found[i]->second));
+    }
+  }
+  template <class K>
+  void find_batch(const K* keys, size_type n, const_iterator* results) const {
+    std::vector<typename index_table::const_iterator> found(n);
+    index.find_batch(keys, n, found.empty() ? NULL : &found[0]);
+    for (size_type i = 0; i < n; ++i) {
+      results[i] = (found[i] == index.end() ? end() :
+                    const_iterator(this, values + found[i]->second,
+                                   values + num_slots, false));
+    }
+  }
+  size_type insert_batch(const value_type* objs, size_type n) {
+    size_type num_inserted = 0;
+    for (size_type i = 0; i < n; ++i) {
+      if (insert(objs[i]).second)
+        ++num_inserted;
+    }
+    return num_inserted;
+  }
+  template <class K>
+  size_type erase_batch(const K* keys, size_type n) {
+    size_type num_erased = 0;
+    for (size_type i = 0; i < n; ++i)
+      num_erased += erase(keys[i]);
+    return num_erased;
+  }
+
+
+  // COMPARISON
+  bool operator==(const split_dense_hashtable& ht) const {
+    if (size() != ht.size()) {
+      return false;
+    } else if (this == &ht) {
+      return true;
+    } else {
+      // Iterate through the elements in "this" and see if the
+      // corresponding element is in ht
+      for ( const_iterator it = begin(); it != end(); ++it ) {
+        const_iterator it2 = ht.find(get_key(*it));
+        if ((it2 == ht.end()) || (*it != *it2)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+  bool operator!=(const split_dense_hashtable& ht) const {
+    return !(*this == ht);
+  }
+
+
+  // I/O
+  // The file is just the values, in slot order; reading it inserts
+  // them again, so the hasher need only agree on equal keys.  It's not
+  // the format dense_hashtable uses: a table needs the same Policy to
+  // read what this one wrote.
+  typedef sparsehash_internal::pod_serializer<value_type> NopointerSerializer;
+
+  // ValueSerializer: a functor.  operator()(OUTPUT*, const value_type&)
+  template <typename ValueSerializer, typename OUTPUT>
+  bool serialize(ValueSerializer serializer, OUTPUT *fp) {
+    if ( !write_header(fp) )
+      return false;
+    for ( const_iterator it = begin(); it != end(); ++it ) {
+      if ( !serializer(fp, *it) ) return false;
+    }
+    return true;
+  }
+
+  // The same, for values with no pointers in them: once the deleted
+  // slots are gone, the slot array goes out in one write.
+  template <typename OUTPUT>
+  bool serialize(NopointerSerializer, OUTPUT *fp) {
+    pack_slots();
+    if ( !write_header(fp) )
+      return false;
+    return sparsehash_internal::write_data(fp, values,
+                                           num_slots * sizeof(value_type));
+  }
+
+  // ValueSerializer: a functor.  operator()(INPUT*, value_type*)
+  template <typename ValueSerializer, typename INPUT>
+  bool unserialize(ValueSerializer serializer, INPUT *fp) {
+    size_type num_values;
+    if ( !read_header(fp, &num_values) )
+      return false;
+    for ( ; num_slots < num_values; ++num_slots ) {
+      new(values + num_slots) value_type();
+      if ( !serializer(fp, values + num_slots) ) {
+        ++num_slots;                   // so clear() destroys it
+        clear();
+        return false;
+      }
+    }
+    return index_slots();
+  }
+
+  template <typename INPUT>
+  bool unserialize(NopointerSerializer, INPUT *fp) {
+    size_type num_values;
+    if ( !read_header(fp, &num_values) )
+      return false;
+    if ( !sparsehash_internal::read_data(fp, values,
+                                         num_values * sizeof(value_type)) )
+      return false;
+    num_slots = num_values;
+    return index_slots();
+  }
+
+  // Writes what dense_hashtable::write_mappable() would, by copying
+  // everything into one first; so it takes as much memory again as a
+  // dense_hashtable with the same contents.
+  template <typename OUTPUT>
+  bool write_mappable(OUTPUT *fp) {
+    dense_hashtable<Value, Key, HashFcn, ExtractKey, SetKey, EqualKey,
+                    Alloc, Policy> tmp(size(), hash_funct(), key_eq(),
+                                       key_info, key_info, get_allocator());
+    tmp.set_empty_key(empty_key());
+    tmp.insert(begin(), end());
+    return tmp.write_mappable(fp);
+  }
+
+ private:
+  template <class K>
+  typename index_table::const_iterator find_entry(const K& key) const {
+    return index.find(key);
+  }
+
+  iterator slot_iterator(size_type slot) {
+    return iterator(this, values + slot, values + num_slots, false);
+  }
+
+  // Makes sure there's a free slot at the end of the slot array,
+  // packing the slots if enough of them are deleted, and growing the
+  // array otherwise.
+  void make_room_for_slot() {
+    if (num_slots < slot_capacity)
+      return;
+    if (num_deleted_slots > 0 && num_deleted_slots >= num_slots / 4) {
+      pack_slots();
+    } else {
+      reallocate_slots(slot_capacity == 0 ? HT_MIN_SLOTS : slot_capacity * 2);
+    }
+  }
+
+  // Puts the value just built in the free slot into the buckets.
+  iterator add_slot() {
+    const size_type slot = num_slots;
+    assert((!use_deleted || !equals(key_info.delkey, get_key(values[slot])))
+           && "Inserting the deleted key");
+    index.insert(index_entry(get_key(values[slot]), slot));
+    ++num_slots;
+    return slot_iterator(slot);
+  }
+
+  void erase_slot(size_type slot) {
+    assert(use_deleted && "set_deleted_key() must be called before erase");
+    set_key(&values[slot], key_info.delkey);   // also clears the data
+    ++num_deleted_slots;
+  }
+
+  // Moves the live values down over the deleted ones, and tells their
+  // buckets where they've gone.
+  void pack_slots() {
+    if (num_deleted_slots == 0)
+      return;
+    size_type dst = 0;
+    for (size_type src = 0; src < num_slots; ++src) {
+      if (test_deleted_slot(values + src)) {
+        values[src].~value_type();
+        continue;
+      }
+      if (src != dst) {
+        move_slot(dst, src);
+        index.find(get_key(values[dst]))->second = dst;
+      }
+      ++dst;
+    }
+    num_slots = dst;
+    num_deleted_slots = 0;
+  }
+
+  // Constructs slot dst from slot src, and destroys src.
+  void move_slot(size_type dst, size_type src) {
+#ifdef SPARSEHASH_CXX11
+    new(values + dst) value_type(std::move(values[src]));
+#else
+    new(values + dst) value_type(values[src]);
+#endif
+    values[src].~value_type();
+  }
+
+  // Gives the slot array room for new_capacity values; it must already
+  // hold fewer.  Slots keep their numbers.
+  void reallocate_slots(size_type new_capacity) {
+    if (new_capacity == slot_capacity)
+      return;
+    assert(new_capacity >= num_slots);
+    pointer old_values = values;
+    values = new_capacity ? allocator.allocate(new_capacity) : NULL;
+    for (size_type i = 0; i < num_slots; ++i) {
+#ifdef SPARSEHASH_CXX11
+      new(values + i) value_type(std::move(old_values[i]));
+#else
+      new(values + i) value_type(old_values[i]);
+#endif
+      old_values[i].~value_type();
+    }
+    if (old_values)
+      allocator.deallocate(old_values, slot_capacity);
+    slot_capacity = new_capacity;
+  }
+
+  void destroy_slots() {
+    for (size_type i = 0; i < num_slots; ++i)
+      values[i].~value_type();
+    num_slots = 0;
+    num_deleted_slots = 0;
+  }
+
+  void deallocate_slots() {
+    if (values)
+      allocator.deallocate(values, slot_capacity);
+    values = NULL;
+    slot_capacity = 0;
+  }
+
+  template <typename OUTPUT>
+  bool write_header(OUTPUT *fp) const {
+    if ( !sparsehash_internal::write_bigendian_number(fp, MAGIC_NUMBER, 4) )
+      return false;
+    if ( !sparsehash_internal::write_bigendian_number(fp, size(), 8) )
+      return false;
+    return true;
+  }
+
+  // Clears the table and makes room for the values to come.
+  template <typename INPUT>
+  bool read_header(INPUT *fp, size_type *num_values) {
+    clear();                        // just to be consistent
+    MagicNumberType magic_read;
+    if ( !sparsehash_internal::read_bigendian_number(fp, &magic_read, 4) )
+      return false;
+    if ( magic_read != MAGIC_NUMBER )
+      return false;
+    if ( !sparsehash_internal::read_bigendian_number(fp, num_values, 8) )
+      return false;
+    index.resize(*num_values);
+    reallocate_slots(*num_values);
+    return true;
+  }
+
+  // Fills the buckets in for every slot.  A key that's there twice
+  // means the file is bad.
+  bool index_slots() {
+    for (size_type i = 0; i < num_slots; ++i) {
+      if ( !index.insert(index_entry(get_key(values[i]), i)).second ) {
+        clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Package functors with another class to eliminate memory needed for
+  // zero-size functors.
+  class KeyInfo : public ExtractKey, public SetKey, public EqualKey {
+   public:
+    KeyInfo(const ExtractKey& ek, const SetKey& sk, const EqualKey& eq)
+        : ExtractKey(ek),
+          SetKey(sk),
+          EqualKey(eq) {
+    }
+
+    // We want to return the exact same type as ExtractKey: Key or const Key&
+    typename ExtractKey::result_type get_key(const_reference v) const {
+      return ExtractKey::operator()(v);
+    }
+    void set_key(pointer v, const key_type& k) const {
+      SetKey::operator()(v, k);
+    }
+    bool equals(const key_type& a, const key_type& b) const {
+      return EqualKey::operator()(a, b);
+    }
+
+    // Which key marks deleted slots.
+    typename base::remove_const<key_type>::type delkey;
+  };
+
+  bool equals(const key_type& a, const key_type& b) const {
+    return key_info.equals(a, b);
+  }
+  typename ExtractKey::result_type get_key(const_reference v) const {
+    return key_info.get_key(v);
+  }
+  void set_key(pointer v, const key_type& k) const {
+    key_info.set_key(v, k);
+  }
+
+  // The actual data
+  index_table index;                // the buckets
+  KeyInfo key_info;
+  value_alloc_type allocator;
+  bool use_deleted;                 // whether key_info.delkey is set
+  pointer values;                   // the slot array
+  size_type num_slots;              // slots in use, deleted ones included
+  size_type num_deleted_slots;
+  size_type slot_capacity;          // how many slots values has room for
+};
+
+namespace sparsehash_internal {
+
+// The table behind dense_hash_map: a dense_hashtable, unless Policy
+// sets split_values.
+template <class Value, class Key, class HashFcn, class ExtractKey,
+          class SetKey, class EqualKey, class Alloc, class Policy,
+          bool split = Policy::split_values>
+struct dense_map_table {
+  typedef dense_hashtable<Value, Key, HashFcn, ExtractKey, SetKey,
+                          EqualKey, Alloc, Policy> type;
+};
+template <class Value, class Key, class HashFcn, class ExtractKey,
+          class SetKey, class EqualKey, class Alloc, class Policy>
+struct dense_map_table<Value, Key, HashFcn, ExtractKey, SetKey,
+                       EqualKey, Alloc, Policy, true> {
+  typedef split_dense_hashtable<Value, Key, HashFcn, ExtractKey, SetKey,
+                                EqualKey, Alloc, Policy> type;
+};
+
+}  // namespace sparsehash_internal
+
+_END_GOOGLE_NAMESPACE_
+
+#endif /* _SPLITDENSEHASHTABLE_H_ */
@@ -94,7 +94,7 @@ template<typename C1, typename C2, typename C3, typename C4, typename C5,
   typedef C6 type6;
 };
 
-// I need to list 18 types here, for code below to compile, though
+// I need to list 24 types here, for code below to compile, though
 // only the first 6 are ever used.
 #define TYPED_TEST_CASE_6(classname, typelist)  \
   typedef typelist::type1 classname##_type1;    \
@@ -115,7 +115,13 @@ template<typename C1, typename C2, typename C3, typename C4, typename C5,
   typedef typelist::type1 classname##_type15;   \
   typedef typelist::type1 classname##_type16;   \
   typedef typelist::type1 classname##_type17;   \
-  typedef typelist::type1 classname##_type18;
+  typedef typelist::type1 classname##_type18;   \
+  typedef typelist::type1 classname##_type19;   \
+  typedef typelist::type1 classname##_type20;   \
+  typedef typelist::type1 classname##_type21;   \
+  typedef typelist::type1 classname##_type22;   \
+  typedef typelist::type1 classname##_type23;   \
+  typedef typelist::type1 classname##_type24;
 
 template<typename C1, typename C2, typename C3, typename C4, typename C5,
          typename C6, typename C7, typename C8, typename C9, typename C10,
@@ -160,7 +166,72 @@ template<typename C1, typename C2, typename C3, typename C4, typename C5,
   typedef typelist::type16 classname##_type16;    \
   typedef typelist::type17 classname##_type17;    \
   typedef typelist::type18 classname##_type18;    \
-  static const int classname##_numtypes = 18;
+  static const int classname##_numtypes = 18;  \
+  typedef typelist::type1 classname##_type19;   \
+  typedef typelist::type1 classname##_type20;   \
+  typedef typelist::type1 classname##_type21;   \
+  typedef typelist::type1 classname##_type22;   \
+  typedef typelist::type1 classname##_type23;   \
+  typedef typelist::type1 classname##_type24;
+
+template<typename C1, typename C2, typename C3, typename C4, typename C5,
+         typename C6, typename C7, typename C8, typename C9, typename C10,
+         typename C11, typename C12, typename C13, typename C14, typename C15,
+         typename C16, typename C17, typename C18, typename C19, typename C20,
+         typename C21, typename C22, typename C23, typename C24>
+struct TypeList24 {
+  typedef C1 type1;
+  typedef C2 type2;
+  typedef C3 type3;
+  typedef C4 type4;
+  typedef C5 type5;
+  typedef C6 type6;
+  typedef C7 type7;
+  typedef C8 type8;
+  typedef C9 type9;
+  typedef C10 type10;
+  typedef C11 type11;
+  typedef C12 type12;
+  typedef C13 type13;
+  typedef C14 type14;
+  typedef C15 type15;
+  typedef C16 type16;
+  typedef C17 type17;
+  typedef C18 type18;
+  typedef C19 type19;
+  typedef C20 type20;
+  typedef C21 type21;
+  typedef C22 type22;
+  typedef C23 type23;
+  typedef C24 type24;
+};
+
+#define TYPED_TEST_CASE_24(classname, typelist)  \
+  typedef typelist::type1 classname##_type1;    \
+  typedef typelist::type2 classname##_type2;    \
+  typedef typelist::type3 classname##_type3;    \
+  typedef typelist::type4 classname##_type4;    \
+  typedef typelist::type5 classname##_type5;    \
+  typedef typelist::type6 classname##_type6;    \
+  typedef typelist::type7 classname##_type7;    \
+  typedef typelist::type8 classname##_type8;    \
+  typedef typelist::type9 classname##_type9;    \
+  typedef typelist::type10 classname##_type10;   \
+  typedef typelist::type11 classname##_type11;   \
+  typedef typelist::type12 classname##_type12;   \
+  typedef typelist::type13 classname##_type13;   \
+  typedef typelist::type14 classname##_type14;   \
+  typedef typelist::type15 classname##_type15;   \
+  typedef typelist::type16 classname##_type16;   \
+  typedef typelist::type17 classname##_type17;   \
+  typedef typelist::type18 classname##_type18;   \
+  typedef typelist::type19 classname##_type19;   \
+  typedef typelist::type20 classname##_type20;   \
+  typedef typelist::type21 classname##_type21;   \
+  typedef typelist::type22 classname##_type22;   \
+  typedef typelist::type23 classname##_type23;   \
+  typedef typelist::type24 classname##_type24;   \
+  static const int classname##_numtypes = 24;
 
 #define TYPED_TEST(superclass, testname)                                \
   template<typename TypeParam>                                          \
@@ -248,6 +319,30 @@ template<typename C1, typename C2, typename C3, typename C4, typename C5,
         ::fputs("Running " #superclass "." #testname ".18\n", stderr);  \
         TEST_onetype_##superclass##_##testname<superclass##_type18> t;  \
       }                                                                 \
+      if (superclass##_numtypes >= 19) {                                \
+        ::fputs("Running " #superclass "." #testname ".19\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type19> t;  \
+      }                                                                 \
+      if (superclass##_numtypes >= 20) {                                \
+        ::fputs("Running " #superclass "." #testname ".20\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type20> t;  \
+      }                                                                 \
+      if (superclass##_numtypes >= 21) {                                \
+        ::fputs("Running " #superclass "." #testname ".21\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type21> t;  \
+      }                                                                 \
+      if (superclass##_numtypes >= 22) {                                \
+        ::fputs("Running " #superclass "." #testname ".22\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type22> t;  \
+      }                                                                 \
+      if (superclass##_numtypes >= 23) {                                \
+        ::fputs("Running " #superclass "." #testname ".23\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type23> t;  \
+      }                                                                 \
+      if (superclass##_numtypes >= 24) {                                \
+        ::fputs("Running " #superclass "." #testname ".24\n", stderr);  \
+        TEST_onetype_##superclass##_##testname<superclass##_type24> t;  \
+      }                                                                 \
     }                                                                   \
   };                                                                    \
   static TEST_typed_##superclass##_##testname                           \
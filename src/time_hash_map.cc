@@ -39,7 +39,8 @@
 //
 // The tests generally yield best-case performance because the
 // code uses sequential keys; on the other hand, "map_fetch_random" does
-// lookups in a pseudorandom order.  Also, "stresshashfunction" is
+// lookups in a pseudorandom order, and "map_fetch_batch" does the same
+// lookups with find_batch().  Also, "stresshashfunction" is
 // a stress test of sorts.  It uses keys from an arithmetic sequence, which,
 // if combined with a quick-and-dirty hash function, will yield worse
 // performance than the otherwise similar "map_predict/grow."
@@ -85,15 +86,33 @@ extern "C" {
 #include <sparsehash/type_traits.h>
 #include <sparsehash/dense_hash_map>
 #include <sparsehash/sparse_hash_map>
+#include <sparsehash/internal/aligned_allocator_with_realloc.h>
+#include <sparsehash/internal/huge_page_allocator_with_realloc.h>
 
 using std::map;
+using std::pair;
 using std::swap;
 using std::vector;
+using GOOGLE_NAMESPACE::aligned_allocator_with_realloc;
 using GOOGLE_NAMESPACE::dense_hash_map;
+using GOOGLE_NAMESPACE::dense_hashtable_policy;
+using GOOGLE_NAMESPACE::fibonacci_hash_mixing;
+using GOOGLE_NAMESPACE::huge_page_allocator_with_realloc;
+using GOOGLE_NAMESPACE::libc_allocator_with_realloc;
+using GOOGLE_NAMESPACE::linear_probing;
+using GOOGLE_NAMESPACE::no_hash_mixing;
 using GOOGLE_NAMESPACE::sparse_hash_map;
+using GOOGLE_NAMESPACE::sparse_hashtable_policy;
 
 static bool FLAGS_test_sparse_hash_map = true;
 static bool FLAGS_test_dense_hash_map = true;
+static bool FLAGS_test_grouped_dense_hash_map = true;
+static bool FLAGS_test_robin_hood_dense_hash_map = true;
+static bool FLAGS_test_linear_probing_hash_maps = true;
+static bool FLAGS_test_unmixed_dense_hash_map = true;
+static bool FLAGS_test_fastrange_dense_hash_map = true;
+static bool FLAGS_test_big_value_dense_hash_maps = true;
+static bool FLAGS_test_huge_page_dense_hash_map = true;
 static bool FLAGS_test_hash_map = true;
 static bool FLAGS_test_map = true;
 
@@ -118,16 +137,22 @@ static const int kDefaultIters = 10000000;
 // resize(), so users can just call resize() for all tests without
 // worrying about whether the map-type supports it or not.
 
-template<typename K, typename V, typename H>
-class EasyUseSparseHashMap : public sparse_hash_map<K,V,H> {
+template<typename K, typename V, typename H,
+         typename P = sparse_hashtable_policy>
+class EasyUseSparseHashMap
+    : public sparse_hash_map<K,V,H,std::equal_to<K>,
+                             libc_allocator_with_realloc<pair<const K, V> >,
+                             P> {
  public:
   EasyUseSparseHashMap() {
     this->set_deleted_key(-1);
   }
 };
 
-template<typename K, typename V, typename H>
-class EasyUseDenseHashMap : public dense_hash_map<K,V,H> {
+template<typename K, typename V, typename H,
+         typename P = dense_hashtable_policy,
+         typename A = libc_allocator_with_realloc<pair<const K, V> > >
+class EasyUseDenseHashMap : public dense_hash_map<K,V,H,std::equal_to<K>,A,P> {
  public:
   EasyUseDenseHashMap() {
     this->set_empty_key(-1);
@@ -136,14 +161,18 @@ class EasyUseDenseHashMap : public dense_hash_map<K,V,H> {
 };
 
 // For pointers, we only set the empty key.
-template<typename K, typename V, typename H>
-class EasyUseSparseHashMap<K*, V, H> : public sparse_hash_map<K*,V,H> {
+template<typename K, typename V, typename H, typename P>
+class EasyUseSparseHashMap<K*, V, H, P>
+    : public sparse_hash_map<K*,V,H,std::equal_to<K*>,
+                             libc_allocator_with_realloc<pair<K* const, V> >,
+                             P> {
  public:
   EasyUseSparseHashMap() { }
 };
 
-template<typename K, typename V, typename H>
-class EasyUseDenseHashMap<K*, V, H> : public dense_hash_map<K*,V,H> {
+template<typename K, typename V, typename H, typename P, typename A>
+class EasyUseDenseHashMap<K*, V, H, P, A>
+    : public dense_hash_map<K*,V,H,std::equal_to<K*>,A,P> {
  public:
   EasyUseDenseHashMap() {
     this->set_empty_key((K*)(~0));
@@ -156,18 +185,33 @@ class EasyUseHashMap : public unordered_map<K,V,H> {
  public:
   // resize() is called rehash() in tr1
   void resize(size_t r) { this->rehash(r); }
+  // find_batch() is a sparsehash extension; do it one find() at a time.
+  template<typename Iterator>
+  void find_batch(const K* keys, size_t n, Iterator* results) {
+    for (size_t i = 0; i < n; ++i)
+      results[i] = this->find(keys[i]);
+  }
 };
 #elif defined(_MSC_VER)
 template<typename K, typename V, typename H>
 class EasyUseHashMap : public hash_map<K,V,H> {
  public:
   void resize(size_t r) { }
+  template<typename Iterator>
+  void find_batch(const K* keys, size_t n, Iterator* results) {
+    for (size_t i = 0; i < n; ++i)
+      results[i] = this->find(keys[i]);
+  }
 };
 #elif defined(HAVE_HASH_MAP)
 template<typename K, typename V, typename H>
 class EasyUseHashMap : public hash_map<K,V,H> {
  public:
-  // Don't need to do anything: hash_map is already easy to use!
+  template<typename Iterator>
+  void find_batch(const K* keys, size_t n, Iterator* results) {
+    for (size_t i = 0; i < n; ++i)
+      results[i] = this->find(keys[i]);
+  }
 };
 #endif
 
@@ -175,6 +219,12 @@ template<typename K, typename V>
 class EasyUseMap : public map<K,V> {
  public:
   void resize(size_t) { }   // map<> doesn't support resize
+  // find_batch() is a sparsehash extension; do it one find() at a time.
+  template<typename Iterator>
+  void find_batch(const K* keys, size_t n, Iterator* results) {
+    for (size_t i = 0; i < n; ++i)
+      results[i] = this->find(keys[i]);
+  }
 };
 
 
@@ -525,6 +575,42 @@ static void time_map_fetch_random(int iters) {
   time_map_fetch<MapType>(iters, v, "map_fetch_random");
 }
 
+// Like map_fetch_random, but looks up kBatchSize keys per find_batch().
+template<class MapType>
+static void time_map_fetch_random_batch(int iters) {
+  static const int kBatchSize = 64;
+  typedef typename MapType::key_type Key;
+  MapType set;
+  Rusage t;
+  int r;
+  int i;
+
+  for (i = 0; i < iters; i++) {
+    set[i] = i+1;
+  }
+  vector<int> v(iters);
+  for (i = 0; i < iters; i++) {
+    v[i] = i;
+  }
+  shuffle(&v);
+  vector<Key> keys(v.begin(), v.end());
+  vector<typename MapType::iterator> results(kBatchSize);
+
+  r = 1;
+  t.Reset();
+  for (i = 0; i < iters; i += kBatchSize) {
+    const int n = iters - i < kBatchSize ? iters - i : kBatchSize;
+    set.find_batch(&keys[i], n, &results[0]);
+    for (int j = 0; j < n; j++) {
+      r ^= static_cast<int>(results[j] != set.end());
+    }
+  }
+  double ut = t.UserTime();
+
+  srand(r);   // keep compiler from optimizing away r (we never call rand())
+  report("map_fetch_batch", ut, iters, 0, 0);
+}
+
 template<class MapType>
 static void time_map_fetch_empty(int iters) {
   MapType set;
@@ -661,6 +747,7 @@ static void measure_map(const char* label, int obj_size, int iters,
   if (1) time_map_grow_predicted<MapType>(iters);
   if (1) time_map_replace<MapType>(iters);
   if (1) time_map_fetch_random<MapType>(iters);
+  if (1) time_map_fetch_random_batch<MapType>(iters);
   if (1) time_map_fetch_sequential<MapType>(iters);
   if (1) time_map_fetch_empty<MapType>(iters);
   if (1) time_map_remove<MapType>(iters);
@@ -676,6 +763,60 @@ static void measure_map(const char* label, int obj_size, int iters,
   }
 }
 
+// dense_hash_map, with each group of buckets in one cache line.
+struct BucketGroupPolicy : public dense_hashtable_policy {
+  enum { bucket_group_bytes = 64 };
+};
+
+// dense_hash_map, with Robin Hood probing and backward-shift deletion.
+struct RobinHoodPolicy : public dense_hashtable_policy {
+  enum { use_robin_hood = true };
+};
+
+// The tables above probe quadratically; these probe linearly, bucket
+// by bucket or (for bucket groups) group by group.
+struct LinearProbingPolicy : public dense_hashtable_policy {
+  typedef linear_probing probing;
+};
+struct LinearBucketGroupPolicy : public BucketGroupPolicy {
+  typedef linear_probing probing;
+};
+struct SparseLinearProbingPolicy : public sparse_hashtable_policy {
+  typedef linear_probing probing;
+};
+
+// dense_hash_map, using the hash as it is.  Only the pointer keys of
+// stresshashfunction are mixed by default, so that's where it shows.
+struct NoHashMixingPolicy : public dense_hashtable_policy {
+  typedef no_hash_mixing hash_mixing;
+};
+
+// dense_hash_map, with any number of buckets.  That picks buckets with
+// the upper bits of the hash, and HashObject's hash is just the key,
+// so we mix it.
+struct FastrangePolicy : public dense_hashtable_policy {
+  typedef linear_probing probing;
+  typedef fibonacci_hash_mixing hash_mixing;
+  enum { fastrange_buckets = true };
+};
+
+// dense_hash_map, with the values kept apart from the buckets.
+struct SplitValuesPolicy : public dense_hashtable_policy {
+  enum { split_values = true };
+};
+
+// A mapped value much bigger than its key, which is where split_values
+// should pay off.  It converts to and from the int the timing loops
+// store.
+class BigValue {
+ public:
+  BigValue() { memset(words_, 0, sizeof(words_)); }
+  BigValue(int i) { for (int j = 0; j < 64; ++j) words_[j] = i; }
+  operator int() const { return words_[0]; }
+ private:
+  int words_[64];
+};
+
 template<class ObjType>
 static void test_all_maps(int obj_size, int iters) {
   const bool stress_hash_function = obj_size <= 8;
@@ -690,6 +831,72 @@ static void test_all_maps(int obj_size, int iters) {
                  EasyUseDenseHashMap<ObjType*, int, HashFn> >(
         "DENSE_HASH_MAP", obj_size, iters, stress_hash_function);
 
+  if (FLAGS_test_grouped_dense_hash_map) {
+    typedef aligned_allocator_with_realloc<pair<const ObjType, int> > Alloc;
+    typedef aligned_allocator_with_realloc<pair<ObjType* const, int> >
+        PtrAlloc;
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn,
+                                     BucketGroupPolicy, Alloc>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn,
+                                     BucketGroupPolicy, PtrAlloc> >(
+        "DENSE_HASH_MAP (BUCKET GROUPS)", obj_size, iters,
+        stress_hash_function);
+  }
+
+  if (FLAGS_test_robin_hood_dense_hash_map)
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn, RobinHoodPolicy>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn, RobinHoodPolicy> >(
+        "DENSE_HASH_MAP (ROBIN HOOD)", obj_size, iters, stress_hash_function);
+
+  if (FLAGS_test_linear_probing_hash_maps) {
+    measure_map< EasyUseSparseHashMap<ObjType, int, HashFn,
+                                      SparseLinearProbingPolicy>,
+                 EasyUseSparseHashMap<ObjType*, int, HashFn,
+                                      SparseLinearProbingPolicy> >(
+        "SPARSE_HASH_MAP (LINEAR PROBING)", obj_size, iters,
+        stress_hash_function);
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn,
+                                     LinearProbingPolicy>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn,
+                                     LinearProbingPolicy> >(
+        "DENSE_HASH_MAP (LINEAR PROBING)", obj_size, iters,
+        stress_hash_function);
+    typedef aligned_allocator_with_realloc<pair<const ObjType, int> > Alloc;
+    typedef aligned_allocator_with_realloc<pair<ObjType* const, int> >
+        PtrAlloc;
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn,
+                                     LinearBucketGroupPolicy, Alloc>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn,
+                                     LinearBucketGroupPolicy, PtrAlloc> >(
+        "DENSE_HASH_MAP (LINEAR BUCKET GROUPS)", obj_size, iters,
+        stress_hash_function);
+  }
+
+  if (FLAGS_test_unmixed_dense_hash_map)
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn,
+                                     NoHashMixingPolicy>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn,
+                                     NoHashMixingPolicy> >(
+        "DENSE_HASH_MAP (NO HASH MIXING)", obj_size, iters,
+        stress_hash_function);
+
+  if (FLAGS_test_fastrange_dense_hash_map)
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn, FastrangePolicy>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn, FastrangePolicy> >(
+        "DENSE_HASH_MAP (FASTRANGE)", obj_size, iters, stress_hash_function);
+
+  if (FLAGS_test_huge_page_dense_hash_map) {
+    typedef huge_page_allocator_with_realloc<pair<const ObjType, int> > Alloc;
+    typedef huge_page_allocator_with_realloc<pair<ObjType* const, int> >
+        PtrAlloc;
+    measure_map< EasyUseDenseHashMap<ObjType, int, HashFn,
+                                     dense_hashtable_policy, Alloc>,
+                 EasyUseDenseHashMap<ObjType*, int, HashFn,
+                                     dense_hashtable_policy, PtrAlloc> >(
+        "DENSE_HASH_MAP (HUGE PAGES)", obj_size, iters,
+        stress_hash_function);
+  }
+
   if (FLAGS_test_hash_map)
     measure_map< EasyUseHashMap<ObjType, int, HashFn>,
                  EasyUseHashMap<ObjType*, int, HashFn> >(
@@ -701,6 +908,19 @@ static void test_all_maps(int obj_size, int iters) {
         "STANDARD MAP", obj_size, iters, false);
 }
 
+// Maps 4-byte keys to BigValues, with and without split_values.
+static void test_big_value_maps(int iters) {
+  typedef HashObject<4,4> ObjType;
+  measure_map< EasyUseDenseHashMap<ObjType, BigValue, HashFn>,
+               EasyUseDenseHashMap<ObjType*, BigValue, HashFn> >(
+      "DENSE_HASH_MAP (256 BYTE VALUES)", 4, iters, false);
+  measure_map< EasyUseDenseHashMap<ObjType, BigValue, HashFn,
+                                   SplitValuesPolicy>,
+               EasyUseDenseHashMap<ObjType*, BigValue, HashFn,
+                                   SplitValuesPolicy> >(
+      "DENSE_HASH_MAP (SPLIT 256 BYTE VALUES)", 4, iters, false);
+}
+
 int main(int argc, char** argv) {
 
   int iters = kDefaultIters;
@@ -724,6 +944,7 @@ int main(int argc, char** argv) {
   if (FLAGS_test_8_bytes)  test_all_maps< HashObject<8,8> >(8, iters/2);
   if (FLAGS_test_16_bytes)  test_all_maps< HashObject<16,16> >(16, iters/4);
   if (FLAGS_test_256_bytes)  test_all_maps< HashObject<256,32> >(256, iters/32);
+  if (FLAGS_test_big_value_dense_hash_maps)  test_big_value_maps(iters/32);
 
   return 0;
 }
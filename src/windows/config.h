@@ -87,6 +87,9 @@
 /* Define to 1 if you have the <string.h> header file. */
 #define HAVE_STRING_H  1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#undef HAVE_SYS_MMAN_H
+
 /* Define to 1 if you have the <sys/resource.h> header file. */
 #undef HAVE_SYS_RESOURCE_H
 